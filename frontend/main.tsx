@@ -61,8 +61,8 @@ interface TPMConfig {
 // Binary pickstats struct (C representation)
 interface ToothpastePickStats {
   first_pick_time: number;
-  last_pick_time: number;  // time_t
-  total_picks: number;     // unsigned int
+  last_pick_time: number;  // int64
+  total_picks: number;     // uint64
 }
 
 interface ResultType {
@@ -159,21 +159,43 @@ const default_answers: string[] = [
   "Thanks you"
 ];
 
-// Generate binary pickstats file
+// FNV-1a 64 checksum matching fnv1a64 in tpm.c
+function fnv1a64(bytes: Uint8Array): bigint {
+  let h = 0xcbf29ce484222325n;
+  for (const b of bytes) {
+    h ^= BigInt(b);
+    h = (h * 0x100000001b3n) & 0xffffffffffffffffn;
+  }
+  return h;
+}
+
+// Generate binary pickstats file (v2, 256 bytes, every field little-endian)
 function generateBinaryPickStats(stats: ToothpastePickStats): Uint8Array {
-  const buffer = new ArrayBuffer(20);
+  const buffer = new ArrayBuffer(256);
   const view = new DataView(buffer);
+  const bytes = new Uint8Array(buffer);
+
+  // magic "TPMS", version 2, byte order mark 0x0102
+  bytes.set([0x54, 0x50, 0x4d, 0x53], 0);
+  view.setUint16(4, 2, true);
+  view.setUint16(6, 0x0102, true);
+
+  // time and count field widths, file size
+  view.setUint8(8, 8);
+  view.setUint8(9, 8);
+  view.setUint16(10, 256, true);
 
-  // time_t first_pick_time: 8 bytes
-  view.setBigUint64(0, BigInt(stats.first_pick_time), true);
+  // int64 first_pick_time, int64 last_pick_time, uint64 total_picks
+  view.setBigInt64(16, BigInt(stats.first_pick_time), true);
+  view.setBigInt64(24, BigInt(stats.last_pick_time), true);
+  view.setBigUint64(32, BigInt(stats.total_picks), true);
 
-  // time_t last_pick_time: 8 bytes
-  view.setBigUint64(8, BigInt(stats.last_pick_time), true);
+  // bytes 40..247 hold the daily, weekly and monthly rollups, empty for a new file
 
-  // unsigned int total_picks: 4 bytes
-  view.setUint32(16, stats.total_picks, true);
+  // checksum of everything before it
+  view.setBigUint64(248, fnv1a64(bytes.subarray(0, 248)), true);
 
-  return new Uint8Array(buffer);
+  return bytes;
 }
 
 // Generate enhanced toothpaste file with toothbrush info
@@ -554,7 +576,7 @@ export default function App() {
 
 		const binaryData = generateBinaryPickStats(pickStats);
 
-		// Always exactly 20 bytes
+		// Always exactly 256 bytes
 		const hexString = Array.from(binaryData)
 		  .map(b => b.toString(16).padStart(2, '0'))
 		  .join(' ');
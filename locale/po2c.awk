@@ -0,0 +1,129 @@
+# Compiles locale/*/tpm.po into constant C tables for builds without gettext
+# usage: LC_ALL=C awk -f locale/po2c.awk locale/*/tpm.po > src/tpm_catalog.h
+# Entries of each locale are sorted by msgid so they can be bsearched, the
+# locales themselves are sorted by name. Untranslated and fuzzy entries are
+# left out, a lookup missing them falls back to the msgid like gettext does.
+
+function locale_of(path,    n, parts)
+{
+	n = split(path, parts, "/")
+	return (n >= 2) ? parts[n - 1] : path
+}
+
+# The bytes a C compiler makes of a po string, only needed to sort
+function unescaped(s,    out, c, i)
+{
+	out = ""
+	for (i = 1; i <= length(s); i++)
+	{
+		c = substr(s, i, 1)
+		if (c == "\\" && i < length(s))
+		{
+			i++
+			c = substr(s, i, 1)
+			if (c == "n") c = "\n"
+			else if (c == "t") c = "\t"
+		}
+		out = out c
+	}
+	return out
+}
+
+# Text between the outer quotes of a po string line
+function quoted(line)
+{
+	sub(/^[^"]*"/, "", line)
+	sub(/"[ \t\r]*$/, "", line)
+	return line
+}
+
+function flush_entry()
+{
+	if (state != "" && msgid != "" && msgstr != "" && !fuzzy)
+	{
+		count[cur]++
+		ids[cur, count[cur]] = msgid
+		strs[cur, count[cur]] = msgstr
+		keys[cur, count[cur]] = unescaped(msgid)
+	}
+	state = ""
+	msgid = ""
+	msgstr = ""
+	fuzzy = 0
+}
+
+FNR == 1 {
+	flush_entry()
+	cur = locale_of(FILENAME)
+	locales[++total] = cur
+	count[cur] = 0
+}
+
+/^#,.*fuzzy/ { if (state != "") flush_entry(); fuzzy = 1; next }
+/^#/ || /^[ \t\r]*$/ { if (state == "msgstr") flush_entry(); next }
+/^msgid[ \t]/ { if (state != "") flush_entry(); state = "msgid"; msgid = quoted($0); next }
+/^msgstr[ \t]/ { state = "msgstr"; msgstr = quoted($0); next }
+/^"/ {
+	if (state == "msgid") msgid = msgid quoted($0)
+	else if (state == "msgstr") msgstr = msgstr quoted($0)
+	next
+}
+
+END {
+	flush_entry()
+
+	for (i = 2; i <= total; i++)
+	{
+		name = locales[i]
+		for (j = i - 1; j >= 1 && locales[j] > name; j--)
+		{
+			locales[j + 1] = locales[j]
+		}
+		locales[j + 1] = name
+	}
+
+	print "/* Generated by locale/po2c.awk from locale/<lang>/tpm.po, do not edit */"
+	print "#ifndef TPM_CATALOG_H"
+	print "#define TPM_CATALOG_H"
+	for (l = 1; l <= total; l++)
+	{
+		cur = locales[l]
+		n = count[cur]
+		for (i = 2; i <= n; i++)
+		{
+			k = keys[cur, i]; a = ids[cur, i]; b = strs[cur, i]
+			for (j = i - 1; j >= 1 && keys[cur, j] > k; j--)
+			{
+				keys[cur, j + 1] = keys[cur, j]
+				ids[cur, j + 1] = ids[cur, j]
+				strs[cur, j + 1] = strs[cur, j]
+			}
+			keys[cur, j + 1] = k; ids[cur, j + 1] = a; strs[cur, j + 1] = b
+		}
+		print ""
+		print "static const catalog_entry_t catalog_" cur "[] = {"
+		for (i = 1; i <= n; i++)
+		{
+			print "\t{\"" ids[cur, i] "\",\n\t \"" strs[cur, i] "\"}" ((i < n) ? "," : "")
+		}
+		# An empty initializer is not C, a locale without entries gets a
+		# placeholder its count of 0 keeps out of every lookup
+		if (n == 0)
+		{
+			print "\t{\"\", \"\"}"
+		}
+		print "};"
+	}
+	print ""
+	print "static const catalog_t embedded_catalogs[] = {"
+	for (l = 1; l <= total; l++)
+	{
+		cur = locales[l]
+		print "\t{\"" cur "\", catalog_" cur ", " count[cur] "}" ((l < total) ? "," : "")
+	}
+	print "};"
+	print ""
+	print "#define TOTAL_EMBEDDED_CATALOGS " total
+	print ""
+	print "#endif"
+}
@@ -2,12 +2,14 @@
 
 /* for malloc, EXIT_SUCCESS and _FAILURE, exit */
 #include <stdlib.h>
-/* for FILE*, fgets, fputs */
+/* for FILE*, fread, fputs */
 #include <stdio.h>
-/* for memset, strlen, strchr etc */
+/* for memset, strlen, memchr etc */
 #include <string.h>
 /* for tolower, isspace */
 #include <ctype.h>
+/* for errno, ERANGE */
+#include <errno.h>
 
 /* SIZE_MAX */
 #if __STDC_VERSION__ >= 199901L
@@ -16,23 +18,98 @@
   #define SIZE_MAX ((size_t)-1)
 #endif
 
+/* for mapping the config file */
+#if defined(_WIN32) || defined(_WIN64)
+  #include <windows.h>
+#elif !defined(__wasi__)
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
 /* ************************************************************************* */
 /* implementation details of (opaque) config structures */
 /* ************************************************************************* */
 
 struct cfg_node
 {
+  /* "section.name" for keys below a [SECTION] header, else just "name" */
   char* key;
   char* value;
+  /* value without its outer quotes, the same pointer when it had none */
+  char* text;
+
+  /* normalized key length and hash, kept for rehashing and compares */
+  size_t key_len;
+  size_t hash;
+  /* where the name starts in key (0 without a section) and its own hash */
+  size_t name_offset;
+  size_t name_hash;
+
+  /* filled by cfg_resolve: the node a chain of references ends on (the
+      node itself when the chain never ends) and its text converted once */
+  struct cfg_node* target;
+  struct cfg_node* link;
+  unsigned char state;
+  unsigned char types;
+  long long number;
+  int boolean;
 
+  struct cfg_node* prev;
   struct cfg_node* next;
 };
 
+/* Open addressing with linear probing, capacity is a power of two and
+    deleted slots hold a tombstone until the next rehash */
+struct cfg_index
+{
+  struct cfg_node** slots;
+  size_t capacity;
+  size_t used;
+};
+
+/* The list keeps insertion order for cfg_save and cfg_get_keys. keys
+    indexes every node by its full key, names indexes the sectioned ones by
+    their bare name, the last one loaded answering a lookup without section */
 struct cfg_struct
 {
   struct cfg_node* head;
+  struct cfg_node* tail;
+
+  struct cfg_index keys;
+  struct cfg_index names;
+  size_t count;
+
+  /* set by any change, the typed getters resolve again before reading */
+  int stale;
+};
+
+/* A key to look up, split at its first '.' into section and name. The
+    spans point into the caller's string and are not NUL terminated */
+struct cfg_key
+{
+  const char* section;
+  size_t section_len;
+  const char* name;
+  size_t name_len;
+  size_t hash;
 };
 
+#define CFG_MIN_CAPACITY 32
+#define CFG_READ_CHUNK 4096
+
+#define CFG_UNSEEN 0
+#define CFG_VISITING 1
+#define CFG_DONE 2
+#define CFG_LITERAL 3
+
+#define CFG_HAS_NUMBER 1
+#define CFG_HAS_BOOL 2
+
+static struct cfg_node cfg_tombstone;
+#define CFG_TOMBSTONE (&cfg_tombstone)
+
 /* ************************************************************************* */
 /* Helper functions */
 /* ************************************************************************* */
@@ -52,73 +129,774 @@ static void* cfg_malloc(const size_t size)
   return ptr;
 }
 
-/* Returns a duplicate of input str, without leading / trailing whitespace
-    Input str *MUST* be null-terminated, or disaster will result */
-static char* cfg_trim(const char* str)
+/* A realloc() wrapper which handles null return values */
+static void* cfg_realloc(void* ptr, const size_t size)
 {
-  size_t tlen;
-  char* tstr;
+  void* grown =
+    realloc(ptr, size);
+
+  if (grown == NULL)
+  {
+    perror("cfg_parse: ERROR: realloc() returned NULL");
+    exit(EXIT_FAILURE);
+  }
+
+  return grown;
+}
+
+/* Narrows the span str[0..len) to its part without leading / trailing
+    whitespace, returns the new length */
+static size_t cfg_span_trim(const char** str, size_t len)
+{
+  const char* s = *str;
 
   /* advance start pointer to first non-whitespace char */
- while (isspace((unsigned char)*str))
-    str ++;
+  while (len > 0 && isspace((unsigned char)*s))
+  {
+    s ++;
+    len --;
+  }
 
   /* roll back length until we run out of whitespace */
-  tlen = strlen(str);
-while (tlen > 0 && isspace((unsigned char)str[tlen - 1]))
-    tlen --;
+  while (len > 0 && isspace((unsigned char)s[len - 1]))
+    len --;
+
+  *str = s;
+  return len;
+}
+
+/* Returns a NUL terminated duplicate of the span str[0..len), without
+    leading / trailing whitespace */
+static char* cfg_copy_span(const char* str, size_t len)
+{
+  char* tstr;
+
+  len = cfg_span_trim(&str, len);
 
   /* copy portion of string to new string */
-  tstr = cfg_malloc(tlen + 1);
-  tstr[tlen] = '\0';
-  if (tlen > 0) memcpy(tstr, str, tlen);
+  tstr = cfg_malloc(len + 1);
+  tstr[len] = '\0';
+  if (len > 0) memcpy(tstr, str, len);
 
   return tstr;
 }
 
-/* Returns a duplicate of input str, without leading / trailing whitespace
-    Also lowercases the string, AND returns NULL instead of empty str */
-static char* cfg_norm_key(const char* key)
+/* Returns value without one pair of matching outer quotes, as a copy when
+    there were quotes and value itself otherwise */
+static char* cfg_unquote(char* value)
 {
-  size_t i, tlen;
-  char* tkey;
+  size_t len = strlen(value);
+  char* text;
 
-  /* advance start pointer to first non-whitespace char */
-  while (isspace((unsigned char)*key))
-    key ++;
+  if (len < 2 || !((value[0] == '"' && value[len - 1] == '"') ||
+      (value[0] == '\'' && value[len - 1] == '\'')))
+    return value;
 
-  /* roll back length until we run out of whitespace */
-  tlen = strlen(key);
-while (tlen > 0 && isspace((unsigned char)key[tlen - 1]))
-    tlen --;
+  text = cfg_malloc(len - 1);
+  memcpy(text, value + 1, len - 2);
+  text[len - 2] = '\0';
 
-  /* Exclude empty key */
-  if (tlen == 0) return NULL;
+  return text;
+}
 
-  /* copy portion of string to new string */
-  tkey = cfg_malloc(tlen + 1);
-  tkey[tlen] = '\0';
-  /* Lowercase key and copy */
-  for (i = 0; i < tlen; i++)
-    tkey[i] = (char)tolower((unsigned char)key[i]);
+static void cfg_free_node(struct cfg_node* cur)
+{
+  if (cur->text != cur->value) free(cur->text);
+  free(cur->value);
+  free(cur->key);
+  free(cur);
+}
+
+/* FNV-1a over the lowercased bytes, so "Key" and "KEY" land together. It
+    runs over the pieces of a key, the basis starts it and cfg_hash_finish
+    folds the result */
+#define CFG_HASH_BASIS 14695981039346656037ULL
+
+static unsigned long long cfg_hash_bytes(unsigned long long hash, const char* key, size_t len)
+{
+  size_t i;
 
-  return tkey;
+  for (i = 0; i < len; i++)
+  {
+    hash ^= (unsigned char)tolower((unsigned char)key[i]);
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
 }
 
-/* Creates a node struct with key and value, and returns it */
-static struct cfg_node* cfg_create_node(char* key, char* value)
+static size_t cfg_hash_finish(unsigned long long hash)
+{
+  return (size_t)(hash ^ (hash >> 32));
+}
+
+/* Fills k with section and name, hashed as the stored "section.name" */
+static void cfg_key_init(struct cfg_key* k, const char* section, size_t section_len, const char* name, size_t name_len)
+{
+  unsigned long long hash = CFG_HASH_BASIS;
+
+  if (section_len > 0)
+  {
+    hash = cfg_hash_bytes(hash, section, section_len);
+    hash = cfg_hash_bytes(hash, ".", 1);
+  }
+  hash = cfg_hash_bytes(hash, name, name_len);
+
+  k->section = (section_len > 0) ? section : NULL;
+  k->section_len = section_len;
+  k->name = name;
+  k->name_len = name_len;
+  k->hash = cfg_hash_finish(hash);
+}
+
+/* Reads the span key[0..len) as a key: trimmed, and "section.name" when it
+    holds a '.' between two non-empty parts. No copy is made so lookups do
+    not allocate. Returns 0 for an empty key */
+static int cfg_key_parse(struct cfg_key* k, const char* key, size_t len)
+{
+  const char* dot;
+
+  len = cfg_span_trim(&key, len);
+  if (len == 0) return 0;
+
+  dot = memchr(key, '.', len);
+  if (dot != NULL && dot > key && dot < key + len - 1)
+    cfg_key_init(k, key, (size_t)(dot - key), dot + 1, len - (size_t)(dot - key) - 1);
+  else
+    cfg_key_init(k, NULL, 0, key, len);
+
+  return 1;
+}
+
+/* The full key of a stored node, as cfg_key_parse would make it */
+static void cfg_node_key(const struct cfg_node* node, struct cfg_key* k)
+{
+  k->section = (node->name_offset > 0) ? node->key : NULL;
+  k->section_len = (node->name_offset > 0) ? node->name_offset - 1 : 0;
+  k->name = node->key + node->name_offset;
+  k->name_len = node->key_len - node->name_offset;
+  k->hash = node->hash;
+}
+
+/* The bare name of a stored node, without its section */
+static void cfg_node_name(const struct cfg_node* node, struct cfg_key* k)
+{
+  k->section = NULL;
+  k->section_len = 0;
+  k->name = node->key + node->name_offset;
+  k->name_len = node->key_len - node->name_offset;
+  k->hash = node->name_hash;
+}
+
+/* Compares a stored (already lowercase) span with a raw one */
+static int cfg_span_equal(const char* stored, const char* raw, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    if (stored[i] != (char)tolower((unsigned char)raw[i]))
+      return 0;
+
+  return 1;
+}
+
+/* Compares a node with k, by its full key or by its bare name */
+static int cfg_key_equal(const struct cfg_node* node, int bare, const struct cfg_key* k)
+{
+  const char* stored = node->key;
+  size_t len = node->key_len;
+
+  if (bare)
+  {
+    if (node->name_hash != k->hash) return 0;
+    stored += node->name_offset;
+    len -= node->name_offset;
+  }
+  else if (node->hash != k->hash)
+    return 0;
+
+  if (k->section_len > 0)
+  {
+    if (len != k->section_len + 1 + k->name_len ||
+        !cfg_span_equal(stored, k->section, k->section_len) ||
+        stored[k->section_len] != '.')
+      return 0;
+
+    stored += k->section_len + 1;
+    len -= k->section_len + 1;
+  }
+
+  return len == k->name_len && cfg_span_equal(stored, k->name, k->name_len);
+}
+
+/* Returns the slot holding key, or SIZE_MAX when it is not there */
+static size_t cfg_find_slot(const struct cfg_index* idx, int bare, const struct cfg_key* k)
+{
+  size_t mask, i;
+  struct cfg_node* cur;
+
+  if (idx->capacity == 0) return SIZE_MAX;
+
+  mask = idx->capacity - 1;
+  for (i = k->hash & mask; (cur = idx->slots[i]) != NULL; i = (i + 1) & mask)
+  {
+    if (cur != CFG_TOMBSTONE && cfg_key_equal(cur, bare, k))
+      return i;
+  }
+
+  return SIZE_MAX;
+}
+
+/* Places a node known to be absent into the first free or deleted slot */
+static void cfg_place(struct cfg_index* idx, int bare, struct cfg_node* node)
+{
+  size_t mask = idx->capacity - 1;
+  size_t i = (bare ? node->name_hash : node->hash) & mask;
+
+  while (idx->slots[i] != NULL && idx->slots[i] != CFG_TOMBSTONE)
+    i = (i + 1) & mask;
+
+  if (idx->slots[i] == NULL) idx->used ++;
+  idx->slots[i] = node;
+}
+
+/* Points the bare name of a sectioned node at it, replacing an older
+    node of that name. Needs a free slot */
+static void cfg_place_name(struct cfg_index* idx, struct cfg_node* node)
+{
+  struct cfg_key k;
+  size_t slot;
+
+  cfg_node_name(node, &k);
+  slot = cfg_find_slot(idx, 1, &k);
+  if (slot != SIZE_MAX)
+    idx->slots[slot] = node;
+  else
+    cfg_place(idx, 1, node);
+}
+
+/* Rebuilds an index from the list, doubling it if live entries need the
+    room, otherwise only sweeping out the tombstones */
+static void cfg_rehash(struct cfg_struct* cfg, struct cfg_index* idx, int bare)
+{
+  size_t capacity = (idx->capacity == 0) ? CFG_MIN_CAPACITY : idx->capacity;
+  struct cfg_node* cur;
+
+  while ((cfg->count + 1) * 2 > capacity)
+  {
+    if (capacity > SIZE_MAX / 2 / sizeof(struct cfg_node*))
+    {
+      perror("cfg_parse: ERROR: config too large");
+      exit(EXIT_FAILURE);
+    }
+    capacity *= 2;
+  }
+
+  free(idx->slots);
+  idx->slots = cfg_malloc(capacity * sizeof(struct cfg_node*));
+  memset(idx->slots, 0, capacity * sizeof(struct cfg_node*));
+  idx->capacity = capacity;
+  idx->used = 0;
+
+  for (cur = cfg->head; cur != NULL; cur = cur->next)
+  {
+    if (!bare)
+      cfg_place(idx, 0, cur);
+    else if (cur->name_offset > 0)
+      cfg_place_name(idx, cur);
+  }
+}
+
+/* Creates a node struct for key k and value, appends it to the list and
+    indexes it. The stored key is the lowercased "section.name" */
+static struct cfg_node* cfg_create_node(struct cfg_struct* cfg, const struct cfg_key* k, char* value)
 {
   struct cfg_node* cur =
     cfg_malloc(sizeof(struct cfg_node));
+  size_t i, len = k->name_len;
+  char* key;
+
+  if (k->section_len > 0)
+    len += k->section_len + 1;
+
+  /* copy and lowercase section and name */
+  key = cfg_malloc(len + 1);
+  for (i = 0; i < k->section_len; i++)
+    key[i] = (char)tolower((unsigned char)k->section[i]);
+  if (k->section_len > 0)
+    key[i++] = '.';
+  cur->name_offset = i;
+  for (; i < len; i++)
+    key[i] = (char)tolower((unsigned char)k->name[i - cur->name_offset]);
+  key[len] = '\0';
 
   /* assign key, value */
   cur->key = key;
   cur->value = value;
+  cur->text = cfg_unquote(value);
+  cur->key_len = len;
+  cur->hash = k->hash;
+  cur->name_hash = (k->section_len > 0) ?
+    cfg_hash_finish(cfg_hash_bytes(CFG_HASH_BASIS, k->name, k->name_len)) : k->hash;
+  cur->target = NULL;
+  cur->link = NULL;
+  cur->state = CFG_UNSEEN;
+  cur->types = 0;
+  cur->prev = cfg->tail;
   cur->next = NULL;
 
+  if (cfg->tail != NULL)
+    cfg->tail->next = cur;
+  else
+    cfg->head = cur;
+  cfg->tail = cur;
+  cfg->count ++;
+  cfg->stale = 1;
+
+  /* keep the load, tombstones included, at three quarters at most */
+  if ((cfg->keys.used + 1) * 4 > cfg->keys.capacity * 3)
+    cfg_rehash(cfg, &cfg->keys, 0);
+  else
+    cfg_place(&cfg->keys, 0, cur);
+
+  if (cur->name_offset > 0)
+  {
+    if ((cfg->names.used + 1) * 4 > cfg->names.capacity * 3)
+      cfg_rehash(cfg, &cfg->names, 1);
+    else
+      cfg_place_name(&cfg->names, cur);
+  }
+
   return cur;
 }
 
+/* Unlinks a node from the list and both indexes and frees it. Returns 1 if
+    it was what its bare name found, the caller then rebuilds the names
+    index so an older node of that name takes over */
+static int cfg_remove_node(struct cfg_struct* cfg, struct cfg_node* cur)
+{
+  struct cfg_key k;
+  size_t slot;
+  int named = 0;
+
+  cfg_node_key(cur, &k);
+  slot = cfg_find_slot(&cfg->keys, 0, &k);
+  if (slot != SIZE_MAX) cfg->keys.slots[slot] = CFG_TOMBSTONE;
+
+  if (cur->name_offset > 0)
+  {
+    cfg_node_name(cur, &k);
+    slot = cfg_find_slot(&cfg->names, 1, &k);
+    if (slot != SIZE_MAX && cfg->names.slots[slot] == cur)
+    {
+      cfg->names.slots[slot] = CFG_TOMBSTONE;
+      named = 1;
+    }
+  }
+
+  if (cur->prev != NULL)
+    cur->prev->next = cur->next;
+  else
+    cfg->head = cur->next;
+
+  if (cur->next != NULL)
+    cur->next->prev = cur->prev;
+  else
+    cfg->tail = cur->prev;
+
+  cfg->count --;
+  cfg->stale = 1;
+
+  cfg_free_node(cur);
+  return named;
+}
+
+/* The node for k: the exact key, else for a key without section the last
+    loaded sectioned key of that name */
+static struct cfg_node* cfg_find(const struct cfg_struct* cfg, const struct cfg_key* k)
+{
+  size_t slot = cfg_find_slot(&cfg->keys, 0, k);
+
+  if (slot != SIZE_MAX) return cfg->keys.slots[slot];
+
+  if (k->section_len == 0)
+  {
+    slot = cfg_find_slot(&cfg->names, 1, k);
+    if (slot != SIZE_MAX) return cfg->names.slots[slot];
+  }
+
+  return NULL;
+}
+
+/* Text a reference or a typed getter sees: the value with one pair of
+    outer quotes removed, resolved at load instead of on every cfg_get */
+static const char* cfg_lookup_text(const struct cfg_struct* cfg, const char* key, struct cfg_node** node)
+{
+  struct cfg_key k;
+
+  *node = NULL;
+  if (cfg == NULL || cfg->head == NULL || key == NULL) return NULL;
+
+  if (!cfg_key_parse(&k, key, strlen(key))) return NULL;
+
+  *node = cfg_find(cfg, &k);
+  return (*node != NULL) ? (*node)->text : NULL;
+}
+
+/* The key a node's value refers to, if any. A reference without section
+    looks in the node's own section before anywhere else */
+static struct cfg_node* cfg_find_ref(const struct cfg_struct* cfg, const struct cfg_node* cur)
+{
+  struct cfg_key k, local;
+  struct cfg_node* ref;
+
+  if (!cfg_key_parse(&k, cur->text, strlen(cur->text))) return NULL;
+
+  if (k.section_len == 0 && cur->name_offset > 0)
+  {
+    cfg_key_init(&local, cur->key, cur->name_offset - 1, k.name, k.name_len);
+    ref = cfg_find(cfg, &local);
+    if (ref != NULL) return ref;
+  }
+
+  return cfg_find(cfg, &k);
+}
+
+/* Sets key k to a trimmed copy of value[0..len), creating it if needed.
+    Only the exact full key matches, a bare name is for lookups alone */
+static void cfg_set_key(struct cfg_struct* cfg, const struct cfg_key* k, const char* value, size_t len)
+{
+  size_t slot = cfg_find_slot(&cfg->keys, 0, k);
+  struct cfg_node* cur = (slot != SIZE_MAX) ? cfg->keys.slots[slot] : NULL;
+  char* tvalue = cfg_copy_span(value, len);
+
+  if (cur != NULL)
+  {
+    /* found a match: update value */
+    if (cur->text != cur->value) free(cur->text);
+    free(cur->value);
+    cur->value = tvalue;
+    cur->text = cfg_unquote(tvalue);
+    cfg->stale = 1;
+    return;
+  }
+
+  /* not found: create new element and append it */
+  cfg_create_node(cfg, k, tvalue);
+}
+
+/* Parses a whole string as a decimal integer */
+static int cfg_parse_number(const char* text, long long* number)
+{
+  char* end = NULL;
+
+  errno = 0;
+  *number = strtoll(text, &end, 10);
+  return (end != text && *end == '\0' && errno != ERANGE);
+}
+
+/* Case-insensitive whole string compare */
+static int cfg_word_equal(const char* a, const char* b)
+{
+  while (*a != '\0' && tolower((unsigned char)*a) == tolower((unsigned char)*b))
+  {
+    a ++;
+    b ++;
+  }
+  return *a == '\0' && *b == '\0';
+}
+
+/* Converts the text a node resolves to, once */
+static void cfg_convert(struct cfg_node* cur)
+{
+  const char* text;
+
+  cur->types = 0;
+  if (cur->target == NULL) return;
+
+  text = cur->target->text;
+  if (cfg_parse_number(text, &cur->number))
+  {
+    cur->types = CFG_HAS_NUMBER | CFG_HAS_BOOL;
+    cur->boolean = (cur->number != 0);
+  }
+  else if (cfg_word_equal(text, "true") || cfg_word_equal(text, "yes") || cfg_word_equal(text, "on"))
+  {
+    cur->types = CFG_HAS_BOOL;
+    cur->boolean = 1;
+  }
+  else if (cfg_word_equal(text, "false") || cfg_word_equal(text, "no") || cfg_word_equal(text, "off"))
+  {
+    cur->types = CFG_HAS_BOOL;
+    cur->boolean = 0;
+  }
+}
+
+/* Follows every VALUE=OTHER_KEY chain once. Each node is walked at most
+    twice, so the pass is linear; a chain running into itself, like X=x,
+    leaves every node on it with its own literal text instead of looping */
+static void cfg_resolve(struct cfg_struct* cfg)
+{
+  struct cfg_node* start;
+  struct cfg_node* cur;
+  struct cfg_node* next;
+  struct cfg_node* target;
+  struct cfg_node* ref;
+  int literal;
+
+  for (cur = cfg->head; cur != NULL; cur = cur->next)
+    cur->state = CFG_UNSEEN;
+
+  for (start = cfg->head; start != NULL; start = start->next)
+  {
+    if (start->state != CFG_UNSEEN) continue;
+
+    target = NULL;
+    cur = start;
+    while (cur->state == CFG_UNSEEN)
+    {
+      cur->state = CFG_VISITING;
+      ref = cfg_find_ref(cfg, cur);
+      cur->link = ref;
+      if (ref == NULL)
+      {
+        target = cur;
+        break;
+      }
+      cur = ref;
+    }
+    if (target == NULL && cur->state == CFG_DONE)
+      target = cur->target;
+    literal = (target == NULL);
+
+    for (cur = start; cur != NULL && cur->state == CFG_VISITING; cur = next)
+    {
+      next = cur->link;
+      cur->state = literal ? CFG_LITERAL : CFG_DONE;
+      cur->target = literal ? cur : target;
+      cur->link = NULL;
+      cfg_convert(cur);
+    }
+  }
+
+  cfg->stale = 0;
+}
+
+/* The resolved node for key, resolving again first after changes */
+static struct cfg_node* cfg_resolved_node(struct cfg_struct* cfg, const char* key)
+{
+  struct cfg_node* cur;
+
+  if (cfg != NULL && cfg->stale) cfg_resolve(cfg);
+  if (cfg_lookup_text(cfg, key, &cur) == NULL) return NULL;
+
+  return cur;
+}
+
+/* Reads a whole file into a buffer, for platforms without mmap and for
+    files that cannot be mapped (empty, pipes) */
+static void* cfg_read_file(const char* filename, size_t* size)
+{
+  FILE* fp;
+  char* buffer = NULL;
+  size_t capacity = 0;
+  size_t n;
+
+  fp = fopen(filename, "rb");
+  if (fp == NULL) return NULL;
+
+  *size = 0;
+  do
+  {
+    if (*size == capacity)
+    {
+      capacity = (capacity == 0) ? CFG_READ_CHUNK : capacity * 2;
+      buffer = cfg_realloc(buffer, capacity);
+    }
+    n = fread(buffer + *size, 1, capacity - *size, fp);
+    *size += n;
+  }
+  while (n > 0);
+
+  /* print warning in case the read attempt failed but not because EOF */
+  if (ferror(fp))
+  {
+    perror("cfg_parse: Warning: cfg_load() early termination:");
+  }
+
+  fclose(fp);
+  return buffer;
+}
+
+/* Makes a whole file readable in memory: mapped read only where the
+    platform can, read into a buffer otherwise. Returns NULL if the file
+    cannot be opened, *mapped tells cfg_unmap which one it got */
+static void* cfg_map(const char* filename, size_t* size, int* mapped)
+{
+  *size = 0;
+  *mapped = 0;
+
+#if defined(_WIN32) || defined(_WIN64)
+  {
+    HANDLE file;
+    HANDLE mapping;
+    LARGE_INTEGER file_size;
+    void* view = NULL;
+
+    file = CreateFileA(filename, GENERIC_READ,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0 &&
+        (unsigned long long)file_size.QuadPart <= SIZE_MAX)
+    {
+      mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (mapping != NULL)
+      {
+        view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        /* the view keeps the mapping alive by itself */
+        CloseHandle(mapping);
+      }
+    }
+    CloseHandle(file);
+
+    if (view != NULL)
+    {
+      *size = (size_t)file_size.QuadPart;
+      *mapped = 1;
+      return view;
+    }
+  }
+#elif !defined(__wasi__)
+  {
+    struct stat st;
+    void* view = MAP_FAILED;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) return NULL;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (unsigned long long)st.st_size <= SIZE_MAX)
+      view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (view != MAP_FAILED)
+    {
+      *size = (size_t)st.st_size;
+      *mapped = 1;
+      return view;
+    }
+  }
+#endif
+
+  return cfg_read_file(filename, size);
+}
+
+/* Releases what cfg_map returned */
+static void cfg_unmap(void* data, size_t size, int mapped)
+{
+#if defined(_WIN32) || defined(_WIN64)
+  (void)size;
+  if (mapped)
+  {
+    UnmapViewOfFile(data);
+    return;
+  }
+#elif !defined(__wasi__)
+  if (mapped)
+  {
+    munmap(data, size);
+    return;
+  }
+#else
+  (void)size;
+  (void)mapped;
+#endif
+
+  free(data);
+}
+
+/* Length of a value up to its comment. A '#' inside a value which opens
+    with a quote is part of it until that quote is closed */
+static size_t cfg_value_len(const char* value, size_t len)
+{
+  const char* end;
+  size_t i = 0;
+
+  while (i < len && isspace((unsigned char)value[i]))
+    i ++;
+
+  if (i < len && (value[i] == '"' || value[i] == '\''))
+  {
+    end = memchr(value + i + 1, value[i], len - i - 1);
+    if (end != NULL) i = (size_t)(end - value) + 1;
+  }
+
+  end = memchr(value + i, '#', len - i);
+  return (end != NULL) ? (size_t)(end - value) : len;
+}
+
+/* Parses a config file held in memory in one pass, without copying lines.
+    Keys below a [SECTION] header are stored as "section.key", an empty []
+    header goes back to keys without section */
+static void cfg_parse(struct cfg_struct* cfg, const char* data, size_t size)
+{
+  const char* end = data + size;
+  const char* next;
+  const char* section = NULL;
+  size_t section_len = 0;
+
+  /* skip a UTF-8 byte order mark */
+  if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+    data += 3;
+
+  for (; data < end; data = next)
+  {
+    const char* line = data;
+    const char* eol = memchr(data, '\n', (size_t)(end - data));
+    const char* delim;
+    struct cfg_key k;
+    size_t len;
+
+    if (eol == NULL) eol = end;
+    next = (eol < end) ? eol + 1 : end;
+
+    len = cfg_span_trim(&line, (size_t)(eol - line));
+    if (len == 0 || line[0] == '#') continue;
+
+    if (line[0] == '[')
+    {
+      delim = memchr(line, ']', len);
+      if (delim != NULL)
+      {
+        section = line + 1;
+        section_len = cfg_span_trim(&section, (size_t)(delim - section));
+      }
+      continue;
+    }
+
+    /* split at the first '=', unless a comment starts before it */
+    for (delim = line; delim < line + len && *delim != '=' && *delim != '#'; delim ++)
+      ;
+    if (delim == line + len || *delim == '#') continue;
+
+    if (section_len > 0)
+    {
+      const char* key = line;
+      size_t key_len = cfg_span_trim(&key, (size_t)(delim - line));
+
+      if (key_len == 0) continue;
+      cfg_key_init(&k, section, section_len, key, key_len);
+    }
+    else if (!cfg_key_parse(&k, line, (size_t)(delim - line)))
+      continue;
+
+    delim ++;
+    cfg_set_key(cfg, &k, delim, cfg_value_len(delim, (size_t)(line + len - delim)));
+  }
+}
+
 /* ************************************************************************* */
 /* Public functions */
 /* ************************************************************************* */
@@ -133,6 +911,15 @@ struct cfg_struct* cfg_init(void)
   struct cfg_struct* cfg =
     cfg_malloc(sizeof(struct cfg_struct));
   cfg->head = NULL;
+  cfg->tail = NULL;
+  cfg->keys.slots = NULL;
+  cfg->keys.capacity = 0;
+  cfg->keys.used = 0;
+  cfg->names.slots = NULL;
+  cfg->names.capacity = 0;
+  cfg->names.used = 0;
+  cfg->count = 0;
+  cfg->stale = 0;
 
   return cfg;
 }
@@ -152,11 +939,11 @@ void cfg_free(struct cfg_struct* cfg)
   {
     cfg->head = temp->next;
 
-    free(temp->key);
-    free(temp->value);
-    free(temp);
+    cfg_free_node(temp);
   }
 
+  free(cfg->keys.slots);
+  free(cfg->names.slots);
   free(cfg);
 }
 
@@ -165,8 +952,11 @@ void cfg_free(struct cfg_struct* cfg)
  *  cfg_struct.  New keys will be inserted.  Existing keys will have values
  *  overwritten by those read from the file.
  * The format of config-files is "key=value", with any amount of whitespace.
- * Comments can be added, beginning with a # character until end-of-line.
- * The maximum line size is CFG_MAX_LINE bytes (see cfg_parse.h)
+ * Comments can be added, beginning with a # character until end-of-line; a
+ *  # inside a quoted value is kept. Lines have no length limit.
+ * Keys after a [SECTION] line are stored as "section.key". A lookup without
+ *  section also finds them by their bare name, and a value naming another
+ *  key looks in its own section first.
  * @param cfg Pointer to cfg_struct to update.
  * @param filename String containing filename to open and parse.
  * @return EXIT_SUCCESS (0) on success, or EXIT_FAILURE if file could not be
@@ -174,47 +964,29 @@ void cfg_free(struct cfg_struct* cfg)
  */
 int cfg_load(struct cfg_struct* cfg, const char* filename)
 {
-  FILE* fp;
-  char buffer[CFG_MAX_LINE + 1];
+  void* data;
+  size_t size;
+  int mapped;
 
   /* safety check: null input */
   if (cfg == NULL || filename == NULL) return EXIT_FAILURE;
 
-  /* open file for reading */
-  fp = fopen(filename, "r");
-  if (fp == NULL) return EXIT_FAILURE;
-
-  while (fgets(buffer, CFG_MAX_LINE + 1, fp) != NULL)
-  {
-    /* locate first # sign and terminate string there (comment) */
-    char* delim = strchr(buffer, '#');
-    if (delim != NULL) *delim = '\0';
-
-    /* locate first = sign and prepare to split */
-    delim = strchr(buffer, '=');
-    if (delim != NULL)
-    {
-      *delim = '\0';
-      delim ++;
-
-      cfg_set(cfg, buffer, delim);
-    }
-    /* else: no '=', so either a blank or invalid line */
-  }
+  /* map (or read) the whole file, lines are parsed where they lie */
+  data = cfg_map(filename, &size, &mapped);
+  if (data == NULL) return EXIT_FAILURE;
 
-  /* print warning in case the read attempt failed but not because EOF */
-  if (!feof(fp))
-  {
-    perror("cfg_parse: Warning: cfg_load() early termination:");
-  }
+  cfg_parse(cfg, data, size);
+  cfg_unmap(data, size, mapped);
 
-  fclose(fp);
+  /* references, quotes and numbers are settled here, not per lookup */
+  cfg_resolve(cfg);
   return EXIT_SUCCESS;
 }
 
 /**
  * This function saves a complete cfg_struct to a file.
- * Comments are not preserved.
+ * Comments are not preserved. Keys without section come first, sectioned
+ *  keys follow below a [section] line whenever the section changes.
  * @param cfg Pointer to cfg_struct to save.
  * @param filename String containing filename to open and parse.
  * @return EXIT_SUCCESS (0) on success, or EXIT_FAILURE if file could not be
@@ -224,6 +996,8 @@ int cfg_save(const struct cfg_struct* cfg, const char* filename)
 {
   FILE* fp;
   struct cfg_node* cur;
+  const struct cfg_node* section = NULL;
+  int sectioned;
 
   /* safety check: null input */
   if (cfg == NULL || filename == NULL) return EXIT_FAILURE;
@@ -232,21 +1006,35 @@ int cfg_save(const struct cfg_struct* cfg, const char* filename)
   fp = fopen(filename, "w");
   if (fp == NULL) return EXIT_FAILURE;
 
-  /* point at first item in list */
-  cur = cfg->head;
-  /* step through the list, dumping each key-value pair to disk */
-  while (cur != NULL)
+  /* step through the list twice, dumping each key-value pair to disk */
+  for (sectioned = 0; sectioned < 2; sectioned ++)
   {
-    if (fputs(cur->key, fp) == EOF ||
-        fputc('=', fp) == EOF ||
-        fputs(cur->value, fp) == EOF ||
-        fputc('\n', fp) == EOF)
+    for (cur = cfg->head; cur != NULL; cur = cur->next)
     {
-      fclose(fp);
-      return EXIT_FAILURE;
-    }
+      if ((cur->name_offset > 0) != sectioned) continue;
 
-    cur = cur->next;
+      if (sectioned && (section == NULL || section->name_offset != cur->name_offset ||
+          memcmp(section->key, cur->key, cur->name_offset) != 0))
+      {
+        section = cur;
+        if (fputc('[', fp) == EOF ||
+            fwrite(cur->key, 1, cur->name_offset - 1, fp) != cur->name_offset - 1 ||
+            fputs("]\n", fp) == EOF)
+        {
+          fclose(fp);
+          return EXIT_FAILURE;
+        }
+      }
+
+      if (fputs(cur->key + cur->name_offset, fp) == EOF ||
+          fputc('=', fp) == EOF ||
+          fputs(cur->value, fp) == EOF ||
+          fputc('\n', fp) == EOF)
+      {
+        fclose(fp);
+        return EXIT_FAILURE;
+      }
+    }
   }
 
   fclose(fp);
@@ -255,59 +1043,132 @@ int cfg_save(const struct cfg_struct* cfg, const char* filename)
 
 /**
  * This function performs a key-lookup on a cfg_struct, and returns the
- *  associated value.
+ *  associated value without its outer quotes. The stored value is not
+ *  modified, cfg_save still writes it as it was set.
  * @param cfg Pointer to cfg_struct to search.
  * @param key String containing key to search for.
  * @return String containing associated value, or NULL if key was not found.
  */
- void remove_outer_quotes(char* str) 
- {
-    size_t len = strlen(str);
-    if (len >= 2) {
-        char first = str[0];
-        char last = str[len - 1];
-
-        
-        if ((first == '"' && last == '"') || (first == '\'' && last == '\'')) {
-            str[len - 1] = '\0';
-            memmove(str, str + 1, len - 1); 
-        }
-    }
-}
-
 const char* cfg_get(const struct cfg_struct* cfg, const char* key)
 {
-  char* tkey;
   struct cfg_node* cur;
 
-  /* safety check: null input */
-  if (cfg == NULL || cfg->head == NULL || key == NULL) return NULL;
+  return cfg_lookup_text(cfg, key, &cur);
+}
+
+/**
+ * This function looks up a key and follows its value through other keys,
+ *  so with TRUE=1 and VERBOSE=TRUE the value of VERBOSE is "1".
+ * @param cfg Pointer to cfg_struct to search.
+ * @param key String containing key to search for.
+ * @return The value the chain ends on, the key's own value if its chain of
+ *  references never ends (X=x, A=B with B=A), or NULL if key was not found.
+ */
+const char* cfg_get_value(struct cfg_struct* cfg, const char* key)
+{
+  struct cfg_node* cur = cfg_resolved_node(cfg, key);
 
-  /* Trim input search key */
-  tkey = cfg_norm_key(key);
-  /* Exclude empty key */
-  if (tkey == NULL) return NULL;
+  return (cur != NULL && cur->target != NULL) ? cur->target->text : NULL;
+}
 
-  /* set up pointer to start of list */
-  cur = cfg->head;
-  /* loop through linked list looking for match on key
-    if found, free search key, return the value */
-  do
+/**
+ * This function reads a resolved value as a decimal integer.
+ * @param cfg Pointer to cfg_struct to search.
+ * @param key String containing key to search for.
+ * @param number Output parameter, left alone unless EXIT_SUCCESS is returned.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if key is missing or not a whole
+ *  number.
+ */
+int cfg_get_int(struct cfg_struct* cfg, const char* key, long long* number)
+{
+  struct cfg_node* cur = cfg_resolved_node(cfg, key);
+
+  if (cur == NULL || number == NULL || !(cur->types & CFG_HAS_NUMBER)) return EXIT_FAILURE;
+
+  *number = cur->number;
+  return EXIT_SUCCESS;
+}
+
+/**
+ * This function reads a resolved value as a boolean: any integer, or
+ *  true/false, yes/no, on/off in any case.
+ * @param cfg Pointer to cfg_struct to search.
+ * @param key String containing key to search for.
+ * @param flag Output parameter set to 0 or 1 on EXIT_SUCCESS.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if key is missing or not a boolean.
+ */
+int cfg_get_bool(struct cfg_struct* cfg, const char* key, int* flag)
+{
+  struct cfg_node* cur = cfg_resolved_node(cfg, key);
+
+  if (cur == NULL || flag == NULL || !(cur->types & CFG_HAS_BOOL)) return EXIT_FAILURE;
+
+  *flag = cur->boolean;
+  return EXIT_SUCCESS;
+}
+
+/**
+ * This function reads a resolved value as one of count choices, given
+ *  either by its index or by its name in names[] (any case).
+ * @param cfg Pointer to cfg_struct to search.
+ * @param key String containing key to search for.
+ * @param names Array of count choice names, may be NULL for numbers only.
+ * @param count Number of choices.
+ * @param choice Output parameter set to the index on EXIT_SUCCESS.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if key is missing or no choice.
+ */
+int cfg_get_enum(struct cfg_struct* cfg, const char* key, const char* const names[], size_t count, int* choice)
+{
+  struct cfg_node* cur = cfg_resolved_node(cfg, key);
+  size_t i;
+
+  if (cur == NULL || cur->target == NULL || choice == NULL) return EXIT_FAILURE;
+
+  if (cur->types & CFG_HAS_NUMBER)
+  {
+    if (cur->number < 0 || (unsigned long long)cur->number >= count) return EXIT_FAILURE;
+    *choice = (int)cur->number;
+    return EXIT_SUCCESS;
+  }
+
+  for (i = 0; names != NULL && i < count; i ++)
   {
-    if (strcmp(tkey, cur->key) == 0)
+    if (names[i] != NULL && cfg_word_equal(cur->target->text, names[i]))
     {
-      free(tkey);
-      remove_outer_quotes(cur->value);
-	  return cur->value;
+      *choice = (int)i;
+      return EXIT_SUCCESS;
     }
-  } while ((cur = cur->next) != NULL);
+  }
 
-  free(tkey);
-  return NULL;
+  return EXIT_FAILURE;
+}
+
+/**
+ * This function copies a resolved value meant as a file path.
+ * @param cfg Pointer to cfg_struct to search.
+ * @param key String containing key to search for.
+ * @param path Output buffer, untouched unless EXIT_SUCCESS is returned.
+ * @param size Size of the output buffer.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if key is missing, empty or the path
+ *  does not fit, a cut path would name some other file.
+ */
+int cfg_get_path(struct cfg_struct* cfg, const char* key, char* path, size_t size)
+{
+  const char* value = cfg_get_value(cfg, key);
+  size_t len;
+
+  if (value == NULL || path == NULL) return EXIT_FAILURE;
+
+  len = strlen(value);
+  if (len == 0 || len >= size) return EXIT_FAILURE;
+
+  memcpy(path, value, len + 1);
+  return EXIT_SUCCESS;
 }
 
 /**
  * Returns an array of strings, one for each key in the config struct.
+ * Keys below a [SECTION] are returned as "section.key".
  * This array and its contents are dynamically allocated: the caller
  * should free them when done.
  * @param cfg Pointer to cfg_struct to retrieve keys from.
@@ -324,10 +1185,8 @@ char** cfg_get_keys(const struct cfg_struct* cfg, size_t* count)
   /* safety check: null input */
   if (cfg == NULL || cfg->head == NULL) return NULL;
 
-  /* walk the list to count how many keys we have available */
-  i = 0;
-  for (cur = cfg->head; cur != NULL; cur = cur->next)
-    i ++;
+  /* the index keeps count of the keys we have available */
+  i = cfg->count;
 
   /* now create the array to hold them all */
   if (SIZE_MAX / sizeof(char*) < i) return NULL;
@@ -350,6 +1209,8 @@ char** cfg_get_keys(const struct cfg_struct* cfg, size_t* count)
  * This function sets a single key-value pair in a cfg_struct.
  * If the key already exists, its value will be updated.
  * If not, a new item is added to the cfg_struct list.
+ * A key may name its section as "section.key"; a key without section is
+ *  set outside any section, even when a sectioned key has that name.
  * For convenience, a NULL value is treated as a call to cfg_delete().
  * @param cfg Pointer to cfg_struct to search.
  * @param key String containing key to search for.
@@ -357,10 +1218,7 @@ char** cfg_get_keys(const struct cfg_struct* cfg, size_t* count)
  */
 void cfg_set(struct cfg_struct* cfg, const char* key, const char* value)
 {
-  char* tkey;
-  char* tvalue;
-
-  struct cfg_node* cur;
+  struct cfg_key k;
 
   /* Treat NULL value as a "delete" operation */
   if (value == NULL)
@@ -372,41 +1230,10 @@ void cfg_set(struct cfg_struct* cfg, const char* key, const char* value)
   /* safety check: null input */
   if (cfg == NULL || key == NULL) return;
 
-  /* Trim input search key */
-  tkey = cfg_norm_key(key);
-  /* Exclude empty key */
-  if (tkey == NULL) return;
-
-  /* Trim value. */
-  tvalue = cfg_trim(value);
+  /* Trim input search key, excluding empty key */
+  if (!cfg_key_parse(&k, key, strlen(key))) return;
 
-  if (cfg->head == NULL)
-  {
-    /* list was empty to begin with */
-    cfg->head = cfg_create_node(tkey, tvalue);
-  } else {
-    struct cfg_node* prev;
-
-    /* search list for existing key */
-    cur = cfg->head;
-    do
-    {
-      if (strcmp(tkey, cur->key) == 0)
-      {
-        /* found a match: no longer need cur key */
-        free(tkey);
-
-        /* update value */
-        free(cur->value);
-        cur->value = tvalue;
-        return;
-      }
-      prev = cur;
-    } while ((cur = cur->next) != NULL);
-
-    /* not found: create new element and append it */
-    prev->next = cfg_create_node(tkey, tvalue);
-  }
+  cfg_set_key(cfg, &k, value, strlen(value));
 }
 
 /**
@@ -436,51 +1263,21 @@ void cfg_set_array(struct cfg_struct* cfg, const char* keys[], const char* value
  */
 void cfg_delete(struct cfg_struct* cfg, const char* key)
 {
-  char* tkey;
+  struct cfg_key k;
   struct cfg_node* cur;
-  struct cfg_node* prev;
 
   /* safety check: null input */
   if (cfg == NULL || cfg->head == NULL || key == NULL) return;
 
-  /* Trim input search key */
-  tkey = cfg_norm_key(key);
-  /* Exclude empty key */
-  if (tkey == NULL) return;
+  /* Trim input search key, excluding empty key */
+  if (!cfg_key_parse(&k, key, strlen(key))) return;
 
-  /* search list for existing key */
- cur = cfg->head; 
- prev = cur->next;
-  do
-  {
-    if (strcmp(tkey, cur->key) == 0)
-    {
-      /* found it - cleanup trimmed key */
-      free(tkey);
-
-      if (cur == cfg->head)
-      {
-        /* first element */
-        cfg->head = cur->next;
-      } else {
-        /* splice out element */
-        prev->next = cur->next;
-      }
-
-      /* delete element */
-      free(cur->value);
-      free(cur->key);
-      free(cur);
+  /* not found: nothing to do */
+  cur = cfg_find(cfg, &k);
+  if (cur == NULL) return;
 
-      return;
-    }
-
-    prev = cur;
-  } while ((cur = cur->next) != NULL);
-  /* not found */
-
-  /* cleanup trimmed key */
-  free(tkey);
+  if (cfg_remove_node(cfg, cur))
+    cfg_rehash(cfg, &cfg->names, 1);
 }
 
 /**
@@ -505,6 +1302,7 @@ void cfg_delete_array(struct cfg_struct* cfg, const char* keys[], const size_t c
  * This function performs the inverse of cfg_delete_array().
  * Instead of deleting entries from cfg which match keys[],
  *  this will KEEP only those entries that match keys[].
+ * A sectioned entry is kept if keys[] has its full or its bare name.
  * It can be used to keep a config file tidy between versions or
  *  after user edits.
  * @param cfg Pointer to cfg_struct to search.
@@ -513,74 +1311,50 @@ void cfg_delete_array(struct cfg_struct* cfg, const char* keys[], const size_t c
  */
 void cfg_prune(struct cfg_struct* cfg, const char* keys[], const size_t count)
 {
-  char** tkeys;
-  size_t i, j;
-
+  struct cfg_struct* keep;
   struct cfg_node* cur;
-  struct cfg_node* prev;
+  struct cfg_node* next;
+  struct cfg_key k;
+  size_t i;
+  int named = 0;
 
   /* safety check: null input */
-  if (cfg == NULL || cfg->head == NULL || keys == NULL || count == 0 ||
-    SIZE_MAX / sizeof(char*) < count) return;
-
-  /* First we must prep every key in keys[] using the normalize function. */
-  tkeys = cfg_malloc(count * sizeof(char*));
+  if (cfg == NULL || cfg->head == NULL || keys == NULL || count == 0) return;
 
-  j = 0;
+  /* First index every key in keys[], so each entry is tested in one probe */
+  keep = cfg_init();
   for (i = 0; i < count; i ++)
   {
-    char *tkey;
-
-    if (keys[i] == NULL) continue;
-    tkey = cfg_norm_key(keys[i]);
-    if (tkey == NULL) continue;
-    
-    tkeys[j] = tkey;
-    j ++;
+    if (keys[i] != NULL)
+      cfg_set(keep, keys[i], "");
   }
 
-  if (j == 0)
+  if (keep->count == 0)
   {
-    free(tkeys);
+    cfg_free(keep);
     return;
   }
 
   /* Now iterate through the cfg struct and test every entry */
- cur = cfg->head; 
- prev = cur->next;
-  do
+  for (cur = cfg->head; cur != NULL; cur = next)
   {
-    for (i = 0; i < j; i ++)
-      if (strcmp(tkeys[i], cur->key) == 0)
-        break;
+    next = cur->next;
 
-    if (i == j)
-    {
-      /* Didn't find a key match - delete this */
-      free(cur->value);
-      free(cur->key);
+    cfg_node_key(cur, &k);
+    if (cfg_find_slot(&keep->keys, 0, &k) != SIZE_MAX) continue;
 
-      if (cur == cfg->head)
-      {
-        /* first element */
-        cfg->head = cur->next;
-        free(cur);
-        cur = cfg->head;
-      } else {
-        /* splice out element */
-        prev->next = cur->next;
-        free(cur);
-        cur = prev->next;
-      }
-    } else {
-      /* matched, advance list element */
-      prev = cur;
-      cur = cur->next;
+    if (cur->name_offset > 0)
+    {
+      cfg_node_name(cur, &k);
+      if (cfg_find_slot(&keep->keys, 0, &k) != SIZE_MAX) continue;
     }
-  } while (cur != NULL);
 
-  /* Cleanup all our trimmed keys */
-  for (i = 0; i < j; i ++)
-    free(tkeys[i]);
-  free(tkeys);
+    /* Didn't find a key match - delete this */
+    named |= cfg_remove_node(cfg, cur);
+  }
+
+  if (named)
+    cfg_rehash(cfg, &cfg->names, 1);
+
+  cfg_free(keep);
 }
@@ -6,6 +6,8 @@
  * user should create a pointer to a cfg_struct, initialize it with cfg_init(),
  * and then perform actions on that object (lookup, add, delete) by passing the
  * pointer to the functions here.
+ * Keys below a [SECTION] line of a config file are named "section.key", a
+ * lookup by the bare key finds them too.
  * At end of use, call cfg_delete to clean up the object.
  */
 #ifndef CFG_PARSE_H_
@@ -13,15 +15,6 @@
 
 #include <stddef.h>
 
-/**
- * @brief Sets the maximum size of a line in a configuration file.
- *
- * cfg_load uses this definition to limit the size of its read buffer.
- * Lines which exceed the length do not crash outright, but probably won't
- * load correctly.
- */
-#define CFG_MAX_LINE 256
-
 /* Opaque data structure holding config in memory */
 struct cfg_struct;
 
@@ -56,6 +49,31 @@ int cfg_save(const struct cfg_struct* cfg, const char* filename);
  */
 const char* cfg_get(const struct cfg_struct* cfg, const char* key);
 
+/**
+ * @brief Retrieves a value, following references to other keys.
+ */
+const char* cfg_get_value(struct cfg_struct* cfg, const char* key);
+
+/**
+ * @brief Retrieves a resolved value converted to an integer.
+ */
+int cfg_get_int(struct cfg_struct* cfg, const char* key, long long* number);
+
+/**
+ * @brief Retrieves a resolved value converted to a boolean.
+ */
+int cfg_get_bool(struct cfg_struct* cfg, const char* key, int* flag);
+
+/**
+ * @brief Retrieves a resolved value as an index into a list of choices.
+ */
+int cfg_get_enum(struct cfg_struct* cfg, const char* key, const char* const names[], size_t count, int* choice);
+
+/**
+ * @brief Copies a resolved value into a path buffer, failing if it does not fit.
+ */
+int cfg_get_path(struct cfg_struct* cfg, const char* key, char* path, size_t size);
+
 /**
  * @brief Retrieves a list of all keys in a cfg_struct.
  */
@@ -5,10 +5,10 @@ The XRP PRNG Xor Rotate Pair Pseudo Random Number Generator
 
 
 #include "prng64_xrp32.h"
+#include <string.h>
 
 #define SHIFTED_WORD_WIDTH 64
 
-#ifdef PAIR_STREAM_CIPHER
 static uint32_t
 rotl32(uint32_t x, int n) 
 {
@@ -25,6 +25,15 @@ load32(const void *a)
 	(uint32_t)p[3] << 24 ;
 }
 static void 
+store32( void *dst, uint32_t w )
+{
+  uint8_t *p = ( uint8_t * )dst;
+  p[0] = (uint8_t)(w >>  0);
+  p[1] = (uint8_t)(w >>  8);
+  p[2] = (uint8_t)(w >> 16);
+  p[3] = (uint8_t)(w >> 24);
+}
+static void 
 store64( void *dst, uint64_t w )
 {
   uint8_t *p = ( uint8_t * )dst;
@@ -110,6 +119,7 @@ chacha20_block_next(chacha20_context_t *ctx) {
 	}
 }
 
+#ifdef PAIR_STREAM_CIPHER
 static void
 chacha20_init_context(chacha20_context_t *ctx, uint8_t key[], uint8_t nonce[], uint64_t counter)
 {
@@ -167,6 +177,80 @@ rotr64(uint64_t n, size_t shift)
 #define TOTAL_PARAMS 4
 
 #ifdef PAIR_TOY_TEST
+#if !defined(PAIR_TOY_SCALAR) && defined(__AVX512VBMI__) && defined(__AVX512BW__)
+#define PAIR_TOY_AVX512
+#include <immintrin.h>
+#elif !defined(PAIR_TOY_SCALAR) && (defined(__SSSE3__) || defined(__AVX2__))
+#define PAIR_TOY_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#if defined(PAIR_TOY_AVX512)
+/* vpermb path: the 256-byte table is four 64-byte registers, the low 7 index
+   bits pick a byte from a register pair and bit 7 selects the pair */
+static uint64_t
+pearson32(uint64_t* in,xrp_state_t* xrp)
+{
+	size_t i;
+	uint64_t h=0;
+	const __m512i t0 = _mm512_loadu_si512((const void*)(XRP32_TABLE_ID + 0));
+	const __m512i t1 = _mm512_loadu_si512((const void*)(XRP32_TABLE_ID + 64));
+	const __m512i t2 = _mm512_loadu_si512((const void*)(XRP32_TABLE_ID + 128));
+	const __m512i t3 = _mm512_loadu_si512((const void*)(XRP32_TABLE_ID + 192));
+	
+	for (i = 0; i < TOTAL_PARAMS; ++i)
+	{
+		h^=in[i];
+		
+		__m512i idx = _mm512_castsi128_si512(_mm_loadl_epi64((const __m128i*)(const void*)&h));
+		__m512i lo = _mm512_permutex2var_epi8(t0, idx, t1);
+		__m512i hi = _mm512_permutex2var_epi8(t2, idx, t3);
+		__m512i out = _mm512_mask_blend_epi8(_mm512_movepi8_mask(idx), lo, hi);
+		
+		_mm_storel_epi64((__m128i*)(void*)&h, _mm512_castsi512_si128(out));
+	}
+	
+	return h;
+}
+#elif defined(PAIR_TOY_SSSE3)
+/* pshufb path: the table is sixteen 16-byte rows, the low nibble shuffles
+   every row and the high nibble masks in the row each byte belongs to */
+static uint64_t
+pearson32(uint64_t* in,xrp_state_t* xrp)
+{
+	size_t i, r;
+	uint64_t h=0;
+	__m128i rows[TABLE_SIZE_BYTES / 16];
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	
+	for (r = 0; r < TABLE_SIZE_BYTES / 16; ++r)
+	{
+		rows[r] = _mm_loadu_si128((const __m128i*)(const void*)(XRP32_TABLE_ID + r * 16));
+	}
+	
+	for (i = 0; i < TOTAL_PARAMS; ++i)
+	{
+		h^=in[i];
+		
+		__m128i v = _mm_loadl_epi64((const __m128i*)(const void*)&h);
+		__m128i lo = _mm_and_si128(v, nibble);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+		__m128i out = _mm_setzero_si128();
+		
+		for (r = 0; r < TABLE_SIZE_BYTES / 16; ++r)
+		{
+			__m128i row_mask = _mm_cmpeq_epi8(hi, _mm_set1_epi8((char)r));
+			out = _mm_or_si128(out, _mm_and_si128(row_mask, _mm_shuffle_epi8(rows[r], lo)));
+		}
+		
+		_mm_storel_epi64((__m128i*)(void*)&h, out);
+	}
+	
+	return h;
+}
+#else
+/* Scalar reference, also selected with PAIR_TOY_SCALAR, the vector paths
+   above must stay bit-identical to it */
 static uint64_t 
 get_word(uint64_t in, xrp_state_t* xrp)
 {
@@ -200,7 +284,10 @@ pearson32(uint64_t* in,xrp_state_t* xrp)
 	return h;
 
 }
+#endif
 
+/* Stays scalar in every build: consecutive swaps may hit the same table
+   entries and must be applied strictly in order */
 static void
 shuffle8bytes(uint64_t a, uint64_t b, xrp_state_t* xrp)
 {
@@ -367,6 +454,115 @@ seed_xrp32(uint64_t seed)
 #endif
 	return;
 }
+
+/* Checkpoint the whole generator state so the stream can be resumed later
+   without running seed_xrp32() again. Returns the state size, copies nothing
+   when dst is NULL or too small. */
+size_t
+save_xrp32(void* dst, size_t size)
+{
+	xrp_state_t* xrp = get_xrp_state();
+	
+	if (dst != NULL && size >= sizeof(xrp_state_t))
+	{
+		memcpy(dst, xrp, sizeof(xrp_state_t));
+	}
+	return sizeof(xrp_state_t);
+}
+
+/* Resume the stream from a save_xrp32() checkpoint. Returns 0 on success and
+   -1 if the checkpoint does not match this build of the generator. */
+int
+load_xrp32(const void* src, size_t size)
+{
+	xrp_state_t* xrp = get_xrp_state();
+	
+	if (src == NULL || size != sizeof(xrp_state_t))
+	{
+		return -1;
+	}
+	memcpy(xrp, src, sizeof(xrp_state_t));
+	return 0;
+}
+/* Compress key bytes of any length into a 32-byte key for keyed_xrp32().
+   Each 16 bytes, then the length, fill counter and nonce of one ChaCha20
+   block keyed by the key so far; the next key is words 0-3 and 12-15 of
+   that block, as in HChaCha20, so no block can be run backwards. */
+void
+derive_key_xrp32(uint8_t key[32], const void* data, size_t size)
+{
+	chacha20_context_t ctx;
+	const uint8_t* bytes = (const uint8_t*)data;
+	uint8_t chunk[16];
+	size_t done = 0;
+	size_t n = 0;
+	size_t i = 0;
+	int last = 0;
+	
+	memset(key, 0, 32);
+	while (!last)
+	{
+		memset(chunk, 0, sizeof(chunk));
+		if (done < size)
+		{
+			n = (size - done < sizeof(chunk)) ? size - done : sizeof(chunk);
+			memcpy(chunk, bytes + done, n);
+			done += n;
+		}
+		else
+		{
+			store64(chunk, (uint64_t)size);
+			chunk[15] = 0x80;
+			last = 1;
+		}
+		memset(&ctx, 0, sizeof(ctx));
+		chacha20_init_block(&ctx, key, chunk + 4);
+		ctx.state[12] = load32(chunk);
+		chacha20_block_next(&ctx);
+		for (i=0;i<4;i++)
+		{
+			store32(&key[4 * i], ctx.keystream32[i]);
+			store32(&key[16 + 4 * i], ctx.keystream32[12 + i]);
+		}
+	}
+	memset(&ctx, 0, sizeof(ctx));
+	memset(chunk, 0, sizeof(chunk));
+}
+
+/* Counter-based keyed generator: the ChaCha20 block for (user, day) is
+   computed directly, so any slot of any day is random access and does not
+   touch the sequential xrp state. Each block yields KEYED_WORDS_PER_BLOCK
+   words and a day spans 1 << KEYED_BLOCKS_PER_DAY_SHIFT blocks. Day and
+   block make the 64-bit counter in words 12-13, the user stays alone in
+   words 14-15, so days repeat only modulo 2^56 and never reach another
+   user's stream. */
+uint64_t
+keyed_xrp32(const uint8_t key[32], uint64_t user, uint64_t day, uint64_t slot)
+{
+	chacha20_context_t ctx;
+	uint8_t k[32];
+	uint8_t nonce[12];
+	uint64_t block;
+	uint64_t word;
+	size_t i = 0;
+	
+	memset(&ctx, 0, sizeof(ctx));
+	memset(nonce, 0, sizeof(nonce));
+	for (i=0;i<32;i++) {k[i]=key[i];}
+	store64(nonce + 4, user);
+	
+	block = (slot / KEYED_WORDS_PER_BLOCK) & ((1U << KEYED_BLOCKS_PER_DAY_SHIFT) - 1);
+	chacha20_init_block(&ctx, k, nonce);
+	chacha20_block_set_counter(&ctx, (day << KEYED_BLOCKS_PER_DAY_SHIFT) | block);
+	chacha20_block_next(&ctx);
+	
+	i = (size_t)(slot % KEYED_WORDS_PER_BLOCK) * 2;
+	word = (uint64_t)ctx.keystream32[i] | ((uint64_t)ctx.keystream32[i + 1] << 32);
+	
+	memset(&ctx, 0, sizeof(ctx));
+	for (i=0;i<32;i++) {k[i]=0;}
+	return word;
+}
 #undef TABLE_SIZE_BYTES
 #undef SHIFTED_WORD_WIDTH
 #undef BYTES_IN_WORD
@@ -16,6 +16,10 @@ extern "C" {
 
 uint64_t prng64_xrp32(void);
 void seed_xrp32(uint64_t seed);
+size_t save_xrp32(void* dst, size_t size);
+int load_xrp32(const void* src, size_t size);
+void derive_key_xrp32(uint8_t key[32], const void* data, size_t size);
+uint64_t keyed_xrp32(const uint8_t key[32], uint64_t user, uint64_t day, uint64_t slot);
 #define XRP32_TABLE_ID xrp->table
 #define TABLE_SIZE_BYTES 256
 /* The table must be seeded with DISTINCT 0-255 chars in random order. */
@@ -23,7 +27,8 @@ void seed_xrp32(uint64_t seed);
 #define XRP_MAX ULONG_MAX
 #define BYTES_IN_WORD 8
 #define WORDS_IN_TABLE 32
-#ifdef PAIR_STREAM_CIPHER
+#define KEYED_WORDS_PER_BLOCK 8
+#define KEYED_BLOCKS_PER_DAY_SHIFT 8
 typedef struct 
 {
 	uint32_t keystream32[16];
@@ -35,7 +40,6 @@ typedef struct
 
 	uint32_t state[16];
 }chacha20_context_t;
-#endif
 typedef struct 
 {
 #ifdef PAIR_TOY_TEST	
@@ -8,6 +8,9 @@
 	The C program to control the toothpastes lists
 */
 #include "tpm.h"
+#if !defined(ENABLE_NLS) || (ENABLE_NLS != 1)
+#include "tpm_catalog.h"
+#endif
 
 #define	TPM_NO_ERROR 0
 #define	OPTS_IS_NULL 1
@@ -23,6 +26,7 @@
 #define	NULL_CONTEXT 11
 #define TPM_RARE_ERROR 42
 #define INVALID_ARGUMENT 13
+#define STATS_STORE_FULL 14
 
 static const toothpaste_data_t toothpastes[TOTAL_TOOTHPASTES]={
 	{PASTE_BUILTIN,0,"BUILTIN TOOTHPASTE 1",75,90,"White", "Builtin Toothbrush 1",20,50},
@@ -37,7 +41,8 @@ static const char* pick_type_strings[TOTAL_PICK_TYPE_STRINGS]={
 	gettext_noop("Max rating"),
 	gettext_noop("Max tube mass"),
 	gettext_noop("Min rating"),
-	gettext_noop("Min tube mass")
+	gettext_noop("Min tube mass"),
+	gettext_noop("Keyed random")
 };
 static const char* toothpaste_type_strings[TOTAL_TOOTHPASTE_TYPES]={
 	gettext_noop("Random"), 
@@ -56,6 +61,22 @@ static const char* days_of_week[TOTAL_DAYS_OF_WEEK]={
 	gettext_noop("Tuesday"),
 	gettext_noop("Wednesday")
 };
+static const char* output_format_strings[TOTAL_OUTPUT_FORMATS]={
+	"text",
+	"json",
+	"ndjson",
+	"csv",
+	"cbor",
+	"msgpack",
+	"arrow",
+	"arrow-file"
+};
+static const char* list_sort_strings[TOTAL_LIST_SORTS]={
+	"none",
+	"rating",
+	"mass",
+	"brand"
+};
 static const char* times_of_day[TOTAL_TIMES_OF_DAY]={
 	gettext_noop("Night"),
 	gettext_noop("Morning"),
@@ -74,9 +95,10 @@ static const char* error_strings[TOTAL_ERROR_MESSAGES]={
 	gettext_noop("Error 108: Opening last_pick file for writing"),
 	gettext_noop("Error 109: Pick is NULL perform pick first"),
 	gettext_noop("Error 110: No toothpastes available."),
-	gettext_noop("Error 111: NULL context")
-	gettext_noop("Rare Error 42: 42")
-	gettext_noop("Error 113: Invalid argument strtoul()")
+	gettext_noop("Error 111: NULL context"),
+	gettext_noop("Rare Error 42: 42"),
+	gettext_noop("Error 113: Invalid argument strtoul()"),
+	gettext_noop("Error 114: Stats store is full, raise STATS_STORE_SLOTS for a new store")
 };
 static const char* user_strings[TOTAL_USER_MESSAGES]={
 	gettext_noop("Pick counter clear"),
@@ -113,7 +135,10 @@ static const char* user_strings[TOTAL_USER_MESSAGES]={
 	gettext_noop("BUILTIN TOOTHPASTE 1"),
 	gettext_noop("BUILTIN TOOTHPASTE 2"),
 	gettext_noop("BUILTIN TOOTHPASTE 3"),
-	gettext_noop("Press any key to continue . . .")
+	gettext_noop("Press any key to continue . . ."),
+	gettext_noop("Coverage last 7 days:"),
+	gettext_noop("Coverage last 30 days:"),
+	gettext_noop("Coverage this year:")
 };
 
 static const char left_armour[TOTAL_USER_ARMOUR]={"<<<"};
@@ -124,6 +149,12 @@ static const char stats_file_name[MAX_PATH] ="pickstats";
 static const char toothpastes_file_name[MAX_PATH] ="toothpastes";
 static const char output_file_name[MAX_PATH] ="last_pick";
 static const char config_file_name[MAX_PATH] ="tpm.conf";
+static const char prng_state_file_ext[MAX_PATH] =".xrp";
+static const char stats_lock_file_ext[MAX_PATH] =".lock";
+static const char temp_file_ext[MAX_PATH] =".tmp";
+static const char pick_log_file_ext[MAX_PATH] =".log";
+static const char journal_file_ext[MAX_PATH] =".wal";
+static const char corrupt_file_ext[MAX_PATH] =".corrupt";
 
 #ifndef _MSC_VER
 #define _strdup strdup
@@ -319,6 +350,114 @@ init_tpm_console(void)
 	return 0;
 }
 
+#if !defined(ENABLE_NLS) || (ENABLE_NLS != 1)
+/* Without gettext the translations come from the tables compiled in from
+   locale/<lang>/tpm.po, looked up in memory with no .mo files to open */
+static const catalog_t* active_catalog = NULL;
+
+static int
+compare_catalog_locale(const void* key, const void* item)
+{
+	return strcmp((const char*)key, ((const catalog_t*)item)->locale);
+}
+
+static int
+compare_catalog_entry(const void* key, const void* item)
+{
+	return strcmp((const char*)key, ((const catalog_entry_t*)item)->msgid);
+}
+
+/* fr_FR.UTF-8@euro tries fr_FR then fr */
+static const catalog_t*
+find_catalog(const char* locale_id)
+{
+	char name[MAX_LOCALE_CODE];
+	const catalog_t* catalog;
+	char* territory;
+	size_t len;
+
+	if (locale_id == NULL)
+	{
+		return NULL;
+	}
+	len = strcspn(locale_id, ".@:");
+	if (len == 0 || len >= sizeof(name))
+	{
+		return NULL;
+	}
+	memcpy(name, locale_id, len);
+	name[len] = '\0';
+	catalog = bsearch(name, embedded_catalogs, TOTAL_EMBEDDED_CATALOGS,
+		sizeof(catalog_t), compare_catalog_locale);
+	territory = strchr(name, '_');
+	if (catalog == NULL && territory != NULL)
+	{
+		*territory = '\0';
+		catalog = bsearch(name, embedded_catalogs, TOTAL_EMBEDDED_CATALOGS,
+			sizeof(catalog_t), compare_catalog_locale);
+	}
+	return catalog;
+}
+
+/* The -L/LOCALE code if given, otherwise the environment in the order
+   gettext reads it, LANGUAGE being a colon separated list of choices */
+static const catalog_t*
+select_catalog(const char* locale_id)
+{
+	const catalog_t* catalog;
+	const char* value;
+	const char* language;
+
+	if (locale_id != NULL && locale_id[0] != '\0')
+	{
+		return find_catalog(locale_id);
+	}
+	value = getenv("LC_ALL");
+	if (value == NULL || value[0] == '\0')
+	{
+		value = getenv("LC_MESSAGES");
+	}
+	if (value == NULL || value[0] == '\0')
+	{
+		value = getenv("LANG");
+	}
+	if (value == NULL || value[0] == '\0' || strcmp(value, "C") == 0 || strcmp(value, "POSIX") == 0)
+	{
+		return NULL;
+	}
+	language = getenv("LANGUAGE");
+	while (language != NULL && language[0] != '\0')
+	{
+		catalog = find_catalog(language);
+		if (catalog != NULL)
+		{
+			return catalog;
+		}
+		language = strchr(language, ':');
+		if (language != NULL)
+		{
+			language++;
+		}
+	}
+	return find_catalog(value);
+}
+
+/* Stands in for gettext(), the msgid itself when it has no translation */
+static const char*
+catalog_gettext(const char* msgid)
+{
+	const catalog_entry_t* entry;
+
+	if (active_catalog == NULL || msgid == NULL)
+	{
+		return msgid;
+	}
+	entry = bsearch(msgid, active_catalog->entries, active_catalog->count,
+		sizeof(catalog_entry_t), compare_catalog_entry);
+	return (entry != NULL) ? entry->msgstr : msgid;
+}
+#endif
+
 static int 
 init_tpm_locale(char* locale_id, toothpaste_pick_options_t* opts)
 {
@@ -368,10 +507,109 @@ init_tpm_locale(char* locale_id, toothpaste_pick_options_t* opts)
 
     bind_textdomain_codeset("tpm", "UTF-8");
     textdomain("tpm");
+
+#if !defined(ENABLE_NLS) || (ENABLE_NLS != 1)
+    active_catalog = select_catalog((opts != NULL) ? opts->tpm_locale : NULL);
+#endif
 	
+    if (opts != NULL)
+    {
+        opts->strings = load_locale_strings();
+    }
     return 0;
 }
 
+#define LOCALE_TEXT(s) (((s) != NULL) ? _(s) : NULL)
+
+/* One table per locale seen, kept for the life of the process so a batch
+   switching between locales resolves each of them only once */
+static locale_strings_t* locale_tables = NULL;
+
+/* The untranslated messages, used if a table cannot be allocated */
+static locale_strings_t untranslated_strings;
+
+static const locale_strings_t*
+load_locale_strings(void)
+{
+	locale_strings_t* table;
+	const char* locale;
+	unsigned int k;
+	
+#if !defined(ENABLE_NLS) || (ENABLE_NLS != 1)
+	locale = (active_catalog != NULL) ? active_catalog->locale : NULL;
+#elif defined(LC_MESSAGES)
+	locale = setlocale(LC_MESSAGES, NULL);
+#else
+	locale = setlocale(LC_ALL, NULL);
+#endif
+	if (locale == NULL)
+	{
+		locale = "C";
+	}
+	for (table = locale_tables; table != NULL; table = table->next)
+	{
+		if (strcmp(table->locale, locale) == 0)
+		{
+			return table;
+		}
+	}
+	table = calloc(1, sizeof(locale_strings_t));
+	if (table == NULL)
+	{
+		return NULL;
+	}
+	table->locale = _strdup(locale);
+	if (table->locale == NULL)
+	{
+		free(table);
+		return NULL;
+	}
+	for (k = 0; k < TOTAL_USER_MESSAGES; k++)
+	{
+		table->user[k] = LOCALE_TEXT(user_strings[k]);
+	}
+	for (k = 0; k < TOTAL_TIMES_OF_DAY; k++)
+	{
+		table->times_of_day[k] = LOCALE_TEXT(times_of_day[k]);
+	}
+	for (k = 0; k < TOTAL_DAYS_OF_WEEK; k++)
+	{
+		table->days_of_week[k] = LOCALE_TEXT(days_of_week[k]);
+	}
+	for (k = 0; k < TOTAL_TOOTHPASTE_TYPES; k++)
+	{
+		table->toothpaste_types[k] = LOCALE_TEXT(toothpaste_type_strings[k]);
+	}
+	for (k = 0; k < TOTAL_PICK_TYPE_STRINGS; k++)
+	{
+		table->pick_types[k] = LOCALE_TEXT(pick_type_strings[k]);
+	}
+	table->next = locale_tables;
+	locale_tables = table;
+	return table;
+}
+
+/* The table of the locale opts runs in, a context set up without
+   init_tpm_locale gets the current one on first use */
+static const locale_strings_t*
+locale_strings(toothpaste_pick_options_t* opts)
+{
+	if (opts->strings == NULL)
+	{
+		opts->strings = load_locale_strings();
+	}
+	if (opts->strings == NULL)
+	{
+		memcpy(untranslated_strings.user, user_strings, sizeof(user_strings));
+		memcpy(untranslated_strings.times_of_day, times_of_day, sizeof(times_of_day));
+		memcpy(untranslated_strings.days_of_week, days_of_week, sizeof(days_of_week));
+		memcpy(untranslated_strings.toothpaste_types, toothpaste_type_strings, sizeof(toothpaste_type_strings));
+		memcpy(untranslated_strings.pick_types, pick_type_strings, sizeof(pick_type_strings));
+		return &untranslated_strings;
+	}
+	return opts->strings;
+}
+
 TPM int
 tpm_init_context(toothpaste_pick_options_t* opts)
 {
@@ -383,8 +621,14 @@ tpm_init_context(toothpaste_pick_options_t* opts)
     opts->ptype = PICK_DEFAULT;
     opts->verbose = 1;
     opts->lat_flag = 0;
+    opts->history_flag = 0;
     opts->json_flag = 0;
     opts->csv_flag = 0;
+    opts->ndjson_flag = 0;
+    opts->output_format = OUTPUT_FORMAT_TEXT;
+    opts->list_sort = LIST_SORT_NONE;
+    opts->list_offset = 0;
+    opts->list_limit = 0;
     opts->fake_stats = 0;
     opts->output_to_file = 0;
     opts->upper_brands = 0;
@@ -394,6 +638,22 @@ tpm_init_context(toothpaste_pick_options_t* opts)
     opts->config_load_failure = 0;
     opts->toothpastes_list = NULL;
     opts->username = NULL;
+    opts->stats_fsync = DEFAULT_STATS_FSYNC;
+    opts->stats_store_path = NULL;
+    opts->stats_store_slots = DEFAULT_STATS_STORE_SLOTS;
+    opts->stats_store = STATS_NO_LOCK;
+    memset(&opts->journal, 0, sizeof(opts->journal));
+    opts->journal.commit_picks = DEFAULT_JOURNAL_COMMIT_PICKS;
+    opts->journal.commit_seconds = DEFAULT_JOURNAL_COMMIT_SECONDS;
+    opts->journal.checkpoint_picks = DEFAULT_JOURNAL_CHECKPOINT_PICKS;
+    opts->journal.lock = STATS_NO_LOCK;
+    opts->pick_db_path = NULL;
+    opts->pick_db_batch = DEFAULT_PICK_DB_BATCH;
+    opts->pick_db = NULL;
+    opts->template_source = NULL;
+    opts->template_ops = NULL;
+    opts->template_op_count = 0;
+    opts->template_literals = NULL;
 
   
     opts->meme_payload = (char*)malloc(MAX_TOOTHPASTE_LINE);
@@ -509,14 +769,25 @@ free_context(toothpaste_pick_options_t* opts)
 {
     if (opts == NULL) return;
     
+    tpm_flush_stats(opts);
+#ifdef HAVE_SQLITE
+    tpm_close_pick_db(opts);
+#endif
     free(opts->meme_payload);
     free(opts->tpm_template);
+    free_template(opts);
     free(opts->username);
 	free(opts->stats_file_path_final);
 	free(opts->toothpastes_file_path_final);
 	free(opts->output_file_path_final);
 	free(opts->config_file_path_final);
 	free((void*)opts->brand_string);
+	free(opts->random_key);
+	free(opts->journal.pending);
+	free(opts->journal.log_pending);
+	close_stats_store(opts);
+	free(opts->stats_store_path);
+	free(opts->pick_db_path);
     
    
 }
@@ -537,22 +808,28 @@ create_node(toothpaste_data_t p_data)
     return new_node;
 }
 
+/* Appends after tail and returns the new tail, a NULL tail walks the list
+   from head once to find it */
 static list_node_t* 
-add_to_list(list_node_t* head, toothpaste_data_t p_data) 
+add_to_list(list_node_t** head, list_node_t* tail, toothpaste_data_t p_data) 
 {
     list_node_t* new_node = create_node(p_data);
-    list_node_t* current = head;
 	
-	if (head == NULL) 
+	if (*head == NULL) 
 	{
+        *head = new_node;
         return new_node;
     }
-    while (current->next != NULL) 
+    if (tail == NULL)
+    {
+        tail = *head;
+    }
+    while (tail->next != NULL) 
 	{
-        current = current->next;
+        tail = tail->next;
     }
-    current->next = new_node;
-    return head;
+    tail->next = new_node;
+    return new_node;
 }
 
 static char* 
@@ -667,6 +944,7 @@ tpm_load_list_from_file(const char *filename,
     unsigned int i;
     unsigned int cnt = 0;
     FILE *file;
+    list_node_t *tail = NULL;
     toothpaste_data_t temp_data;
     char line[MAX_LINE_LENGTH];
     char long_line[4 * MAX_LINE_LENGTH];
@@ -694,7 +972,7 @@ tpm_load_list_from_file(const char *filename,
                 toothpastes[i].toothbrush_color ?
                 _strdup(toothpastes[i].toothbrush_color) : NULL;
 
-            *head = add_to_list(*head, temp_data);
+            tail = add_to_list(head, tail, temp_data);
         }
 
         return TOOTHPASTES_FAILED;
@@ -816,14 +1094,9 @@ tpm_load_list_from_file(const char *filename,
                 }
             }
 
-            *head = add_to_list(*head, temp_data);
+            tail = add_to_list(head, tail, temp_data);
 
             cnt++;
-
-            if (cnt > MAX_TOOTHPASTE_LINES)
-            {
-                break;
-            }
         }
         else
         {
@@ -857,7 +1130,7 @@ tpm_load_list_from_file(const char *filename,
                 toothpastes[i].toothbrush_color ?
                 _strdup(toothpastes[i].toothbrush_color) : NULL;
 
-            *head = add_to_list(*head, temp_data);
+            tail = add_to_list(head, tail, temp_data);
         }
     }
 
@@ -866,53 +1139,143 @@ tpm_load_list_from_file(const char *filename,
     return TPM_NO_ERROR;
 }
 
-static void 
-display_list(list_node_t* head, toothpaste_pick_t* pick) 
+/* The catalog in listing order, sorted if asked and cut to the offset and
+   limit window. Only row pointers move, the list stays as it was loaded.
+   NULL opts selects every row in catalog order */
+static int
+select_list_rows(list_node_t* head, const toothpaste_pick_options_t* opts, list_row_t** rows, size_t* count)
 {
-	unsigned int cnt=0;
-    list_node_t* current = head;
-	char line[4*MAX_TOOTHPASTE_LINE];
+	list_node_t* current;
+	list_row_t* all;
+	list_row_t* scratch;
+	list_sort_t sort = (opts != NULL) ? opts->list_sort : LIST_SORT_NONE;
+	size_t offset = (opts != NULL) ? opts->list_offset : 0;
+	size_t limit = (opts != NULL) ? opts->list_limit : 0;
+	size_t total = 0;
+	size_t first;
 	size_t i = 0;
-	size_t len =0;
 	
-	memset(line,0,4*MAX_TOOTHPASTE_LINE);
-	memset(pick->message,0,OUTPUT_BLOCK_SIZE);
-	
-		if (!pick->opts->enhanced_toothpastes)
+	*rows = NULL;
+	*count = 0;
+	for (current = head; current != NULL; current = current->next)
+	{
+		total++;
+	}
+	all = malloc((total + 1) * sizeof(list_row_t));
+	if (all == NULL)
+	{
+		return MALLOC_FAILED;
+	}
+	for (current = head; current != NULL; current = current->next, i++)
+	{
+		all[i].node = current;
+		if (sort == LIST_SORT_RATING)
 		{
-			snprintf(pick->message,MAX_TOOTHPASTE_LINE,"%s \n",_(user_strings[MSG_COMMENT]));
+			all[i].key = current->data.rating;
+		}
+		else if (sort == LIST_SORT_MASS)
+		{
+			all[i].key = current->data.tube_mass_g;
 		}
 		else
 		{
-			snprintf(pick->message,MAX_TOOTHPASTE_LINE,"%s \n",_(user_strings[MSG_ENHANCED_COMMENT]));
+			all[i].key = (uint32_t)i;
 		}
-	while (current != NULL) 
+	}
+	if (sort == LIST_SORT_RATING || sort == LIST_SORT_MASS)
 	{
-        if (pick->opts->upper_brands)
+		scratch = malloc((total + 1) * sizeof(list_row_t));
+		if (scratch == NULL)
 		{
-			len = strlen(current->data.toothpaste_brand);
-			for (i =0; i<len; i++)
-			{
-				current->data.toothpaste_brand[i]=(char)toupper((unsigned char)current->data.toothpaste_brand[i]);
-			}
+			free(all);
+			return MALLOC_FAILED;
 		}
-		if (!pick->opts->enhanced_toothpastes)
+		radix_sort_rows(all, scratch, total);
+		free(scratch);
+	}
+	else if (sort == LIST_SORT_BRAND)
+	{
+		qsort(all, total, sizeof(list_row_t), compare_brand_rows);
+	}
+	
+	first = (offset < total) ? offset : total;
+	memmove(all, all + first, (total - first) * sizeof(list_row_t));
+	*count = total - first;
+	if (limit > 0 && limit < *count)
+	{
+		*count = limit;
+	}
+	*rows = all;
+	return TPM_NO_ERROR;
+}
+
+/* Stable LSD radix sort on the 32-bit key a byte at a time. A byte that is
+   the same in every row, like the high bytes of a rating, costs only the
+   counting pass */
+static void
+radix_sort_rows(list_row_t* rows, list_row_t* scratch, size_t count)
+{
+	size_t buckets[LIST_RADIX_BUCKETS];
+	list_row_t* from = rows;
+	list_row_t* to = scratch;
+	list_row_t* swap;
+	unsigned int shift;
+	unsigned int digit;
+	size_t sum;
+	size_t n;
+	size_t i;
+	
+	if (count < 2)
+	{
+		return;
+	}
+	for (shift = 0; shift < 32; shift += LIST_RADIX_BITS)
+	{
+		memset(buckets, 0, sizeof(buckets));
+		for (i = 0; i < count; i++)
 		{
-			snprintf(line,MAX_TOOTHPASTE_LINE,"%d,%.120s,%d,%d\n", current->data.index, current->data.toothpaste_brand, current->data.tube_mass_g, current->data.rating);
+			buckets[(from[i].key >> shift) & (LIST_RADIX_BUCKETS - 1)]++;
 		}
-		else
+		if (buckets[(from[0].key >> shift) & (LIST_RADIX_BUCKETS - 1)] == count)
 		{
-			snprintf(line,4*MAX_TOOTHPASTE_LINE,"%d,%.120s,%d,%d,%.30s,%.120s,%u,%u\n", current->data.index, current->data.toothpaste_brand, current->data.tube_mass_g, current->data.rating, current->data.toothbrush_color, current->data.toothbrush_brand, current->data.toothbrush_length_cm, current->data.toothbrush_hardness);
+			continue;
 		}
-		
-        size_t rem = OUTPUT_BLOCK_SIZE - strlen(pick->message) - 1;
-		strncat_s(pick->message,OUTPUT_BLOCK_SIZE, line, rem);
-		
-		current = current->next;
-		cnt++;
-		if (cnt>MAX_TOOTHPASTE_LINES){break;}
+		for (sum = 0, digit = 0; digit < LIST_RADIX_BUCKETS; digit++)
+		{
+			n = buckets[digit];
+			buckets[digit] = sum;
+			sum += n;
+		}
+		for (i = 0; i < count; i++)
+		{
+			to[buckets[(from[i].key >> shift) & (LIST_RADIX_BUCKETS - 1)]++] = from[i];
+		}
+		swap = from;
+		from = to;
+		to = swap;
 	}
-	return;
+	if (from != rows)
+	{
+		memcpy(rows, from, count * sizeof(list_row_t));
+	}
+}
+
+/* Brands are free text so they go through qsort, equal brands keep the
+   catalog order through the position in key */
+static int
+compare_brand_rows(const void* a, const void* b)
+{
+	const list_row_t* left = (const list_row_t*)a;
+	const list_row_t* right = (const list_row_t*)b;
+	const char* left_brand = left->node->data.toothpaste_brand;
+	const char* right_brand = right->node->data.toothpaste_brand;
+	int order = strcmp(left_brand != NULL ? left_brand : "", right_brand != NULL ? right_brand : "");
+	
+	if (order != 0)
+	{
+		return order;
+	}
+	return (left->key > right->key) - (left->key < right->key);
 }
 
 static unsigned int 
@@ -1062,22 +1425,23 @@ free_list(list_node_t* head)
 static int 
 reset_counters(toothpaste_pick_options_t* opts) 
 {
-	FILE* file_ptr;
-	unsigned int zero=0;
-	time_t cur =time(NULL);
-	errno_t err;
+	toothpaste_pick_stats_t stats;
+	stats_lock_t lock;
+	int result;
 	
-	err = fopen_s(&file_ptr,opts->stats_file_path_final, "wb");
-	if (err != 0) 
+	memset(&stats, 0, sizeof(stats));
+	stats.first_pick_time = time(NULL);
+	stats.last_pick_time = stats.first_pick_time;
+	stats.total_picks = 0;
+	
+	lock = lock_stats(opts);
+	result = write_counters(stats, 0, opts);
+	unlock_stats(opts, lock);
+	if (result != 0) 
 	{
-		perror(_(error_strings[PICKSTATS_WRITE_FAILED]));
-		return 3;
+		return result;
 	}	
 
-	fwrite(&cur, sizeof(time_t), 1, file_ptr);	
-	fwrite(&cur, sizeof(time_t), 1, file_ptr);	
-	fwrite(&zero, sizeof(unsigned int), 1, file_ptr);
-	fclose(file_ptr);
 	printf("%s \n", _(user_strings[MSG_PICK_COUNTER_C])); 
 	return 0;
 }
@@ -1085,14 +1449,13 @@ reset_counters(toothpaste_pick_options_t* opts)
 static int 
 set_counters(void* opt_arg,toothpaste_pick_options_t* opts) 
 {
-	FILE* file_ptr;
-	unsigned int zero=0;
+	toothpaste_pick_stats_t stats;
+	stats_lock_t lock;
 	time_t total_seconds=time(NULL)+opts->delta_hours*SECONDS_PER_HOUR;
-	time_t cur;	
+	int result;
 
 	char *end = NULL;
 	unsigned long value;
-	errno_t err;
 	
 	errno = 0;
 	value = strtoul(opt_arg, &end, 10);
@@ -1102,128 +1465,2201 @@ set_counters(void* opt_arg,toothpaste_pick_options_t* opts)
 		return INVALID_ARGUMENT; 
 	}
 
-	zero = (unsigned int)value;
+	memset(&stats, 0, sizeof(stats));
+	stats.first_pick_time = total_seconds - (time_t)(value * SECONDS_PER_DAY);
+	stats.last_pick_time = total_seconds;
+	stats.total_picks = (unsigned int)value;
 
-	err = fopen_s(&file_ptr,opts->stats_file_path_final, "wb");
-	if (err != 0) 
+	lock = lock_stats(opts);
+	result = write_counters(stats, 0, opts);
+	unlock_stats(opts, lock);
+	if (result != 0) 
 	{
-		perror(_(error_strings[PICKSTATS_WRITE_FAILED]));
-		return 3;
+		return result;
 	}	
 
-	cur = total_seconds - (time_t)(value * SECONDS_PER_DAY);
-	fwrite(&cur, sizeof(time_t), 1, file_ptr);
-	fwrite(&total_seconds, sizeof(time_t), 1, file_ptr);
-	fwrite(&zero, sizeof(unsigned int), 1, file_ptr);
-	fclose(file_ptr);
 	printf("%s \n", _(user_strings[MSG_PICK_COUNTER_S])); 
 
 	return 0;
 }
 
-static size_t
-read_counters(toothpaste_pick_stats_t* stats,int fake_stats,toothpaste_pick_options_t* opts)
+/* pickstats v2, every field little-endian whatever the host
+
+	0  magic "TPMS"       4  u16 version         6  u16 byte order 0x0102
+	8  u8 time width      9  u8 count width      10 u16 file size
+	12 u32 journal gen.   16 i64 first pick      24 i64 last pick
+	32 u64 total picks    40 rollups             248 u64 FNV-1a of bytes [0,248)
+
+   v1 was the same up to byte 40 with the checksum right there and no rollups
+*/
+static void
+encode_pickstats(const toothpaste_pick_stats_t* stats, unsigned char* dst)
 {
-	FILE* file_ptr;
-	size_t nbytes=0;
-	errno_t err;
+	memset(dst, 0, PICKSTATS_FILE_SIZE);
+	memcpy(dst, PICKSTATS_MAGIC, PICKSTATS_MAGIC_SIZE);
+	store_le16(dst + 4, PICKSTATS_VERSION);
+	store_le16(dst + 6, PICKSTATS_BYTE_ORDER);
+	dst[8] = PICKSTATS_FIELD_WIDTH;
+	dst[9] = PICKSTATS_FIELD_WIDTH;
+	store_le16(dst + 10, PICKSTATS_FILE_SIZE);
+	store_le32(dst + 12, stats->journal_generation);
+	store_le64(dst + 16, (uint64_t)(int64_t)stats->first_pick_time);
+	store_le64(dst + 24, (uint64_t)(int64_t)stats->last_pick_time);
+	store_le64(dst + 32, stats->total_picks);
+	encode_rollups(stats, dst + PICKSTATS_ROLLUP_OFFSET);
+	store_le64(dst + PICKSTATS_CHECKSUM_OFFSET, fnv1a64(dst, PICKSTATS_CHECKSUM_OFFSET));
+}
+
+/* 0 for a valid v2 file, 1 for a v1 or legacy raw time_t/unsigned int file
+   that needs migrating, -1 for anything else */
+static int
+decode_pickstats(const unsigned char* src, size_t size, toothpaste_pick_stats_t* stats)
+{
+	uint64_t total;
+	uint16_t version;
+	size_t checksum_offset;
 	
-	stats->total_picks=0;
-	stats->last_pick_time=0;
-	stats->first_pick_time=0;
-	if (!fake_stats)
-	{	
-		err = fopen_s(&file_ptr,opts->stats_file_path_final, "rb");
-		if (err != 0) 
+	if (size == PICKSTATS_FILE_SIZE || size == PICKSTATS_V1_SIZE)
+	{
+		version = (size == PICKSTATS_FILE_SIZE) ? PICKSTATS_VERSION : PICKSTATS_V1_VERSION;
+		checksum_offset = (size == PICKSTATS_FILE_SIZE) ? PICKSTATS_CHECKSUM_OFFSET : PICKSTATS_V1_CHECKSUM_OFFSET;
+		if (memcmp(src, PICKSTATS_MAGIC, PICKSTATS_MAGIC_SIZE) != 0 ||
+			load_le16(src + 4) != version ||
+			load_le16(src + 6) != PICKSTATS_BYTE_ORDER ||
+			src[8] != PICKSTATS_FIELD_WIDTH || src[9] != PICKSTATS_FIELD_WIDTH ||
+			load_le16(src + 10) != size ||
+			load_le64(src + checksum_offset) != fnv1a64(src, checksum_offset))
 		{
-			perror(_(error_strings[PICKSTATS_READ_FAILED]));
-			return 4;
+			return -1;
 		}
-
-		nbytes=fread(&(stats->first_pick_time), sizeof(time_t), 1, file_ptr);
-		nbytes+=fread(&(stats->last_pick_time), sizeof(time_t), 1, file_ptr);
-		nbytes+=fread(&(stats->total_picks), sizeof(unsigned int), 1, file_ptr);
-
-
-	   
-		fclose(file_ptr);	
+		total = load_le64(src + 32);
+		stats->first_pick_time = (time_t)(int64_t)load_le64(src + 16);
+		stats->last_pick_time = (time_t)(int64_t)load_le64(src + 24);
+		stats->total_picks = total > UINT_MAX ? UINT_MAX : (unsigned int)total;
+		if (version == PICKSTATS_V1_VERSION)
+		{
+			return 1;
+		}
+		stats->journal_generation = load_le32(src + 12);
+		decode_rollups(src + PICKSTATS_ROLLUP_OFFSET, stats);
+		return 0;
 	}
-	else 
+	/* every build that wrote the raw layout ran on a little-endian host */
+	if (size == PICKSTATS_LEGACY_SIZE)
 	{
-		seed_xrp32((uint64_t)time(NULL));
-		
-		uint64_t value = rand_range(0, BRUSHES_PER_LIFETIME);
+		stats->first_pick_time = (time_t)(int64_t)load_le64(src);
+		stats->last_pick_time = (time_t)(int64_t)load_le64(src + 8);
+		stats->total_picks = load_le32(src + 16);
+		return 1;
+	}
+	if (size == PICKSTATS_LEGACY32_SIZE)
+	{
+		stats->first_pick_time = (time_t)(int32_t)load_le32(src);
+		stats->last_pick_time = (time_t)(int32_t)load_le32(src + 4);
+		stats->total_picks = load_le32(src + 8);
+		return 1;
+	}
+	return -1;
+}
 
-		if (value > UINT_MAX) {
-			
-			return 0; 
-		}
+/* Rollups, shared by pickstats and the stats store slots
 
-		stats->total_picks = (unsigned int)value;
-		
-		
-		stats->last_pick_time=time(NULL)-SECONDS_PER_DAY+opts->delta_hours*SECONDS_PER_HOUR;
-		
-		stats->first_pick_time = stats->last_pick_time;
+	0   i64 day of the newest daily bucket   8   u32 daily picks ring [32]
+	136 i64 week of week picks               144 u32 week picks
+	148 u32 reserved                         152 i64 month of the newest monthly bucket
+	160 u32 monthly picks ring [12]
+*/
+static void
+encode_rollups(const toothpaste_pick_stats_t* stats, unsigned char* dst)
+{
+	size_t k;
+	
+	memset(dst, 0, PICKSTATS_ROLLUP_SIZE);
+	store_le64(dst, (uint64_t)stats->rollup_day);
+	for (k = 0; k < ROLLUP_DAYS; k++)
+	{
+		store_le32(dst + 8 + 4 * k, stats->daily_picks[k]);
+	}
+	store_le64(dst + 136, (uint64_t)stats->rollup_week);
+	store_le32(dst + 144, stats->week_picks);
+	store_le64(dst + 152, (uint64_t)stats->rollup_month);
+	for (k = 0; k < ROLLUP_MONTHS; k++)
+	{
+		store_le32(dst + 160 + 4 * k, stats->monthly_picks[k]);
 	}
-	return nbytes;
 }
 
-static int
-list_available_toothpastes(toothpaste_pick_t* pick)
+static void
+decode_rollups(const unsigned char* src, toothpaste_pick_stats_t* stats)
 {
-	display_list(pick->where,pick);
-	return 0;
+	size_t k;
+	
+	stats->rollup_day = (int64_t)load_le64(src);
+	for (k = 0; k < ROLLUP_DAYS; k++)
+	{
+		stats->daily_picks[k] = load_le32(src + 8 + 4 * k);
+	}
+	stats->rollup_week = (int64_t)load_le64(src + 136);
+	stats->week_picks = load_le32(src + 144);
+	stats->rollup_month = (int64_t)load_le64(src + 152);
+	for (k = 0; k < ROLLUP_MONTHS; k++)
+	{
+		stats->monthly_picks[k] = load_le32(src + 160 + 4 * k);
+	}
 }
 
-static int
-write_counters(toothpaste_pick_stats_t stats,int fake_stats,toothpaste_pick_options_t* opts)
+static int64_t
+floor_div(int64_t a, int64_t b)
 {
-	FILE* file_ptr;
-	errno_t err;
-	if (!fake_stats)
+	int64_t q = a / b;
+	
+	if ((a % b != 0) && ((a < 0) != (b < 0)))
 	{
-		err = fopen_s(&file_ptr,opts->stats_file_path_final, "wb");
-		if (err != 0) 
-		{
-			perror(_(error_strings[PICKSTATS_WRITE_FAILED]));
-			return 3;
-		}
-		fwrite(&stats.first_pick_time, sizeof(time_t), 1, file_ptr);
-		fwrite(&stats.last_pick_time, sizeof(time_t), 1, file_ptr);
-		fwrite(&stats.total_picks, sizeof(unsigned int), 1, file_ptr);
-		fclose(file_ptr);
+		q--;
 	}
-	return 0;
+	return q;
 }
 
-static void 
-stop_system(void) 
+/* Proleptic Gregorian calendar over days since 1970-01-01, no gmtime needed */
+static int64_t
+days_from_civil(int64_t year, unsigned int month, unsigned int day)
 {
-    int c;
+	int64_t y = year - (month <= 2);
+	int64_t era = floor_div(y, 400);
+	int64_t yoe = y - era * 400;
+	int64_t mp = (int64_t)((month + 9) % 12);
+	int64_t doy = (153 * mp + 2) / 5 + (int64_t)day - 1;
+	int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
 	
-    printf("%s",_(user_strings[MSG_PAUSE]));
-    while ((c = getchar()) != EOF && c != '\n');
-    getchar(); 
+	return era * 146097 + doe - 719468;
+}
+
+static void
+civil_from_days(int64_t days, int64_t* year, unsigned int* month, unsigned int* day)
+{
+	int64_t z = days + 719468;
+	int64_t era = floor_div(z, 146097);
+	int64_t doe = z - era * 146097;
+	int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	int64_t mp = (5 * doy + 2) / 153;
+	unsigned int m = (unsigned int)(mp < 10 ? mp + 3 : mp - 9);
 	
-	return;
+	*year = yoe + era * 400 + (m <= 2);
+	*month = m;
+	*day = (unsigned int)(doy - (153 * mp + 2) / 5 + 1);
 }
 
-TPM int 
-tpm_free_toothpaste_pick(toothpaste_pick_t* pick)
+/* Counts a pick on day into the daily, weekly and monthly rollups, buckets
+   that slid out of their ring since the last pick are cleared on the way */
+static void
+record_rollup(toothpaste_pick_stats_t* stats, int64_t day)
 {
-	if (pick!=NULL)
-	{
-		free(pick->who);
-		free(pick->message);
-		free(pick->JSON);
-		free(pick->CSV);
-		free(pick->waste_report);
-		free_list(pick->where);
-		free_context(pick->opts);
-		return TPM_NO_ERROR;
-	}
-	else 
+	int64_t year;
+	unsigned int month;
+	unsigned int mday;
+	int64_t month_index;
+	int64_t week = floor_div(day + 3, COVERAGE_SHORT_DAYS);
+	int64_t k;
+	
+	if (day > stats->rollup_day)
+	{
+		for (k = stats->rollup_day + 1; k <= day && k - stats->rollup_day <= ROLLUP_DAYS; k++)
+		{
+			stats->daily_picks[(size_t)(k - floor_div(k, ROLLUP_DAYS) * ROLLUP_DAYS)] = 0;
+		}
+		if (day - stats->rollup_day > ROLLUP_DAYS)
+		{
+			memset(stats->daily_picks, 0, sizeof(stats->daily_picks));
+		}
+		stats->rollup_day = day;
+	}
+	if (stats->rollup_day - day < ROLLUP_DAYS)
+	{
+		stats->daily_picks[(size_t)(day - floor_div(day, ROLLUP_DAYS) * ROLLUP_DAYS)]++;
+	}
+	
+	if (week > stats->rollup_week)
+	{
+		stats->rollup_week = week;
+		stats->week_picks = 0;
+	}
+	if (week == stats->rollup_week)
+	{
+		stats->week_picks++;
+	}
+	
+	civil_from_days(day, &year, &month, &mday);
+	month_index = year * ROLLUP_MONTHS + (int64_t)month - 1;
+	if (month_index > stats->rollup_month)
+	{
+		for (k = stats->rollup_month + 1; k <= month_index && k - stats->rollup_month <= ROLLUP_MONTHS; k++)
+		{
+			stats->monthly_picks[(size_t)(k - floor_div(k, ROLLUP_MONTHS) * ROLLUP_MONTHS)] = 0;
+		}
+		if (month_index - stats->rollup_month > ROLLUP_MONTHS)
+		{
+			memset(stats->monthly_picks, 0, sizeof(stats->monthly_picks));
+		}
+		stats->rollup_month = month_index;
+	}
+	if (stats->rollup_month - month_index < ROLLUP_MONTHS)
+	{
+		stats->monthly_picks[(size_t)(month_index - floor_div(month_index, ROLLUP_MONTHS) * ROLLUP_MONTHS)]++;
+	}
+}
+
+/* Picks over the days days ending with day, at most ROLLUP_DAYS buckets */
+static uint32_t
+rollup_days(const toothpaste_pick_stats_t* stats, int64_t day, unsigned int days)
+{
+	uint32_t total = 0;
+	int64_t k;
+	
+	for (k = day - (int64_t)days + 1; k <= day; k++)
+	{
+		if (k <= stats->rollup_day && stats->rollup_day - k < ROLLUP_DAYS)
+		{
+			total += stats->daily_picks[(size_t)(k - floor_div(k, ROLLUP_DAYS) * ROLLUP_DAYS)];
+		}
+	}
+	return total;
+}
+
+static uint32_t
+rollup_months(const toothpaste_pick_stats_t* stats, int64_t from_month, int64_t to_month)
+{
+	uint32_t total = 0;
+	int64_t k;
+	
+	for (k = from_month; k <= to_month; k++)
+	{
+		if (k <= stats->rollup_month && stats->rollup_month - k < ROLLUP_MONTHS)
+		{
+			total += stats->monthly_picks[(size_t)(k - floor_div(k, ROLLUP_MONTHS) * ROLLUP_MONTHS)];
+		}
+	}
+	return total;
+}
+
+/* Same formula as the lifetime coverage, over a window of days */
+static unsigned int
+window_coverage(uint32_t picks, int64_t days, unsigned int brush_times_per_day)
+{
+	uint64_t percents;
+	
+	if (days < 1)
+	{
+		days = 1;
+	}
+	if (brush_times_per_day == 0)
+	{
+		brush_times_per_day = 1;
+	}
+	percents = ((uint64_t)TOTAL_PERCENTS * picks) / ((uint64_t)days * brush_times_per_day);
+	
+	return percents > TOTAL_PERCENTS ? TOTAL_PERCENTS : (unsigned int)percents;
+}
+
+/* Windows never reach back before the first pick */
+static void
+eval_rollup_coverage(toothpaste_pick_t* pick)
+{
+	const toothpaste_pick_stats_t* stats = &pick->stats;
+	unsigned int bpd = pick->opts->formula.brush_times_per_day;
+	int64_t day = (int64_t)pick->day;
+	int64_t tracked = day + 1;
+	int64_t year;
+	unsigned int month;
+	unsigned int mday;
+	int64_t year_days;
+	
+	if (stats->first_pick_time > 0)
+	{
+		tracked = day - floor_div((int64_t)stats->first_pick_time, SECONDS_PER_DAY) + 1;
+	}
+	civil_from_days(day, &year, &month, &mday);
+	year_days = day - days_from_civil(year, 1, 1) + 1;
+	
+	pick->coverage_short_percents = window_coverage(rollup_days(stats, day, COVERAGE_SHORT_DAYS),
+		tracked < COVERAGE_SHORT_DAYS ? tracked : COVERAGE_SHORT_DAYS, bpd);
+	pick->coverage_long_percents = window_coverage(rollup_days(stats, day, COVERAGE_LONG_DAYS),
+		tracked < COVERAGE_LONG_DAYS ? tracked : COVERAGE_LONG_DAYS, bpd);
+	pick->coverage_year_percents = window_coverage(rollup_months(stats, year * ROLLUP_MONTHS, year * ROLLUP_MONTHS + (int64_t)month - 1),
+		tracked < year_days ? tracked : year_days, bpd);
+	pick->picks_this_week = (stats->rollup_week == floor_div(day + 3, COVERAGE_SHORT_DAYS)) ? stats->week_picks : 0;
+	pick->picks_this_month = rollup_months(stats, year * ROLLUP_MONTHS + (int64_t)month - 1, year * ROLLUP_MONTHS + (int64_t)month - 1);
+}
+
+/* 0 when the stats must not be written back, a damaged pickstats that
+   could not be moved aside is never overwritten with empty stats */
+static size_t
+read_counters(toothpaste_pick_stats_t* stats,int fake_stats,toothpaste_pick_options_t* opts)
+{
+	FILE* file_ptr;
+	uint64_t buffer[PICKSTATS_FILE_SIZE / sizeof(uint64_t) + 1];
+	size_t nbytes=0;
+	int format;
+	errno_t err;
+	
+	memset(stats, 0, sizeof(toothpaste_pick_stats_t));
+	if (!fake_stats && opts->stats_store_path != NULL && opts->stats_store_path[0] != '\0')
+	{
+		int result = read_store_counters(stats, opts);
+		
+		if (result != TPM_NO_ERROR)
+		{
+			fprintf(stderr, "%s\n", _(error_strings[result == STATS_STORE_FULL ? STATS_STORE_FULL : PICKSTATS_READ_FAILED]));
+			return 4;
+		}
+		nbytes = 3;
+	}
+	else if (!fake_stats && journal_active(opts) && opts->journal.loaded)
+	{
+		*stats = opts->journal.stats;
+		nbytes = 3;
+	}
+	else if (!fake_stats)
+	{	
+		err = fopen_s(&file_ptr,opts->stats_file_path_final, "rb");
+		if (err != 0) 
+		{
+			perror(_(error_strings[PICKSTATS_READ_FAILED]));
+			replay_journal(stats, opts);
+			return 4;
+		}
+
+		/* one read of the whole file, one byte more tells a v1 file from a longer one */
+		nbytes=fread(buffer, 1, sizeof(buffer), file_ptr);
+		fclose(file_ptr);
+		
+		format = decode_pickstats((const unsigned char*)buffer, nbytes, stats);
+		if (format < 0)
+		{
+			/* kept for a look instead of written over, the next pick starts afresh */
+			char corrupt_path[2 * MAX_PATH];
+			int moved;
+			
+			snprintf(corrupt_path, sizeof(corrupt_path), "%s%s", opts->stats_file_path_final, corrupt_file_ext);
+#if defined(_WIN32) || defined(_WIN64)
+			moved = MoveFileExA(opts->stats_file_path_final, corrupt_path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+			moved = rename(opts->stats_file_path_final, corrupt_path) == 0;
+#endif
+			fprintf(stderr, "%s: %s\n", _(error_strings[PICKSTATS_READ_FAILED]),
+				moved ? corrupt_path : opts->stats_file_path_final);
+			memset(stats, 0, sizeof(toothpaste_pick_stats_t));
+			if (!moved)
+			{
+				return 0;
+			}
+			replay_journal(stats, opts);
+			return 4;
+		}
+		if (format == 1)
+		{
+			write_file_counters(stats, opts);
+		}
+		replay_journal(stats, opts);
+		nbytes = 3;
+	}
+	else 
+	{
+		uint64_t value = 0;
+
+		if (draw_random(opts, 0, BRUSHES_PER_LIFETIME, &value) != TPM_NO_ERROR)
+		{
+			perror(_(error_strings[PICKSTATS_WRITE_FAILED]));
+			return 0;
+		}
+		if (value > UINT_MAX) {
+			
+			return 0; 
+		}
+
+		stats->total_picks = (unsigned int)value;
+		
+		
+		stats->last_pick_time=time(NULL)-SECONDS_PER_DAY+opts->delta_hours*SECONDS_PER_HOUR;
+		
+		stats->first_pick_time = stats->last_pick_time;
+		nbytes = 3;
+	}
+	return nbytes;
+}
+
+static int
+write_counters(toothpaste_pick_stats_t stats,int fake_stats,toothpaste_pick_options_t* opts)
+{
+	if (!fake_stats && opts->stats_store_path != NULL && opts->stats_store_path[0] != '\0')
+	{
+		int result = write_store_counters(&stats, opts);
+		
+		if (result != TPM_NO_ERROR)
+		{
+			fprintf(stderr, "%s\n", _(error_strings[result == STATS_STORE_FULL ? STATS_STORE_FULL : PICKSTATS_WRITE_FAILED]));
+			return 3;
+		}
+	}
+	else if (!fake_stats && journal_active(opts))
+	{
+		return journal_counters(&stats, opts);
+	}
+	else if (!fake_stats)
+	{
+		return write_file_counters(&stats, opts);
+	}
+	return 0;
+}
+
+static int
+write_file_counters(const toothpaste_pick_stats_t* stats, toothpaste_pick_options_t* opts)
+{
+	unsigned char record[PICKSTATS_FILE_SIZE];
+	
+	encode_pickstats(stats, record);
+	if (replace_file(opts->stats_file_path_final, record, sizeof(record), opts->stats_fsync) != TPM_NO_ERROR) 
+	{
+		perror(_(error_strings[PICKSTATS_WRITE_FAILED]));
+		return 3;
+	}
+	return 0;
+}
+
+/* Advisory lock on a side file, the stats file itself gets replaced by rename
+   so it cannot carry the lock. With STATS_STORE only the user's slot is locked,
+   with STATS_JOURNAL the lock is kept until tpm_flush_stats() and the caller
+   gets nothing to release. Runs without a lock when none can be taken */
+static stats_lock_t
+lock_stats(toothpaste_pick_options_t* opts)
+{
+	if (opts->stats_store_path != NULL && opts->stats_store_path[0] != '\0')
+	{
+		open_user_stats_store(opts);
+		return opts->stats_store;
+	}
+	if (journal_active(opts))
+	{
+		if (opts->journal.lock == STATS_NO_LOCK)
+		{
+			opts->journal.lock = lock_stats_file(opts);
+		}
+		return STATS_NO_LOCK;
+	}
+	return lock_stats_file(opts);
+}
+
+static stats_lock_t
+lock_stats_file(toothpaste_pick_options_t* opts)
+{
+	char path[2 * MAX_PATH];
+	
+	snprintf(path, sizeof(path), "%s%s", opts->stats_file_path_final, stats_lock_file_ext);
+	return lock_file_path(path);
+}
+
+/* Exclusive advisory lock on the file at path, created when missing */
+static stats_lock_t
+lock_file_path(const char* path)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	OVERLAPPED overlapped = {0};
+	HANDLE lock;
+	
+	lock = CreateFileA(path, GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (lock == INVALID_HANDLE_VALUE)
+	{
+		return STATS_NO_LOCK;
+	}
+	if (!LockFileEx(lock, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped))
+	{
+		CloseHandle(lock);
+		return STATS_NO_LOCK;
+	}
+	return lock;
+#elif defined(__wasi__)
+	(void)path;
+	return STATS_NO_LOCK;
+#else
+	int lock;
+	
+	lock = open(path, O_RDWR | O_CREAT, 0644);
+	if (lock < 0)
+	{
+		return STATS_NO_LOCK;
+	}
+	while (flock(lock, LOCK_EX) != 0)
+	{
+		if (errno != EINTR)
+		{
+			close(lock);
+			return STATS_NO_LOCK;
+		}
+	}
+	return lock;
+#endif
+}
+
+static void
+unlock_stats(toothpaste_pick_options_t* opts, stats_lock_t lock)
+{
+	if (lock == STATS_NO_LOCK)
+	{
+		return;
+	}
+	if (opts->stats_store_path != NULL && opts->stats_store_path[0] != '\0')
+	{
+		close_stats_store(opts);
+		return;
+	}
+	unlock_stats_file(lock);
+}
+
+static void
+unlock_stats_file(stats_lock_t lock)
+{
+	if (lock == STATS_NO_LOCK)
+	{
+		return;
+	}
+#if defined(_WIN32) || defined(_WIN64)
+	{
+		OVERLAPPED overlapped = {0};
+		UnlockFileEx(lock, 0, 1, 0, &overlapped);
+		CloseHandle(lock);
+	}
+#elif !defined(__wasi__)
+	flock(lock, LOCK_UN);
+	close(lock);
+#else
+	(void)lock;
+#endif
+}
+
+/* Single file multi-user store, a header then fixed slots found by linear
+   probing from the username hash. Slots are claimed once and never moved so
+   a slot offset stays valid while its record lock is held
+
+	header  0 magic "TPMU"  4 u16 version  6 u16 byte order  8 u32 slots
+	        12 u32 slot size  56 u64 FNV-1a of bytes [0,56)
+	slot    0 u64 user hash  8 i64 first pick  16 i64 last pick
+	        24 u64 total picks  32 username, NUL padded  64 rollups
+
+   v1 slots were the first 64 bytes alone. Slots past the end of the file
+   read as empty, so a store starts as its header and grows as slots are claimed
+*/
+static int
+store_io(stats_lock_t file, uint64_t offset, void* data, size_t size, int write_flag)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	OVERLAPPED overlapped = {0};
+	DWORD done = 0;
+	BOOL ok;
+	
+	overlapped.Offset = (DWORD)(offset & 0xFFFFFFFFU);
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	if (write_flag)
+	{
+		ok = WriteFile(file, data, (DWORD)size, &done, &overlapped);
+	}
+	else
+	{
+		ok = ReadFile(file, data, (DWORD)size, &done, &overlapped);
+		if (ok && done < size)
+		{
+			memset((unsigned char*)data + done, 0, size - done);
+			done = (DWORD)size;
+		}
+	}
+	return (ok && done == size) ? TPM_NO_ERROR : PICKSTATS_READ_FAILED;
+#else
+	unsigned char* bytes = (unsigned char*)data;
+	size_t done = 0;
+	ssize_t n;
+	
+	while (done < size)
+	{
+		if (write_flag)
+		{
+			n = pwrite(file, bytes + done, size - done, (off_t)(offset + done));
+		}
+		else
+		{
+			n = pread(file, bytes + done, size - done, (off_t)(offset + done));
+		}
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n == 0 && !write_flag)
+		{
+			memset(bytes + done, 0, size - done);
+			break;
+		}
+		if (n <= 0)
+		{
+			return PICKSTATS_READ_FAILED;
+		}
+		done += (size_t)n;
+	}
+	return TPM_NO_ERROR;
+#endif
+}
+
+static int
+store_lock_range(stats_lock_t file, uint64_t offset, uint64_t size, int lock_flag)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	OVERLAPPED overlapped = {0};
+	
+	overlapped.Offset = (DWORD)(offset & 0xFFFFFFFFU);
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	if (lock_flag)
+	{
+		return LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, (DWORD)size, 0, &overlapped) ? 0 : -1;
+	}
+	return UnlockFileEx(file, 0, (DWORD)size, 0, &overlapped) ? 0 : -1;
+#elif defined(__wasi__)
+	(void)file;
+	(void)offset;
+	(void)size;
+	(void)lock_flag;
+	return 0;
+#else
+	struct flock fl;
+	
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = lock_flag ? F_WRLCK : F_UNLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = (off_t)offset;
+	fl.l_len = (off_t)size;
+	while (fcntl(file, F_SETLKW, &fl) != 0)
+	{
+		if (errno != EINTR)
+		{
+			return -1;
+		}
+	}
+	return 0;
+#endif
+}
+
+/* Nonzero when src starts with a sound store header of that version and slot size */
+static int
+check_store_header(const unsigned char* src, size_t size, uint16_t version, uint32_t slot_size)
+{
+	return size >= STATS_STORE_HEADER_SIZE &&
+		memcmp(src, STATS_STORE_MAGIC, PICKSTATS_MAGIC_SIZE) == 0 &&
+		load_le16(src + 4) == version &&
+		load_le16(src + 6) == PICKSTATS_BYTE_ORDER &&
+		load_le32(src + 12) == slot_size &&
+		load_le32(src + 8) != 0 && load_le32(src + 8) <= MAX_STATS_STORE_SLOTS &&
+		load_le64(src + STATS_STORE_CHECKSUM_OFFSET) == fnv1a64(src, STATS_STORE_CHECKSUM_OFFSET);
+}
+
+/* Creates the store, or migrates a v1 store with its slots in place and empty
+   rollups. Either way the new file is written aside and renamed over the old
+   one under the store's side lock, so a crash leaves the old file or the new
+   one and never a store without header. A file that is neither is left alone */
+static int
+build_stats_store(toothpaste_pick_options_t* opts)
+{
+	char lock_path[2 * MAX_PATH];
+	unsigned char header[STATS_STORE_HEADER_SIZE];
+	unsigned char* old_store = NULL;
+	unsigned char* image = NULL;
+	size_t old_size = 0;
+	size_t image_size = STATS_STORE_HEADER_SIZE;
+	size_t used = 0;
+	size_t n;
+	size_t k;
+	uint32_t slots = opts->stats_store_slots;
+	stats_lock_t lock;
+	FILE* file_ptr;
+	int result = TPM_NO_ERROR;
+	
+	snprintf(lock_path, sizeof(lock_path), "%s%s", opts->stats_store_path, stats_lock_file_ext);
+	lock = lock_file_path(lock_path);
+	
+	if (fopen_s(&file_ptr, opts->stats_store_path, "rb") == 0)
+	{
+		n = fread(header, 1, sizeof(header), file_ptr);
+		if (check_store_header(header, n, STATS_STORE_VERSION, STATS_STORE_SLOT_SIZE))
+		{
+			/* another run got here first */
+			fclose(file_ptr);
+			unlock_stats_file(lock);
+			return TPM_NO_ERROR;
+		}
+		if (check_store_header(header, n, STATS_STORE_V1_VERSION, STATS_STORE_V1_SLOT_SIZE))
+		{
+			slots = load_le32(header + 8);
+			old_size = (size_t)slots * STATS_STORE_V1_SLOT_SIZE;
+			old_store = calloc(old_size, 1);
+			if (old_store == NULL)
+			{
+				result = MALLOC_FAILED;
+			}
+			else
+			{
+				/* a short v1 file only lacks empty slots */
+				(void)fread(old_store, 1, old_size, file_ptr);
+			}
+		}
+		else
+		{
+			/* a header cut short or left zero by a crash while creating holds no slots */
+			for (k = 0; k < n && header[k] == 0; k++)
+			{
+			}
+			if (k < n)
+			{
+				result = PICKSTATS_READ_FAILED;
+			}
+		}
+		fclose(file_ptr);
+	}
+	
+	if (result == TPM_NO_ERROR)
+	{
+		for (k = 0; k < slots && old_store != NULL; k++)
+		{
+			if (load_le64(old_store + k * STATS_STORE_V1_SLOT_SIZE) != 0)
+			{
+				used = k + 1;
+			}
+		}
+		image_size += used * STATS_STORE_SLOT_SIZE;
+		image = calloc(image_size, 1);
+		if (image == NULL)
+		{
+			result = MALLOC_FAILED;
+		}
+	}
+	if (result == TPM_NO_ERROR)
+	{
+		memcpy(image, STATS_STORE_MAGIC, PICKSTATS_MAGIC_SIZE);
+		store_le16(image + 4, STATS_STORE_VERSION);
+		store_le16(image + 6, PICKSTATS_BYTE_ORDER);
+		store_le32(image + 8, slots);
+		store_le32(image + 12, STATS_STORE_SLOT_SIZE);
+		store_le64(image + STATS_STORE_CHECKSUM_OFFSET, fnv1a64(image, STATS_STORE_CHECKSUM_OFFSET));
+		for (k = 0; k < used; k++)
+		{
+			memcpy(image + STATS_STORE_HEADER_SIZE + k * STATS_STORE_SLOT_SIZE,
+				old_store + k * STATS_STORE_V1_SLOT_SIZE, STATS_STORE_V1_SLOT_SIZE);
+		}
+		result = replace_file(opts->stats_store_path, image, image_size, opts->stats_fsync);
+	}
+	
+	free(image);
+	free(old_store);
+	unlock_stats_file(lock);
+	return result;
+}
+
+/* Opens the store, creates or migrates it on first use and leaves the slot
+   of username locked in opts->stats_store until close_stats_store */
+static int
+open_stats_store(toothpaste_pick_options_t* opts, const char* username)
+{
+	unsigned char header[STATS_STORE_HEADER_SIZE];
+	unsigned char slot[STATS_STORE_SLOT_SIZE];
+	char name[STATS_STORE_NAME_SIZE];
+	stats_lock_t file;
+	uint64_t hash;
+	uint64_t offset = 0;
+	uint32_t slots;
+	uint32_t index;
+	uint32_t probe;
+	int attempt;
+	int result;
+	
+	if (opts->stats_store != STATS_NO_LOCK)
+	{
+		return TPM_NO_ERROR;
+	}
+	
+	for (attempt = 0; ; attempt++)
+	{
+#if defined(_WIN32) || defined(_WIN64)
+		file = CreateFileA(opts->stats_store_path, GENERIC_READ | GENERIC_WRITE,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+#else
+		file = open(opts->stats_store_path, O_RDWR);
+#endif
+		if (file != STATS_NO_LOCK)
+		{
+			if (store_io(file, 0, header, STATS_STORE_HEADER_SIZE, 0) == TPM_NO_ERROR &&
+				check_store_header(header, sizeof(header), STATS_STORE_VERSION, STATS_STORE_SLOT_SIZE))
+			{
+				break;
+			}
+#if defined(_WIN32) || defined(_WIN64)
+			CloseHandle(file);
+#else
+			close(file);
+#endif
+		}
+		if (attempt > 0)
+		{
+			return PICKSTATS_READ_FAILED;
+		}
+		result = build_stats_store(opts);
+		if (result != TPM_NO_ERROR)
+		{
+			return result == MALLOC_FAILED ? result : PICKSTATS_READ_FAILED;
+		}
+	}
+	slots = load_le32(header + 8);
+	
+	/* the slot keeps a prefix of the name for people reading the file, the
+	   hash covers all of it so names sharing that prefix stay apart */
+	memset(name, 0, sizeof(name));
+	strncpy_s(name, STATS_STORE_NAME_SIZE, username, STATS_STORE_NAME_SIZE - 1);
+	hash = fnv1a64(username, strlen(username));
+	if (hash == 0)
+	{
+		hash = 1;
+	}
+	
+	index = (uint32_t)(hash % slots);
+	for (probe = 0; probe < slots; probe++)
+	{
+		offset = STATS_STORE_HEADER_SIZE + (uint64_t)index * STATS_STORE_SLOT_SIZE;
+		if (store_lock_range(file, offset, STATS_STORE_SLOT_SIZE, 1) != 0 ||
+			store_io(file, offset, slot, STATS_STORE_SLOT_SIZE, 0) != TPM_NO_ERROR)
+		{
+			goto fail;
+		}
+		if (load_le64(slot) == 0)
+		{
+			memset(slot, 0, sizeof(slot));
+			store_le64(slot, hash);
+			memcpy(slot + 32, name, STATS_STORE_NAME_SIZE);
+			if (store_io(file, offset, slot, STATS_STORE_SLOT_SIZE, 1) != TPM_NO_ERROR)
+			{
+				store_lock_range(file, offset, STATS_STORE_SLOT_SIZE, 0);
+				goto fail;
+			}
+			break;
+		}
+		if (load_le64(slot) == hash && memcmp(slot + 32, name, STATS_STORE_NAME_SIZE) == 0)
+		{
+			break;
+		}
+		store_lock_range(file, offset, STATS_STORE_SLOT_SIZE, 0);
+		index = (index + 1) % slots;
+	}
+	if (probe == slots)
+	{
+#if defined(_WIN32) || defined(_WIN64)
+		CloseHandle(file);
+#else
+		close(file);
+#endif
+		return STATS_STORE_FULL;
+	}
+	
+	opts->stats_store = file;
+	opts->stats_store_offset = offset;
+	return TPM_NO_ERROR;
+	
+fail:
+#if defined(_WIN32) || defined(_WIN64)
+	CloseHandle(file);
+#else
+	close(file);
+#endif
+	return PICKSTATS_READ_FAILED;
+}
+
+/* open_stats_store for the user the options resolve to */
+static int
+open_user_stats_store(toothpaste_pick_options_t* opts)
+{
+	char username[UNLEN + 1];
+	
+	resolve_username(opts, username, sizeof(username));
+	return open_stats_store(opts, username);
+}
+
+static void
+close_stats_store(toothpaste_pick_options_t* opts)
+{
+	if (opts->stats_store == STATS_NO_LOCK)
+	{
+		return;
+	}
+	store_lock_range(opts->stats_store, opts->stats_store_offset, STATS_STORE_SLOT_SIZE, 0);
+#if defined(_WIN32) || defined(_WIN64)
+	CloseHandle(opts->stats_store);
+#else
+	close(opts->stats_store);
+#endif
+	opts->stats_store = STATS_NO_LOCK;
+}
+
+static int
+read_store_counters(toothpaste_pick_stats_t* stats, toothpaste_pick_options_t* opts)
+{
+	unsigned char fields[STATS_STORE_ROLLUP_OFFSET + PICKSTATS_ROLLUP_SIZE];
+	uint64_t total;
+	int opened = 0;
+	int result;
+	
+	if (opts->stats_store == STATS_NO_LOCK)
+	{
+		result = open_user_stats_store(opts);
+		if (result != TPM_NO_ERROR)
+		{
+			return result;
+		}
+		opened = 1;
+	}
+	result = store_io(opts->stats_store, opts->stats_store_offset, fields, sizeof(fields), 0);
+	if (result == TPM_NO_ERROR)
+	{
+		total = load_le64(fields + 24);
+		stats->first_pick_time = (time_t)(int64_t)load_le64(fields + 8);
+		stats->last_pick_time = (time_t)(int64_t)load_le64(fields + 16);
+		stats->total_picks = total > UINT_MAX ? UINT_MAX : (unsigned int)total;
+		decode_rollups(fields + STATS_STORE_ROLLUP_OFFSET, stats);
+	}
+	if (opened)
+	{
+		close_stats_store(opts);
+	}
+	return result;
+}
+
+/* Updated in place, the slot is only ever written under its record lock */
+static int
+write_store_counters(const toothpaste_pick_stats_t* stats, toothpaste_pick_options_t* opts)
+{
+	unsigned char fields[24];
+	unsigned char rollups[PICKSTATS_ROLLUP_SIZE];
+	int opened = 0;
+	int result;
+	
+	if (opts->stats_store == STATS_NO_LOCK)
+	{
+		result = open_user_stats_store(opts);
+		if (result != TPM_NO_ERROR)
+		{
+			return result == STATS_STORE_FULL ? result : PICKSTATS_WRITE_FAILED;
+		}
+		opened = 1;
+	}
+	store_le64(fields, (uint64_t)(int64_t)stats->first_pick_time);
+	store_le64(fields + 8, (uint64_t)(int64_t)stats->last_pick_time);
+	store_le64(fields + 16, stats->total_picks);
+	encode_rollups(stats, rollups);
+	result = store_io(opts->stats_store, opts->stats_store_offset + 8, fields, sizeof(fields), 1);
+	if (result == TPM_NO_ERROR)
+	{
+		result = store_io(opts->stats_store, opts->stats_store_offset + STATS_STORE_ROLLUP_OFFSET, rollups, sizeof(rollups), 1);
+	}
+	if (result == TPM_NO_ERROR && opts->stats_fsync)
+	{
+#if defined(_WIN32) || defined(_WIN64)
+		FlushFileBuffers(opts->stats_store);
+#else
+		fsync(opts->stats_store);
+#endif
+	}
+	if (opened)
+	{
+		close_stats_store(opts);
+	}
+	return result == TPM_NO_ERROR ? TPM_NO_ERROR : PICKSTATS_WRITE_FAILED;
+}
+
+/* Write a temp file next to path, optionally flush it to disk and rename it
+   over path, readers see either the old or the new content but never a torn one */
+static int
+replace_file(const char* path, const void* data, size_t size, int sync)
+{
+	char temp_path[2 * MAX_PATH];
+#if defined(_WIN32) || defined(_WIN64)
+	FILE* file_ptr;
+	errno_t err;
+	DWORD flags = MOVEFILE_REPLACE_EXISTING;
+	
+	snprintf(temp_path, sizeof(temp_path), "%s.%lu%s", path, (unsigned long)GetCurrentProcessId(), temp_file_ext);
+	err = fopen_s(&file_ptr, temp_path, "wb");
+	if (err != 0)
+	{
+		return PICKSTATS_WRITE_FAILED;
+	}
+	if (fwrite(data, 1, size, file_ptr) != size || fflush(file_ptr) != 0 ||
+		(sync && _commit(_fileno(file_ptr)) != 0))
+	{
+		fclose(file_ptr);
+		remove(temp_path);
+		return PICKSTATS_WRITE_FAILED;
+	}
+	if (fclose(file_ptr) != 0)
+	{
+		remove(temp_path);
+		return PICKSTATS_WRITE_FAILED;
+	}
+	if (sync)
+	{
+		flags |= MOVEFILE_WRITE_THROUGH;
+	}
+	if (!MoveFileExA(temp_path, path, flags))
+	{
+		remove(temp_path);
+		return PICKSTATS_WRITE_FAILED;
+	}
+#else
+	const unsigned char* bytes = (const unsigned char*)data;
+	size_t done = 0;
+	ssize_t n;
+	int fd;
+	
+#if defined(__wasi__)
+	snprintf(temp_path, sizeof(temp_path), "%s%s", path, temp_file_ext);
+#else
+	snprintf(temp_path, sizeof(temp_path), "%s.%ld%s", path, (long)getpid(), temp_file_ext);
+#endif
+	fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		return PICKSTATS_WRITE_FAILED;
+	}
+	while (done < size)
+	{
+		n = write(fd, bytes + done, size - done);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			break;
+		}
+		done += (size_t)n;
+	}
+	if (done != size || (sync && fsync(fd) != 0))
+	{
+		close(fd);
+		remove(temp_path);
+		return PICKSTATS_WRITE_FAILED;
+	}
+	if (close(fd) != 0 || rename(temp_path, path) != 0)
+	{
+		remove(temp_path);
+		return PICKSTATS_WRITE_FAILED;
+	}
+#if !defined(__wasi__)
+	if (sync)
+	{
+		/* the rename itself is only durable once the directory is synced */
+		char dir_path[2 * MAX_PATH];
+		char* slash;
+		
+		snprintf(dir_path, sizeof(dir_path), "%s", path);
+		slash = strrchr(dir_path, '/');
+		if (slash == dir_path)
+		{
+			slash[1] = '\0';
+		}
+		else if (slash != NULL)
+		{
+			*slash = '\0';
+		}
+		else
+		{
+			snprintf(dir_path, sizeof(dir_path), ".");
+		}
+		fd = open(dir_path, O_RDONLY);
+		if (fd >= 0)
+		{
+			fsync(fd);
+			close(fd);
+		}
+	}
+#endif
+#endif
+	return TPM_NO_ERROR;
+}
+
+static void
+store_le16(unsigned char* dst, uint16_t v)
+{
+	dst[0] = (unsigned char)(v & 0xFF);
+	dst[1] = (unsigned char)(v >> 8);
+}
+
+static void
+store_le32(unsigned char* dst, uint32_t v)
+{
+	store_le16(dst, (uint16_t)(v & 0xFFFF));
+	store_le16(dst + 2, (uint16_t)(v >> 16));
+}
+
+static void
+store_le64(unsigned char* dst, uint64_t v)
+{
+	store_le32(dst, (uint32_t)(v & 0xFFFFFFFFU));
+	store_le32(dst + 4, (uint32_t)(v >> 32));
+}
+
+/* Most significant byte first, as CBOR and MessagePack want it */
+static void
+store_be(unsigned char* dst, uint64_t v, size_t size)
+{
+	while (size > 0)
+	{
+		dst[--size] = (unsigned char)(v & 0xFFU);
+		v >>= 8;
+	}
+}
+
+static uint16_t
+load_le16(const unsigned char* src)
+{
+	return (uint16_t)(src[0] | (src[1] << 8));
+}
+
+static uint32_t
+load_le32(const unsigned char* src)
+{
+	return (uint32_t)load_le16(src) | ((uint32_t)load_le16(src + 2) << 16);
+}
+
+static uint64_t
+load_le64(const unsigned char* src)
+{
+	return (uint64_t)load_le32(src) | ((uint64_t)load_le32(src + 4) << 32);
+}
+
+/* The pick history lives next to the pickstats file */
+static void
+pick_log_path(toothpaste_pick_options_t* opts, char* dest, size_t size)
+{
+	snprintf(dest, size, "%s%s", opts->stats_file_path_final, pick_log_file_ext);
+}
+
+/* One little-endian record per counted pick, a single append sized write so
+   concurrent writers never interleave inside a record. With STATS_JOURNAL the
+   records wait for the next group commit */
+static int
+append_pick_log(toothpaste_pick_options_t* opts, const pick_log_record_t* record)
+{
+	char path[2 * MAX_PATH];
+	unsigned char buffer[PICK_LOG_RECORD_SIZE];
+	stats_journal_t* journal = &opts->journal;
+	
+	store_le64(buffer, (uint64_t)record->when);
+	store_le64(buffer + 8, record->user_hash);
+	store_le32(buffer + 16, record->toothpaste_index);
+	store_le16(buffer + 20, record->pick_type);
+	store_le16(buffer + 22, record->flags);
+	
+	if (journal_active(opts) && journal->log_pending != NULL)
+	{
+		if (journal->log_pending_records >= journal->commit_picks &&
+			commit_journal(opts) != TPM_NO_ERROR)
+		{
+			return PICKSTATS_WRITE_FAILED;
+		}
+		memcpy(journal->log_pending + (size_t)journal->log_pending_records * PICK_LOG_RECORD_SIZE,
+			buffer, PICK_LOG_RECORD_SIZE);
+		journal->log_pending_records++;
+		return TPM_NO_ERROR;
+	}
+	pick_log_path(opts, path, sizeof(path));
+	return append_file(path, buffer, PICK_LOG_RECORD_SIZE, opts->stats_fsync);
+}
+
+/* Opened for append on every call, whole batches go out in one write */
+static int
+append_file(const char* path, const void* data, size_t size, int sync)
+{
+	int result = TPM_NO_ERROR;
+#if defined(_WIN32) || defined(_WIN64)
+	DWORD written = 0;
+	HANDLE file;
+	
+	if (size > MAXDWORD)
+	{
+		return PICKSTATS_WRITE_FAILED;
+	}
+	file = CreateFileA(path, FILE_APPEND_DATA,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return PICKSTATS_WRITE_FAILED;
+	}
+	if (!WriteFile(file, data, (DWORD)size, &written, NULL) ||
+		written != size ||
+		(sync && !FlushFileBuffers(file)))
+	{
+		result = PICKSTATS_WRITE_FAILED;
+	}
+	CloseHandle(file);
+#else
+	const unsigned char* next = (const unsigned char*)data;
+	ssize_t written;
+	int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	
+	if (fd < 0)
+	{
+		return PICKSTATS_WRITE_FAILED;
+	}
+	while (size > 0)
+	{
+		written = write(fd, next, size);
+		if (written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (written <= 0)
+		{
+			result = PICKSTATS_WRITE_FAILED;
+			break;
+		}
+		next += written;
+		size -= (size_t)written;
+	}
+	if (result == TPM_NO_ERROR && sync && fsync(fd) != 0)
+	{
+		result = PICKSTATS_WRITE_FAILED;
+	}
+	close(fd);
+#endif
+	return result;
+}
+
+/* The journal only fronts the plain pickstats file */
+static int
+journal_active(const toothpaste_pick_options_t* opts)
+{
+	return opts->journal.enabled &&
+		(opts->stats_store_path == NULL || opts->stats_store_path[0] == '\0');
+}
+
+static void
+journal_path(toothpaste_pick_options_t* opts, char* dest, size_t size)
+{
+	snprintf(dest, size, "%s%s", opts->stats_file_path_final, journal_file_ext);
+}
+
+static void
+apply_journal_record(toothpaste_pick_stats_t* stats, uint32_t type, int64_t first, int64_t last, int64_t day)
+{
+	if (type & JOURNAL_FIRST_PICK)
+	{
+		stats->first_pick_time = (time_t)first;
+	}
+	if (type & JOURNAL_PICK)
+	{
+		stats->total_picks++;
+		stats->last_pick_time = (time_t)last;
+		record_rollup(stats, day);
+	}
+}
+
+static int
+same_counters(const toothpaste_pick_stats_t* a, const toothpaste_pick_stats_t* b)
+{
+	return a->first_pick_time == b->first_pick_time &&
+		a->last_pick_time == b->last_pick_time &&
+		a->total_picks == b->total_picks &&
+		a->rollup_day == b->rollup_day &&
+		a->rollup_week == b->rollup_week &&
+		a->week_picks == b->week_picks &&
+		a->rollup_month == b->rollup_month &&
+		memcmp(a->daily_picks, b->daily_picks, sizeof(a->daily_picks)) == 0 &&
+		memcmp(a->monthly_picks, b->monthly_picks, sizeof(a->monthly_picks)) == 0;
+}
+
+/* Layout of pickstats.wal, little-endian:
+   header  0 magic "TPMJ", 4 u16 version, 6 u16 record size,
+           8 u32 generation of the pickstats file it applies to, 12 reserved
+   record  0 u32 type, 4 i32 day, 8 i64 first pick, 16 i64 last pick,
+           24 u64 FNV-1a of bytes 0-23
+   Records stop at the first bad checksum, that is where a crash cut the tail.
+   A journal from an older generation was already checkpointed and is dropped.
+   With the journal switched off a leftover one is folded in and removed */
+static void
+replay_journal(toothpaste_pick_stats_t* stats, toothpaste_pick_options_t* opts)
+{
+	char path[2 * MAX_PATH];
+	unsigned char header[JOURNAL_HEADER_SIZE];
+	unsigned char record[JOURNAL_RECORD_SIZE];
+	stats_journal_t* journal = &opts->journal;
+	FILE* file_ptr;
+	unsigned int records = 0;
+	int clean = 0;
+	size_t nbytes;
+	
+	if (opts->stats_store_path != NULL && opts->stats_store_path[0] != '\0')
+	{
+		return;
+	}
+	journal_path(opts, path, sizeof(path));
+	if (fopen_s(&file_ptr, path, "rb") == 0)
+	{
+		if (fread(header, 1, sizeof(header), file_ptr) == sizeof(header) &&
+			memcmp(header, JOURNAL_MAGIC, PICKSTATS_MAGIC_SIZE) == 0 &&
+			load_le16(header + 4) == JOURNAL_VERSION &&
+			load_le16(header + 6) == JOURNAL_RECORD_SIZE &&
+			load_le32(header + 8) == stats->journal_generation)
+		{
+			clean = 1;
+			while ((nbytes = fread(record, 1, sizeof(record), file_ptr)) == sizeof(record) &&
+				load_le64(record + 24) == fnv1a64(record, 24))
+			{
+				apply_journal_record(stats, load_le32(record),
+					(int64_t)load_le64(record + 8), (int64_t)load_le64(record + 16),
+					(int64_t)(int32_t)load_le32(record + 4));
+				records++;
+			}
+			clean = (nbytes == 0);
+		}
+		fclose(file_ptr);
+		if (!journal->enabled)
+		{
+			if (records > 0)
+			{
+				stats->journal_generation++;
+				write_file_counters(stats, opts);
+			}
+			remove(path);
+			return;
+		}
+	}
+	else if (!journal->enabled)
+	{
+		return;
+	}
+	journal->stats = *stats;
+	journal->loaded = 1;
+	journal->pending_records = 0;
+	journal->disk_records = records;
+	journal->commit_time = time(NULL);
+	
+	/* appending behind a torn or stale tail would hide the new records */
+	if (!clean)
+	{
+		checkpoint_journal(stats, opts);
+	}
+}
+
+/* A new pick or a first pick date becomes one delta record, anything else
+   (reset, set, migration) is written straight through as a checkpoint */
+static int
+journal_counters(const toothpaste_pick_stats_t* stats, toothpaste_pick_options_t* opts)
+{
+	stats_journal_t* journal = &opts->journal;
+	toothpaste_pick_stats_t next;
+	unsigned char* record;
+	uint32_t type = 0;
+	
+	if (!journal->loaded)
+	{
+		read_counters(&next, 0, opts);
+	}
+	if (journal->pending == NULL)
+	{
+		journal->pending = (unsigned char*)malloc((size_t)journal->commit_picks * JOURNAL_RECORD_SIZE);
+		journal->log_pending = (unsigned char*)malloc((size_t)journal->commit_picks * PICK_LOG_RECORD_SIZE);
+		if (journal->pending == NULL || journal->log_pending == NULL)
+		{
+			free(journal->pending);
+			free(journal->log_pending);
+			journal->pending = NULL;
+			journal->log_pending = NULL;
+			return checkpoint_journal(stats, opts);
+		}
+	}
+	next = journal->stats;
+	if (stats->first_pick_time != next.first_pick_time)
+	{
+		type |= JOURNAL_FIRST_PICK;
+	}
+	if (stats->total_picks == next.total_picks + 1 && stats->rollup_day <= INT32_MAX && stats->rollup_day >= INT32_MIN)
+	{
+		type |= JOURNAL_PICK;
+	}
+	apply_journal_record(&next, type, (int64_t)stats->first_pick_time,
+		(int64_t)stats->last_pick_time, stats->rollup_day);
+	if (!same_counters(&next, stats))
+	{
+		return checkpoint_journal(stats, opts);
+	}
+	if (type == 0)
+	{
+		return 0;
+	}
+	if (journal->pending_records >= journal->commit_picks &&
+		commit_journal(opts) != TPM_NO_ERROR)
+	{
+		return 3;
+	}
+	record = journal->pending + (size_t)journal->pending_records * JOURNAL_RECORD_SIZE;
+	store_le32(record, type);
+	store_le32(record + 4, (uint32_t)(int32_t)stats->rollup_day);
+	store_le64(record + 8, (uint64_t)(int64_t)stats->first_pick_time);
+	store_le64(record + 16, (uint64_t)(int64_t)stats->last_pick_time);
+	store_le64(record + 24, fnv1a64(record, 24));
+	journal->pending_records++;
+	journal->stats = next;
+	
+	if (journal->pending_records >= journal->commit_picks ||
+		time(NULL) - journal->commit_time >= (time_t)journal->commit_seconds)
+	{
+		return commit_journal(opts);
+	}
+	return 0;
+}
+
+/* Group commit, one append and one sync for every record since the last one.
+   The pick history goes out right after, it is rebuilt from nothing on replay */
+static int
+commit_journal(toothpaste_pick_options_t* opts)
+{
+	char path[2 * MAX_PATH];
+	stats_journal_t* journal = &opts->journal;
+	int result = TPM_NO_ERROR;
+	
+	if (journal->pending_records > 0)
+	{
+		journal_path(opts, path, sizeof(path));
+		if (append_file(path, journal->pending, (size_t)journal->pending_records * JOURNAL_RECORD_SIZE,
+			opts->stats_fsync) != TPM_NO_ERROR)
+		{
+			perror(_(error_strings[PICKSTATS_WRITE_FAILED]));
+			return 3;
+		}
+		journal->disk_records += journal->pending_records;
+		journal->pending_records = 0;
+	}
+	if (journal->log_pending_records > 0)
+	{
+		pick_log_path(opts, path, sizeof(path));
+		result = append_file(path, journal->log_pending,
+			(size_t)journal->log_pending_records * PICK_LOG_RECORD_SIZE, opts->stats_fsync);
+		journal->log_pending_records = 0;
+	}
+	journal->commit_time = time(NULL);
+	if (journal->disk_records >= journal->checkpoint_picks)
+	{
+		return checkpoint_journal(&journal->stats, opts);
+	}
+	return result;
+}
+
+/* The pickstats file is replaced first under a new generation, so a crash
+   before the journal is emptied leaves a journal that replay ignores */
+static int
+checkpoint_journal(const toothpaste_pick_stats_t* stats, toothpaste_pick_options_t* opts)
+{
+	char path[2 * MAX_PATH];
+	unsigned char header[JOURNAL_HEADER_SIZE];
+	stats_journal_t* journal = &opts->journal;
+	toothpaste_pick_stats_t next = *stats;
+	
+	if (journal->log_pending_records > 0)
+	{
+		pick_log_path(opts, path, sizeof(path));
+		append_file(path, journal->log_pending,
+			(size_t)journal->log_pending_records * PICK_LOG_RECORD_SIZE, opts->stats_fsync);
+		journal->log_pending_records = 0;
+	}
+	next.journal_generation = journal->stats.journal_generation + 1;
+	if (write_file_counters(&next, opts) != 0)
+	{
+		return 3;
+	}
+	journal->stats = next;
+	journal->pending_records = 0;
+	journal->disk_records = 0;
+	journal->commit_time = time(NULL);
+	
+	memset(header, 0, sizeof(header));
+	memcpy(header, JOURNAL_MAGIC, PICKSTATS_MAGIC_SIZE);
+	store_le16(header + 4, JOURNAL_VERSION);
+	store_le16(header + 6, JOURNAL_RECORD_SIZE);
+	store_le32(header + 8, next.journal_generation);
+	journal_path(opts, path, sizeof(path));
+	if (replace_file(path, header, sizeof(header), opts->stats_fsync) != TPM_NO_ERROR)
+	{
+		perror(_(error_strings[PICKSTATS_WRITE_FAILED]));
+		return 3;
+	}
+	return 0;
+}
+
+/* Commits whatever the journal and the pick database still hold and lets go
+   of the stats lock, free_context() does it for every context */
+TPM int
+tpm_flush_stats(toothpaste_pick_options_t* opts)
+{
+	stats_journal_t* journal;
+	int result = TPM_NO_ERROR;
+	
+	if (opts == NULL)
+	{
+		return NULL_CONTEXT;
+	}
+	journal = &opts->journal;
+#ifdef HAVE_SQLITE
+	if (commit_pick_db(opts) != TPM_NO_ERROR)
+	{
+		result = PICKSTATS_WRITE_FAILED;
+	}
+#endif
+	if (!journal_active(opts))
+	{
+		return result;
+	}
+	if (journal->loaded && commit_journal(opts) != 0)
+	{
+		result = PICKSTATS_WRITE_FAILED;
+	}
+	unlock_stats_file(journal->lock);
+	journal->lock = STATS_NO_LOCK;
+	journal->loaded = 0;
+	return result;
+}
+
+#ifdef HAVE_SQLITE
+/* Same tables as pick.sql so the database can be queried next to an import
+   of the CSV output, the indexes serve the pick queries and history lookups */
+static const char pick_db_schema[] =
+	"PRAGMA journal_mode=WAL;"
+	"CREATE TABLE IF NOT EXISTS toothpastes ("
+	" id INTEGER, brand_string TEXT, tube_mass_g INTEGER, rating INTEGER);"
+	"CREATE TABLE IF NOT EXISTS picks ("
+	" username TEXT, pick_type TEXT, new_pick_flag INTEGER,"
+	" new_toothbrush_flag INTEGER, new_dentist_visit INTEGER,"
+	" toothpaste_brand TEXT, tube_mass_g INTEGER, toothpaste_rating INTEGER,"
+	" toothbrush_color TEXT, toothbrush_brand TEXT, toothbrush_length_cm INTEGER,"
+	" toothbrush_hardness INTEGER, toothpaste_index INTEGER, total_toothpastes INTEGER,"
+	" toothpaste_type TEXT, dental_formula TEXT, day_of_the_week TEXT,"
+	" day_counter INTEGER, total_picks INTEGER, last_pick_time INTEGER,"
+	" coverage_percent INTEGER, wasted_tubes_report TEXT,"
+	" toothpastes_file_path TEXT, meme_payload TEXT);"
+	"CREATE INDEX IF NOT EXISTS toothpastes_id ON toothpastes (id);"
+	"CREATE INDEX IF NOT EXISTS toothpastes_brand ON toothpastes (brand_string, id);"
+	"CREATE INDEX IF NOT EXISTS toothpastes_rating ON toothpastes (rating, id);"
+	"CREATE INDEX IF NOT EXISTS toothpastes_mass ON toothpastes (tube_mass_g, id);"
+	"CREATE INDEX IF NOT EXISTS picks_user_time ON picks (username, last_pick_time);";
+
+/* One query per pick type in pick_type_t order, ?1 is the day or a position
+   and ?2 the brand. Positions count rows in id order, so ids with gaps pick
+   like the list does. Ties go to the lowest id like the list walks do */
+static const char* pick_db_queries[PICK_KEYED_RANDOM + 1] = {
+	"SELECT id FROM toothpastes ORDER BY id LIMIT 1 OFFSET ?1 % (SELECT COUNT(*) FROM toothpastes)",
+	"SELECT id FROM toothpastes ORDER BY id LIMIT 1 OFFSET ?1",
+	"SELECT id FROM toothpastes ORDER BY id LIMIT 1 OFFSET min(?1, (SELECT COUNT(*) FROM toothpastes) - 1)",
+	"SELECT id FROM toothpastes WHERE brand_string = ?2 ORDER BY id LIMIT 1",
+	"SELECT id FROM toothpastes WHERE rating = (SELECT MAX(rating) FROM toothpastes) ORDER BY id LIMIT 1",
+	"SELECT id FROM toothpastes WHERE tube_mass_g = (SELECT MAX(tube_mass_g) FROM toothpastes) ORDER BY id LIMIT 1",
+	"SELECT id FROM toothpastes ORDER BY rating, id LIMIT 1",
+	"SELECT id FROM toothpastes ORDER BY tube_mass_g, id LIMIT 1",
+	"SELECT id FROM toothpastes ORDER BY id LIMIT 1 OFFSET ?1"
+};
+
+static int
+pick_db_error(toothpaste_pick_options_t* opts, int code)
+{
+	fprintf(stderr, "%s: %s\n", _(error_strings[code]),
+		(opts->pick_db != NULL && opts->pick_db->db != NULL) ? sqlite3_errmsg(opts->pick_db->db) : opts->pick_db_path);
+	return code;
+}
+
+/* Opens PICK_DB, creates the tables and prepares every statement once */
+TPM int
+tpm_open_pick_db(toothpaste_pick_options_t* opts)
+{
+	pick_db_t* pdb;
+	size_t k;
+	
+	if (opts == NULL)
+	{
+		return NULL_CONTEXT;
+	}
+	if (opts->pick_db != NULL)
+	{
+		return TPM_NO_ERROR;
+	}
+	if (opts->pick_db_path == NULL || opts->pick_db_path[0] == '\0')
+	{
+		return INVALID_ARGUMENT;
+	}
+	pdb = (pick_db_t*)calloc(1, sizeof(pick_db_t));
+	if (pdb == NULL)
+	{
+		return MALLOC_FAILED;
+	}
+	opts->pick_db = pdb;
+	if (sqlite3_open_v2(opts->pick_db_path, &pdb->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK ||
+		sqlite3_busy_timeout(pdb->db, 5000) != SQLITE_OK ||
+		sqlite3_exec(pdb->db, pick_db_schema, NULL, NULL, NULL) != SQLITE_OK ||
+		sqlite3_prepare_v2(pdb->db,
+			"INSERT INTO picks (username, pick_type, new_pick_flag, new_toothbrush_flag,"
+			" new_dentist_visit, toothpaste_brand, tube_mass_g, toothpaste_rating,"
+			" toothbrush_color, toothbrush_brand, toothbrush_length_cm, toothbrush_hardness,"
+			" toothpaste_index, total_toothpastes, toothpaste_type, dental_formula,"
+			" day_of_the_week, day_counter, total_picks, last_pick_time, coverage_percent,"
+			" wasted_tubes_report, toothpastes_file_path, meme_payload)"
+			" VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12,"
+			" ?13, ?14, ?15, ?16, ?17, ?18, ?19, ?20, ?21, ?22, ?23, ?24)",
+			-1, &pdb->insert_pick, NULL) != SQLITE_OK ||
+		sqlite3_prepare_v2(pdb->db,
+			"INSERT INTO toothpastes (id, brand_string, tube_mass_g, rating) VALUES (?1, ?2, ?3, ?4)",
+			-1, &pdb->insert_toothpaste, NULL) != SQLITE_OK ||
+		sqlite3_prepare_v2(pdb->db,
+			"SELECT COUNT(*) FROM picks WHERE username = ?1 AND last_pick_time >= ?2 AND new_pick_flag = 1",
+			-1, &pdb->count_picks, NULL) != SQLITE_OK ||
+		sqlite3_prepare_v2(pdb->db, "SELECT COUNT(*) FROM toothpastes", -1, &pdb->count_toothpastes, NULL) != SQLITE_OK)
+	{
+		pick_db_error(opts, PICKSTATS_READ_FAILED);
+		tpm_close_pick_db(opts);
+		return PICKSTATS_READ_FAILED;
+	}
+	for (k = 0; k <= PICK_KEYED_RANDOM; k++)
+	{
+		if (sqlite3_prepare_v2(pdb->db, pick_db_queries[k], -1, &pdb->select_toothpaste[k], NULL) != SQLITE_OK)
+		{
+			pick_db_error(opts, PICKSTATS_READ_FAILED);
+			tpm_close_pick_db(opts);
+			return PICKSTATS_READ_FAILED;
+		}
+	}
+	return TPM_NO_ERROR;
+}
+
+/* The catalog is rewritten in one transaction only when its checksum, kept
+   in user_version, no longer matches the loaded list */
+static int
+sync_pick_db_catalog(toothpaste_pick_options_t* opts, list_node_t* head)
+{
+	pick_db_t* pdb = opts->pick_db;
+	list_node_t* current;
+	uint64_t hash = FNV1A64_OFFSET_BASIS;
+	sqlite3_stmt* version;
+	char pragma[64];
+	int result = SQLITE_OK;
+	
+	for (current = head; current != NULL; current = current->next)
+	{
+		uint32_t fields[3];
+		
+		fields[0] = current->data.index;
+		fields[1] = current->data.tube_mass_g;
+		fields[2] = current->data.rating;
+		hash = (hash ^ fnv1a64(fields, sizeof(fields))) * FNV1A64_PRIME;
+		if (current->data.toothpaste_brand != NULL)
+		{
+			hash = (hash ^ fnv1a64(current->data.toothpaste_brand, strlen(current->data.toothpaste_brand))) * FNV1A64_PRIME;
+		}
+	}
+	hash &= 0x7FFFFFFFU;
+	if (sqlite3_prepare_v2(pdb->db, "PRAGMA user_version", -1, &version, NULL) == SQLITE_OK)
+	{
+		if (sqlite3_step(version) == SQLITE_ROW && (uint64_t)sqlite3_column_int64(version, 0) == hash)
+		{
+			pdb->catalog_synced = 1;
+		}
+		sqlite3_finalize(version);
+	}
+	if (pdb->catalog_synced)
+	{
+		return TPM_NO_ERROR;
+	}
+	if (commit_pick_db(opts) != TPM_NO_ERROR ||
+		sqlite3_exec(pdb->db, "BEGIN IMMEDIATE; DELETE FROM toothpastes;", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		return pick_db_error(opts, PICKSTATS_WRITE_FAILED);
+	}
+	for (current = head; current != NULL && result == SQLITE_OK; current = current->next)
+	{
+		sqlite3_bind_int64(pdb->insert_toothpaste, 1, current->data.index);
+		sqlite3_bind_text(pdb->insert_toothpaste, 2, current->data.toothpaste_brand, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(pdb->insert_toothpaste, 3, current->data.tube_mass_g);
+		sqlite3_bind_int64(pdb->insert_toothpaste, 4, current->data.rating);
+		result = sqlite3_step(pdb->insert_toothpaste) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+		sqlite3_reset(pdb->insert_toothpaste);
+	}
+	snprintf(pragma, sizeof(pragma), "PRAGMA user_version=%" PRIu64 ";", hash);
+	if (result != SQLITE_OK ||
+		sqlite3_exec(pdb->db, pragma, NULL, NULL, NULL) != SQLITE_OK ||
+		sqlite3_exec(pdb->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		pick_db_error(opts, PICKSTATS_WRITE_FAILED);
+		sqlite3_exec(pdb->db, "ROLLBACK", NULL, NULL, NULL);
+		return PICKSTATS_WRITE_FAILED;
+	}
+	pdb->catalog_synced = 1;
+	return TPM_NO_ERROR;
+}
+
+/* The same fields as the CSV line, batched PICK_DB_BATCH rows per transaction.
+   A batch is also committed once it has been open PICK_DB_BATCH_SECONDS, so
+   a long running caller never keeps other writers out until it exits */
+static int
+record_pick_db(toothpaste_pick_t* pick, list_node_t* head, int new_pick_flag, int toothbrush_flag, int dentist_flag, unsigned int index)
+{
+	toothpaste_pick_options_t* topts = pick->opts;
+	pick_db_t* pdb;
+	sqlite3_stmt* insert;
+	char formula[64];
+	int result;
+	
+	if (tpm_open_pick_db(topts) != TPM_NO_ERROR)
+	{
+		return PICKSTATS_WRITE_FAILED;
+	}
+	pdb = topts->pick_db;
+	if (!pdb->catalog_synced && sync_pick_db_catalog(topts, head) != TPM_NO_ERROR)
+	{
+		return PICKSTATS_WRITE_FAILED;
+	}
+	if (pdb->pending_picks == 0)
+	{
+		if (sqlite3_exec(pdb->db, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK)
+		{
+			return pick_db_error(topts, PICKSTATS_WRITE_FAILED);
+		}
+		pdb->batch_start = time(NULL);
+	}
+	snprintf(formula, sizeof(formula), "%u-%u-%u-%u",
+		topts->formula.brush_times_per_day, topts->formula.minutes_per_brush,
+		topts->formula.swap_toothbrush_times_per_year, topts->formula.visit_dentist_times_per_year);
+	
+	insert = pdb->insert_pick;
+	sqlite3_bind_text(insert, 1, pick->who, -1, SQLITE_STATIC);
+	sqlite3_bind_text(insert, 2, pick_type_strings[topts->ptype], -1, SQLITE_STATIC);
+	sqlite3_bind_int(insert, 3, new_pick_flag);
+	sqlite3_bind_int(insert, 4, toothbrush_flag);
+	sqlite3_bind_int(insert, 5, dentist_flag);
+	sqlite3_bind_text(insert, 6, pick->what.toothpaste_brand, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(insert, 7, pick->what.tube_mass_g);
+	sqlite3_bind_int64(insert, 8, pick->what.rating);
+	sqlite3_bind_text(insert, 9, pick->what.toothbrush_color, -1, SQLITE_STATIC);
+	sqlite3_bind_text(insert, 10, pick->what.toothbrush_brand, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(insert, 11, pick->what.toothbrush_length_cm);
+	sqlite3_bind_int64(insert, 12, pick->what.toothbrush_hardness);
+	sqlite3_bind_int64(insert, 13, index);
+	sqlite3_bind_int64(insert, 14, pick->total_toothpastes);
+	sqlite3_bind_text(insert, 15, toothpaste_type_strings[pick->what.type], -1, SQLITE_STATIC);
+	sqlite3_bind_text(insert, 16, formula, -1, SQLITE_STATIC);
+	sqlite3_bind_text(insert, 17, days_of_week[pick->j], -1, SQLITE_STATIC);
+	sqlite3_bind_int64(insert, 18, (sqlite3_int64)pick->day);
+	sqlite3_bind_int64(insert, 19, pick->stats.total_picks);
+	sqlite3_bind_int64(insert, 20, (sqlite3_int64)pick->stats.last_pick_time);
+	sqlite3_bind_int64(insert, 21, pick->coverage_percents);
+	sqlite3_bind_text(insert, 22, eval_waste_report(pick), -1, SQLITE_STATIC);
+	sqlite3_bind_text(insert, 23, topts->toothpastes_file_path_final, -1, SQLITE_STATIC);
+	sqlite3_bind_text(insert, 24, topts->meme_payload, -1, SQLITE_STATIC);
+	result = sqlite3_step(insert);
+	sqlite3_reset(insert);
+	sqlite3_clear_bindings(insert);
+	if (result != SQLITE_DONE)
+	{
+		return pick_db_error(topts, PICKSTATS_WRITE_FAILED);
+	}
+	pdb->pending_picks++;
+	if (pdb->pending_picks >= topts->pick_db_batch ||
+		time(NULL) - pdb->batch_start >= PICK_DB_BATCH_SECONDS)
+	{
+		return commit_pick_db(topts);
+	}
+	return TPM_NO_ERROR;
+}
+
+static int
+commit_pick_db(toothpaste_pick_options_t* opts)
+{
+	pick_db_t* pdb = opts->pick_db;
+	
+	if (pdb == NULL || pdb->pending_picks == 0)
+	{
+		return TPM_NO_ERROR;
+	}
+	pdb->pending_picks = 0;
+	if (sqlite3_exec(pdb->db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		pick_db_error(opts, PICKSTATS_WRITE_FAILED);
+		sqlite3_exec(pdb->db, "ROLLBACK", NULL, NULL, NULL);
+		return PICKSTATS_WRITE_FAILED;
+	}
+	return TPM_NO_ERROR;
+}
+
+/* Answers the pick type in opts from the stored catalog the way
+   tpm_pick_toothpaste() picks from the list, day is days since the epoch */
+TPM int
+tpm_db_select_toothpaste(toothpaste_pick_options_t* opts, time_t day, unsigned int* index)
+{
+	sqlite3_stmt* select;
+	int result = PICKSTATS_READ_FAILED;
+	
+	if (opts == NULL || index == NULL)
+	{
+		return NULL_CONTEXT;
+	}
+	if ((unsigned int)opts->ptype > PICK_KEYED_RANDOM)
+	{
+		return INVALID_ARGUMENT;
+	}
+	if (tpm_open_pick_db(opts) != TPM_NO_ERROR)
+	{
+		return PICKSTATS_READ_FAILED;
+	}
+	select = opts->pick_db->select_toothpaste[opts->ptype];
+	if (opts->ptype == PICK_BY_INDEX)
+	{
+		sqlite3_bind_int64(select, 1, opts->pick_by_index_index);
+	}
+	else if (opts->ptype == PICK_KEYED_RANDOM || opts->ptype == PICK_RANDOM)
+	{
+		sqlite3_stmt* count = opts->pick_db->count_toothpastes;
+		char username[UNLEN + 1];
+		unsigned int total = 0;
+		uint64_t value = 0;
+		
+		if (sqlite3_step(count) == SQLITE_ROW)
+		{
+			total = (unsigned int)sqlite3_column_int64(count, 0);
+		}
+		sqlite3_reset(count);
+		if (total == 0)
+		{
+			return PICKSTATS_READ_FAILED;
+		}
+		/* the same generators as the list picks, the random one continuing
+		   the persisted stream */
+		if (opts->ptype == PICK_RANDOM)
+		{
+			if (draw_random(opts, 0, total, &value) != TPM_NO_ERROR)
+			{
+				return PICKSTATS_WRITE_FAILED;
+			}
+		}
+		else
+		{
+			resolve_username(opts, username, sizeof(username));
+			value = tpm_keyed_pick_index(username, day, total, opts->random_key);
+		}
+		sqlite3_bind_int64(select, 1, (sqlite3_int64)value);
+	}
+	else if (opts->ptype == PICK_BY_BRAND)
+	{
+		sqlite3_bind_text(select, 2, opts->brand_string, -1, SQLITE_STATIC);
+	}
+	else if (opts->ptype == PICK_DEFAULT)
+	{
+		sqlite3_bind_int64(select, 1, (sqlite3_int64)day);
+	}
+	if (sqlite3_step(select) == SQLITE_ROW)
+	{
+		*index = (unsigned int)sqlite3_column_int64(select, 0);
+		result = TPM_NO_ERROR;
+	}
+	sqlite3_reset(select);
+	sqlite3_clear_bindings(select);
+	return result;
+}
+
+/* New picks recorded for a user since a time, served from picks_user_time */
+TPM unsigned int
+tpm_db_count_picks(toothpaste_pick_options_t* opts, const char* username, time_t since)
+{
+	sqlite3_stmt* count;
+	unsigned int total = 0;
+	
+	if (opts == NULL || username == NULL || tpm_open_pick_db(opts) != TPM_NO_ERROR)
+	{
+		return 0;
+	}
+	count = opts->pick_db->count_picks;
+	sqlite3_bind_text(count, 1, username, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(count, 2, (sqlite3_int64)since);
+	if (sqlite3_step(count) == SQLITE_ROW)
+	{
+		total = (unsigned int)sqlite3_column_int64(count, 0);
+	}
+	sqlite3_reset(count);
+	sqlite3_clear_bindings(count);
+	return total;
+}
+
+/* Commits the open batch, safe to call on a context that never opened one */
+TPM int
+tpm_close_pick_db(toothpaste_pick_options_t* opts)
+{
+	pick_db_t* pdb;
+	int result;
+	size_t k;
+	
+	if (opts == NULL)
+	{
+		return NULL_CONTEXT;
+	}
+	pdb = opts->pick_db;
+	if (pdb == NULL)
+	{
+		return TPM_NO_ERROR;
+	}
+	result = commit_pick_db(opts);
+	sqlite3_finalize(pdb->insert_pick);
+	sqlite3_finalize(pdb->insert_toothpaste);
+	sqlite3_finalize(pdb->count_picks);
+	sqlite3_finalize(pdb->count_toothpastes);
+	for (k = 0; k <= PICK_KEYED_RANDOM; k++)
+	{
+		sqlite3_finalize(pdb->select_toothpaste[k]);
+	}
+	sqlite3_close(pdb->db);
+	free(pdb);
+	opts->pick_db = NULL;
+	return result;
+}
+#endif
+
+/* Maps the pick history read only, WASI has no mmap and reads it into memory.
+   A torn record left by a crash at the tail is ignored */
+TPM int
+tpm_open_pick_log(toothpaste_pick_options_t* opts, pick_log_t* log)
+{
+	char path[2 * MAX_PATH];
+	
+	if (opts == NULL || log == NULL)
+	{
+		return NULL_CONTEXT;
+	}
+	memset(log, 0, sizeof(pick_log_t));
+	pick_log_path(opts, path, sizeof(path));
+	
+#if defined(_WIN32) || defined(_WIN64)
+	{
+		LARGE_INTEGER file_size;
+		
+		log->file = CreateFileA(path, GENERIC_READ,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		log->mapping = NULL;
+		if (log->file == INVALID_HANDLE_VALUE)
+		{
+			return PICKSTATS_READ_FAILED;
+		}
+		if (!GetFileSizeEx(log->file, &file_size))
+		{
+			CloseHandle(log->file);
+			log->file = INVALID_HANDLE_VALUE;
+			return PICKSTATS_READ_FAILED;
+		}
+		log->size = (size_t)file_size.QuadPart;
+		if (log->size >= PICK_LOG_RECORD_SIZE)
+		{
+			log->mapping = CreateFileMappingA(log->file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (log->mapping != NULL)
+			{
+				log->records = (unsigned char*)MapViewOfFile(log->mapping, FILE_MAP_READ, 0, 0, 0);
+			}
+			if (log->records == NULL)
+			{
+				tpm_close_pick_log(log);
+				return PICKSTATS_READ_FAILED;
+			}
+			log->mapped = 1;
+		}
+	}
+#elif defined(__wasi__)
+	{
+		FILE* file_ptr;
+		unsigned char* buffer = NULL;
+		unsigned char* grown;
+		size_t capacity = 0;
+		size_t n;
+		errno_t err;
+		
+		err = fopen_s(&file_ptr, path, "rb");
+		if (err != 0)
+		{
+			return PICKSTATS_READ_FAILED;
+		}
+		do
+		{
+			if (log->size == capacity)
+			{
+				capacity = capacity ? capacity * 2 : OUTPUT_BLOCK_SIZE;
+				grown = realloc(buffer, capacity);
+				if (grown == NULL)
+				{
+					free(buffer);
+					fclose(file_ptr);
+					return MALLOC_FAILED;
+				}
+				buffer = grown;
+			}
+			n = fread(buffer + log->size, 1, capacity - log->size, file_ptr);
+			log->size += n;
+		}
+		while (n > 0);
+		fclose(file_ptr);
+		log->records = buffer;
+	}
+#else
+	{
+		struct stat st;
+		void* map;
+		int fd = open(path, O_RDONLY);
+		
+		if (fd < 0)
+		{
+			return PICKSTATS_READ_FAILED;
+		}
+		if (fstat(fd, &st) != 0)
+		{
+			close(fd);
+			return PICKSTATS_READ_FAILED;
+		}
+		log->size = (size_t)st.st_size;
+		if (log->size >= PICK_LOG_RECORD_SIZE)
+		{
+			map = mmap(NULL, log->size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map == MAP_FAILED)
+			{
+				close(fd);
+				log->size = 0;
+				return PICKSTATS_READ_FAILED;
+			}
+			log->records = (unsigned char*)map;
+			log->mapped = 1;
+		}
+		close(fd);
+	}
+#endif
+	log->total_records = log->size / PICK_LOG_RECORD_SIZE;
+	
+	return TPM_NO_ERROR;
+}
+
+TPM int
+tpm_get_pick_log_record(const pick_log_t* log, size_t i, pick_log_record_t* record)
+{
+	const unsigned char* src;
+	
+	if (log == NULL || record == NULL || i >= log->total_records)
+	{
+		return INVALID_ARGUMENT;
+	}
+	src = log->records + i * PICK_LOG_RECORD_SIZE;
+	record->when = (int64_t)load_le64(src);
+	record->user_hash = load_le64(src + 8);
+	record->toothpaste_index = load_le32(src + 16);
+	record->pick_type = load_le16(src + 20);
+	record->flags = load_le16(src + 22);
+	
+	return TPM_NO_ERROR;
+}
+
+/* Counted picks of username at or after since, NULL counts every user */
+TPM unsigned int
+tpm_count_logged_picks(const pick_log_t* log, const char* username, time_t since)
+{
+	uint64_t user_hash = 0;
+	unsigned int total = 0;
+	size_t i;
+	const unsigned char* src;
+	
+	if (log == NULL)
+	{
+		return 0;
+	}
+	if (username != NULL)
+	{
+		user_hash = fnv1a64(username, strlen(username));
+	}
+	for (i = 0; i < log->total_records; i++)
+	{
+		src = log->records + i * PICK_LOG_RECORD_SIZE;
+		if ((int64_t)load_le64(src) >= (int64_t)since &&
+			(username == NULL || load_le64(src + 8) == user_hash))
+		{
+			total++;
+		}
+	}
+	return total;
+}
+
+TPM int
+tpm_close_pick_log(pick_log_t* log)
+{
+	if (log == NULL)
+	{
+		return NULL_CONTEXT;
+	}
+#if defined(_WIN32) || defined(_WIN64)
+	if (log->records != NULL)
+	{
+		UnmapViewOfFile(log->records);
+	}
+	if (log->mapping != NULL)
+	{
+		CloseHandle(log->mapping);
+	}
+	if (log->file != INVALID_HANDLE_VALUE && log->file != NULL)
+	{
+		CloseHandle(log->file);
+	}
+	log->mapping = NULL;
+	log->file = INVALID_HANDLE_VALUE;
+#elif defined(__wasi__)
+	free(log->records);
+#else
+	if (log->mapped)
+	{
+		munmap(log->records, log->size);
+	}
+#endif
+	log->records = NULL;
+	log->total_records = 0;
+	log->size = 0;
+	log->mapped = 0;
+	
+	return TPM_NO_ERROR;
+}
+
+static void 
+stop_system(void) 
+{
+    int c;
+	
+    printf("%s",_(user_strings[MSG_PAUSE]));
+    while ((c = getchar()) != EOF && c != '\n');
+    getchar(); 
+	
+	return;
+}
+
+TPM int 
+tpm_free_toothpaste_pick(toothpaste_pick_t* pick)
+{
+	if (pick!=NULL)
+	{
+		free(pick->who);
+		free(pick->message);
+		free(pick->JSON);
+		free(pick->CSV);
+		free(pick->waste_report);
+		free_list(pick->where);
+		free_context(pick->opts);
+		return TPM_NO_ERROR;
+	}
+	else 
 	{
 		perror(_(error_strings[PICK_NULL]));
 		return PICK_NULL;
@@ -1422,13 +3858,171 @@ version_short(void)
 static void
 usage(char* prog_name)
 {
-	fprintf(stderr, "%s %s %s \n",user_strings[MSG_USAGE], prog_name, "[-awjCvxqlrUF] [-f dental-formula] [-c config_file] [-o pick output file] [-t stats file]"
-	"[-s total_picks value] [-p pick_type_value] [-i toothpaste_index] [-b brand_string [-z delta_hours] [-d delta_days]"
-	"[-m meme_payload] [-T output_template] [-L locale_code] [-I days_ago] [toothpastes_file]");
+	fprintf(stderr, "%s %s %s \n",user_strings[MSG_USAGE], prog_name, "[-awjCJvxkqlHrUF] [-f dental-formula] [-c config_file] [-o pick output file] [-t stats file]"
+	"[-s total_picks value] [-e output_format] [-p pick_type_value] [-i toothpaste_index] [-b brand_string [-z delta_hours] [-d delta_days]"
+	"[-m meme_payload] [-T output_template] [-L locale_code] [-I days_ago] [-S sort] [-O offset] [-N limit] [toothpastes_file]");
 	exit(EXIT_SUCCESS);
 	return;
 }
 
+/* the report walks the whole list, so it is only built when a field asks for it */
+static const char*
+eval_waste_report(toothpaste_pick_t* pick)
+{
+	toothpaste_pick_stats_t stats;
+	
+	if (pick->waste_report == NULL)
+	{
+		stats = pick->stats;
+		stats.total_picks = pick->waste_picks;
+		pick->waste_report = report_wasted_tubes(pick->head, &stats);
+	}
+	return (pick->waste_report != NULL) ? pick->waste_report : "";
+}
+
+/* Every field of the CSV row, plus the rollup coverage the CSV leaves out
+   to keep its historical 24 columns */
+static void
+record_write_pick(record_writer_t* w, toothpaste_pick_t* pick)
+{
+	toothpaste_pick_options_t* topts = pick->opts;
+	char formula[4 * RECORD_NUMBER_SIZE];
+	
+	snprintf(formula, sizeof(formula), "%u-%u-%u-%u",
+		topts->formula.brush_times_per_day, topts->formula.minutes_per_brush,
+		topts->formula.swap_toothbrush_times_per_year, topts->formula.visit_dentist_times_per_year);
+	record_begin(w, '{', PICK_RECORD_FIELDS);
+	record_field_string(w, "who", pick->who);
+	record_field_string(w, "pick_type", pick_type_strings[topts->ptype]);
+	record_field_bool(w, "new_pick", pick->new_pick_flag);
+	record_field_bool(w, "new_toothbrush", pick->toothbrush_flag);
+	record_field_bool(w, "dentist_visit", pick->dentist_flag);
+	record_field_string(w, "toothpaste", pick->what.toothpaste_brand);
+	record_field_uint(w, "tube_mass_g", pick->what.tube_mass_g);
+	record_field_uint(w, "rating", pick->what.rating);
+	record_field_string(w, "toothbrush_color", pick->what.toothbrush_color);
+	record_field_string(w, "toothbrush_brand", pick->what.toothbrush_brand);
+	record_field_uint(w, "toothbrush_length_cm", pick->what.toothbrush_length_cm);
+	record_field_uint(w, "toothbrush_hardness", pick->what.toothbrush_hardness);
+	record_field_uint(w, "toothpaste_index", pick->toothpaste_pick_index);
+	record_field_uint(w, "total_toothpastes", pick->total_toothpastes);
+	record_field_string(w, "toothpaste_type", toothpaste_type_strings[pick->what.type]);
+	record_field_string(w, "dental_formula", formula);
+	record_field_string(w, "day_of_the_week", days_of_week[pick->j]);
+	record_field_int(w, "day_counter", (intmax_t)pick->day);
+	record_field_uint(w, "total_picks", pick->stats.total_picks);
+	record_field_int(w, "last_pick_time", (intmax_t)pick->stats.last_pick_time);
+	record_field_uint(w, "coverage_percent", pick->coverage_percents);
+	if (w->format != OUTPUT_FORMAT_CSV)
+	{
+		record_field_uint(w, "coverage_7_days", pick->coverage_short_percents);
+		record_field_uint(w, "coverage_30_days", pick->coverage_long_percents);
+		record_field_uint(w, "coverage_this_year", pick->coverage_year_percents);
+		record_field_uint(w, "picks_this_week", pick->picks_this_week);
+		record_field_uint(w, "picks_this_month", pick->picks_this_month);
+	}
+	record_field_string(w, "tubes_wasted", eval_waste_report(pick));
+	record_field_string(w, "source", topts->toothpastes_file_path_final);
+	record_field_string(w, "meme", topts->meme_payload);
+	record_end(w, '}');
+}
+
+static int
+eval_pick_JSON(toothpaste_pick_t* pick)
+{
+	render_buffer_t out;
+	record_writer_t w;
+	
+	record_writer_init(&w, NULL, OUTPUT_FORMAT_JSON);
+	render_init(&out);
+	w.buffer = &out;
+	record_write_pick(&w, pick);
+	pick->JSON = render_detach(&out);
+	return (pick->JSON != NULL) ? TPM_NO_ERROR : MALLOC_FAILED;
+}
+
+static int
+eval_pick_CSV(toothpaste_pick_t* pick)
+{
+	render_buffer_t out;
+	record_writer_t w;
+	
+	record_writer_init(&w, NULL, OUTPUT_FORMAT_CSV);
+	render_init(&out);
+	w.buffer = &out;
+	record_write_pick(&w, pick);
+	pick->CSV = render_detach(&out);
+	return (pick->CSV != NULL) ? TPM_NO_ERROR : MALLOC_FAILED;
+}
+
+static void
+record_write_toothpaste(record_writer_t* w, const toothpaste_data_t* data)
+{
+	record_begin(w, '{', TOOTHPASTE_RECORD_FIELDS);
+	record_field_uint(w, "index", data->index);
+	record_field_string(w, "toothpaste", data->toothpaste_brand);
+	record_field_uint(w, "tube_mass_g", data->tube_mass_g);
+	record_field_uint(w, "rating", data->rating);
+	record_field_string(w, "toothpaste_type", toothpaste_type_strings[data->type]);
+	record_field_string(w, "toothbrush_color", data->toothbrush_color);
+	record_field_string(w, "toothbrush_brand", data->toothbrush_brand);
+	record_field_uint(w, "toothbrush_length_cm", data->toothbrush_length_cm);
+	record_field_uint(w, "toothbrush_hardness", data->toothbrush_hardness);
+	record_end(w, '}');
+}
+
+/* The user hash is hex text in JSON and CSV, it does not fit a JSON
+   double, CBOR and MessagePack carry it as a 64-bit integer */
+static void
+record_write_log_entry(record_writer_t* w, const pick_log_record_t* record)
+{
+	char user_hash[RECORD_NUMBER_SIZE];
+	
+	record_begin(w, '{', PICK_LOG_RECORD_FIELDS);
+	record_field_int(w, "when", (intmax_t)record->when);
+	if (RECORD_BINARY(w))
+	{
+		record_field_uint(w, "user_hash", record->user_hash);
+	}
+	else
+	{
+		snprintf(user_hash, sizeof(user_hash), "%016jx", (uintmax_t)record->user_hash);
+		record_field_string(w, "user_hash", user_hash);
+	}
+	record_field_uint(w, "toothpaste_index", record->toothpaste_index);
+	record_field_string(w, "pick_type", record->pick_type < TOTAL_PICK_TYPE_STRINGS ? pick_type_strings[record->pick_type] : NULL);
+	record_field_bool(w, "new_pick", (record->flags & PICK_LOG_NEW_PICK) != 0);
+	record_field_bool(w, "new_toothbrush", (record->flags & PICK_LOG_TOOTHBRUSH) != 0);
+	record_field_bool(w, "dentist_visit", (record->flags & PICK_LOG_DENTIST) != 0);
+	record_end(w, '}');
+}
+
+/* A CSV table starts with the field names, taken from an empty record */
+static void
+record_write_header(record_writer_t* w, int pick_log)
+{
+	toothpaste_data_t data;
+	pick_log_record_t record;
+	
+	if (w->format != OUTPUT_FORMAT_CSV)
+	{
+		return;
+	}
+	memset(&data, 0, sizeof(data));
+	memset(&record, 0, sizeof(record));
+	w->header = 1;
+	if (pick_log)
+	{
+		record_write_log_entry(w, &record);
+	}
+	else
+	{
+		record_write_toothpaste(w, &data);
+	}
+	record_line_end(w);
+	w->header = 0;
+}
+
 TPM int 
 tpm_get_toothpaste_picking_message(toothpaste_pick_t* pick, char** dest)
 {
@@ -1451,6 +4045,11 @@ tpm_get_toothpaste_picking_JSON(toothpaste_pick_t* pick, char** dest)
 		*dest = NULL;
 		return PICK_NULL;
 	}
+	if (pick->message != NULL && pick->JSON == NULL && eval_pick_JSON(pick) != TPM_NO_ERROR)
+	{
+		*dest = NULL;
+		return MALLOC_FAILED;
+	}
 	*dest = pick->JSON;
 	return TPM_NO_ERROR;
 }
@@ -1464,9 +4063,187 @@ tpm_get_toothpaste_picking_CSV(toothpaste_pick_t* pick, char** dest)
 		*dest=NULL;
 		return PICK_NULL;
 	}
+	if (pick->message != NULL && pick->CSV == NULL && eval_pick_CSV(pick) != TPM_NO_ERROR)
+	{
+		*dest = NULL;
+		return MALLOC_FAILED;
+	}
 	*dest = pick->CSV;
 	return TPM_NO_ERROR;
 }
+
+TPM int
+tpm_write_toothpaste_picking(toothpaste_pick_t* pick, FILE* out, output_format_t format)
+{
+	record_writer_t w;
+	
+	if (pick == NULL || pick->message == NULL)
+	{
+		perror(_(error_strings[PICK_NULL]));
+		return PICK_NULL;
+	}
+	if (record_writer_init(&w, out, format) != TPM_NO_ERROR)
+	{
+		return INVALID_ARGUMENT;
+	}
+	record_write_pick(&w, pick);
+	if (w.lines)
+	{
+		record_line_end(&w);
+	}
+	return w.failed ? LAST_PICK_WRITING_FAILED : TPM_NO_ERROR;
+}
+
+/* The same sort and window as the text listing, the binary array headers
+   count the rows of the window */
+TPM int
+tpm_write_toothpaste_list(list_node_t* head, const toothpaste_pick_options_t* opts, FILE* out, output_format_t format)
+{
+	record_writer_t w;
+	list_row_t* rows;
+	size_t count;
+	size_t i;
+	int result;
+	
+	result = select_list_rows(head, opts, &rows, &count);
+	if (result != TPM_NO_ERROR)
+	{
+		return result;
+	}
+	if (format == OUTPUT_FORMAT_ARROW || format == OUTPUT_FORMAT_ARROW_FILE)
+	{
+		result = arrow_write_catalog(rows, count, out, format == OUTPUT_FORMAT_ARROW_FILE);
+		free(rows);
+		return result;
+	}
+	if (record_writer_init(&w, out, format) != TPM_NO_ERROR)
+	{
+		free(rows);
+		return INVALID_ARGUMENT;
+	}
+	if (!w.lines)
+	{
+		record_begin(&w, '[', count);
+	}
+	record_write_header(&w, 0);
+	for (i = 0; i < count; i++)
+	{
+		record_write_toothpaste(&w, &rows[i].node->data);
+		if (w.lines)
+		{
+			record_line_end(&w);
+		}
+	}
+	if (!w.lines)
+	{
+		record_end(&w, ']');
+	}
+	free(rows);
+	return w.failed ? LAST_PICK_WRITING_FAILED : TPM_NO_ERROR;
+}
+
+/* Streams the text listing a row at a time, the same lines tpm -l always
+   printed so the output loads back as a toothpastes file */
+TPM int
+tpm_write_toothpaste_listing(list_node_t* head, toothpaste_pick_options_t* opts, FILE* out)
+{
+	list_row_t* rows;
+	const toothpaste_data_t* data;
+	char brand[MAX_TOOTHPASTE_LINE];
+	size_t count;
+	size_t i;
+	size_t k;
+	int result;
+	
+	if (opts == NULL || out == NULL)
+	{
+		return NULL_CONTEXT;
+	}
+	result = select_list_rows(head, opts, &rows, &count);
+	if (result != TPM_NO_ERROR)
+	{
+		return result;
+	}
+	fprintf(out, "%s \n", locale_strings(opts)->user[opts->enhanced_toothpastes ? MSG_ENHANCED_COMMENT : MSG_COMMENT]);
+	for (i = 0; i < count; i++)
+	{
+		data = &rows[i].node->data;
+		snprintf(brand, sizeof(brand), "%.120s", data->toothpaste_brand != NULL ? data->toothpaste_brand : "");
+		if (opts->upper_brands)
+		{
+			for (k = 0; brand[k] != '\0'; k++)
+			{
+				brand[k] = (char)toupper((unsigned char)brand[k]);
+			}
+		}
+		if (!opts->enhanced_toothpastes)
+		{
+			fprintf(out, "%d,%s,%d,%d\n", data->index, brand, data->tube_mass_g, data->rating);
+		}
+		else
+		{
+			fprintf(out, "%d,%s,%d,%d,%.30s,%.120s,%u,%u\n", data->index, brand, data->tube_mass_g, data->rating,
+				data->toothbrush_color != NULL ? data->toothbrush_color : "",
+				data->toothbrush_brand != NULL ? data->toothbrush_brand : "",
+				data->toothbrush_length_cm, data->toothbrush_hardness);
+		}
+	}
+	free(rows);
+	return ferror(out) ? LAST_PICK_WRITING_FAILED : TPM_NO_ERROR;
+}
+
+TPM int
+tpm_write_pick_log(const pick_log_t* log, FILE* out, output_format_t format)
+{
+	record_writer_t w;
+	pick_log_record_t record;
+	size_t readable = 0;
+	size_t i;
+	
+	if (log == NULL)
+	{
+		return NULL_CONTEXT;
+	}
+	if (format == OUTPUT_FORMAT_ARROW || format == OUTPUT_FORMAT_ARROW_FILE)
+	{
+		return arrow_write_history(log, out, format == OUTPUT_FORMAT_ARROW_FILE);
+	}
+	if (record_writer_init(&w, out, format) != TPM_NO_ERROR)
+	{
+		return INVALID_ARGUMENT;
+	}
+	if (!w.lines)
+	{
+		/* the binary array header is written first, so it counts only the
+		   records that will follow */
+		for (i = 0; i < log->total_records; i++)
+		{
+			if (tpm_get_pick_log_record(log, i, &record) == TPM_NO_ERROR)
+			{
+				readable++;
+			}
+		}
+		record_begin(&w, '[', readable);
+	}
+	record_write_header(&w, 1);
+	for (i = 0; i < log->total_records; i++)
+	{
+		if (tpm_get_pick_log_record(log, i, &record) != TPM_NO_ERROR)
+		{
+			continue;
+		}
+		record_write_log_entry(&w, &record);
+		if (w.lines)
+		{
+			record_line_end(&w);
+		}
+	}
+	if (!w.lines)
+	{
+		record_end(&w, ']');
+	}
+	return w.failed ? LAST_PICK_WRITING_FAILED : TPM_NO_ERROR;
+}
 /*[min,max)*/
 static uint64_t
 rand_range(uint64_t min, uint64_t max)
@@ -1495,6 +4272,194 @@ rand_range(uint64_t min, uint64_t max)
     return (r % range) + min;
 }
 
+static uint64_t
+fnv1a64(const void* data, size_t size)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	uint64_t h = FNV1A64_OFFSET_BASIS;
+	size_t i;
+	
+	for (i = 0; i < size; i++)
+	{
+		h ^= p[i];
+		h *= FNV1A64_PRIME;
+	}
+	return h;
+}
+
+/* Random pick for any (user, day) without sequential generator state so
+   schedules and replays get the same pick on every machine */
+TPM unsigned int
+tpm_keyed_pick_index(const char* username, time_t day, unsigned int total_toothpastes, const char* key)
+{
+	uint8_t derived_key[RANDOM_KEY_BYTES];
+	uint64_t user;
+	uint64_t limit;
+	uint64_t r;
+	uint64_t slot = 0;
+	const uint64_t max_slot = (uint64_t)KEYED_WORDS_PER_BLOCK << KEYED_BLOCKS_PER_DAY_SHIFT;
+	
+	if (total_toothpastes == 0)
+	{
+		return 0;
+	}
+	if (username == NULL)
+	{
+		username = user_strings[MSG_ANON];
+	}
+	if (key == NULL || key[0] == '\0')
+	{
+		key = DEFAULT_RANDOM_KEY;
+	}
+	
+	derive_key_xrp32(derived_key, key, strlen(key));
+	user = fnv1a64(username, strlen(username));
+	limit = UINT64_MAX - (UINT64_MAX % total_toothpastes);
+	
+	do
+	{
+		r = keyed_xrp32(derived_key, user, (uint64_t)day, slot++);
+	}
+	while (r >= limit && slot < max_slot);
+	
+	memset(derived_key, 0, sizeof(derived_key));
+	
+	return (unsigned int)(r % total_toothpastes);
+}
+
+/* Only used when there is no generator checkpoint to resume from */
+static uint64_t
+entropy_seed(void)
+{
+	uint64_t seed = 0;
+	
+#if defined(_WIN32) || defined(_WIN64)
+	unsigned int hi, lo;
+	
+	if (rand_s(&hi) == 0 && rand_s(&lo) == 0)
+	{
+		return ((uint64_t)hi << 32) | (uint64_t)lo;
+	}
+#else
+	FILE* file_ptr;
+	
+	if (fopen_s(&file_ptr, "/dev/urandom", "rb") == 0)
+	{
+		size_t n = fread(&seed, sizeof(seed), 1, file_ptr);
+		fclose(file_ptr);
+		if (n == 1 && seed != 0)
+		{
+			return seed;
+		}
+	}
+#endif
+	seed = (uint64_t)time(NULL);
+	seed ^= (uint64_t)clock() << 32;
+	seed ^= (uint64_t)(uintptr_t)&seed;
+	return fnv1a64(&seed, sizeof(seed));
+}
+
+/* The generator checkpoint lives next to the pickstats file */
+static void
+prng_state_path(toothpaste_pick_options_t* opts, char* dest, size_t size)
+{
+	snprintf(dest, size, "%s%s", opts->stats_file_path_final, prng_state_file_ext);
+}
+
+static int
+resume_prng(toothpaste_pick_options_t* opts)
+{
+	FILE* file_ptr;
+	char path[2 * MAX_PATH];
+	char magic[PRNG_STATE_MAGIC_SIZE];
+	unsigned char* state;
+	size_t size = save_xrp32(NULL, 0);
+	uint32_t stored_size = 0;
+	uint64_t checksum = 0;
+	int loaded = 0;
+	errno_t err;
+	
+	prng_state_path(opts, path, sizeof(path));
+	state = malloc(size);
+	
+	if (state != NULL)
+	{
+		err = fopen_s(&file_ptr, path, "rb");
+		if (err == 0)
+		{
+			if (fread(magic, PRNG_STATE_MAGIC_SIZE, 1, file_ptr) == 1 &&
+				memcmp(magic, PRNG_STATE_MAGIC, PRNG_STATE_MAGIC_SIZE) == 0 &&
+				fread(&stored_size, sizeof(stored_size), 1, file_ptr) == 1 &&
+				stored_size == (uint32_t)size &&
+				fread(state, size, 1, file_ptr) == 1 &&
+				fread(&checksum, sizeof(checksum), 1, file_ptr) == 1 &&
+				checksum == fnv1a64(state, size))
+			{
+				loaded = (load_xrp32(state, size) == 0);
+			}
+			fclose(file_ptr);
+		}
+		free(state);
+	}
+	
+	if (!loaded && !opts->prng_resumed)
+	{
+		seed_xrp32(entropy_seed());
+	}
+	opts->prng_resumed = 1;
+	return loaded;
+}
+
+static int
+checkpoint_prng(toothpaste_pick_options_t* opts)
+{
+	char path[2 * MAX_PATH];
+	unsigned char* record;
+	size_t size = save_xrp32(NULL, 0);
+	size_t record_size = PRNG_STATE_MAGIC_SIZE + sizeof(uint32_t) + size + sizeof(uint64_t);
+	uint32_t stored_size = (uint32_t)size;
+	uint64_t checksum;
+	int result;
+	
+	record = malloc(record_size);
+	if (record == NULL)
+	{
+		return MALLOC_FAILED;
+	}
+	memcpy(record, PRNG_STATE_MAGIC, PRNG_STATE_MAGIC_SIZE);
+	memcpy(record + PRNG_STATE_MAGIC_SIZE, &stored_size, sizeof(stored_size));
+	save_xrp32(record + PRNG_STATE_MAGIC_SIZE + sizeof(stored_size), size);
+	checksum = fnv1a64(record + PRNG_STATE_MAGIC_SIZE + sizeof(stored_size), size);
+	memcpy(record + PRNG_STATE_MAGIC_SIZE + sizeof(stored_size) + size, &checksum, sizeof(checksum));
+	
+	prng_state_path(opts, path, sizeof(path));
+	result = replace_file(path, record, record_size, opts->stats_fsync);
+	free(record);
+	
+	return result;
+}
+
+/* [min,max) continuing the persisted stream instead of reseeding every run.
+   The checkpoint is reloaded, advanced and saved under its own lock, so
+   overlapping runs never draw from the same state; it is separate from the
+   stats lock, which the pick may already hold */
+static int
+draw_random(toothpaste_pick_options_t* opts, uint64_t min, uint64_t max, uint64_t* value)
+{
+	char path[2 * MAX_PATH];
+	stats_lock_t lock;
+	int result;
+	
+	snprintf(path, sizeof(path), "%s%s%s", opts->stats_file_path_final, prng_state_file_ext, stats_lock_file_ext);
+	lock = lock_file_path(path);
+	resume_prng(opts);
+	*value = rand_range(min, max);
+	result = checkpoint_prng(opts);
+	unlock_stats_file(lock);
+	
+	return result;
+}
+
 static char *
 report_wasted_tubes(list_node_t *head, toothpaste_pick_stats_t *stats)
 {
@@ -1623,643 +4588,1966 @@ report_wasted_tubes(list_node_t *head, toothpaste_pick_stats_t *stats)
     return report;
 }
 
-static int
-eval_total_toothpastes(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts)
+static int
+eval_total_toothpastes(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts)
+{
+	if (topts==NULL || pick == NULL) return 1;
+	pick->total_toothpastes = count_list(pick->head);
+	if (0==pick->total_toothpastes) 
+	{
+			perror(_(error_strings[NO_TOOTHPASTES_LOADED]));
+	}
+	return 0;
+}
+
+
+static int
+eval_username(toothpaste_pick_t *pick, toothpaste_pick_options_t *topts)
+{
+    if (pick == NULL || topts == NULL)
+        return 1;
+
+    pick->who = malloc(UNLEN + 1);
+    if (pick->who == NULL)
+        return 1;
+
+    resolve_username(topts, pick->who, UNLEN + 1);
+
+    return 0;
+}
+
+/* Configured username, then the account name, then anonymous */
+static void
+resolve_username(toothpaste_pick_options_t* topts, char* dest, size_t size)
+{
+    char username[UNLEN + 1] = {0};
+    const char *source = NULL;
+
+    if (topts->username != NULL && topts->username[0] != '\0')
+    {
+        source = topts->username;
+    }
+    
+    else if (get_current_username(username, sizeof(username)) == 0)
+    {
+        source = username;
+    }
+    
+    else
+    {
+        source = user_strings[MSG_ANON];
+    }
+
+    strncpy_s(dest, size, source, size - 1);
+    dest[size - 1] = '\0';
+}
+
+
+/* Starts on the inline block, an ordinary pick never touches the heap here */
+static void
+render_init(render_buffer_t* out)
+{
+	out->data = out->inline_data;
+	out->size = sizeof(out->inline_data);
+	out->length = 0;
+	out->data[0] = '\0';
+}
+
+/* Makes room for extra bytes plus the terminator, doubling the capacity */
+static int
+render_reserve(render_buffer_t* out, size_t extra)
+{
+	size_t size = out->size;
+	char* grown;
+	
+	if (extra < out->size - out->length)
+	{
+		return TPM_NO_ERROR;
+	}
+	if (extra >= SIZE_MAX / 2 - out->length)
+	{
+		return MALLOC_FAILED;
+	}
+	while (size - out->length <= extra)
+	{
+		size *= 2;
+	}
+	if (out->data == out->inline_data)
+	{
+		grown = malloc(size);
+		if (grown != NULL)
+		{
+			memcpy(grown, out->data, out->length + 1);
+		}
+	}
+	else
+	{
+		grown = realloc(out->data, size);
+	}
+	if (grown == NULL)
+	{
+		return MALLOC_FAILED;
+	}
+	out->data = grown;
+	out->size = size;
+	return TPM_NO_ERROR;
+}
+
+/* Appends to the buffer, limit is the old per-field line size so a long
+   brand is cut exactly where it always was; SIZE_MAX keeps the whole text */
+static void
+render_printf(render_buffer_t* out, size_t limit, const char* format, ...)
+{
+	va_list args;
+	size_t avail = out->size - out->length;
+	size_t needed;
+	int written;
+	
+	if (limit <= 1)
+	{
+		return;
+	}
+	va_start(args, format);
+	written = vsnprintf(out->data + out->length, avail, format, args);
+	va_end(args);
+	if (written < 0)
+	{
+		out->data[out->length] = '\0';
+		return;
+	}
+	needed = (size_t)written < limit ? (size_t)written : limit - 1;
+	if (needed >= avail)
+	{
+		if (render_reserve(out, needed) == TPM_NO_ERROR)
+		{
+			va_start(args, format);
+			vsnprintf(out->data + out->length, needed + 1, format, args);
+			va_end(args);
+		}
+		else
+		{
+			needed = avail - 1;
+		}
+	}
+	out->length += needed;
+	out->data[out->length] = '\0';
+}
+
+/* Hands the text over as a heap string the caller frees */
+static char*
+render_detach(render_buffer_t* out)
+{
+	char* text;
+	
+	if (out->data != out->inline_data)
+	{
+		text = out->data;
+	}
+	else
+	{
+		text = malloc(out->length + 1);
+		if (text != NULL)
+		{
+			memcpy(text, out->data, out->length + 1);
+		}
+	}
+	render_init(out);
+	return text;
+}
+
+static void
+render_free(render_buffer_t* out)
+{
+	if (out->data != out->inline_data)
+	{
+		free(out->data);
+	}
+	render_init(out);
+}
+
+static void
+render_append(render_buffer_t* out, const char* data, size_t length)
+{
+	if (render_reserve(out, length) != TPM_NO_ERROR)
+	{
+		length = out->size - out->length - 1;
+	}
+	memcpy(out->data + out->length, data, length);
+	out->length += length;
+	out->data[out->length] = '\0';
+}
+
+static void
+record_emit(record_writer_t* w, const char* data, size_t length)
+{
+	if (w->buffer != NULL)
+	{
+		render_append(w->buffer, data, length);
+	}
+	else if (length > 0 && fwrite(data, 1, length, w->file) != length)
+	{
+		w->failed = 1;
+	}
+}
+
+/* Bytes below 0x20, the quote and the backslash need escaping, everything
+   else (UTF-8 included) is copied through */
+#define JSON_ONES 0x0101010101010101ULL
+#define JSON_HIGHS 0x8080808080808080ULL
+#define JSON_HAS_ZERO(x) (((x) - JSON_ONES) & ~(x) & JSON_HIGHS)
+#define JSON_HAS_LESS(x, n) (((x) - JSON_ONES * (n)) & ~(x) & JSON_HIGHS)
+
+/* Length of the leading run that needs no escaping, eight bytes at a time */
+static size_t
+json_safe_run(const char* s, size_t length)
+{
+	uint64_t word;
+	size_t i = 0;
+	unsigned char c;
+	
+	while (i + sizeof(word) <= length)
+	{
+		memcpy(&word, s + i, sizeof(word));
+		if (JSON_HAS_LESS(word, 0x20U) ||
+			JSON_HAS_ZERO(word ^ (JSON_ONES * '"')) ||
+			JSON_HAS_ZERO(word ^ (JSON_ONES * '\\')))
+		{
+			break;
+		}
+		i += sizeof(word);
+	}
+	for (; i < length; i++)
+	{
+		c = (unsigned char)s[i];
+		if (c < 0x20U || c == '"' || c == '\\')
+		{
+			break;
+		}
+	}
+	return i;
+}
+
+static void
+json_string(record_writer_t* w, const char* value)
+{
+	static const char hex[] = "0123456789abcdef";
+	char escape[7];
+	size_t length;
+	size_t run;
+	unsigned char c;
+	
+	if (value == NULL)
+	{
+		record_emit(w, "null", 4);
+		return;
+	}
+	length = strlen(value);
+	record_emit(w, "\"", 1);
+	while (length > 0)
+	{
+		run = json_safe_run(value, length);
+		record_emit(w, value, run);
+		value += run;
+		length -= run;
+		if (length == 0)
+		{
+			break;
+		}
+		c = (unsigned char)*value;
+		escape[0] = '\\';
+		switch (c)
+		{
+			case '"': escape[1] = '"'; break;
+			case '\\': escape[1] = '\\'; break;
+			case '\n': escape[1] = 'n'; break;
+			case '\r': escape[1] = 'r'; break;
+			case '\t': escape[1] = 't'; break;
+			case '\b': escape[1] = 'b'; break;
+			case '\f': escape[1] = 'f'; break;
+			default: escape[1] = 'u'; break;
+		}
+		if (escape[1] == 'u')
+		{
+			escape[2] = '0';
+			escape[3] = '0';
+			escape[4] = hex[c >> 4];
+			escape[5] = hex[c & 0x0fU];
+			record_emit(w, escape, 6);
+		}
+		else
+		{
+			record_emit(w, escape, 2);
+		}
+		value++;
+		length--;
+	}
+	record_emit(w, "\"", 1);
+}
+
+/* Comma, newline and indentation ahead of the next member or element */
+static void
+json_item(record_writer_t* w)
+{
+	unsigned int k;
+	
+	if (w->depth == 0)
+	{
+		return;
+	}
+	if (w->items[w->depth - 1]++ > 0)
+	{
+		record_emit(w, ",", 1);
+	}
+	if (w->lines)
+	{
+		return;
+	}
+	record_emit(w, "\n", 1);
+	for (k = 0; k < w->depth; k++)
+	{
+		record_emit(w, "\t", 1);
+	}
+}
+
+/* Length of the leading run a CSV field holds without quotes, eight bytes at
+   a time like the JSON scan */
+static size_t
+csv_safe_run(const char* s, size_t length)
+{
+	uint64_t word;
+	size_t i = 0;
+	unsigned char c;
+	
+	while (i + sizeof(word) <= length)
+	{
+		memcpy(&word, s + i, sizeof(word));
+		if (JSON_HAS_ZERO(word ^ (JSON_ONES * ',')) ||
+			JSON_HAS_ZERO(word ^ (JSON_ONES * '"')) ||
+			JSON_HAS_ZERO(word ^ (JSON_ONES * '\n')) ||
+			JSON_HAS_ZERO(word ^ (JSON_ONES * '\r')))
+		{
+			break;
+		}
+		i += sizeof(word);
+	}
+	for (; i < length; i++)
+	{
+		c = (unsigned char)s[i];
+		if (c == ',' || c == '"' || c == '\n' || c == '\r')
+		{
+			break;
+		}
+	}
+	return i;
+}
+
+/* RFC 4180: a field with a comma, a quote or a line break is quoted and its
+   quotes doubled, NULL is an empty field */
+static void
+csv_string(record_writer_t* w, const char* value)
+{
+	const char* quote;
+	size_t length;
+	size_t run;
+	
+	if (value == NULL)
+	{
+		return;
+	}
+	length = strlen(value);
+	if (csv_safe_run(value, length) == length)
+	{
+		record_emit(w, value, length);
+		return;
+	}
+	record_emit(w, "\"", 1);
+	while ((quote = memchr(value, '"', length)) != NULL)
+	{
+		run = (size_t)(quote - value) + 1;
+		record_emit(w, value, run);
+		record_emit(w, "\"", 1);
+		value += run;
+		length -= run;
+	}
+	record_emit(w, value, length);
+	record_emit(w, "\"", 1);
+}
+
+/* Decimal digits written backwards from end, two per division */
+static char*
+record_digits(char* end, uintmax_t value)
+{
+	static const char pairs[] =
+		"0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+		"5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+	size_t pair;
+	
+	while (value >= 100U)
+	{
+		pair = (size_t)(value % 100U) * 2;
+		value /= 100U;
+		*--end = pairs[pair + 1];
+		*--end = pairs[pair];
+	}
+	if (value >= 10U)
+	{
+		pair = (size_t)value * 2;
+		*--end = pairs[pair + 1];
+		*--end = pairs[pair];
+	}
+	else
+	{
+		*--end = (char)('0' + value);
+	}
+	return end;
+}
+
+static int
+record_writer_init(record_writer_t* w, FILE* out, output_format_t format)
+{
+	memset(w, 0, sizeof(*w));
+	if (format != OUTPUT_FORMAT_JSON && format != OUTPUT_FORMAT_NDJSON &&
+		format != OUTPUT_FORMAT_CSV &&
+		format != OUTPUT_FORMAT_CBOR && format != OUTPUT_FORMAT_MSGPACK)
+	{
+		return INVALID_ARGUMENT;
+	}
+	w->format = format;
+	w->file = out;
+	w->lines = (format == OUTPUT_FORMAT_NDJSON || format == OUTPUT_FORMAT_CSV);
+	return TPM_NO_ERROR;
+}
+
+/* Type and length prefix, CBOR major types are mapped onto the matching
+   MessagePack families */
+static void
+record_head(record_writer_t* w, unsigned int major, uint64_t value)
+{
+	unsigned char head[9];
+	size_t size = 0;
+	int64_t n;
+	
+	if (w->format == OUTPUT_FORMAT_CBOR)
+	{
+		head[0] = (unsigned char)(major << 5);
+		if (value < 24U) { head[0] |= (unsigned char)value; }
+		else if (value <= UINT8_MAX) { head[0] |= 24U; size = 1; }
+		else if (value <= UINT16_MAX) { head[0] |= 25U; size = 2; }
+		else if (value <= UINT32_MAX) { head[0] |= 26U; size = 4; }
+		else { head[0] |= 27U; size = 8; }
+	}
+	else if (major == CBOR_UINT)
+	{
+		if (value < 0x80U) { head[0] = (unsigned char)value; }
+		else if (value <= UINT8_MAX) { head[0] = 0xcc; size = 1; }
+		else if (value <= UINT16_MAX) { head[0] = 0xcd; size = 2; }
+		else if (value <= UINT32_MAX) { head[0] = 0xce; size = 4; }
+		else { head[0] = 0xcf; size = 8; }
+	}
+	else if (major == CBOR_NEGINT)
+	{
+		n = -1 - (int64_t)value;
+		value = (uint64_t)n;
+		if (n >= -32) { head[0] = (unsigned char)(value & 0xffU); }
+		else if (n >= INT8_MIN) { head[0] = 0xd0; size = 1; }
+		else if (n >= INT16_MIN) { head[0] = 0xd1; size = 2; }
+		else if (n >= INT32_MIN) { head[0] = 0xd2; size = 4; }
+		else { head[0] = 0xd3; size = 8; }
+	}
+	else if (major == CBOR_TEXT)
+	{
+		if (value < 32U) { head[0] = (unsigned char)(0xa0U | value); }
+		else if (value <= UINT8_MAX) { head[0] = 0xd9; size = 1; }
+		else if (value <= UINT16_MAX) { head[0] = 0xda; size = 2; }
+		else { head[0] = 0xdb; size = 4; }
+	}
+	else
+	{
+		if (value < 16U) { head[0] = (unsigned char)((major == CBOR_MAP ? 0x80U : 0x90U) | value); }
+		else if (value <= UINT16_MAX) { head[0] = (major == CBOR_MAP) ? 0xde : 0xdc; size = 2; }
+		else { head[0] = (major == CBOR_MAP) ? 0xdf : 0xdd; size = 4; }
+	}
+	store_be(head + 1, value, size);
+	record_emit(w, (const char*)head, size + 1);
+}
+
+static void
+record_text(record_writer_t* w, const char* value)
+{
+	unsigned char nil;
+	size_t length;
+	
+	if (w->format == OUTPUT_FORMAT_CSV)
+	{
+		if (!w->header)
+		{
+			csv_string(w, value);
+		}
+	}
+	else if (!RECORD_BINARY(w))
+	{
+		json_string(w, value);
+	}
+	else if (value == NULL)
+	{
+		nil = (w->format == OUTPUT_FORMAT_CBOR) ? CBOR_NULL : MSGPACK_NIL;
+		record_emit(w, (const char*)&nil, 1);
+	}
+	else
+	{
+		length = strlen(value);
+		record_head(w, CBOR_TEXT, length);
+		record_emit(w, value, length);
+	}
+}
+
+/* count is the number of members or elements, only the binary formats need
+   it; a CSV record is just its fields */
+static void
+record_begin(record_writer_t* w, char open, size_t count)
 {
-	if (topts==NULL || pick == NULL) return 1;
-	pick->total_toothpastes = count_list(pick->head);
-	if (0==pick->total_toothpastes) 
+	if (RECORD_BINARY(w))
 	{
-			perror(_(error_strings[NO_TOOTHPASTES_LOADED]));
+		record_head(w, open == '{' ? CBOR_MAP : CBOR_ARRAY, count);
+	}
+	else if (w->format != OUTPUT_FORMAT_CSV)
+	{
+		json_item(w);
+		record_emit(w, &open, 1);
+	}
+	if (w->depth < RECORD_MAX_DEPTH)
+	{
+		w->items[w->depth++] = 0;
 	}
-	return 0;
 }
 
-
-static int
-eval_username(toothpaste_pick_t *pick, toothpaste_pick_options_t *topts)
+static void
+record_end(record_writer_t* w, char close)
 {
-    char username[UNLEN + 1] = {0};
-    const char *source = NULL;
+	unsigned int k;
+	
+	if (w->depth > 0)
+	{
+		w->depth--;
+	}
+	if (RECORD_BINARY(w) || w->format == OUTPUT_FORMAT_CSV)
+	{
+		return;
+	}
+	if (!w->lines)
+	{
+		record_emit(w, "\n", 1);
+		for (k = 0; k < w->depth; k++)
+		{
+			record_emit(w, "\t", 1);
+		}
+	}
+	record_emit(w, &close, 1);
+}
 
-    if (pick == NULL || topts == NULL)
-        return 1;
+/* One record per line for NDJSON and CSV, the stream is flushed every batch */
+static void
+record_line_end(record_writer_t* w)
+{
+	record_emit(w, "\n", 1);
+	if (w->file != NULL && ++w->pending_lines >= RECORD_LINES_BATCH)
+	{
+		if (fflush(w->file) != 0)
+		{
+			w->failed = 1;
+		}
+		w->pending_lines = 0;
+	}
+}
 
-    
-    if (topts->username != NULL && topts->username[0] != '\0')
-    {
-        source = topts->username;
-    }
-    
-    else if (get_current_username(username, sizeof(username)) == 0)
-    {
-        source = username;
-    }
-    
-    else
-    {
-        source = user_strings[MSG_ANON];
-    }
+/* CSV keys are only written in the header row */
+static void
+record_key(record_writer_t* w, const char* key)
+{
+	if (RECORD_BINARY(w))
+	{
+		record_text(w, key);
+		return;
+	}
+	if (w->format == OUTPUT_FORMAT_CSV)
+	{
+		if (w->depth > 0 && w->items[w->depth - 1]++ > 0)
+		{
+			record_emit(w, ",", 1);
+		}
+		if (w->header)
+		{
+			csv_string(w, key);
+		}
+		return;
+	}
+	json_item(w);
+	json_string(w, key);
+	record_emit(w, ":", 1);
+}
 
-    pick->who = malloc(UNLEN + 1);
-    if (pick->who == NULL)
-        return 1;
+static void
+record_field_string(record_writer_t* w, const char* key, const char* value)
+{
+	record_key(w, key);
+	record_text(w, value);
+}
 
-    strncpy_s(pick->who, UNLEN+1, source, UNLEN);
-    pick->who[UNLEN] = '\0';
+static void
+record_field_uint(record_writer_t* w, const char* key, uintmax_t value)
+{
+	char number[RECORD_NUMBER_SIZE];
+	char* digits;
+	
+	record_key(w, key);
+	if (w->header)
+	{
+		return;
+	}
+	if (RECORD_BINARY(w))
+	{
+		record_head(w, CBOR_UINT, (uint64_t)value);
+		return;
+	}
+	digits = record_digits(number + sizeof(number), value);
+	record_emit(w, digits, (size_t)(number + sizeof(number) - digits));
+}
 
-    return 0;
+static void
+record_field_int(record_writer_t* w, const char* key, intmax_t value)
+{
+	char number[RECORD_NUMBER_SIZE];
+	char* digits;
+	
+	record_key(w, key);
+	if (w->header)
+	{
+		return;
+	}
+	if (RECORD_BINARY(w))
+	{
+		if (value >= 0)
+		{
+			record_head(w, CBOR_UINT, (uint64_t)value);
+		}
+		else
+		{
+			record_head(w, CBOR_NEGINT, (uint64_t)(-1 - value));
+		}
+		return;
+	}
+	digits = record_digits(number + sizeof(number), value < 0 ? (uintmax_t)(-(value + 1)) + 1U : (uintmax_t)value);
+	if (value < 0)
+	{
+		*--digits = '-';
+	}
+	record_emit(w, digits, (size_t)(number + sizeof(number) - digits));
 }
 
+static void
+record_field_bool(record_writer_t* w, const char* key, int value)
+{
+	unsigned char flag;
+	
+	record_key(w, key);
+	if (w->header)
+	{
+		return;
+	}
+	if (w->format == OUTPUT_FORMAT_CSV)
+	{
+		record_emit(w, value ? "1" : "0", 1);
+		return;
+	}
+	if (w->format == OUTPUT_FORMAT_CBOR)
+	{
+		flag = value ? CBOR_TRUE : CBOR_FALSE;
+		record_emit(w, (const char*)&flag, 1);
+		return;
+	}
+	if (w->format == OUTPUT_FORMAT_MSGPACK)
+	{
+		flag = value ? MSGPACK_TRUE : MSGPACK_FALSE;
+		record_emit(w, (const char*)&flag, 1);
+		return;
+	}
+	record_emit(w, value ? "true" : "false", value ? 4 : 5);
+}
 
-static char*
-str_good_day(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+/* Zero bytes until length + shift is a multiple of align */
+static void
+fb_pad(render_buffer_t* b, size_t align, size_t shift)
 {
-    if (topts == NULL || pick == NULL) return NULL;	
+	while ((b->length + shift) % align != 0)
+	{
+		render_append(b, "", 1);
+	}
+}
 
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL; 
-    
-    memset(line, 0, MAX_TOOTHPASTE_LINE);
+static void
+fb_put(render_buffer_t* b, uint64_t value, size_t size)
+{
+	unsigned char bytes[8];
+	
+	store_le64(bytes, value);
+	render_append(b, (const char*)bytes, size);
+}
 
-    const char* translated_good = _(user_strings[MSG_GOOD]);
-    
-    const char* raw_time_str = times_of_day[topts->time_of_day_ind];
-    const char* translated_time = (raw_time_str != NULL) ? _(raw_time_str) : "";
+/* Flatbuffer offsets always point forward, children are written after the
+   parent and the parent's slot is patched */
+static void
+fb_patch(render_buffer_t* b, size_t slot, size_t target)
+{
+	store_le32((unsigned char*)b->data + slot, (uint32_t)(target - slot));
+}
 
-    snprintf(line, MAX_TOOTHPASTE_LINE, "%s %s ", translated_good, translated_time);
+/* The vtable goes right in front of its table, widest fields first so each
+   one lands on its own alignment */
+static size_t
+fb_table(render_buffer_t* b, fb_field_t* fields, unsigned int count)
+{
+	uint16_t offsets[MAX_FB_FIELDS];
+	size_t vtable_size = 4 + 2 * (size_t)count;
+	size_t table_size = 4;
+	size_t vtable;
+	size_t table;
+	unsigned int size;
+	unsigned int k;
+	int wide = 0;
+	
+	for (k = 0; k < count; k++)
+	{
+		offsets[k] = 0;
+	}
+	for (size = 8; size > 0; size /= 2)
+	{
+		for (k = 0; k < count; k++)
+		{
+			if (fields[k].size == size)
+			{
+				offsets[k] = (uint16_t)table_size;
+				table_size += size;
+				wide |= (size == 8);
+			}
+		}
+	}
+	fb_pad(b, 2, 0);
+	while ((b->length + vtable_size) % (wide ? 8U : 4U) != (wide ? 4U : 0U))
+	{
+		fb_put(b, 0, 2);
+	}
+	vtable = b->length;
+	fb_put(b, vtable_size, 2);
+	fb_put(b, table_size, 2);
+	for (k = 0; k < count; k++)
+	{
+		fb_put(b, offsets[k], 2);
+	}
+	table = b->length;
+	fb_put(b, table - vtable, 4);
+	for (size = 8; size > 0; size /= 2)
+	{
+		for (k = 0; k < count; k++)
+		{
+			if (fields[k].size == size)
+			{
+				fields[k].slot = b->length;
+				fb_put(b, fields[k].value, size);
+			}
+		}
+	}
+	return table;
+}
 
-    return line;
+/* Zeroed elements to be filled in place, returns the first element, the
+   offset to the vector itself points at the length in front of it */
+static size_t
+fb_vector(render_buffer_t* b, uint32_t count, size_t element_size)
+{
+	size_t first;
+	size_t k;
+	
+	fb_pad(b, element_size >= 8 ? 8 : 4, 4);
+	fb_put(b, count, 4);
+	first = b->length;
+	for (k = 0; k < count * element_size; k++)
+	{
+		render_append(b, "", 1);
+	}
+	return first;
 }
 
+static size_t
+fb_string(render_buffer_t* b, const char* value)
+{
+	size_t length = strlen(value);
+	size_t at;
+	
+	fb_pad(b, 4, 0);
+	at = b->length;
+	fb_put(b, length, 4);
+	render_append(b, value, length);
+	render_append(b, "", 1);
+	return at;
+}
 
-static char*
-str_anon_username(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static size_t
+arrow_padded(size_t size)
 {
-    if (topts == NULL || pick == NULL || pick->who == NULL) return NULL;
+	return (size + ARROW_ALIGNMENT - 1) & ~(size_t)(ARROW_ALIGNMENT - 1);
+}
 
-    size_t buffer_size = UNLEN + 3; 
-    char* line = malloc(buffer_size);
-    if (line == NULL) return NULL;
+static void
+arrow_emit(arrow_writer_t* w, const void* data, size_t size)
+{
+	if (size > 0 && fwrite(data, 1, size, w->file) != size)
+	{
+		w->failed = 1;
+	}
+	w->offset += size;
+}
 
-    memset(line, 0, buffer_size);
+/* Column buffers are written in host byte order and the schema says which */
+static size_t
+arrow_schema(render_buffer_t* b, const arrow_column_t* columns, unsigned int count)
+{
+	const uint16_t probe = 1;
+	fb_field_t schema[2] = {{2, 0, 0}, {4, 0, 0}};
+	fb_field_t field[6];
+	fb_field_t type[2];
+	unsigned int total_type;
+	size_t table;
+	size_t vector;
+	size_t field_table;
+	unsigned int k;
+	
+	schema[0].value = (*(const unsigned char*)&probe == 0);
+	table = fb_table(b, schema, 2);
+	vector = fb_vector(b, count, 4);
+	fb_patch(b, schema[1].slot, vector - 4);
+	for (k = 0; k < count; k++)
+	{
+		memset(field, 0, sizeof(field));
+		field[0].size = 4;
+		field[2].size = 1;
+		field[2].value = columns[k].type;
+		field[3].size = 4;
+		field[5].size = 4;
+		field_table = fb_table(b, field, 6);
+		fb_patch(b, vector + 4 * (size_t)k, field_table);
+		fb_patch(b, field[0].slot, fb_string(b, columns[k].name));
+		
+		memset(type, 0, sizeof(type));
+		total_type = 0;
+		if (columns[k].type == ARROW_TYPE_INT)
+		{
+			type[0].size = 4;
+			type[0].value = columns[k].bit_width;
+			type[1].size = 1;
+			type[1].value = (uint64_t)columns[k].is_signed;
+			total_type = 2;
+		}
+		else if (columns[k].type == ARROW_TYPE_TIMESTAMP)
+		{
+			type[1].size = 4;
+			total_type = 2;
+		}
+		fb_patch(b, field[3].slot, fb_table(b, type, total_type));
+		if (columns[k].type == ARROW_TYPE_TIMESTAMP)
+		{
+			fb_patch(b, type[1].slot, fb_string(b, "UTC"));
+		}
+		fb_patch(b, field[5].slot, fb_vector(b, 0, 4) - 4);
+	}
+	return table;
+}
 
-    snprintf(line, buffer_size, "%s ", pick->who);
+/* Continuation marker, padded metadata length, then the flatbuffer */
+static void
+arrow_message(arrow_writer_t* w, render_buffer_t* b, uint64_t body_length)
+{
+	unsigned char prefix[8];
 	
-    return line;
+	fb_pad(b, ARROW_ALIGNMENT, 0);
+	store_le32(prefix, ARROW_CONTINUATION);
+	store_le32(prefix + 4, (uint32_t)b->length);
+	w->batch_metadata = (uint32_t)(sizeof(prefix) + b->length);
+	w->batch_body = body_length;
+	arrow_emit(w, prefix, sizeof(prefix));
+	arrow_emit(w, b->data, b->length);
 }
 
-static char*
-str_welcome(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+arrow_write_schema(arrow_writer_t* w, const arrow_column_t* columns, unsigned int count)
 {
-    if (topts == NULL || pick == NULL) return NULL;	
+	render_buffer_t b;
+	fb_field_t message[4] = {{2, ARROW_METADATA_V5, 0}, {1, ARROW_HEADER_SCHEMA, 0}, {4, 0, 0}, {8, 0, 0}};
+	
+	render_init(&b);
+	fb_put(&b, 0, 4);
+	fb_patch(&b, 0, fb_table(&b, message, 4));
+	fb_patch(&b, message[2].slot, arrow_schema(&b, columns, count));
+	arrow_message(w, &b, 0);
+	render_free(&b);
+}
 
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL;
-    
-    memset(line, 0, MAX_TOOTHPASTE_LINE);
+/* One batch with every row, each column has an empty validity buffer, Utf8
+   adds its offsets and every buffer is padded to 8 bytes */
+static void
+arrow_write_batch(arrow_writer_t* w, const arrow_column_t* columns, unsigned int count, uint32_t rows)
+{
+	static const unsigned char zeros[ARROW_ALIGNMENT] = {0};
+	render_buffer_t b;
+	fb_field_t message[4] = {{2, ARROW_METADATA_V5, 0}, {1, ARROW_HEADER_RECORD_BATCH, 0}, {4, 0, 0}, {8, 0, 0}};
+	fb_field_t batch[3] = {{8, 0, 0}, {4, 0, 0}, {4, 0, 0}};
+	size_t offsets_size = ((size_t)rows + 1) * sizeof(int32_t);
+	uint64_t body = 0;
+	uint32_t total_buffers = 0;
+	size_t nodes;
+	size_t buffers;
+	unsigned char* slot;
+	unsigned int k;
+	
+	for (k = 0; k < count; k++)
+	{
+		total_buffers += (columns[k].type == ARROW_TYPE_UTF8) ? 3U : 2U;
+	}
+	render_init(&b);
+	fb_put(&b, 0, 4);
+	fb_patch(&b, 0, fb_table(&b, message, 4));
+	batch[0].value = rows;
+	fb_patch(&b, message[2].slot, fb_table(&b, batch, 3));
+	nodes = fb_vector(&b, count, ARROW_FIELD_NODE_SIZE);
+	fb_patch(&b, batch[1].slot, nodes - 4);
+	for (k = 0; k < count; k++)
+	{
+		store_le64((unsigned char*)b.data + nodes + (size_t)k * ARROW_FIELD_NODE_SIZE, rows);
+	}
+	buffers = fb_vector(&b, total_buffers, ARROW_BUFFER_SIZE);
+	fb_patch(&b, batch[2].slot, buffers - 4);
+	slot = (unsigned char*)b.data + buffers;
+	for (k = 0; k < count; k++)
+	{
+		store_le64(slot, body);
+		slot += ARROW_BUFFER_SIZE;
+		if (columns[k].type == ARROW_TYPE_UTF8)
+		{
+			store_le64(slot, body);
+			store_le64(slot + 8, offsets_size);
+			body += arrow_padded(offsets_size);
+			slot += ARROW_BUFFER_SIZE;
+		}
+		store_le64(slot, body);
+		store_le64(slot + 8, columns[k].data_size);
+		body += arrow_padded(columns[k].data_size);
+		slot += ARROW_BUFFER_SIZE;
+	}
+	store_le64((unsigned char*)b.data + message[3].slot, body);
+	
+	w->batch_offset = w->offset;
+	arrow_message(w, &b, body);
+	render_free(&b);
+	for (k = 0; k < count; k++)
+	{
+		if (columns[k].type == ARROW_TYPE_UTF8)
+		{
+			arrow_emit(w, columns[k].offsets, offsets_size);
+			arrow_emit(w, zeros, arrow_padded(offsets_size) - offsets_size);
+		}
+		arrow_emit(w, columns[k].data, columns[k].data_size);
+		arrow_emit(w, zeros, arrow_padded(columns[k].data_size) - columns[k].data_size);
+	}
+	w->batches++;
+}
 
-    const char* translated_welcome = _(user_strings[MSG_WELCOME]);
+/* The file footer repeats the schema and points at the record batch */
+static void
+arrow_write_footer(arrow_writer_t* w, const arrow_column_t* columns, unsigned int count)
+{
+	render_buffer_t b;
+	fb_field_t footer[4] = {{2, ARROW_METADATA_V5, 0}, {4, 0, 0}, {4, 0, 0}, {4, 0, 0}};
+	unsigned char trailer[4];
+	size_t blocks;
+	
+	render_init(&b);
+	fb_put(&b, 0, 4);
+	fb_patch(&b, 0, fb_table(&b, footer, 4));
+	fb_patch(&b, footer[1].slot, arrow_schema(&b, columns, count));
+	fb_patch(&b, footer[2].slot, fb_vector(&b, 0, ARROW_BLOCK_SIZE) - 4);
+	blocks = fb_vector(&b, (uint32_t)w->batches, ARROW_BLOCK_SIZE);
+	fb_patch(&b, footer[3].slot, blocks - 4);
+	if (w->batches > 0)
+	{
+		store_le64((unsigned char*)b.data + blocks, w->batch_offset);
+		store_le32((unsigned char*)b.data + blocks + 8, w->batch_metadata);
+		store_le64((unsigned char*)b.data + blocks + 16, w->batch_body);
+	}
+	store_le32(trailer, (uint32_t)b.length);
+	arrow_emit(w, b.data, b.length);
+	arrow_emit(w, trailer, sizeof(trailer));
+	arrow_emit(w, ARROW_MAGIC, ARROW_MAGIC_SIZE);
+	render_free(&b);
+}
 
-    snprintf(line, MAX_TOOTHPASTE_LINE, "%s\n", translated_welcome);
+/* Arrow IPC stream, or the file format that wraps the stream in magic and a
+   footer so it can be memory-mapped */
+static int
+arrow_write_table(FILE* out, const arrow_column_t* columns, unsigned int count, uint32_t rows, int file_format)
+{
+	static const unsigned char magic[ARROW_ALIGNMENT] = {'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+	unsigned char end[8];
+	arrow_writer_t w;
 	
-    return line;
+	memset(&w, 0, sizeof(w));
+	w.file = out;
+	if (file_format)
+	{
+		arrow_emit(&w, magic, sizeof(magic));
+	}
+	arrow_write_schema(&w, columns, count);
+	arrow_write_batch(&w, columns, count, rows);
+	store_le32(end, ARROW_CONTINUATION);
+	store_le32(end + 4, 0);
+	arrow_emit(&w, end, sizeof(end));
+	if (file_format)
+	{
+		arrow_write_footer(&w, columns, count);
+	}
+	return w.failed ? LAST_PICK_WRITING_FAILED : TPM_NO_ERROR;
 }
 
-static char*
-str_next_pick(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+free_catalog_columns(catalog_columns_t* cols)
 {
-    if (topts == NULL || pick == NULL) return NULL;	
+	free(cols->index);
+	free(cols->tube_mass_g);
+	free(cols->rating);
+	free(cols->toothbrush_length_cm);
+	free(cols->toothbrush_hardness);
+	free(cols->brand_offsets);
+	free(cols->brand_data);
+	free(cols->type_offsets);
+	free(cols->type_data);
+	free(cols->color_offsets);
+	free(cols->color_data);
+	free(cols->toothbrush_brand_offsets);
+	free(cols->toothbrush_brand_data);
+	memset(cols, 0, sizeof(*cols));
+}
 
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL; 
-    
-    memset(line, 0, MAX_TOOTHPASTE_LINE);
+#define CATALOG_TEXT(s) ((s) != NULL ? (s) : "")
+
+/* Two passes over the list, one to size the string columns and one to fill
+   every column */
+static int
+build_catalog_columns(const list_row_t* selected, size_t rows, catalog_columns_t* cols)
+{
+	const toothpaste_data_t* data;
+	size_t brand = 0, type = 0, color = 0, toothbrush_brand = 0;
+	size_t length;
+	uint32_t r;
 	
-    const char* translated_next_pick = _(user_strings[MSG_NEXT_PICK]);
+	memset(cols, 0, sizeof(*cols));
+	if (rows > INT32_MAX)
+	{
+		return INVALID_ARGUMENT;
+	}
+	for (r = 0; r < rows; r++)
+	{
+		data = &selected[r].node->data;
+		brand += strlen(CATALOG_TEXT(data->toothpaste_brand));
+		type += strlen(toothpaste_type_strings[data->type]);
+		color += strlen(CATALOG_TEXT(data->toothbrush_color));
+		toothbrush_brand += strlen(CATALOG_TEXT(data->toothbrush_brand));
+	}
+	if (brand > INT32_MAX || type > INT32_MAX || color > INT32_MAX || toothbrush_brand > INT32_MAX)
+	{
+		return INVALID_ARGUMENT;
+	}
+	cols->rows = (uint32_t)rows;
+	cols->index = malloc((rows + 1) * sizeof(uint32_t));
+	cols->tube_mass_g = malloc((rows + 1) * sizeof(uint32_t));
+	cols->rating = malloc((rows + 1) * sizeof(uint32_t));
+	cols->toothbrush_length_cm = malloc((rows + 1) * sizeof(uint32_t));
+	cols->toothbrush_hardness = malloc((rows + 1) * sizeof(uint32_t));
+	cols->brand_offsets = malloc((rows + 1) * sizeof(int32_t));
+	cols->type_offsets = malloc((rows + 1) * sizeof(int32_t));
+	cols->color_offsets = malloc((rows + 1) * sizeof(int32_t));
+	cols->toothbrush_brand_offsets = malloc((rows + 1) * sizeof(int32_t));
+	cols->brand_data = malloc(brand + 1);
+	cols->type_data = malloc(type + 1);
+	cols->color_data = malloc(color + 1);
+	cols->toothbrush_brand_data = malloc(toothbrush_brand + 1);
+	if (!cols->index || !cols->tube_mass_g || !cols->rating || !cols->toothbrush_length_cm ||
+		!cols->toothbrush_hardness || !cols->brand_offsets || !cols->type_offsets ||
+		!cols->color_offsets || !cols->toothbrush_brand_offsets || !cols->brand_data ||
+		!cols->type_data || !cols->color_data || !cols->toothbrush_brand_data)
+	{
+		free_catalog_columns(cols);
+		return MALLOC_FAILED;
+	}
+	cols->brand_offsets[0] = 0;
+	cols->type_offsets[0] = 0;
+	cols->color_offsets[0] = 0;
+	cols->toothbrush_brand_offsets[0] = 0;
+	for (r = 0; r < rows; r++)
+	{
+		data = &selected[r].node->data;
+		cols->index[r] = data->index;
+		cols->tube_mass_g[r] = data->tube_mass_g;
+		cols->rating[r] = data->rating;
+		cols->toothbrush_length_cm[r] = data->toothbrush_length_cm;
+		cols->toothbrush_hardness[r] = data->toothbrush_hardness;
+		
+		length = strlen(CATALOG_TEXT(data->toothpaste_brand));
+		memcpy(cols->brand_data + cols->brand_offsets[r], CATALOG_TEXT(data->toothpaste_brand), length);
+		cols->brand_offsets[r + 1] = cols->brand_offsets[r] + (int32_t)length;
+		
+		length = strlen(toothpaste_type_strings[data->type]);
+		memcpy(cols->type_data + cols->type_offsets[r], toothpaste_type_strings[data->type], length);
+		cols->type_offsets[r + 1] = cols->type_offsets[r] + (int32_t)length;
+		
+		length = strlen(CATALOG_TEXT(data->toothbrush_color));
+		memcpy(cols->color_data + cols->color_offsets[r], CATALOG_TEXT(data->toothbrush_color), length);
+		cols->color_offsets[r + 1] = cols->color_offsets[r] + (int32_t)length;
+		
+		length = strlen(CATALOG_TEXT(data->toothbrush_brand));
+		memcpy(cols->toothbrush_brand_data + cols->toothbrush_brand_offsets[r], CATALOG_TEXT(data->toothbrush_brand), length);
+		cols->toothbrush_brand_offsets[r + 1] = cols->toothbrush_brand_offsets[r] + (int32_t)length;
+	}
+	return TPM_NO_ERROR;
+}
 
-    snprintf(line, MAX_TOOTHPASTE_LINE, "%s\n", translated_next_pick);
+static int
+arrow_write_catalog(const list_row_t* rows, size_t count, FILE* out, int file_format)
+{
+	catalog_columns_t cols;
+	int result = build_catalog_columns(rows, count, &cols);
+	size_t words;
 	
-    return line;
+	if (result != TPM_NO_ERROR)
+	{
+		return result;
+	}
+	words = (size_t)cols.rows * sizeof(uint32_t);
+	{
+		const arrow_column_t columns[CATALOG_COLUMNS] = {
+			{"index", ARROW_TYPE_INT, 32, 0, cols.index, words, NULL},
+			{"toothpaste", ARROW_TYPE_UTF8, 0, 0, cols.brand_data, (size_t)cols.brand_offsets[cols.rows], cols.brand_offsets},
+			{"tube_mass_g", ARROW_TYPE_INT, 32, 0, cols.tube_mass_g, words, NULL},
+			{"rating", ARROW_TYPE_INT, 32, 0, cols.rating, words, NULL},
+			{"toothpaste_type", ARROW_TYPE_UTF8, 0, 0, cols.type_data, (size_t)cols.type_offsets[cols.rows], cols.type_offsets},
+			{"toothbrush_color", ARROW_TYPE_UTF8, 0, 0, cols.color_data, (size_t)cols.color_offsets[cols.rows], cols.color_offsets},
+			{"toothbrush_brand", ARROW_TYPE_UTF8, 0, 0, cols.toothbrush_brand_data, (size_t)cols.toothbrush_brand_offsets[cols.rows], cols.toothbrush_brand_offsets},
+			{"toothbrush_length_cm", ARROW_TYPE_INT, 32, 0, cols.toothbrush_length_cm, words, NULL},
+			{"toothbrush_hardness", ARROW_TYPE_INT, 32, 0, cols.toothbrush_hardness, words, NULL}
+		};
+		result = arrow_write_table(out, columns, CATALOG_COLUMNS, cols.rows, file_format);
+	}
+	free_catalog_columns(&cols);
+	return result;
 }
 
-static char*
-str_new_toothbrush(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+/* The pick log is row by row on disk, it is split into columns here and the
+   flags become three bit-packed Bool columns */
+static int
+arrow_write_history(const pick_log_t* log, FILE* out, int file_format)
 {
-    if (topts == NULL || pick == NULL) return NULL;	
+	pick_log_record_t record;
+	size_t rows = log->total_records;
+	size_t bits = (rows + 7) / 8;
+	int64_t* when;
+	uint64_t* user_hash;
+	uint32_t* toothpaste_index;
+	uint16_t* pick_type;
+	unsigned char* flags;
+	size_t i;
+	int result;
+	
+	if (rows > INT32_MAX)
+	{
+		return INVALID_ARGUMENT;
+	}
+	when = malloc((rows + 1) * sizeof(*when));
+	user_hash = malloc((rows + 1) * sizeof(*user_hash));
+	toothpaste_index = malloc((rows + 1) * sizeof(*toothpaste_index));
+	pick_type = malloc((rows + 1) * sizeof(*pick_type));
+	flags = calloc(3 * bits + 1, 1);
+	if (!when || !user_hash || !toothpaste_index || !pick_type || !flags)
+	{
+		result = MALLOC_FAILED;
+		goto cleanup;
+	}
+	for (i = 0; i < rows; i++)
+	{
+		memset(&record, 0, sizeof(record));
+		tpm_get_pick_log_record(log, i, &record);
+		when[i] = record.when;
+		user_hash[i] = record.user_hash;
+		toothpaste_index[i] = record.toothpaste_index;
+		pick_type[i] = record.pick_type;
+		if (record.flags & PICK_LOG_NEW_PICK)
+			flags[i / 8] |= (unsigned char)(1U << (i % 8));
+		if (record.flags & PICK_LOG_TOOTHBRUSH)
+			flags[bits + i / 8] |= (unsigned char)(1U << (i % 8));
+		if (record.flags & PICK_LOG_DENTIST)
+			flags[2 * bits + i / 8] |= (unsigned char)(1U << (i % 8));
+	}
+	{
+		const arrow_column_t columns[HISTORY_COLUMNS] = {
+			{"when", ARROW_TYPE_TIMESTAMP, 64, 1, when, rows * sizeof(*when), NULL},
+			{"user_hash", ARROW_TYPE_INT, 64, 0, user_hash, rows * sizeof(*user_hash), NULL},
+			{"toothpaste_index", ARROW_TYPE_INT, 32, 0, toothpaste_index, rows * sizeof(*toothpaste_index), NULL},
+			{"pick_type", ARROW_TYPE_INT, 16, 0, pick_type, rows * sizeof(*pick_type), NULL},
+			{"new_pick", ARROW_TYPE_BOOL, 1, 0, flags, bits, NULL},
+			{"new_toothbrush", ARROW_TYPE_BOOL, 1, 0, flags + bits, bits, NULL},
+			{"dentist_visit", ARROW_TYPE_BOOL, 1, 0, flags + 2 * bits, bits, NULL}
+		};
+		result = arrow_write_table(out, columns, HISTORY_COLUMNS, (uint32_t)rows, file_format);
+	}
+	
+	cleanup:
+	free(when);
+	free(user_hash);
+	free(toothpaste_index);
+	free(pick_type);
+	free(flags);
+	return result;
+}
 
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL; 
+static void
+str_good_day(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
+{
+    const locale_strings_t* tr = locale_strings(topts);
+    const char* translated_good = tr->user[MSG_GOOD];
     
-    memset(line, 0, MAX_TOOTHPASTE_LINE);	
-	
-    const char* translated_swap_msg = _(user_strings[MSG_SWAP_TOOTHBRUSH]);
+    const char* raw_time_str = tr->times_of_day[topts->time_of_day_ind];
+    const char* translated_time = (raw_time_str != NULL) ? raw_time_str : "";
 
-    snprintf(line, MAX_TOOTHPASTE_LINE, "%s\n", translated_swap_msg);
-	
-    return line;
+    (void)pick;
+    render_printf(out, MAX_TOOTHPASTE_LINE, "%s %s ", translated_good, translated_time);
 }
 
-static char*
-str_visit_dentist(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
-{
-    if (topts == NULL || pick == NULL) return NULL;		
-
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL; 
-    
-    memset(line, 0, MAX_TOOTHPASTE_LINE);	
 
-    
-    const char* translated_dentist_msg = _(user_strings[MSG_DENTIST]);
+static void
+str_anon_username(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
+{
+    (void)topts;
+    if (pick->who == NULL) return;
 
-    
-    snprintf(line, MAX_TOOTHPASTE_LINE, "%s\n", translated_dentist_msg);
-		
-    return line;
+    render_printf(out, UNLEN + 3, "%s ", pick->who);
 }
 
-static char*
-str_already_picked(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+str_welcome(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-    if (topts == NULL || pick == NULL) return NULL;		
-
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL; 
-    
-    memset(line, 0, MAX_TOOTHPASTE_LINE);	
+    (void)pick;
+    render_printf(out, MAX_TOOTHPASTE_LINE, "%s\n", locale_strings(topts)->user[MSG_WELCOME]);
+}
 
- 
-    const char* translated_already_msg = _(user_strings[MSG_ALREADY]);
+static void
+str_next_pick(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
+{
+    (void)pick;
+    render_printf(out, MAX_TOOTHPASTE_LINE, "%s\n", locale_strings(topts)->user[MSG_NEXT_PICK]);
+}
 
-    snprintf(line, MAX_TOOTHPASTE_LINE, "%s\n", translated_already_msg);
-		
-    return line;
+static void
+str_new_toothbrush(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
+{
+    (void)pick;
+    render_printf(out, MAX_TOOTHPASTE_LINE, "%s\n", locale_strings(topts)->user[MSG_SWAP_TOOTHBRUSH]);
 }
 
-static char*
-str_pick_type(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+str_visit_dentist(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-    if (topts == NULL || pick == NULL) return NULL;		
+    (void)pick;
+    render_printf(out, MAX_TOOTHPASTE_LINE, "%s\n", locale_strings(topts)->user[MSG_DENTIST]);
+}
 
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL;
-    
-    memset(line, 0, MAX_TOOTHPASTE_LINE);	
+static void
+str_already_picked(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
+{
+    (void)pick;
+    render_printf(out, MAX_TOOTHPASTE_LINE, "%s\n", locale_strings(topts)->user[MSG_ALREADY]);
+}
 
-    
-    const char* label = _(user_strings[MSG_PICK_TYPE]);
+static void
+str_pick_type(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
+{
+    const locale_strings_t* tr = locale_strings(topts);
+    const char* label = tr->user[MSG_PICK_TYPE];
 
-    
-    const char* raw_pick_str = pick_type_strings[topts->ptype];
-    const char* translated_pick = (raw_pick_str != NULL) ? _(raw_pick_str) : "";
+    const char* raw_pick_str = tr->pick_types[topts->ptype];
+    const char* translated_pick = (raw_pick_str != NULL) ? raw_pick_str : "";
 
-    snprintf(line, MAX_TOOTHPASTE_LINE, "%s: %s\n", label, translated_pick);
-		
-    return line;
+    (void)pick;
+    render_printf(out, MAX_TOOTHPASTE_LINE, "%s: %s\n", label, translated_pick);
 }
 
-static char*
-str_toothpaste(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+str_toothpaste(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-    if (topts == NULL || pick == NULL) return NULL;		
-
-    char* line = malloc(MAX_LINE_LENGTH);
-    if (line == NULL) return NULL; 
-    
-    memset(line, 0, MAX_LINE_LENGTH);	
-
-    const char* translated_toothpaste_label = _(user_strings[MSG_TOOTHPASTE]);
+    const char* translated_toothpaste_label = locale_strings(topts)->user[MSG_TOOTHPASTE];
 
     const char* brand = (pick->what.toothpaste_brand != NULL) ? pick->what.toothpaste_brand : "";
 
-    snprintf(line, MAX_LINE_LENGTH, "%s %s %.127s (%ug) [%u/100] %s\n", 
+    render_printf(out, MAX_LINE_LENGTH, "%s %s %.127s (%ug) [%u/100] %s\n", 
              translated_toothpaste_label, 
              right_armour, 
              brand, 
              pick->what.tube_mass_g, 
              pick->what.rating, 
              left_armour);
-		
-    return line;
 }
 
-static char*
-str_toothbrush(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+str_toothbrush(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-    if (topts == NULL || pick == NULL) return NULL;		
-
-    char* line = malloc(MAX_LINE_LENGTH);
-    if (line == NULL) return NULL; 
-    
-    memset(line, 0, MAX_LINE_LENGTH);
-	
     if (topts->enhanced_toothpastes)
     {
-       
-        const char* label_toothbrush = _(user_strings[MSG_TOOTHBRUSH]);
+        const char* label_toothbrush = locale_strings(topts)->user[MSG_TOOTHBRUSH];
 
-        snprintf(line, MAX_LINE_LENGTH, "%s %s %s %u %u\n", 
+        render_printf(out, MAX_LINE_LENGTH, "%s %s %s %u %u\n", 
                  label_toothbrush, 
                  pick->what.toothbrush_color, 
                  pick->what.toothbrush_brand, 
                  pick->what.toothbrush_length_cm, 
                  pick->what.toothbrush_hardness);
-    }	
-    else 
-    {
-        
-        line[0] = '\0';
     }
-
-    return line;
 }
 
-static char*
-str_toothpaste_index(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+str_toothpaste_index(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-    if (topts == NULL || pick == NULL) return NULL;		
-
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL;
-    
-    memset(line, 0, MAX_TOOTHPASTE_LINE);	
-
-    
-    const char* translated_index_label = _(user_strings[MSG_TOOTHPASTE_I]);
+    const char* translated_index_label = locale_strings(topts)->user[MSG_TOOTHPASTE_I];
 
-   
-    snprintf(line, MAX_TOOTHPASTE_LINE, "%s %u/%u\n", 
+    render_printf(out, MAX_TOOTHPASTE_LINE, "%s %u/%u\n", 
              translated_index_label, 
              pick->toothpaste_pick_index, 
              pick->total_toothpastes);
-		
-    return line;
 }
 
-static char*
-str_toothpaste_type(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+str_toothpaste_type(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-    if (topts == NULL || pick == NULL) return NULL;		
-
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL; 
-    
-    memset(line, 0, MAX_TOOTHPASTE_LINE);		
-
-    const char* label = _(user_strings[MSG_TOOTHPASTE_T]);
+    const locale_strings_t* tr = locale_strings(topts);
+    const char* label = tr->user[MSG_TOOTHPASTE_T];
 
+    const char* raw_type_str = tr->toothpaste_types[pick->what.type];
     
-    const char* raw_type_str = toothpaste_type_strings[pick->what.type];
-    
-    const char* translated_type = (raw_type_str != NULL) ? _(raw_type_str) : "";
-
-    snprintf(line, MAX_TOOTHPASTE_LINE, "%s %s \n", label, translated_type);
-		
-    return line;
+    const char* translated_type = (raw_type_str != NULL) ? raw_type_str : "";
+    render_printf(out, MAX_TOOTHPASTE_LINE, "%s %s \n", label, translated_type);
 }
 
-static char*
-str_dental_formula(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+str_dental_formula(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-    if (topts == NULL || pick == NULL) return NULL;		
-
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL; 
-    
-    memset(line, 0, MAX_TOOTHPASTE_LINE);		
-
-    const char* translated_dental_label = _(user_strings[MSG_DENTAL]);
+    const char* translated_dental_label = locale_strings(topts)->user[MSG_DENTAL];
 
-    snprintf(line, MAX_TOOTHPASTE_LINE, "%s %u-%u-%u-%u\n", 
+    (void)pick;
+    render_printf(out, MAX_TOOTHPASTE_LINE, "%s %u-%u-%u-%u\n", 
              translated_dental_label, 
              topts->formula.brush_times_per_day, 
              topts->formula.minutes_per_brush, 
              topts->formula.swap_toothbrush_times_per_year, 
              topts->formula.visit_dentist_times_per_year);
-		
-    return line;
 }
 
-static char*
-str_day_of_the_week(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+str_day_of_the_week(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-    if (topts == NULL || pick == NULL) return NULL;	
-
-    char* line = malloc(MAX_LINE_LENGTH);
-    if (line == NULL) return NULL; 
-    
-    memset(line, 0, MAX_LINE_LENGTH);	
-
-    const char* translated_msg_day = _(user_strings[MSG_DAY]);
-    const char* translated_day_name = _(days_of_week[pick->j]);
-
-    snprintf(line, MAX_LINE_LENGTH, "%s %s %jd \n", 
+    const locale_strings_t* tr = locale_strings(topts);
+    const char* translated_msg_day = tr->user[MSG_DAY];
+    const char* translated_day_name = tr->days_of_week[pick->j];
+    render_printf(out, MAX_LINE_LENGTH, "%s %s %jd \n", 
              translated_msg_day, 
              translated_day_name, 
              (intmax_t)pick->day);
-		
-    return line;
 }
 
-static char*
-str_total_picks(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+str_total_picks(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-    if (topts == NULL || pick == NULL) return NULL;	
-
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL; 
-    
-    memset(line, 0, MAX_TOOTHPASTE_LINE);		
-    
-    const char* translated_total_picks = _(user_strings[MSG_TOTAL_PICKS]);
+    const char* translated_total_picks = locale_strings(topts)->user[MSG_TOTAL_PICKS];
 
     if (topts->fake_stats) {
-        snprintf(line, MAX_TOOTHPASTE_LINE, "%s ~%u\n", translated_total_picks, pick->stats.total_picks);
+        render_printf(out, MAX_TOOTHPASTE_LINE, "%s ~%u\n", translated_total_picks, pick->stats.total_picks);
     } else {
-        snprintf(line, MAX_TOOTHPASTE_LINE, "%s %u\n", translated_total_picks, pick->stats.total_picks);
+        render_printf(out, MAX_TOOTHPASTE_LINE, "%s %u\n", translated_total_picks, pick->stats.total_picks);
     }
-		
-    return line;
 }
 
-static char* 
-str_brushing_coverage(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts)
+static void 
+str_brushing_coverage(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-	if (topts == NULL || pick == NULL)
-	return NULL;
-
-    char *line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL)
-        return NULL;
-
-    memset(line, 0, MAX_TOOTHPASTE_LINE);
-
-    const char *translated_label = _(user_strings[MSG_COVERAGE]);
-	
-	snprintf(line,
+	render_printf(out,
 		 MAX_TOOTHPASTE_LINE,
 		 "%s %u%%\n",
-		 translated_label,
+		 locale_strings(topts)->user[MSG_COVERAGE],
 		 pick->coverage_percents);
-
-    return line;
-
 }
 
-static char*
-str_last_pick_time(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+/* One rolling coverage line, window is MSG_COVERAGE_SHORT, _LONG or _YEAR */
+static void 
+str_coverage_window(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out, user_msg_t window)
 {
-    if (topts == NULL || pick == NULL)
-        return NULL;
-
-    char *line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL)
-        return NULL;
+	unsigned int percents;
+	
+	switch (window)
+	{
+		case MSG_COVERAGE_SHORT: percents = pick->coverage_short_percents; break;
+		case MSG_COVERAGE_LONG: percents = pick->coverage_long_percents; break;
+		default: window = MSG_COVERAGE_YEAR; percents = pick->coverage_year_percents; break;
+	}
+	render_printf(out,
+		 MAX_TOOTHPASTE_LINE,
+		 "%s %u%%\n",
+		 locale_strings(topts)->user[window],
+		 percents);
+}
 
-    memset(line, 0, MAX_TOOTHPASTE_LINE);
+static void 
+str_coverage_short(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out)
+{
+	str_coverage_window(pick, topts, out, MSG_COVERAGE_SHORT);
+}
 
-    const char *translated_label = _(user_strings[MSG_LAST_PICK_TIME]);
+static void 
+str_coverage_long(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out)
+{
+	str_coverage_window(pick, topts, out, MSG_COVERAGE_LONG);
+}
 
-    char time_string[64] = "";
+static void 
+str_coverage_year(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out)
+{
+	str_coverage_window(pick, topts, out, MSG_COVERAGE_YEAR);
+}
 
-    {
-        struct tm tm_buf;
+static void
+format_last_pick_time(const toothpaste_pick_t* pick, char* buffer, size_t size)
+{
+    struct tm tm_buf;
 
+    buffer[0] = '\0';
 #if defined(_WIN32) || defined(_WIN64)
-        if (localtime_s(&tm_buf, &pick->stats.last_pick_time) == 0)
+    if (localtime_s(&tm_buf, &pick->stats.last_pick_time) == 0)
 #elif defined(__EMSCRIPTEN__) || defined(__wasi__)
-        if (localtime_r(&pick->stats.last_pick_time, &tm_buf) != NULL)
+    if (localtime_r(&pick->stats.last_pick_time, &tm_buf) != NULL)
 #else
-        if (localtime_r(&pick->stats.last_pick_time, &tm_buf) != NULL)
+    if (localtime_r(&pick->stats.last_pick_time, &tm_buf) != NULL)
 #endif
-        {
-            strftime(time_string,
-                     sizeof(time_string),
-                     "%Y-%m-%d %H:%M:%S",
-                     &tm_buf);
-        }
+    {
+        strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &tm_buf);
     }
+}
+
+static void
+str_last_pick_time(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
+{
+    const char *translated_label = locale_strings(topts)->user[MSG_LAST_PICK_TIME];
+
+    char time_string[64] = "";
 
-    snprintf(line,
+    format_last_pick_time(pick, time_string, sizeof(time_string));
+    render_printf(out,
              MAX_TOOTHPASTE_LINE,
              "%s %s\n",
              translated_label,
              time_string);
-
-    return line;
 }
 
-static char*
-str_tubes_wasted(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+str_tubes_wasted(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-    if (topts == NULL || pick == NULL) return NULL;		
-
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL; 
-    
-    memset(line, 0, MAX_TOOTHPASTE_LINE);			
-
-    const char* translated_tubes_wasted = _(user_strings[MSG_TUBES_WASTED]);
+    const char* translated_tubes_wasted = locale_strings(topts)->user[MSG_TUBES_WASTED];
 
-    const char* report = (pick->waste_report != NULL) ? pick->waste_report : "";
-
-    snprintf(line, MAX_TOOTHPASTE_LINE, "%s %s\n", translated_tubes_wasted, report);
-		
-    return line;
+    render_printf(out, MAX_TOOTHPASTE_LINE, "%s %s\n", translated_tubes_wasted, eval_waste_report(pick));
 }
 
-static char*
-str_source(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+str_source(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-    if (topts == NULL || pick == NULL) return NULL;		
-    
-    const char* translated_source = _(user_strings[MSG_SOURCE]);
-    
     const char* path_str = (topts->toothpastes_file_path_final != NULL) ? 
                             topts->toothpastes_file_path_final : "";
 
-    size_t needed = strlen(translated_source) + strlen(path_str) + 4;
+    (void)pick;
+    render_printf(out, SIZE_MAX, "%s %s \n", locale_strings(topts)->user[MSG_SOURCE], path_str);
+}
 
-    char* line = malloc(needed);
-    if (line == NULL) return NULL; 
-    
-    snprintf(line, needed, "%s %s \n", translated_source, path_str);
-		
-    return line;
+static void
+str_meme(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
+{
+    const char* payload = (topts->meme_payload != NULL) ? topts->meme_payload : "";
+
+    (void)pick;
+    render_printf(out, SIZE_MAX, "%s %s\n", locale_strings(topts)->user[MSG_MEME], payload);
 }
 
-static char*
-str_meme(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+static void
+str_quiet(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out)
 {
-    if (topts == NULL || pick == NULL) return NULL;	
+    const char* brand = (pick->what.toothpaste_brand != NULL) ? pick->what.toothpaste_brand : "";
 
-    const char* translated_meme_label = _(user_strings[MSG_MEME]);
+    (void)topts;
+    render_printf(out, MAX_TOOTHPASTE_LINE, "%.94s (%ug) [%u/100]\n", 
+             brand, 
+             pick->what.tube_mass_g, 
+             pick->what.rating);
+}
 
-    const char* payload = (topts->meme_payload != NULL) ? topts->meme_payload : "";
+static int
+check_visibility(int input_id, int new_pick_flag, int toothbrush_flag, int dentist_flag, int verbose) {
+    if (input_id == 20) {
+        return verbose ? 0 : 1;  
+    }
+    if (!verbose) return 0;
+
+    if (input_id >= 7 || input_id <= 2) return 1;
+    if (input_id == 3 && new_pick_flag) return 1;
+    if (input_id == 4 && toothbrush_flag) return 1;
+    if (input_id == 5 && dentist_flag) return 1;
+    if (input_id == 6 && !new_pick_flag) return 1;
+    return 0;
+}
 
-    size_t needed = strlen(translated_meme_label) + strlen(payload) + 3;
+/* Template character to output string id plus one, zero is not a token */
+static const unsigned char template_tokens[UCHAR_MAX + 1] = {
+	['g'] = 1, ['u'] = 2, ['w'] = 3, ['n'] = 4, ['t'] = 5, ['d'] = 6,
+	['a'] = 7, ['p'] = 8, ['o'] = 9, ['b'] = 10, ['i'] = 11, ['T'] = 12,
+	['f'] = 13, ['W'] = 14, ['P'] = 15, ['l'] = 16, ['c'] = 17, ['U'] = 18,
+	['s'] = 19, ['m'] = 20, ['I'] = 21, ['K'] = 22, ['M'] = 23, ['Y'] = 24
+};
 
-    char* line = malloc(needed);
-    if (line == NULL) return NULL;
-    
-    snprintf(line, needed, "%s %s\n", translated_meme_label, payload);
-    
-    return line;
+/* Output string ids in template_tokens order */
+static const render_field_t template_fields[TOTAL_OUTPUT_STRINGS] = {
+	str_good_day, str_anon_username, str_welcome, str_next_pick,
+	str_new_toothbrush, str_visit_dentist, str_already_picked, str_pick_type,
+	str_toothpaste, str_toothbrush, str_toothpaste_index, str_toothpaste_type,
+	str_dental_formula, str_day_of_the_week, str_total_picks, str_last_pick_time,
+	str_brushing_coverage, str_tubes_wasted, str_source, str_meme,
+	str_quiet, str_coverage_short, str_coverage_long, str_coverage_year
+};
+
+/* {name} to the value it shows, the JSON record keys plus short aliases */
+static const template_name_t template_names[TOTAL_TEMPLATE_NAMES] = {
+	{"who", VALUE_WHO}, {"user", VALUE_WHO},
+	{"pick_type", VALUE_PICK_TYPE},
+	{"toothpaste", VALUE_TOOTHPASTE}, {"brand", VALUE_TOOTHPASTE},
+	{"tube_mass_g", VALUE_TUBE_MASS}, {"mass", VALUE_TUBE_MASS},
+	{"rating", VALUE_RATING},
+	{"toothbrush_color", VALUE_TOOTHBRUSH_COLOR},
+	{"toothbrush_brand", VALUE_TOOTHBRUSH_BRAND},
+	{"toothbrush_length_cm", VALUE_TOOTHBRUSH_LENGTH},
+	{"toothbrush_hardness", VALUE_TOOTHBRUSH_HARDNESS},
+	{"toothpaste_index", VALUE_TOOTHPASTE_INDEX},
+	{"total_toothpastes", VALUE_TOTAL_TOOTHPASTES},
+	{"toothpaste_type", VALUE_TOOTHPASTE_TYPE},
+	{"dental_formula", VALUE_DENTAL_FORMULA},
+	{"day_of_the_week", VALUE_DAY_OF_THE_WEEK},
+	{"day_counter", VALUE_DAY_COUNTER},
+	{"total_picks", VALUE_TOTAL_PICKS},
+	{"last_pick_time", VALUE_LAST_PICK_TIME},
+	{"coverage_percent", VALUE_COVERAGE}, {"coverage", VALUE_COVERAGE},
+	{"coverage_7_days", VALUE_COVERAGE_7_DAYS},
+	{"coverage_30_days", VALUE_COVERAGE_30_DAYS},
+	{"coverage_this_year", VALUE_COVERAGE_THIS_YEAR},
+	{"picks_this_week", VALUE_PICKS_THIS_WEEK},
+	{"picks_this_month", VALUE_PICKS_THIS_MONTH},
+	{"tubes_wasted", VALUE_TUBES_WASTED},
+	{"source", VALUE_SOURCE},
+	{"meme", VALUE_MEME},
+	{"time_of_day", VALUE_TIME_OF_DAY}
+};
+
+/* Replaces tpm_template with a copy of any length, -T and TEMPLATE use it */
+static int
+set_output_template(toothpaste_pick_options_t* opts, const char* text)
+{
+	char* copy = _strdup(text);
+	
+	if (copy == NULL)
+	{
+		return MALLOC_FAILED;
+	}
+	free(opts->tpm_template);
+	opts->tpm_template = copy;
+	return TPM_NO_ERROR;
+}
+
+static void
+free_template(toothpaste_pick_options_t* topts)
+{
+	free(topts->template_source);
+	free(topts->template_ops);
+	free(topts->template_literals);
+	topts->template_source = NULL;
+	topts->template_ops = NULL;
+	topts->template_literals = NULL;
+	topts->template_op_count = 0;
+}
+
+/* The inside of one {...}: a legacy letter for its whole line, or a value
+   name followed by :upper, :lower and printf-like [-][0][width][.precision]
+   modifiers. Anything else is INVALID_ARGUMENT and stays literal text */
+static int
+parse_template_field(const char* name, size_t length, template_op_t* op)
+{
+	const char* end = name + length;
+	const char* colon = memchr(name, ':', length);
+	size_t name_length = (colon != NULL) ? (size_t)(colon - name) : length;
+	const char* p;
+	unsigned int k;
+	
+	memset(op, 0, sizeof(*op));
+	if (name_length == 1 && template_tokens[(unsigned char)name[0]] != 0)
+	{
+		op->kind = TEMPLATE_LINE;
+		op->id = (unsigned char)(template_tokens[(unsigned char)name[0]] - 1);
+		return (colon == NULL) ? TPM_NO_ERROR : INVALID_ARGUMENT;
+	}
+	for (k = 0; k < TOTAL_TEMPLATE_NAMES; k++)
+	{
+		if (strlen(template_names[k].name) == name_length &&
+			memcmp(template_names[k].name, name, name_length) == 0)
+		{
+			break;
+		}
+	}
+	if (k == TOTAL_TEMPLATE_NAMES)
+	{
+		return INVALID_ARGUMENT;
+	}
+	op->kind = TEMPLATE_VALUE;
+	op->id = (unsigned char)template_names[k].value;
+	
+	p = colon;
+	while (p != NULL && p < end)
+	{
+		const char* segment = p + 1;
+		const char* stop = memchr(segment, ':', (size_t)(end - segment));
+		const char* q = segment;
+		
+		if (stop == NULL)
+		{
+			stop = end;
+		}
+		if (stop - segment == 5 && memcmp(segment, "upper", 5) == 0)
+		{
+			op->flags |= TEMPLATE_UPPER;
+		}
+		else if (stop - segment == 5 && memcmp(segment, "lower", 5) == 0)
+		{
+			op->flags |= TEMPLATE_LOWER;
+		}
+		else
+		{
+			if (q < stop && *q == '-')
+			{
+				op->flags |= TEMPLATE_LEFT;
+				q++;
+			}
+			if (q < stop && *q == '0')
+			{
+				op->flags |= TEMPLATE_ZERO;
+				q++;
+			}
+			for (op->width = 0; q < stop && *q >= '0' && *q <= '9'; q++)
+			{
+				op->width = op->width * 10 + (unsigned int)(*q - '0');
+				if (op->width > MAX_TEMPLATE_WIDTH)
+				{
+					return INVALID_ARGUMENT;
+				}
+			}
+			if (q < stop && *q == '.')
+			{
+				op->flags |= TEMPLATE_PRECISION;
+				for (op->precision = 0, q++; q < stop && *q >= '0' && *q <= '9'; q++)
+				{
+					op->precision = op->precision * 10 + (unsigned int)(*q - '0');
+					if (op->precision > MAX_TEMPLATE_WIDTH)
+					{
+						return INVALID_ARGUMENT;
+					}
+				}
+			}
+			if (q == segment || q != stop)
+			{
+				return INVALID_ARGUMENT;
+			}
+		}
+		p = stop;
+	}
+	return TPM_NO_ERROR;
+}
+
+/* Turns tpm_template into a render program once. A template without braces
+   is the classic letter list, unknown letters are dropped here instead of
+   on every render. With braces the text between fields is kept, {{ and }}
+   stand for the braces themselves and \n, \t and \\ are unescaped */
+static int
+compile_template(toothpaste_pick_options_t* topts)
+{
+	const char* text = (strcmp(topts->tpm_template, "*") == 0) ? DEFAULT_OUTPUT_TEMPLATE : topts->tpm_template;
+	size_t length = strlen(text);
+	const char* src = text;
+	size_t run = 0;
+	size_t used = 0;
+	template_op_t op;
+	template_op_t literal;
+	unsigned char id;
+	
+	free_template(topts);
+	topts->template_source = _strdup(text);
+	topts->template_ops = malloc((length + 1) * sizeof(template_op_t));
+	topts->template_literals = malloc(length + 1);
+	if (!topts->template_source || !topts->template_ops || !topts->template_literals)
+	{
+		free_template(topts);
+		return MALLOC_FAILED;
+	}
+	if (strchr(text, '{') == NULL)
+	{
+		while (*src != '\0')
+		{
+			id = template_tokens[(unsigned char)*src++];
+			if (id != 0)
+			{
+				memset(&op, 0, sizeof(op));
+				op.kind = TEMPLATE_LINE;
+				op.id = (unsigned char)(id - 1);
+				topts->template_ops[topts->template_op_count++] = op;
+			}
+		}
+		return TPM_NO_ERROR;
+	}
+	while (*src != '\0')
+	{
+		const char* close = (*src == '{' && src[1] != '{') ? strchr(src + 1, '}') : NULL;
+		
+		if (close != NULL && parse_template_field(src + 1, (size_t)(close - src - 1), &op) == TPM_NO_ERROR)
+		{
+			if (used > run)
+			{
+				memset(&literal, 0, sizeof(literal));
+				literal.kind = TEMPLATE_LITERAL;
+				literal.offset = run;
+				literal.length = used - run;
+				topts->template_ops[topts->template_op_count++] = literal;
+				run = used;
+			}
+			topts->template_ops[topts->template_op_count++] = op;
+			src = close + 1;
+			continue;
+		}
+		if ((src[0] == '{' || src[0] == '}') && src[1] == src[0])
+		{
+			topts->template_literals[used++] = *src;
+			src += 2;
+		}
+		else if (src[0] == '\\' && (src[1] == 'n' || src[1] == 't' || src[1] == '\\'))
+		{
+			topts->template_literals[used++] = (src[1] == 'n') ? '\n' : (src[1] == 't') ? '\t' : '\\';
+			src += 2;
+		}
+		else
+		{
+			topts->template_literals[used++] = *src++;
+		}
+	}
+	if (used > run)
+	{
+		memset(&literal, 0, sizeof(literal));
+		literal.kind = TEMPLATE_LITERAL;
+		literal.offset = run;
+		literal.length = used - run;
+		topts->template_ops[topts->template_op_count++] = literal;
+	}
+	return TPM_NO_ERROR;
 }
 
-static char*
-str_quiet(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts)
+/* The text of one value, numbers are formatted into scratch */
+static const char*
+template_value(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, unsigned int id, char* scratch, size_t size)
 {
-    if (topts == NULL || pick == NULL) return NULL;	
-
-    char* line = malloc(MAX_TOOTHPASTE_LINE);
-    if (line == NULL) return NULL; 
-    
-    memset(line, 0, MAX_TOOTHPASTE_LINE);			
-
-    const char* brand = (pick->what.toothpaste_brand != NULL) ? pick->what.toothpaste_brand : "";
-
-    snprintf(line, MAX_TOOTHPASTE_LINE, "%.94s (%ug) [%u/100]\n", 
-             brand, 
-             pick->what.tube_mass_g, 
-             pick->what.rating);
-
-    return line;
+	const locale_strings_t* tr = locale_strings(topts);
+	const char* text = NULL;
+	uintmax_t number = 0;
+	int numeric = 0;
+	
+	switch (id)
+	{
+		case VALUE_WHO: text = pick->who; break;
+		case VALUE_PICK_TYPE: text = tr->pick_types[topts->ptype]; break;
+		case VALUE_TOOTHPASTE: text = pick->what.toothpaste_brand; break;
+		case VALUE_TUBE_MASS: number = pick->what.tube_mass_g; numeric = 1; break;
+		case VALUE_RATING: number = pick->what.rating; numeric = 1; break;
+		case VALUE_TOOTHBRUSH_COLOR: text = pick->what.toothbrush_color; break;
+		case VALUE_TOOTHBRUSH_BRAND: text = pick->what.toothbrush_brand; break;
+		case VALUE_TOOTHBRUSH_LENGTH: number = pick->what.toothbrush_length_cm; numeric = 1; break;
+		case VALUE_TOOTHBRUSH_HARDNESS: number = pick->what.toothbrush_hardness; numeric = 1; break;
+		case VALUE_TOOTHPASTE_INDEX: number = pick->toothpaste_pick_index; numeric = 1; break;
+		case VALUE_TOTAL_TOOTHPASTES: number = pick->total_toothpastes; numeric = 1; break;
+		case VALUE_TOOTHPASTE_TYPE: text = tr->toothpaste_types[pick->what.type]; break;
+		case VALUE_DAY_OF_THE_WEEK: text = tr->days_of_week[pick->j]; break;
+		case VALUE_TOTAL_PICKS: number = pick->stats.total_picks; numeric = 1; break;
+		case VALUE_COVERAGE: number = pick->coverage_percents; numeric = 1; break;
+		case VALUE_COVERAGE_7_DAYS: number = pick->coverage_short_percents; numeric = 1; break;
+		case VALUE_COVERAGE_30_DAYS: number = pick->coverage_long_percents; numeric = 1; break;
+		case VALUE_COVERAGE_THIS_YEAR: number = pick->coverage_year_percents; numeric = 1; break;
+		case VALUE_PICKS_THIS_WEEK: number = pick->picks_this_week; numeric = 1; break;
+		case VALUE_PICKS_THIS_MONTH: number = pick->picks_this_month; numeric = 1; break;
+		case VALUE_TUBES_WASTED: text = eval_waste_report(pick); break;
+		case VALUE_SOURCE: text = topts->toothpastes_file_path_final; break;
+		case VALUE_MEME: text = topts->meme_payload; break;
+		case VALUE_TIME_OF_DAY: text = tr->times_of_day[topts->time_of_day_ind]; break;
+		case VALUE_DAY_COUNTER:
+			snprintf(scratch, size, "%jd", (intmax_t)pick->day);
+			return scratch;
+		case VALUE_LAST_PICK_TIME:
+			format_last_pick_time(pick, scratch, size);
+			return scratch;
+		case VALUE_DENTAL_FORMULA:
+			snprintf(scratch, size, "%u-%u-%u-%u",
+				topts->formula.brush_times_per_day, topts->formula.minutes_per_brush,
+				topts->formula.swap_toothbrush_times_per_year, topts->formula.visit_dentist_times_per_year);
+			return scratch;
+		default:
+			return "";
+	}
+	if (!numeric)
+	{
+		return (text != NULL) ? text : "";
+	}
+	snprintf(scratch, size, "%ju", number);
+	return scratch;
 }
 
-static int
-check_visibility(int input_id, int new_pick_flag, int toothbrush_flag, int dentist_flag, int verbose) {
-    if (input_id == 20) {
-        return verbose ? 0 : 1;  
-    }
-    if (!verbose) return 0;
-
-    if (input_id >= 7 || input_id <= 2) return 1;
-    if (input_id == 3 && new_pick_flag) return 1;
-    if (input_id == 4 && toothbrush_flag) return 1;
-    if (input_id == 5 && dentist_flag) return 1;
-    if (input_id == 6 && !new_pick_flag) return 1;
-    return 0;
+/* Width and precision count UTF-8 characters so non-ASCII brands line up,
+   case changes only touch ASCII letters */
+static void
+template_emit(render_buffer_t* out, const template_op_t* op, const char* value)
+{
+	size_t length = strlen(value);
+	size_t end;
+	size_t chars = 0;
+	size_t pad;
+	size_t k;
+	char* dst;
+	
+	for (end = 0; end < length; end++)
+	{
+		if (((unsigned char)value[end] & 0xC0) != 0x80)
+		{
+			if ((op->flags & TEMPLATE_PRECISION) && chars == op->precision)
+			{
+				break;
+			}
+			chars++;
+		}
+	}
+	pad = (op->width > chars) ? op->width - chars : 0;
+	if (render_reserve(out, end + pad) != TPM_NO_ERROR)
+	{
+		return;
+	}
+	dst = out->data + out->length;
+	if (!(op->flags & TEMPLATE_LEFT))
+	{
+		memset(dst, (op->flags & TEMPLATE_ZERO) ? '0' : ' ', pad);
+		dst += pad;
+	}
+	for (k = 0; k < end; k++)
+	{
+		unsigned char c = (unsigned char)value[k];
+		
+		if ((op->flags & TEMPLATE_UPPER) && c >= 'a' && c <= 'z')
+		{
+			c = (unsigned char)(c - 'a' + 'A');
+		}
+		else if ((op->flags & TEMPLATE_LOWER) && c >= 'A' && c <= 'Z')
+		{
+			c = (unsigned char)(c - 'A' + 'a');
+		}
+		*dst++ = (char)c;
+	}
+	if (op->flags & TEMPLATE_LEFT)
+	{
+		memset(dst, ' ', pad);
+		dst += pad;
+	}
+	out->length = (size_t)(dst - out->data);
+	out->data[out->length] = '\0';
 }
 
+/* Only the visible fields are formatted, then handed over as pick->message */
 static int
-char_to_strnum(char input)
+render_template(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, int new_pick_flag, int toothbrush_flag, int dentist_flag)
 {
-	switch(input)
+	const char* text = (strcmp(topts->tpm_template, "*") == 0) ? DEFAULT_OUTPUT_TEMPLATE : topts->tpm_template;
+	char scratch[64];
+	render_buffer_t out;
+	const template_op_t* op;
+	size_t k;
+	
+	if (topts->template_source == NULL || strcmp(topts->template_source, text) != 0)
 	{
-		case 'g':
-		return 0;
-		break;
-		case 'u':
-		return 1;
-		break;
-		case 'w':
-		return 2;
-		break;
-		case 'n':
-		return 3;
-		break;
-		case 't':
-		return 4;
-		break;
-		case 'd':
-		return 5;
-		break;
-		case 'a':
-		return 6;
-		break;	
-		case 'p':
-		return 7;
-		break;
-		case 'o':
-		return 8;
-		break;
-		case 'b':
-		return 9;
-		break;
-		case 'i':
-		return 10;
-		break;
-		case 'T':
-		return 11;
-		break;		
-		case 'f':
-		return 12;
-		break;		
-		case 'W':
-		return 13;
-		break;		
-		case 'P':
-		return 14;
-		break;		
-		case 'l':
-		return 15;
-		break;
-		case 'c':
-		return 16;
-		break;			
-		case 'U':
-		return 17;
-		break;		
-		case 's':
-		return 18;
-		break;		
-		case 'm':
-		return 19;
-		break;
-		case 'I':
-		return 20;
-		break;			
-		
-		default:
-			return -1;
-			break;
+		if (compile_template(topts) != TPM_NO_ERROR)
+		{
+			return MALLOC_FAILED;
+		}
 	}
-/*	return -1; */
+	render_init(&out);
+	for (k = 0; k < topts->template_op_count; k++)
+	{
+		op = &topts->template_ops[k];
+		if (op->kind == TEMPLATE_LITERAL)
+		{
+			render_append(&out, topts->template_literals + op->offset, op->length);
+		}
+		else if (op->kind == TEMPLATE_VALUE)
+		{
+			template_emit(&out, op, template_value(pick, topts, op->id, scratch, sizeof(scratch)));
+		}
+		else if (check_visibility(op->id, new_pick_flag, toothbrush_flag, dentist_flag, topts->verbose))
+		{
+			template_fields[op->id](pick, topts, &out);
+		}
+	}
+	free(pick->message);
+	pick->message = render_detach(&out);
+	return (pick->message != NULL) ? TPM_NO_ERROR : MALLOC_FAILED;
 }
 
 
 TPM int 
 tpm_pick_toothpaste(list_node_t* head, toothpaste_pick_options_t* topts, toothpaste_pick_t* pick)
 {
-    unsigned int i = 0, k, ti;
+    unsigned int i = 0, k;
     time_t total_seconds = time(NULL) + topts->delta_days * SECONDS_PER_DAY + topts->delta_hours * SECONDS_PER_HOUR;
     char line[MAX_LINE_LENGTH];
     int new_pick_flag = 0;
     int dentist_flag = 0;
     int toothbrush_flag = 0;
     size_t brand_len;
-    char* toothpaste_picking_message[TOTAL_OUTPUT_STRINGS] = { NULL };
-	char current_char;
-	int str_num = 0;
 	unsigned int interval;
-    size_t current_len;
-	size_t remaining_space;
 	
 	int result = TPM_NO_ERROR;
+	stats_lock_t stats_lock = STATS_NO_LOCK;
 	
     pick->opts = topts;
     memset(line, 0, MAX_LINE_LENGTH);
 
 
-    pick->message = malloc(OUTPUT_BLOCK_SIZE);
-    pick->JSON = malloc(OUTPUT_BLOCK_SIZE);
-    pick->CSV = malloc(OUTPUT_BLOCK_SIZE);
+    pick->message = NULL;
+    pick->JSON = NULL;
+    pick->CSV = NULL;
     pick->waste_report = NULL;
     pick->head = head;
     pick->where = head;
-	
-    if (!pick->message || !pick->JSON || !pick->CSV) {
-		result = MALLOC_FAILED;
-		goto cleanup;
-        /*free(pick->message); free(pick->JSON); free(pick->CSV);
-        return MALLOC_FAILED; */
-    }
-    
-    memset(pick->JSON, 0, OUTPUT_BLOCK_SIZE);    
-    memset(pick->message, 0, OUTPUT_BLOCK_SIZE);
-    memset(pick->CSV, 0, OUTPUT_BLOCK_SIZE);    
     
 	if (eval_username(pick, topts) != 0)
 	{
@@ -2275,13 +6563,21 @@ tpm_pick_toothpaste(list_node_t* head, toothpaste_pick_options_t* topts, toothpa
     
 
     if (pick->total_toothpastes <= 0) {
-        snprintf(pick->message, OUTPUT_BLOCK_SIZE,"%s", _(error_strings[NO_TOOTHPASTES_AVAILBLE]));
         result = NO_TOOTHPASTES_AVAILBLE;
 		goto cleanup;
 		/*return NO_TOOTHPASTES_AVAILBLE;*/ 
     }
 
-    read_counters(&pick->stats, pick->opts->fake_stats,pick->opts);
+    /* held until the pick is written back so overlapping runs see each other */
+    if (!pick->opts->fake_stats)
+    {
+        stats_lock = lock_stats(pick->opts);
+    }
+    if (read_counters(&pick->stats, pick->opts->fake_stats,pick->opts) == 0)
+    {
+        result = PICKSTATS_READ_FAILED;
+        goto cleanup;
+    }
 	if (0!=topts->first_pick_time){pick->stats.first_pick_time=topts->first_pick_time;}
   
 
@@ -2310,7 +6606,7 @@ if (pick->coverage_percents > TOTAL_PERCENTS)
 if (0!=topts->first_pick_time){
 	write_counters(pick->stats, pick->opts->fake_stats,pick->opts);
 }
-	pick->waste_report = report_wasted_tubes(head, &pick->stats);
+	pick->waste_picks = pick->stats.total_picks;
     pick->toothpaste_pick_index = pick->stats.total_picks;
     pick->when = total_seconds;
 
@@ -2343,17 +6639,13 @@ if (0!=topts->first_pick_time){
     }
     else if (topts->ptype == PICK_RANDOM) 
     {
-        
-		time_t total_seconds_rand = time(NULL);
+		uint64_t value = 0;
 
-		if (total_seconds_rand == (time_t)-1) {
-			total_seconds_rand = 0;
+		if (draw_random(topts, 0, pick->total_toothpastes, &value) != TPM_NO_ERROR) {
+			perror(_(error_strings[PICKSTATS_WRITE_FAILED]));
+			result = PICKSTATS_WRITE_FAILED;
+			goto cleanup;
 		}
-
-		seed_xrp32((uint64_t)total_seconds_rand);
-		
-		uint64_t value = rand_range(0, pick->total_toothpastes);
-
 		if (value >= (uint64_t)pick->total_toothpastes) {
 		
 			result=TPM_RARE_ERROR;
@@ -2365,6 +6657,10 @@ if (0!=topts->first_pick_time){
 		
       
     }
+    else if (topts->ptype == PICK_KEYED_RANDOM)
+    {
+        i = tpm_keyed_pick_index(pick->who, pick->day, pick->total_toothpastes, topts->random_key);
+    }
 
   
     if ( i >= pick->total_toothpastes) {
@@ -2435,6 +6731,7 @@ if (0!=topts->first_pick_time){
         new_pick_flag = 1;
         pick->stats.total_picks++;
         pick->stats.last_pick_time = total_seconds;
+        record_rollup(&pick->stats, (int64_t)pick->day);
         write_counters(pick->stats, pick->opts->fake_stats,pick->opts);
         
       
@@ -2452,89 +6749,31 @@ if (0!=topts->first_pick_time){
                 dentist_flag = 1;
             }
         }
-    }
-    
-
-    pick->toothpaste_pick_index = i;
-	
-	toothpaste_picking_message[0] = 	str_good_day(pick,topts);
-	toothpaste_picking_message[1] = 	str_anon_username(pick,topts);
-	toothpaste_picking_message[2] = 	str_welcome(pick,topts);
-	toothpaste_picking_message[3] = 	str_next_pick(pick,topts);
-	toothpaste_picking_message[4] = 	str_new_toothbrush(pick,topts);
-	toothpaste_picking_message[5] = 	str_visit_dentist(pick,topts);
-	toothpaste_picking_message[6] = 	str_already_picked(pick,topts);
-	toothpaste_picking_message[7] = 	str_pick_type(pick,topts);
-	toothpaste_picking_message[8] = 	str_toothpaste(pick,topts);
-	toothpaste_picking_message[9] =		str_toothbrush(pick,topts);
-	toothpaste_picking_message[10] = 	str_toothpaste_index(pick,topts);
-	toothpaste_picking_message[11] = 	str_toothpaste_type(pick,topts);
-	toothpaste_picking_message[12] = 	str_dental_formula(pick,topts);
-	toothpaste_picking_message[13] = 	str_day_of_the_week(pick,topts);
-	toothpaste_picking_message[14] = 	str_total_picks(pick,topts);
-	toothpaste_picking_message[15] = 	str_last_pick_time(pick,topts);
-	toothpaste_picking_message[16] =	str_brushing_coverage(pick,topts);
-	toothpaste_picking_message[17] = 	str_tubes_wasted(pick,topts);
-	toothpaste_picking_message[18] = 	str_source(pick,topts);
-	toothpaste_picking_message[19] = 	str_meme(pick,topts);
-	toothpaste_picking_message[20] = 	str_quiet(pick,topts);
-	
-	ti=0;
-    if (topts->tpm_template[0] == '*' && topts->tpm_template[1] == '\0') 
-    {
-        snprintf(topts->tpm_template, TOTAL_OUTPUT_STRINGS+1, "%s", DEFAULT_OUTPUT_TEMPLATE);
-    }
-
-    pick->message[0] = '\0'; 
-
-    ti = 0;
-	
-    while (topts->tpm_template[ti] != '\0') 
-    {
-        current_char = topts->tpm_template[ti++];
-        str_num = char_to_strnum(current_char);
 
-       
-        if (str_num >= 0 && str_num < TOTAL_OUTPUT_STRINGS) 
-        {
- 
-            if (check_visibility(str_num, new_pick_flag, toothbrush_flag, dentist_flag, topts->verbose)) 
-            {
-                if (toothpaste_picking_message[str_num] != NULL) 
-                {
-                    
-                    current_len = strlen(pick->message);
-                    if (current_len + 1 < OUTPUT_BLOCK_SIZE) 
-                    {
-                        remaining_space = OUTPUT_BLOCK_SIZE - current_len - 1;
-
-						strncat_s(pick->message,
-						OUTPUT_BLOCK_SIZE,
-						toothpaste_picking_message[str_num],
-						remaining_space);
-
-                    } 
-                    else 
-                    {
-                       
-                        break; 
-                    }
-                }
-            }
-        }
-    }
-	
-	
-    for (ti = 0; ti < TOTAL_OUTPUT_STRINGS; ti++) 
-    {
-        if (toothpaste_picking_message[ti] != NULL) 
+        if (!pick->opts->fake_stats)
         {
-            free(toothpaste_picking_message[ti]);
-            toothpaste_picking_message[ti] = NULL; 
+            pick_log_record_t record;
+            
+            record.when = (int64_t)total_seconds;
+            record.user_hash = fnv1a64(pick->who, strlen(pick->who));
+            record.toothpaste_index = pick->what.index;
+            record.pick_type = (uint16_t)topts->ptype;
+            record.flags = (uint16_t)(PICK_LOG_NEW_PICK |
+                (toothbrush_flag ? PICK_LOG_TOOTHBRUSH : 0) |
+                (dentist_flag ? PICK_LOG_DENTIST : 0));
+            append_pick_log(pick->opts, &record);
         }
     }
+    unlock_stats(topts, stats_lock);
+    stats_lock = STATS_NO_LOCK;
+    eval_rollup_coverage(pick);
+
+    pick->toothpaste_pick_index = i;
+    pick->new_pick_flag = new_pick_flag;
+    pick->toothbrush_flag = toothbrush_flag;
+    pick->dentist_flag = dentist_flag;
 	
-	
+    /* before rendering, so the template shows what JSON and CSV show */
     if (pick->who == NULL) {
         pick->who = "Anonymous";
     }
@@ -2547,85 +6786,28 @@ if (0!=topts->first_pick_time){
     if (pick->what.toothbrush_brand == NULL) {
         pick->what.toothbrush_brand = "Unknown";
     }
+	
+    if (render_template(pick, topts, new_pick_flag, toothbrush_flag, dentist_flag) != TPM_NO_ERROR)
+    {
+		result = MALLOC_FAILED;
+		goto cleanup;
+    }
 
-    snprintf(pick->JSON, OUTPUT_BLOCK_SIZE, 
-        "{\n"
-        "\t \"who\":\"%s\",\n"
-        "\t \"toothpaste\":\"%.127s\",\n"
-        "\t \"tube_mass_g\":%u,\n"
-        "\t \"rating\":%u,\n"
-        "\t \"meme\":\"%s\" \n"
-        "}", 
-        pick->who, 
-        pick->what.toothpaste_brand, 
-        pick->what.tube_mass_g, 
-        pick->what.rating, 
-        topts->meme_payload
-    );
-		
-    char* csv_ptr = pick->CSV;
-    size_t csv_rem = OUTPUT_BLOCK_SIZE;
-    int written = 0;
-
-
-    written = snprintf(csv_ptr, csv_rem, "%s,%s,%d,%d,%d,", 
-                       pick->who, pick_type_strings[topts->ptype], 
-                       new_pick_flag, toothbrush_flag, dentist_flag);
-    if (written > 0 && (size_t)written < csv_rem) 
-	{
-		csv_ptr += (size_t) written; 
-		csv_rem -= (size_t) written; 
-	}
-
-
-    written = snprintf(csv_ptr, csv_rem, "%s,%d,%d,", 
-                       pick->what.toothpaste_brand, pick->what.tube_mass_g, pick->what.rating);
-    if (written > 0 && (size_t)written < csv_rem) { csv_ptr += (size_t) written; csv_rem -= (size_t) written; }
-
-
-    written = snprintf(csv_ptr, csv_rem, "%s,%s,%d,%d,", 
-                       pick->what.toothbrush_color, pick->what.toothbrush_brand, 
-                       pick->what.toothbrush_length_cm, pick->what.toothbrush_hardness);
-    if (written > 0 && (size_t)written < csv_rem) { csv_ptr += (size_t) written; csv_rem -= (size_t) written; }
-
-
-    written = snprintf(csv_ptr, csv_rem, "%d,%d,%s,", 
-                       i, pick->total_toothpastes, toothpaste_type_strings[pick->what.type]);
-    if (written > 0 && (size_t)written < csv_rem) { csv_ptr += (size_t) written; csv_rem -= (size_t) written; }
-
-
-    written = snprintf(csv_ptr, csv_rem, "%u-%u-%u-%u,%s,%jd,", 
-                       topts->formula.brush_times_per_day, topts->formula.minutes_per_brush, 
-                       topts->formula.swap_toothbrush_times_per_year, topts->formula.visit_dentist_times_per_year,
-                       days_of_week[pick->j], (intmax_t)pick->day);
-    if (written > 0 && (size_t)written < csv_rem) { csv_ptr += (size_t) written; csv_rem -= (size_t) written; }
-
-   
-    written = snprintf(csv_ptr, csv_rem, LINE_FORMAT_CSV, 
-                       pick->stats.total_picks, (intmax_t)pick->stats.last_pick_time, pick->coverage_percents, 
-                       pick->waste_report, topts->toothpastes_file_path_final, topts->meme_payload);
-    
-
-    if (written >= (int)csv_rem) 
-	{
-
+#ifdef HAVE_SQLITE
+    if (topts->pick_db_path != NULL && !topts->fake_stats)
+    {
+        record_pick_db(pick, head, new_pick_flag, toothbrush_flag, dentist_flag, i);
     }
+#endif
 
 	
-	if (topts->lat_flag) 
-	{
-		list_available_toothpastes(pick);
-	}	
 	result = TPM_NO_ERROR;
 	goto cleanup;
 	
 	cleanup:
 
-	for (ti = 0; ti < TOTAL_OUTPUT_STRINGS; ++ti)
-	{
-		free(toothpaste_picking_message[ti]);
-		toothpaste_picking_message[ti] = NULL;
-	}
+	unlock_stats(topts, stats_lock);
+
 
 	if (result != TPM_NO_ERROR)
 	{
@@ -2665,6 +6847,7 @@ save_default_config(struct cfg_struct* cfg,toothpaste_pick_options_t* opts)
 	cfg_set(cfg,"LIST_TOOTHPASTES","0");
 	cfg_set(cfg,"OUTPUT_JSON","0");
 	cfg_set(cfg,"OUTPUT_CSV","0");
+	cfg_set(cfg,"OUTPUT_NDJSON","0");
 	cfg_set(cfg,"FAKE_STATS","0");	
 	cfg_set(cfg,"OUTPUT_FILE","0");
 	cfg_set(cfg,"PICK_INDEX","0");
@@ -2673,6 +6856,7 @@ save_default_config(struct cfg_struct* cfg,toothpaste_pick_options_t* opts)
 	cfg_set(cfg,"SET_COUNTER","0");
 	cfg_set(cfg,"RESET_COUNTER","0");
 	cfg_set(cfg,"PICK_STATS",opts->stats_file_path_final);
+	cfg_set(cfg,"STATS_FSYNC","1");
 	cfg_set(cfg,"LAST_PICK",opts->output_file_path_final);
 	cfg_set(cfg,"TOOTHPASTES",opts->toothpastes_file_path_final);
 	cfg_set(cfg,"LOAD_CONFIG",opts->config_file_path_final);
@@ -2685,25 +6869,6 @@ save_default_config(struct cfg_struct* cfg,toothpaste_pick_options_t* opts)
 }
 
 
-static const char* 
-cfg_get_rec(const struct cfg_struct* cfg, const char* key, int* depth) 
-{
-    if (*depth >= MAX_RECURSION) return NULL;
-    
-    const char* val = cfg_get(cfg, key);
-    if (val == NULL) return NULL;
-    
-    (*depth)++;
-    
-    const char* next_val = cfg_get_rec(cfg, val, depth);
-    
-    if (next_val == NULL) {
-        return val; 
-    }
-    
-    return next_val;
-}
-
 static int 
 file_exists_fopen(const char *filename) 
 {
@@ -2745,10 +6910,10 @@ read_config(const char *src, toothpaste_pick_options_t *opts)
     struct cfg_struct *cfg = NULL;
     const char *value = NULL;
     static int recursion = 0;
-    int depth = 16;
     int result = 0;
-    int reset_counters_v = 0;
-    int set_counters_v = 0;
+    int flag = 0;
+    int choice = 0;
+    long long number = 0;
 
     if (src == NULL || opts == NULL)
         return -1;
@@ -2757,6 +6922,8 @@ read_config(const char *src, toothpaste_pick_options_t *opts)
     if (cfg == NULL)
         return -1;
 
+    /* references like VERBOSE=TRUE, quotes and numbers are all resolved by
+       cfg_load, every lookup below is a hash probe and a field read */
     if (cfg_load(cfg, src) < 0)
     {
         fprintf(stderr, "%s", _(error_strings[CONFIG_LOAD_FAILED]));
@@ -2765,7 +6932,7 @@ read_config(const char *src, toothpaste_pick_options_t *opts)
         goto cleanup;
     }
 
-    value = cfg_get_rec(cfg, "LOAD_CONFIG", &depth);
+    value = cfg_get_value(cfg, "LOAD_CONFIG");
     if (src != NULL &&
         value != NULL &&
         strcmp(src, value) == 0 &&
@@ -2786,7 +6953,7 @@ read_config(const char *src, toothpaste_pick_options_t *opts)
         goto cleanup;
     }
 
-	value = cfg_get_rec(cfg, "USERNAME", &depth);
+	value = cfg_get_value(cfg, "USERNAME");
 
 	if (value != NULL && value[0] != '\0')
 	{
@@ -2794,124 +6961,150 @@ read_config(const char *src, toothpaste_pick_options_t *opts)
 		opts->username = _strdup(value);
 
 		if (opts->username == NULL)
-			return MALLOC_FAILED;
+		{
+			result = MALLOC_FAILED;
+			goto cleanup;
+		}
 	}
-    value = cfg_get_rec(cfg, "DENTAL_FORMULA", &depth);
+    value = cfg_get_value(cfg, "DENTAL_FORMULA");
     if (value != NULL)
         opts->formula = parse_dental_formula(value);
 
-    value = cfg_get_rec(cfg, "TIMEZONE", &depth);
-    if (value != NULL)
-    {
-        int tz = atoi(value);
-        if (tz >= -MAX_TIMEZONE_DELTA && tz <= MAX_TIMEZONE_DELTA)
-            opts->delta_hours = tz;
-    }
+    if (cfg_get_int(cfg, "TIMEZONE", &number) == EXIT_SUCCESS &&
+        number >= -MAX_TIMEZONE_DELTA && number <= MAX_TIMEZONE_DELTA)
+        opts->delta_hours = (int)number;
 
-    value = cfg_get_rec(cfg, "DELTA_DAYS", &depth);
-    if (value != NULL)
-        opts->delta_days = atoi(value);
+    if (cfg_get_int(cfg, "DELTA_DAYS", &number) == EXIT_SUCCESS &&
+        number >= INT_MIN && number <= INT_MAX)
+        opts->delta_days = (int)number;
 
-    value = cfg_get_rec(cfg, "MEME", &depth);
+    value = cfg_get_value(cfg, "MEME");
     if (value != NULL)
     {
         strncpy_s(opts->meme_payload, MAX_TOOTHPASTE_LINE, value, MAX_TOOTHPASTE_LINE - 1);
         opts->meme_payload[MAX_TOOTHPASTE_LINE - 1] = '\0';
     }
 
-	value = cfg_get_rec(cfg, "TEMPLATE", &depth);
+	value = cfg_get_value(cfg, "TEMPLATE");
 	if (value != NULL)
 	{
-		(void)strncpy_s(opts->tpm_template,
-						TOTAL_OUTPUT_STRINGS + 1,
-						value,
-						TOTAL_OUTPUT_STRINGS);
-
-		opts->tpm_template[TOTAL_OUTPUT_STRINGS] = '\0';
+		(void)set_output_template(opts, value);
 	}
 
-    value = cfg_get_rec(cfg, "LOCALE", &depth);
+    value = cfg_get_value(cfg, "LOCALE");
     if (value != NULL)
     {
         strncpy_s(opts->tpm_locale, MAX_LOCALE_CODE, value, MAX_LOCALE_CODE - 1);
         opts->tpm_locale[MAX_LOCALE_CODE - 1] = '\0';
     }
 
-    value = cfg_get_rec(cfg, "PICK_TYPE", &depth);
+    if (cfg_get_enum(cfg, "PICK_TYPE", pick_type_strings, TOTAL_PICK_TYPE_STRINGS, &choice) == EXIT_SUCCESS)
+        opts->ptype = (pick_type_t)choice;
+
+    value = cfg_get_value(cfg, "RANDOM_KEY");
     if (value != NULL)
     {
-        int tmp = atoi(value);
-        if (tmp >= 0 && tmp < TOTAL_PICK_TYPE_STRINGS)
-            opts->ptype = (pick_type_t) tmp;
+        free(opts->random_key);
+        opts->random_key = _strdup(value);
+        if (opts->random_key == NULL)
+        {
+            result = -1;
+            goto cleanup;
+        }
     }
 
-    value = cfg_get_rec(cfg, "VERBOSE", &depth);
-    if (value != NULL)
-        opts->verbose = atoi(value);
+    if (cfg_get_bool(cfg, "VERBOSE", &flag) == EXIT_SUCCESS)
+        opts->verbose = flag;
+
+    if (cfg_get_bool(cfg, "STATS_FSYNC", &flag) == EXIT_SUCCESS)
+        opts->stats_fsync = flag;
+
+    if (cfg_get_bool(cfg, "STATS_JOURNAL", &flag) == EXIT_SUCCESS)
+        opts->journal.enabled = flag;
+
+    if (cfg_get_int(cfg, "JOURNAL_COMMIT_PICKS", &number) == EXIT_SUCCESS &&
+        number > 0 && number <= MAX_JOURNAL_COMMIT_PICKS)
+        opts->journal.commit_picks = (unsigned int)number;
+
+    if (cfg_get_int(cfg, "JOURNAL_COMMIT_SECONDS", &number) == EXIT_SUCCESS &&
+        number >= 0 && number <= UINT_MAX)
+        opts->journal.commit_seconds = (unsigned int)number;
+
+    if (cfg_get_int(cfg, "JOURNAL_CHECKPOINT_PICKS", &number) == EXIT_SUCCESS &&
+        number > 0 && number <= UINT_MAX)
+        opts->journal.checkpoint_picks = (unsigned int)number;
 #if !defined(__EMSCRIPTEN__) && !defined(__wasi__)
-    value = cfg_get_rec(cfg, "TOOTHPASTES", &depth);
-    if (value != NULL)
-    {
-        strncpy_s(opts->toothpastes_file_path_final, MAX_PATH, value, MAX_PATH - 1);
-        opts->toothpastes_file_path_final[MAX_PATH - 1] = '\0';
-    }
-    value = cfg_get_rec(cfg, "LAST_PICK", &depth);
+    /* a path too long for the buffer keeps the default, cut it would name
+       some other file */
+    (void)cfg_get_path(cfg, "TOOTHPASTES", opts->toothpastes_file_path_final, MAX_PATH);
+    (void)cfg_get_path(cfg, "LAST_PICK", opts->output_file_path_final, MAX_PATH);
+    (void)cfg_get_path(cfg, "PICK_STATS", opts->stats_file_path_final, MAX_PATH);
+
+    value = cfg_get_value(cfg, "STATS_STORE");
     if (value != NULL)
     {
-        strncpy_s(opts->output_file_path_final, MAX_PATH, value, MAX_PATH - 1);
-        opts->output_file_path_final[MAX_PATH - 1] = '\0';
+        free(opts->stats_store_path);
+        opts->stats_store_path = _strdup(value);
+        if (opts->stats_store_path == NULL)
+        {
+            result = -1;
+            goto cleanup;
+        }
     }
 
-    value = cfg_get_rec(cfg, "PICK_STATS", &depth);
+    if (cfg_get_int(cfg, "STATS_STORE_SLOTS", &number) == EXIT_SUCCESS &&
+        number > 0 && number <= MAX_STATS_STORE_SLOTS)
+        opts->stats_store_slots = (unsigned int)number;
+#ifdef HAVE_SQLITE
+    value = cfg_get_value(cfg, "PICK_DB");
     if (value != NULL)
     {
-        strncpy_s(opts->stats_file_path_final, MAX_PATH,value, MAX_PATH - 1);
-        opts->stats_file_path_final[MAX_PATH - 1] = '\0';
+        free(opts->pick_db_path);
+        opts->pick_db_path = _strdup(value);
+        if (opts->pick_db_path == NULL)
+        {
+            result = -1;
+            goto cleanup;
+        }
     }
-#endif	
 
-    value = cfg_get_rec(cfg, "LIST_TOOTHPASTES", &depth);
-    if (value != NULL)
-        opts->lat_flag = atoi(value);
+    if (cfg_get_int(cfg, "PICK_DB_BATCH", &number) == EXIT_SUCCESS &&
+        number > 0 && number <= UINT_MAX)
+        opts->pick_db_batch = (unsigned int)number;
+#endif
+#endif	
 
-    value = cfg_get_rec(cfg, "OUTPUT_JSON", &depth);
-    if (value != NULL)
-        opts->json_flag = atoi(value);
+    if (cfg_get_bool(cfg, "LIST_TOOTHPASTES", &flag) == EXIT_SUCCESS)
+        opts->lat_flag = flag;
 
-    value = cfg_get_rec(cfg, "OUTPUT_CSV", &depth);
-    if (value != NULL)
-        opts->csv_flag = atoi(value);
+    if (cfg_get_bool(cfg, "OUTPUT_JSON", &flag) == EXIT_SUCCESS)
+        opts->json_flag = flag;
 
-    value = cfg_get_rec(cfg, "FAKE_STATS", &depth);
-    if (value != NULL)
-        opts->fake_stats = atoi(value);
+    if (cfg_get_bool(cfg, "OUTPUT_CSV", &flag) == EXIT_SUCCESS)
+        opts->csv_flag = flag;
 
-    value = cfg_get_rec(cfg, "OUTPUT_FILE", &depth);
-    if (value != NULL)
-        opts->output_to_file = atoi(value);
+    if (cfg_get_bool(cfg, "OUTPUT_NDJSON", &flag) == EXIT_SUCCESS)
+        opts->ndjson_flag = flag;
 
-    value = cfg_get_rec(cfg, "PICK_INDEX", &depth);
-    if (value != NULL)
-    {
-        char *end = NULL;
-        unsigned long tmp;
+    if (cfg_get_bool(cfg, "FAKE_STATS", &flag) == EXIT_SUCCESS)
+        opts->fake_stats = flag;
 
-        errno = 0;
-        tmp = strtoul(value, &end, 10);
+    if (cfg_get_bool(cfg, "OUTPUT_FILE", &flag) == EXIT_SUCCESS)
+        opts->output_to_file = flag;
 
-        if (errno != 0 ||
-            end == value ||
-            *end != '\0' ||
-            tmp > UINT_MAX)
+    if (cfg_get_value(cfg, "PICK_INDEX") != NULL)
+    {
+        if (cfg_get_int(cfg, "PICK_INDEX", &number) != EXIT_SUCCESS ||
+            number < 0 || number > UINT_MAX)
         {
             result = -1;
             goto cleanup;
         }
 
-        opts->pick_by_index_index = (unsigned int)tmp;
+        opts->pick_by_index_index = (unsigned int)number;
     }
 
-    value = cfg_get_rec(cfg, "BRAND", &depth);
+    value = cfg_get_value(cfg, "BRAND");
     if (value != NULL)
     {
         free(opts->brand_string);
@@ -2923,28 +7116,22 @@ read_config(const char *src, toothpaste_pick_options_t *opts)
         }
     }
 
-    value = cfg_get_rec(cfg, "UPPER_BRANDS", &depth);
-    if (value != NULL)
-        opts->upper_brands = atoi(value);
-
-    value = cfg_get_rec(cfg, "RESET_COUNTER", &depth);
-    if (value != NULL)
-        reset_counters_v = atoi(value);
+    if (cfg_get_bool(cfg, "UPPER_BRANDS", &flag) == EXIT_SUCCESS)
+        opts->upper_brands = flag;
 
-    if (reset_counters_v)
+    if (cfg_get_bool(cfg, "RESET_COUNTER", &flag) == EXIT_SUCCESS && flag)
         reset_counters(opts);
 
-    value = cfg_get_rec(cfg, "SET_COUNTER", &depth);
-    if (value != NULL)
-        set_counters_v = atoi(value);
-	
-    if (set_counters_v) {
+    if (cfg_get_int(cfg, "SET_COUNTER", &number) == EXIT_SUCCESS &&
+        number != 0 && number >= INT_MIN && number <= INT_MAX)
+    {
+        int set_counters_v = (int)number;
         set_counters(&set_counters_v, opts);
 	}
 	
-	value = cfg_get_rec(cfg, "FIRST_PICK_TIME", &depth);
-    if (value != NULL) {
-        opts->first_pick_time=time(NULL)-SECONDS_PER_DAY*atoi(optarg);
+    if (cfg_get_int(cfg, "FIRST_PICK_TIME", &number) == EXIT_SUCCESS &&
+        number >= 0 && number <= INT_MAX / SECONDS_PER_DAY) {
+        opts->first_pick_time = time(NULL) - SECONDS_PER_DAY * (time_t)number;
 	}
 
 cleanup:
@@ -2969,18 +7156,22 @@ do_not_test_me(int argc, char* argv[])
 	int option_index = 0;
 	toothpaste_pick_t pick;
 	char* out_msg=NULL;
-	char* out_JSON=NULL;
-	char* out_CSV=NULL;
+	output_format_t format;
+	pick_log_t log;
 	
 	struct option long_options[] = {
     {"rating",     no_argument, 0, 'a'},
     {"weight",  no_argument,       0, 'w'},
     {"json",  no_argument, 0, 'j'},
     {"csv",  no_argument, 0, 'C'},
+    {"ndjson",  no_argument, 0, 'J'},
+    {"format", required_argument, 0, 'e'},
     {"version", no_argument,       0, 'V'},
     {"random", no_argument,       0, 'x'},
+    {"keyed", no_argument,       0, 'k'},
     {"quiet", no_argument,       0, 'q'},
     {"list", no_argument,       0, 'l'},
+    {"history", no_argument,       0, 'H'},
 	{"reset", no_argument,       0, 'r'},
 	{"fake_stats", no_argument,       0, 'F'},
     {"formula", required_argument, 0, 'f'},
@@ -2998,6 +7189,9 @@ do_not_test_me(int argc, char* argv[])
 	{"template", required_argument,0, 'T'},	
 	{"locale", required_argument,0, 'L'},
 	{"first_pick_time", required_argument,0, 'I'},	
+	{"sort", required_argument,0, 'S'},
+	{"offset", required_argument,0, 'O'},
+	{"limit", required_argument,0, 'N'},
     {0, 0, 0, 0} 
 	};
 	
@@ -3007,7 +7201,7 @@ do_not_test_me(int argc, char* argv[])
 	result=read_config(topts.config_file_path_final,&topts);
 	if (result<0){};
 	topts.config_load_failure=!file_exists_fopen(topts.config_file_path_final);
-	while ((opt = getopt_long(argc, argv, "awjCvxqlrUFf:t:o:c:s:p:i:b:z:d:m:T:L:I:",long_options,&option_index)) != -1) 
+	while ((opt = getopt_long(argc, argv, "awjCJvxkqlHrUFf:t:o:c:s:p:i:b:z:d:m:T:L:I:e:S:O:N:",long_options,&option_index)) != -1) 
 	{
         switch (opt) 
 		{
@@ -3023,6 +7217,26 @@ do_not_test_me(int argc, char* argv[])
 			case 'C':
 			topts.csv_flag=1;
 			break;
+			case 'J':
+			topts.ndjson_flag=1;
+			break;
+			case 'e': {
+				unsigned int f;
+				
+				for (f = 0; f < TOTAL_OUTPUT_FORMATS; f++)
+				{
+					if (strcmp(optarg, output_format_strings[f]) == 0)
+					{
+						break;
+					}
+				}
+				if (f == TOTAL_OUTPUT_FORMATS) {
+					fprintf(stderr, "Invalid format: %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				topts.output_format = (output_format_t)f;
+				break;
+			}
 			case 'V':
 			version();
 			break;
@@ -3031,13 +7245,19 @@ do_not_test_me(int argc, char* argv[])
 			break;
 			case 'x':
 			topts.ptype = PICK_RANDOM;
-			break;		
+			break;
+			case 'k':
+			topts.ptype = PICK_KEYED_RANDOM;
+			break;
 			case 'q':
 			topts.verbose = 0;
 			break;
 			case 'l':
 			topts.lat_flag=1;
 			break;
+			case 'H':
+			topts.history_flag=1;
+			break;
 			case 'U':
 			topts.upper_brands=1;
 			break;
@@ -3101,7 +7321,11 @@ do_not_test_me(int argc, char* argv[])
                 snprintf(topts.meme_payload, MAX_TOOTHPASTE_LINE, "%s", optarg);
                 break;
             case 'T':
-                snprintf(topts.tpm_template, TOTAL_OUTPUT_STRINGS + 1, "%s", optarg);
+                if (set_output_template(&topts, optarg) != TPM_NO_ERROR)
+                {
+                    perror(_(error_strings[MALLOC_FAILED]));
+                    exit(EXIT_FAILURE);
+                }
             break;
 			case 'L':
 				snprintf(topts.tpm_locale, MAX_LOCALE_CODE, "%s", optarg); 
@@ -3109,6 +7333,29 @@ do_not_test_me(int argc, char* argv[])
 			case 'I':
 				topts.first_pick_time=time(NULL)-SECONDS_PER_DAY*atoi(optarg); 
 			break;
+			case 'S': {
+				unsigned int k;
+				
+				for (k = 0; k < TOTAL_LIST_SORTS; k++)
+				{
+					if (strcmp(optarg, list_sort_strings[k]) == 0)
+					{
+						break;
+					}
+				}
+				if (k == TOTAL_LIST_SORTS) {
+					fprintf(stderr, "Invalid sort: %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				topts.list_sort = (list_sort_t)k;
+				break;
+			}
+			case 'O':
+				topts.list_offset=(atoi(optarg) > 0) ? (size_t)atoi(optarg) : 0;
+			break;
+			case 'N':
+				topts.list_limit=(atoi(optarg) > 0) ? (size_t)atoi(optarg) : 0;
+			break;
 			case '?': 
 				usage(argv[0]);
 			break;
@@ -3121,12 +7368,35 @@ do_not_test_me(int argc, char* argv[])
 		strncpy_s(topts.toothpastes_file_path_final,MAX_PATH,argv[optind],MAX_PATH-1);
 	}	
 	init_tpm_locale(topts.tpm_locale,&topts);
+	format = topts.output_format;
+	if (format == OUTPUT_FORMAT_TEXT)
+	{
+		if (topts.ndjson_flag)
+			format = OUTPUT_FORMAT_NDJSON;
+		else if (topts.json_flag)
+			format = OUTPUT_FORMAT_JSON;
+		else if (topts.csv_flag)
+			format = OUTPUT_FORMAT_CSV;
+	}
+	/* the history has no text form, a table reads best */
+	if (topts.history_flag && format == OUTPUT_FORMAT_TEXT)
+	{
+		format = OUTPUT_FORMAT_CSV;
+	}
 	if (topts.output_to_file)
 	{
 		printf("%s %s \n",_(user_strings[MSG_PICK_FILE]),topts.output_file_path_final);
 		errno_t err;
 		
-		if (topts.csv_flag) 
+		if (format == OUTPUT_FORMAT_ARROW || format == OUTPUT_FORMAT_ARROW_FILE) 
+		{
+			err=fopen_s(&output_file,topts.output_file_path_final,"wb");
+		}
+		else if (format == OUTPUT_FORMAT_CBOR || format == OUTPUT_FORMAT_MSGPACK) 
+		{
+			err=fopen_s(&output_file,topts.output_file_path_final,"ab");
+		}
+		else if (format == OUTPUT_FORMAT_CSV || format == OUTPUT_FORMAT_NDJSON) 
 		{
 			err=fopen_s(&output_file,topts.output_file_path_final,"a");
 		}
@@ -3138,30 +7408,62 @@ do_not_test_me(int argc, char* argv[])
 		{
 			perror(_(error_strings[LAST_PICK_WRITING_FAILED]));
 
-		}		
+		}
+		else if (format == OUTPUT_FORMAT_CSV || format == OUTPUT_FORMAT_NDJSON)
+		{
+			/* a batch of lines goes out in one write */
+			setvbuf(output_file, NULL, _IOFBF, RECORD_WRITE_BUFFER_SIZE);
+		}
 	}
 	else
 	{
 		output_file=stdout;
+#if defined(_WIN32) || defined(_WIN64)
+		if (format == OUTPUT_FORMAT_CBOR || format == OUTPUT_FORMAT_MSGPACK ||
+			format == OUTPUT_FORMAT_ARROW || format == OUTPUT_FORMAT_ARROW_FILE)
+		{
+			_setmode(_fileno(stdout), _O_BINARY);
+		}
+#endif
 	}
 	tpm_load_list_from_file(topts.toothpastes_file_path_final,&topts,&topts.toothpastes_list);
 	tpm_pick_toothpaste(topts.toothpastes_list,&topts,&pick);
 	
-	if (topts.json_flag)
+	if (format == OUTPUT_FORMAT_TEXT && topts.lat_flag)
 	{
-		tpm_get_toothpaste_picking_JSON(&pick,&out_JSON);
-		fprintf(output_file,"%s \n",out_JSON);
+		tpm_write_toothpaste_listing(topts.toothpastes_list,&topts,output_file);
+		fprintf(output_file," \n");
 	}
-	else if (topts.csv_flag)
-	{
-		tpm_get_toothpaste_picking_CSV(&pick,&out_CSV);
-		fprintf(output_file,"%s \n",out_CSV);
-	}
-	else		
+	else if (format == OUTPUT_FORMAT_TEXT)
 	{
 		tpm_get_toothpaste_picking_message(&pick,&out_msg);
 		fprintf(output_file,"%s \n",out_msg);
 	}
+	else if (topts.lat_flag)
+	{
+		tpm_write_toothpaste_list(topts.toothpastes_list,&topts,output_file,format);
+	}
+	else if (topts.history_flag || format == OUTPUT_FORMAT_ARROW || format == OUTPUT_FORMAT_ARROW_FILE)
+	{
+		if (tpm_open_pick_log(&topts,&log) == TPM_NO_ERROR)
+		{
+			tpm_write_pick_log(&log,output_file,format);
+			tpm_close_pick_log(&log);
+		}
+		else
+		{
+			memset(&log,0,sizeof(log));
+			tpm_write_pick_log(&log,output_file,format);
+		}
+	}
+	else
+	{
+		tpm_write_toothpaste_picking(&pick,output_file,format);
+	}
+	if (format == OUTPUT_FORMAT_JSON)
+	{
+		fprintf(output_file," \n");
+	}
 	if (topts.config_load_failure) 
 	{
 		cfg=cfg_init(); 
@@ -3175,7 +7477,7 @@ do_not_test_me(int argc, char* argv[])
 	}
 	
 	
-	if ((topts.json_flag) || (topts.csv_flag)) 
+	if (format != OUTPUT_FORMAT_TEXT) 
 	{
 		finish(NO_SYSTEM_PAUSE,&pick);
 	}
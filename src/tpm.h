@@ -23,6 +23,10 @@ extern "C" {
 #include "config.h"
 #endif
 
+#if defined(_WIN32) || defined(_WIN64)
+#define _CRT_RAND_S
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -31,6 +35,7 @@ extern "C" {
 #include <errno.h>
 #include <limits.h>
 #include <inttypes.h>
+#include <stdarg.h>
 
 /* Compiling gettext to WASM is walking hell example better off 
 If you can contribute it to this project then you are really and I mean really good email me to 
@@ -55,17 +60,21 @@ yendorium@gmail.com before trying the whole pull request thing out*/
 #else
 	
 # undef _
-# define _(String) (String)
+# define _(String) catalog_gettext(String)
 # define gettext_noop(String) String
-# define gettext(String) (String)
-# define textdomain(Domain) ((const char*)(Domain))
-# define bindtextdomain(Domain, Directory) ((const char*)(Directory))
-# define bind_textdomain_codeset(Domain, Codeset) ((const char*)(Codeset))
+# define gettext(String) catalog_gettext(String)
+# define textdomain(Domain) ((void)(Domain))
+# define bindtextdomain(Domain, Directory) ((void)(Domain), (void)(Directory))
+# define bind_textdomain_codeset(Domain, Codeset) ((void)(Domain), (void)(Codeset))
 #endif
 
 #include "prng64_xrp32.h"
 #include "cfg_parse.h"
 
+#ifdef HAVE_SQLITE
+#include <sqlite3.h>
+#endif
+
 #if defined(_WIN32) || defined(_WIN64)
 
 #include <windows.h>
@@ -73,6 +82,8 @@ yendorium@gmail.com before trying the whole pull request thing out*/
 #include <shlobj.h>
 #include <direct.h>
 #include <Lmcons.h>
+#include <io.h>
+#include <fcntl.h>
 
 #define STATIC_GETOPT
 #include "win/getopt.h"
@@ -83,6 +94,7 @@ yendorium@gmail.com before trying the whole pull request thing out*/
 
 #include <unistd.h>
 #include <getopt.h>
+#include <fcntl.h>
 
 #else
 
@@ -90,6 +102,10 @@ yendorium@gmail.com before trying the whole pull request thing out*/
 #include <getopt.h>
 #include <sys/types.h>
 #include <pwd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #endif
 
@@ -111,14 +127,101 @@ yendorium@gmail.com before trying the whole pull request thing out*/
 #define UNLEN 256
 #endif
 #define OUTPUT_BLOCK_SIZE 4096
-#define TOTAL_PICK_TYPE_STRINGS 8
+#define RENDER_INLINE_SIZE OUTPUT_BLOCK_SIZE
+#define RECORD_MAX_DEPTH 4
+#define RECORD_NUMBER_SIZE 24
+#define RECORD_LINES_BATCH 256
+#define RECORD_WRITE_BUFFER_SIZE (64 * 1024)
+#define TOTAL_OUTPUT_FORMATS 8
+#define TOTAL_LIST_SORTS 4
+#define LIST_RADIX_BITS 8
+#define LIST_RADIX_BUCKETS (1U << LIST_RADIX_BITS)
+#define CBOR_UINT 0U
+#define CBOR_NEGINT 1U
+#define CBOR_TEXT 3U
+#define CBOR_ARRAY 4U
+#define CBOR_MAP 5U
+#define CBOR_FALSE 0xf4
+#define CBOR_TRUE 0xf5
+#define CBOR_NULL 0xf6
+#define MSGPACK_NIL 0xc0
+#define MSGPACK_FALSE 0xc2
+#define MSGPACK_TRUE 0xc3
+#define RECORD_BINARY(w) ((w)->format == OUTPUT_FORMAT_CBOR || (w)->format == OUTPUT_FORMAT_MSGPACK)
+#define PICK_RECORD_FIELDS 29
+#define TOOTHPASTE_RECORD_FIELDS 9
+#define PICK_LOG_RECORD_FIELDS 7
+#define ARROW_MAGIC "ARROW1"
+#define ARROW_MAGIC_SIZE 6
+#define ARROW_ALIGNMENT 8
+#define ARROW_CONTINUATION 0xFFFFFFFFU
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_UTF8 5
+#define ARROW_TYPE_BOOL 6
+#define ARROW_TYPE_TIMESTAMP 10
+#define ARROW_FIELD_NODE_SIZE 16
+#define ARROW_BUFFER_SIZE 16
+#define ARROW_BLOCK_SIZE 24
+#define MAX_FB_FIELDS 8
+#define CATALOG_COLUMNS 9
+#define HISTORY_COLUMNS 7
+#define TOTAL_PICK_TYPE_STRINGS 9
 #define MAX_TIMEZONE_DELTA 11
-#define MAX_RECURSION 128
 #define SYSTEM_PAUSE 1
 #define NO_SYSTEM_PAUSE 0
 #define MAX_TOOTHPASTE_LINE 128
-#define MAX_TOOTHPASTE_LINES 1024
 #define MAX_CONFIG_RECURSION 16
+#define PRNG_STATE_MAGIC "XRP1"
+#define PRNG_STATE_MAGIC_SIZE 4
+#define FNV1A64_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV1A64_PRIME 0x100000001b3ULL
+#define DEFAULT_RANDOM_KEY TPM_STRING
+#define RANDOM_KEY_BYTES 32
+#define DEFAULT_STATS_FSYNC 1
+#define PICKSTATS_MAGIC "TPMS"
+#define PICKSTATS_MAGIC_SIZE 4
+#define PICKSTATS_VERSION 2
+#define PICKSTATS_V1_VERSION 1
+#define PICKSTATS_BYTE_ORDER 0x0102
+#define PICKSTATS_FIELD_WIDTH 8
+#define PICKSTATS_FILE_SIZE 256
+#define PICKSTATS_CHECKSUM_OFFSET 248
+#define PICKSTATS_ROLLUP_OFFSET 40
+#define PICKSTATS_ROLLUP_SIZE 208
+#define PICKSTATS_V1_SIZE 48
+#define PICKSTATS_V1_CHECKSUM_OFFSET 40
+#define PICKSTATS_LEGACY_SIZE 20
+#define PICKSTATS_LEGACY32_SIZE 12
+#define PICK_LOG_RECORD_SIZE 24
+#define STATS_STORE_MAGIC "TPMU"
+#define STATS_STORE_VERSION 2
+#define STATS_STORE_HEADER_SIZE 64
+#define STATS_STORE_CHECKSUM_OFFSET 56
+#define STATS_STORE_SLOT_SIZE 320
+#define STATS_STORE_V1_VERSION 1
+#define STATS_STORE_V1_SLOT_SIZE 64
+#define STATS_STORE_ROLLUP_OFFSET 64
+#define STATS_STORE_NAME_SIZE 32
+#define DEFAULT_STATS_STORE_SLOTS 1024
+#define MAX_STATS_STORE_SLOTS 16777216
+#define PICK_LOG_NEW_PICK 0x0001
+#define PICK_LOG_TOOTHBRUSH 0x0002
+#define PICK_LOG_DENTIST 0x0004
+#define JOURNAL_MAGIC "TPMJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 16
+#define JOURNAL_RECORD_SIZE 32
+#define JOURNAL_FIRST_PICK 0x0001
+#define JOURNAL_PICK 0x0002
+#define DEFAULT_JOURNAL_COMMIT_PICKS 64
+#define DEFAULT_JOURNAL_COMMIT_SECONDS 5
+#define DEFAULT_JOURNAL_CHECKPOINT_PICKS 4096
+#define MAX_JOURNAL_COMMIT_PICKS 65536
+#define DEFAULT_PICK_DB_BATCH 64
+#define PICK_DB_BATCH_SECONDS 1
 
 #define SWAP(x,y) do \
 {unsigned char swap_temp[sizeof(x) == sizeof(y) ? (signed)sizeof(x) : -1]; \
@@ -126,22 +229,27 @@ memcpy(swap_temp,&y,sizeof(x)); \
 memcpy(&y,&x,       sizeof(x)); \
 memcpy(&x,swap_temp,sizeof(x)); \
 } while(0)
-#define LINE_FORMAT_CSV "%u,%jd,%u,%s,%s,%s"
 
 #define TOTAL_TOOTHPASTE_TYPES 5
-#define TOTAL_ERROR_MESSAGES 14
-#define TOTAL_USER_MESSAGES 35
+#define TOTAL_ERROR_MESSAGES 15
+#define TOTAL_USER_MESSAGES 38
 #define TOTAL_USER_ARMOUR 10
 
 #define BRUSHES_PER_LIFETIME 30000
 #define GRAMS_PER_NURDLE 2
 #define MAX_REPORT_TERM 10
-#define TOTAL_OUTPUT_STRINGS 21
+#define TOTAL_OUTPUT_STRINGS 24
+#define MAX_TEMPLATE_WIDTH 4096
+#define TOTAL_TEMPLATE_NAMES 31
 #define DEFAULT_OUTPUT_TEMPLATE "guwntdapobiTfWPlcUsmI"
 #define MAX_TOOTHBRUSH_COLOR 32
 #define ENHANCED_MODE_COMAS 7
 #define MAX_LOCALE_CODE 16
 #define TOTAL_PERCENTS 100
+#define ROLLUP_DAYS 32
+#define ROLLUP_MONTHS 12
+#define COVERAGE_SHORT_DAYS 7
+#define COVERAGE_LONG_DAYS 30
 
 typedef enum user_msg_t
 {
@@ -179,9 +287,32 @@ typedef enum user_msg_t
 	MSG_USER_TOOTHPASTE_1,
 	MSG_USER_TOOTHPASTE_2,
 	MSG_USER_TOOTHPASTE_3,
-	MSG_ANY_KEY
+	MSG_ANY_KEY,
+	MSG_COVERAGE_SHORT,
+	MSG_COVERAGE_LONG,
+	MSG_COVERAGE_YEAR
 }user_msg_t;
 
+typedef enum output_format_t
+{
+	OUTPUT_FORMAT_TEXT,
+	OUTPUT_FORMAT_JSON,
+	OUTPUT_FORMAT_NDJSON,
+	OUTPUT_FORMAT_CSV,
+	OUTPUT_FORMAT_CBOR,
+	OUTPUT_FORMAT_MSGPACK,
+	OUTPUT_FORMAT_ARROW,
+	OUTPUT_FORMAT_ARROW_FILE
+}output_format_t;
+
+typedef enum list_sort_t
+{
+	LIST_SORT_NONE,
+	LIST_SORT_RATING,
+	LIST_SORT_MASS,
+	LIST_SORT_BRAND
+}list_sort_t;
+
 typedef enum pick_type_t
 {
 	PICK_DEFAULT,
@@ -191,7 +322,8 @@ typedef enum pick_type_t
 	PICK_MAX_RATING,
 	PICK_MAX_MASS,
 	PICK_MIN_RATING,
-	PICK_MIN_MASS
+	PICK_MIN_MASS,
+	PICK_KEYED_RANDOM
 
 }pick_type_t;
 
@@ -210,7 +342,8 @@ typedef enum error_msg_t
 	NO_TOOTHPASTES_AVAILBLE,
 	NULL_CONTEXT,
 	TPM_RARE_ERROR,
-	INVALID_ARGUMENT
+	INVALID_ARGUMENT,
+	STATS_STORE_FULL
 	
 }error_msg_t;
 
@@ -224,13 +357,156 @@ typedef enum toothpaste_type_t
 	
 }toothpaste_type_t;
 
+#if defined(_WIN32) || defined(_WIN64)
+typedef HANDLE stats_lock_t;
+#define STATS_NO_LOCK INVALID_HANDLE_VALUE
+#else
+typedef int stats_lock_t;
+#define STATS_NO_LOCK (-1)
+#endif
+
 typedef struct toothpaste_pick_stats_t
 {
 	time_t first_pick_time;
 	time_t last_pick_time;
 	unsigned int total_picks;
+	uint32_t journal_generation;
+	int64_t rollup_day;
+	uint32_t daily_picks[ROLLUP_DAYS];
+	int64_t rollup_week;
+	uint32_t week_picks;
+	int64_t rollup_month;
+	uint32_t monthly_picks[ROLLUP_MONTHS];
 }toothpaste_pick_stats_t;
 
+typedef struct pick_log_record_t
+{
+	int64_t when;
+	uint64_t user_hash;
+	uint32_t toothpaste_index;
+	uint16_t pick_type;
+	uint16_t flags;
+}pick_log_record_t;
+
+typedef struct pick_log_t
+{
+	unsigned char* records;
+	size_t total_records;
+	size_t size;
+	int mapped;
+#if defined(_WIN32) || defined(_WIN64)
+	HANDLE file;
+	HANDLE mapping;
+#endif
+}pick_log_t;
+
+typedef struct stats_journal_t
+{
+	int enabled;
+	unsigned int commit_picks;
+	unsigned int commit_seconds;
+	unsigned int checkpoint_picks;
+	int loaded;
+	toothpaste_pick_stats_t stats;
+	unsigned char* pending;
+	unsigned int pending_records;
+	unsigned char* log_pending;
+	unsigned int log_pending_records;
+	unsigned int disk_records;
+	time_t commit_time;
+	stats_lock_t lock;
+}stats_journal_t;
+
+#ifdef HAVE_SQLITE
+typedef struct pick_db_t
+{
+	sqlite3* db;
+	sqlite3_stmt* insert_pick;
+	sqlite3_stmt* insert_toothpaste;
+	sqlite3_stmt* select_toothpaste[PICK_KEYED_RANDOM + 1];
+	sqlite3_stmt* count_picks;
+	sqlite3_stmt* count_toothpastes;
+	unsigned int pending_picks;
+	time_t batch_start;
+	int catalog_synced;
+}pick_db_t;
+#endif
+
+typedef struct render_buffer_t
+{
+	char* data;
+	size_t size;
+	size_t length;
+	char inline_data[RENDER_INLINE_SIZE];
+}render_buffer_t;
+
+/* One flatbuffer table field, size 0 leaves it out and offsets are patched
+   once the child is written */
+typedef struct fb_field_t
+{
+	unsigned int size;
+	uint64_t value;
+	size_t slot;
+}fb_field_t;
+
+/* A column handed to the Arrow writer, no nulls so there is no validity
+   bitmap, offsets only for Utf8 */
+typedef struct arrow_column_t
+{
+	const char* name;
+	unsigned int type;
+	unsigned int bit_width;
+	int is_signed;
+	const void* data;
+	size_t data_size;
+	const int32_t* offsets;
+}arrow_column_t;
+
+typedef struct arrow_writer_t
+{
+	FILE* file;
+	uint64_t offset;
+	uint64_t batch_offset;
+	uint32_t batch_metadata;
+	uint64_t batch_body;
+	int batches;
+	int failed;
+}arrow_writer_t;
+
+/* The catalog column by column, the Arrow buffers point straight in here */
+typedef struct catalog_columns_t
+{
+	uint32_t rows;
+	uint32_t* index;
+	uint32_t* tube_mass_g;
+	uint32_t* rating;
+	uint32_t* toothbrush_length_cm;
+	uint32_t* toothbrush_hardness;
+	int32_t* brand_offsets;
+	char* brand_data;
+	int32_t* type_offsets;
+	char* type_data;
+	int32_t* color_offsets;
+	char* color_data;
+	int32_t* toothbrush_brand_offsets;
+	char* toothbrush_brand_data;
+}catalog_columns_t;
+
+/* Writes JSON, CBOR or MessagePack straight to a FILE* or appends to a
+   render buffer */
+typedef struct record_writer_t
+{
+	output_format_t format;
+	FILE* file;
+	render_buffer_t* buffer;
+	unsigned int depth;
+	unsigned int items[RECORD_MAX_DEPTH];
+	int lines;
+	int header;
+	unsigned int pending_lines;
+	int failed;
+}record_writer_t;
+
 typedef struct dental_formula_t
 {
 	unsigned int brush_times_per_day;
@@ -261,15 +537,120 @@ typedef struct list_node_t
     struct list_node_t *next;
 } list_node_t;
 
+/* One toothpaste of the listing, key is the sort key or the catalog position */
+typedef struct list_row_t
+{
+	uint32_t key;
+	list_node_t* node;
+}list_row_t;
+
+/* A {name:modifiers} template is compiled into a list of these, literal
+   runs point into template_literals, legacy letters keep their whole line */
+typedef enum template_op_kind_t
+{
+	TEMPLATE_LITERAL,
+	TEMPLATE_LINE,
+	TEMPLATE_VALUE
+}template_op_kind_t;
+
+/* Raw values a {name} can show, named after the JSON record keys */
+typedef enum template_value_t
+{
+	VALUE_WHO,
+	VALUE_PICK_TYPE,
+	VALUE_TOOTHPASTE,
+	VALUE_TUBE_MASS,
+	VALUE_RATING,
+	VALUE_TOOTHBRUSH_COLOR,
+	VALUE_TOOTHBRUSH_BRAND,
+	VALUE_TOOTHBRUSH_LENGTH,
+	VALUE_TOOTHBRUSH_HARDNESS,
+	VALUE_TOOTHPASTE_INDEX,
+	VALUE_TOTAL_TOOTHPASTES,
+	VALUE_TOOTHPASTE_TYPE,
+	VALUE_DENTAL_FORMULA,
+	VALUE_DAY_OF_THE_WEEK,
+	VALUE_DAY_COUNTER,
+	VALUE_TOTAL_PICKS,
+	VALUE_LAST_PICK_TIME,
+	VALUE_COVERAGE,
+	VALUE_COVERAGE_7_DAYS,
+	VALUE_COVERAGE_30_DAYS,
+	VALUE_COVERAGE_THIS_YEAR,
+	VALUE_PICKS_THIS_WEEK,
+	VALUE_PICKS_THIS_MONTH,
+	VALUE_TUBES_WASTED,
+	VALUE_SOURCE,
+	VALUE_MEME,
+	VALUE_TIME_OF_DAY
+}template_value_t;
+
+typedef struct template_name_t
+{
+	const char* name;
+	template_value_t value;
+}template_name_t;
+
+#define TEMPLATE_UPPER 1
+#define TEMPLATE_LOWER 2
+#define TEMPLATE_LEFT 4
+#define TEMPLATE_ZERO 8
+#define TEMPLATE_PRECISION 16
+
+typedef struct template_op_t
+{
+	unsigned char kind;
+	unsigned char id;
+	unsigned char flags;
+	unsigned int width;
+	unsigned int precision;
+	size_t offset;
+	size_t length;
+}template_op_t;
+
+/* Every message of one locale resolved once, the renderers index it
+   instead of asking gettext on each pick */
+typedef struct locale_strings_t
+{
+	char* locale;
+	const char* user[TOTAL_USER_MESSAGES];
+	const char* times_of_day[TOTAL_TIMES_OF_DAY];
+	const char* days_of_week[TOTAL_DAYS_OF_WEEK];
+	const char* toothpaste_types[TOTAL_TOOTHPASTE_TYPES];
+	const char* pick_types[TOTAL_PICK_TYPE_STRINGS];
+	struct locale_strings_t* next;
+}locale_strings_t;
+
+/* One message of a catalog compiled in from locale/<lang>/tpm.po */
+typedef struct catalog_entry_t
+{
+	const char* msgid;
+	const char* msgstr;
+}catalog_entry_t;
+
+/* Entries sorted by msgid for bsearch, see locale/po2c.awk */
+typedef struct catalog_t
+{
+	const char* locale;
+	const catalog_entry_t* entries;
+	size_t count;
+}catalog_t;
+
 typedef struct toothpaste_pick_options_t
 {
     pick_type_t ptype;
     int verbose;
     int lat_flag;
+    int history_flag;
     int json_flag;
     int fake_stats;
     int output_to_file;
     int csv_flag;
+    int ndjson_flag;
+    output_format_t output_format;
+    list_sort_t list_sort;
+    size_t list_offset;
+    size_t list_limit;
     unsigned int pick_by_index_index;
     char* username;
     char* brand_string;
@@ -293,6 +674,22 @@ typedef struct toothpaste_pick_options_t
 	time_t first_pick_time;
 	
 	char tpm_locale[MAX_LOCALE_CODE];
+	const locale_strings_t* strings;
+	int prng_resumed;
+	char* random_key;
+	int stats_fsync;
+	char* stats_store_path;
+	unsigned int stats_store_slots;
+	stats_lock_t stats_store;
+	uint64_t stats_store_offset;
+	stats_journal_t journal;
+	char* pick_db_path;
+	unsigned int pick_db_batch;
+	struct pick_db_t* pick_db;
+	char* template_source;
+	template_op_t* template_ops;
+	size_t template_op_count;
+	char* template_literals;
 } toothpaste_pick_options_t;
 
 typedef struct toothpaste_pick_t
@@ -304,7 +701,16 @@ typedef struct toothpaste_pick_t
 	time_t when;
 	toothpaste_pick_stats_t stats;
 	unsigned int coverage_percents;
+	unsigned int coverage_short_percents;
+	unsigned int coverage_long_percents;
+	unsigned int coverage_year_percents;
+	unsigned int picks_this_week;
+	unsigned int picks_this_month;
 	unsigned int toothpaste_pick_index;
+	unsigned int waste_picks;
+	int new_pick_flag;
+	int toothbrush_flag;
+	int dentist_flag;
 	char* message;
 	char* JSON;
 	char* CSV;
@@ -315,6 +721,8 @@ typedef struct toothpaste_pick_t
 	time_t day;
 }toothpaste_pick_t;
 
+typedef void (*render_field_t)(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, render_buffer_t* out);
+
 
 TPM int tpm_init_context(toothpaste_pick_options_t* opts);
 TPM int tpm_load_list_from_file(const char* filename,toothpaste_pick_options_t* opts,list_node_t** head);
@@ -323,12 +731,30 @@ TPM int tpm_get_toothpaste_picking_message(toothpaste_pick_t* pick, char** dest)
 TPM int tpm_get_toothpaste_picking_JSON(toothpaste_pick_t* pick,char** dest);
 TPM int tpm_get_toothpaste_picking_CSV(toothpaste_pick_t* pick,char** dest);
 TPM int tpm_free_toothpaste_pick(toothpaste_pick_t* pick);
+TPM unsigned int tpm_keyed_pick_index(const char* username, time_t day, unsigned int total_toothpastes, const char* key);
+TPM int tpm_open_pick_log(toothpaste_pick_options_t* opts, pick_log_t* log);
+TPM int tpm_get_pick_log_record(const pick_log_t* log, size_t i, pick_log_record_t* record);
+TPM unsigned int tpm_count_logged_picks(const pick_log_t* log, const char* username, time_t since);
+TPM int tpm_close_pick_log(pick_log_t* log);
+TPM int tpm_flush_stats(toothpaste_pick_options_t* opts);
+TPM int tpm_write_toothpaste_picking(toothpaste_pick_t* pick, FILE* out, output_format_t format);
+TPM int tpm_write_toothpaste_list(list_node_t* head, const toothpaste_pick_options_t* opts, FILE* out, output_format_t format);
+TPM int tpm_write_toothpaste_listing(list_node_t* head, toothpaste_pick_options_t* opts, FILE* out);
+TPM int tpm_write_pick_log(const pick_log_t* log, FILE* out, output_format_t format);
+#ifdef HAVE_SQLITE
+TPM int tpm_open_pick_db(toothpaste_pick_options_t* opts);
+TPM int tpm_db_select_toothpaste(toothpaste_pick_options_t* opts, time_t day, unsigned int* index);
+TPM unsigned int tpm_db_count_picks(toothpaste_pick_options_t* opts, const char* username, time_t since);
+TPM int tpm_close_pick_db(toothpaste_pick_options_t* opts);
+#endif
 
 static list_node_t* create_node(toothpaste_data_t p_data);
-static list_node_t* add_to_list(list_node_t* head, toothpaste_data_t p_data);
+static list_node_t* add_to_list(list_node_t** head, list_node_t* tail, toothpaste_data_t p_data);
 static char* rtrim(char *s); 
 static void ltrim(char *s); 
-static void display_list(list_node_t* head, toothpaste_pick_t* pick);  
+static int select_list_rows(list_node_t* head, const toothpaste_pick_options_t* opts, list_row_t** rows, size_t* count);
+static void radix_sort_rows(list_row_t* rows, list_row_t* scratch, size_t count);
+static int compare_brand_rows(const void* a, const void* b);
 static unsigned int count_list(list_node_t* head);
 static toothpaste_data_t get_item_by_index(list_node_t* head,unsigned int i);
 static toothpaste_data_t get_item_by_brand_string(list_node_t* head,const char* str); 
@@ -340,8 +766,59 @@ static void free_list(list_node_t* head);
 static int reset_counters(toothpaste_pick_options_t* opts);
 static int set_counters(void* opt_arg,toothpaste_pick_options_t* opts);
 static size_t read_counters(toothpaste_pick_stats_t* stats,int fake_stats,toothpaste_pick_options_t* opts);
-static int list_available_toothpastes(toothpaste_pick_t* pick);
 static int write_counters(toothpaste_pick_stats_t stats,int fake_stats,toothpaste_pick_options_t* opts);
+static int write_file_counters(const toothpaste_pick_stats_t* stats, toothpaste_pick_options_t* opts);
+static stats_lock_t lock_stats(toothpaste_pick_options_t* opts);
+static void unlock_stats(toothpaste_pick_options_t* opts, stats_lock_t lock);
+static stats_lock_t lock_stats_file(toothpaste_pick_options_t* opts);
+static stats_lock_t lock_file_path(const char* path);
+static void unlock_stats_file(stats_lock_t lock);
+static int store_io(stats_lock_t file, uint64_t offset, void* data, size_t size, int write_flag);
+static int store_lock_range(stats_lock_t file, uint64_t offset, uint64_t size, int lock_flag);
+static int open_stats_store(toothpaste_pick_options_t* opts, const char* username);
+static int check_store_header(const unsigned char* src, size_t size, uint16_t version, uint32_t slot_size);
+static int build_stats_store(toothpaste_pick_options_t* opts);
+static int open_user_stats_store(toothpaste_pick_options_t* opts);
+static void close_stats_store(toothpaste_pick_options_t* opts);
+static int read_store_counters(toothpaste_pick_stats_t* stats, toothpaste_pick_options_t* opts);
+static int write_store_counters(const toothpaste_pick_stats_t* stats, toothpaste_pick_options_t* opts);
+static int replace_file(const char* path, const void* data, size_t size, int sync);
+static void pick_log_path(toothpaste_pick_options_t* opts, char* dest, size_t size);
+static int append_pick_log(toothpaste_pick_options_t* opts, const pick_log_record_t* record);
+static int append_file(const char* path, const void* data, size_t size, int sync);
+static int journal_active(const toothpaste_pick_options_t* opts);
+static void journal_path(toothpaste_pick_options_t* opts, char* dest, size_t size);
+static void apply_journal_record(toothpaste_pick_stats_t* stats, uint32_t type, int64_t first, int64_t last, int64_t day);
+static int same_counters(const toothpaste_pick_stats_t* a, const toothpaste_pick_stats_t* b);
+static void replay_journal(toothpaste_pick_stats_t* stats, toothpaste_pick_options_t* opts);
+static int journal_counters(const toothpaste_pick_stats_t* stats, toothpaste_pick_options_t* opts);
+static int commit_journal(toothpaste_pick_options_t* opts);
+static int checkpoint_journal(const toothpaste_pick_stats_t* stats, toothpaste_pick_options_t* opts);
+#ifdef HAVE_SQLITE
+static int pick_db_error(toothpaste_pick_options_t* opts, int code);
+static int sync_pick_db_catalog(toothpaste_pick_options_t* opts, list_node_t* head);
+static int record_pick_db(toothpaste_pick_t* pick, list_node_t* head, int new_pick_flag, int toothbrush_flag, int dentist_flag, unsigned int index);
+static int commit_pick_db(toothpaste_pick_options_t* opts);
+#endif
+static void encode_pickstats(const toothpaste_pick_stats_t* stats, unsigned char* dst);
+static int decode_pickstats(const unsigned char* src, size_t size, toothpaste_pick_stats_t* stats);
+static void encode_rollups(const toothpaste_pick_stats_t* stats, unsigned char* dst);
+static void decode_rollups(const unsigned char* src, toothpaste_pick_stats_t* stats);
+static int64_t days_from_civil(int64_t year, unsigned int month, unsigned int day);
+static void civil_from_days(int64_t days, int64_t* year, unsigned int* month, unsigned int* day);
+static int64_t floor_div(int64_t a, int64_t b);
+static void record_rollup(toothpaste_pick_stats_t* stats, int64_t day);
+static uint32_t rollup_days(const toothpaste_pick_stats_t* stats, int64_t day, unsigned int days);
+static uint32_t rollup_months(const toothpaste_pick_stats_t* stats, int64_t from_month, int64_t to_month);
+static unsigned int window_coverage(uint32_t picks, int64_t days, unsigned int brush_times_per_day);
+static void eval_rollup_coverage(toothpaste_pick_t* pick);
+static void store_le16(unsigned char* dst, uint16_t v);
+static void store_le32(unsigned char* dst, uint32_t v);
+static void store_le64(unsigned char* dst, uint64_t v);
+static uint16_t load_le16(const unsigned char* src);
+static uint32_t load_le32(const unsigned char* src);
+static uint64_t load_le64(const unsigned char* src);
+static void store_be(unsigned char* dst, uint64_t v, size_t size);
 static void stop_system(void);
 static int finish(int flag,toothpaste_pick_t* pick);
 static char* get_user_home_dir(void);
@@ -349,41 +826,116 @@ static int get_current_username(char* buffer, size_t buffer_size);
 static void version(void);
 static void version_short(void);
 static void usage(char* prog_name);
-static const char* cfg_get_rec(const struct cfg_struct* cfg, const char* key, int* depth);
 static int read_config(const char* src,toothpaste_pick_options_t* opts);
 static dental_formula_t parse_dental_formula(const char* formula_str);
 static void save_default_config(struct cfg_struct* cfg,toothpaste_pick_options_t* opts);
 static int file_exists_fopen(const char *filename);
 static uint64_t rand_range(uint64_t min, uint64_t max);
+static uint64_t fnv1a64(const void* data, size_t size);
+static uint64_t entropy_seed(void);
+static void prng_state_path(toothpaste_pick_options_t* opts, char* dest, size_t size);
+static int resume_prng(toothpaste_pick_options_t* opts);
+static int checkpoint_prng(toothpaste_pick_options_t* opts);
+static int draw_random(toothpaste_pick_options_t* opts, uint64_t min, uint64_t max, uint64_t* value);
 static char* report_wasted_tubes(list_node_t* head,toothpaste_pick_stats_t* stats);
-static char* str_good_day(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_anon_username(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_welcome(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_next_pick(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_new_toothbrush(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_visit_dentist(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_already_picked(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_pick_type(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_toothpaste(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_toothbrush(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_toothpaste_index(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_toothpaste_type(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_dental_formula(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_day_of_the_week(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_total_picks(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_last_pick_time(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_brushing_coverage(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_tubes_wasted(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_source(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_meme(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static char* str_quiet(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
+static void str_good_day(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_anon_username(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_welcome(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_next_pick(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_new_toothbrush(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_visit_dentist(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_already_picked(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_pick_type(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_toothpaste(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_toothbrush(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_toothpaste_index(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_toothpaste_type(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_dental_formula(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_day_of_the_week(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_total_picks(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_last_pick_time(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_brushing_coverage(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_tubes_wasted(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_source(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_meme(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_quiet(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_coverage_window(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out, user_msg_t window);
+static void str_coverage_short(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_coverage_long(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
+static void str_coverage_year(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts, render_buffer_t* out);
 static int eval_username(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
+static void resolve_username(toothpaste_pick_options_t* topts, char* dest, size_t size);
 static int eval_total_toothpastes(toothpaste_pick_t* pick,toothpaste_pick_options_t* topts);
-static int char_to_strnum(char input);
+static const char* eval_waste_report(toothpaste_pick_t* pick);
+static int eval_pick_JSON(toothpaste_pick_t* pick);
+static int eval_pick_CSV(toothpaste_pick_t* pick);
+static void render_init(render_buffer_t* out);
+static int render_reserve(render_buffer_t* out, size_t extra);
+static void render_printf(render_buffer_t* out, size_t limit, const char* format, ...);
+static char* render_detach(render_buffer_t* out);
+static void render_append(render_buffer_t* out, const char* data, size_t length);
+static void render_free(render_buffer_t* out);
+static void record_emit(record_writer_t* w, const char* data, size_t length);
+static size_t json_safe_run(const char* s, size_t length);
+static void json_string(record_writer_t* w, const char* value);
+static void json_item(record_writer_t* w);
+static size_t csv_safe_run(const char* s, size_t length);
+static void csv_string(record_writer_t* w, const char* value);
+static char* record_digits(char* end, uintmax_t value);
+static int record_writer_init(record_writer_t* w, FILE* out, output_format_t format);
+static void record_head(record_writer_t* w, unsigned int major, uint64_t value);
+static void record_text(record_writer_t* w, const char* value);
+static void record_begin(record_writer_t* w, char open, size_t count);
+static void record_end(record_writer_t* w, char close);
+static void record_key(record_writer_t* w, const char* key);
+static void record_field_string(record_writer_t* w, const char* key, const char* value);
+static void record_field_uint(record_writer_t* w, const char* key, uintmax_t value);
+static void record_field_int(record_writer_t* w, const char* key, intmax_t value);
+static void record_field_bool(record_writer_t* w, const char* key, int value);
+static void record_line_end(record_writer_t* w);
+static void record_write_pick(record_writer_t* w, toothpaste_pick_t* pick);
+static void record_write_toothpaste(record_writer_t* w, const toothpaste_data_t* data);
+static void record_write_log_entry(record_writer_t* w, const pick_log_record_t* record);
+static void record_write_header(record_writer_t* w, int pick_log);
+static void fb_pad(render_buffer_t* b, size_t align, size_t shift);
+static void fb_put(render_buffer_t* b, uint64_t value, size_t size);
+static void fb_patch(render_buffer_t* b, size_t slot, size_t target);
+static size_t fb_table(render_buffer_t* b, fb_field_t* fields, unsigned int count);
+static size_t fb_vector(render_buffer_t* b, uint32_t count, size_t element_size);
+static size_t fb_string(render_buffer_t* b, const char* value);
+static size_t arrow_padded(size_t size);
+static void arrow_emit(arrow_writer_t* w, const void* data, size_t size);
+static size_t arrow_schema(render_buffer_t* b, const arrow_column_t* columns, unsigned int count);
+static void arrow_message(arrow_writer_t* w, render_buffer_t* b, uint64_t body_length);
+static void arrow_write_schema(arrow_writer_t* w, const arrow_column_t* columns, unsigned int count);
+static void arrow_write_batch(arrow_writer_t* w, const arrow_column_t* columns, unsigned int count, uint32_t rows);
+static void arrow_write_footer(arrow_writer_t* w, const arrow_column_t* columns, unsigned int count);
+static int arrow_write_table(FILE* out, const arrow_column_t* columns, unsigned int count, uint32_t rows, int file_format);
+static int build_catalog_columns(const list_row_t* selected, size_t rows, catalog_columns_t* cols);
+static void free_catalog_columns(catalog_columns_t* cols);
+static int arrow_write_catalog(const list_row_t* rows, size_t count, FILE* out, int file_format);
+static int arrow_write_history(const pick_log_t* log, FILE* out, int file_format);
+static int set_output_template(toothpaste_pick_options_t* opts, const char* text);
+static void free_template(toothpaste_pick_options_t* topts);
+static int parse_template_field(const char* name, size_t length, template_op_t* op);
+static int compile_template(toothpaste_pick_options_t* topts);
+static const char* template_value(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, unsigned int id, char* scratch, size_t size);
+static void template_emit(render_buffer_t* out, const template_op_t* op, const char* value);
+static void format_last_pick_time(const toothpaste_pick_t* pick, char* buffer, size_t size);
+static int render_template(toothpaste_pick_t* pick, toothpaste_pick_options_t* topts, int new_pick_flag, int toothbrush_flag, int dentist_flag);
 static int check_visibility(int input_id, int new_pick_flag, int toothbrush_flag, int dentist_flag,int verbose);
 static int check_enhanced_toothpastes(const char* filename);
 static void free_context(toothpaste_pick_options_t* opts);
 static int init_tpm_locale(char* locale_id, toothpaste_pick_options_t* opts);
+static const locale_strings_t* load_locale_strings(void);
+static const locale_strings_t* locale_strings(toothpaste_pick_options_t* opts);
+#if !defined(ENABLE_NLS) || (ENABLE_NLS != 1)
+static int compare_catalog_locale(const void* key, const void* item);
+static int compare_catalog_entry(const void* key, const void* item);
+static const catalog_t* find_catalog(const char* locale_id);
+static const catalog_t* select_catalog(const char* locale_id);
+static const char* catalog_gettext(const char* msgid);
+#endif
 static int init_tpm_console(void);
 #ifdef __cplusplus
 }
@@ -0,0 +1,1074 @@
+/* Generated by locale/po2c.awk from locale/<lang>/tpm.po, do not edit */
+#ifndef TPM_CATALOG_H
+#define TPM_CATALOG_H
+
+static const catalog_entry_t catalog_de[] = {
+	{"# Index | Brand | Tube Mass | Rating",
+	 "# Index | Marke | Tubenmasse | Bewertung"},
+	{"# Index | Brand | Tube Mass | Rating | Toothbrush Color | Toothbrush Brand | Toothbrush Length | Toothbrush Hardness",
+	 "# Index | Marke | Tubenmasse | Bewertung | Zahnbürstenfarbe | Zahnbürstenmarke | Zahnbürstenlänge | Zahnbürstenhärte"},
+	{"0-paste",
+	 "Zahnpasta-0"},
+	{"Already picked today",
+	 "Heute bereits ausgewählt"},
+	{"Anonymous",
+	 "Anonym"},
+	{"BUILTIN TOOTHPASTE 1",
+	 "INTEGRIERTE ZAHNPASTA 1"},
+	{"BUILTIN TOOTHPASTE 2",
+	 "INTEGRIERTE ZAHNPASTA 2"},
+	{"BUILTIN TOOTHPASTE 3",
+	 "INTEGRIERTE ZAHNPASTA 3"},
+	{"Brand None",
+	 "Keine Marke"},
+	{"Brushing coverage:",
+	 "Putzabdeckung:"},
+	{"Builtin",
+	 "Integriert"},
+	{"By brand",
+	 "Nach Marke"},
+	{"By index",
+	 "Nach Index"},
+	{"Compiled on:",
+	 "Kompiliert am:"},
+	{"Compiler unknown",
+	 "Compiler unbekannt"},
+	{"Compiler:",
+	 "Compiler:"},
+	{"Coverage last 30 days:",
+	 "Abdeckung letzte 30 Tage:"},
+	{"Coverage last 7 days:",
+	 "Abdeckung letzte 7 Tage:"},
+	{"Coverage this year:",
+	 "Abdeckung dieses Jahr:"},
+	{"Day",
+	 "Tag"},
+	{"Day:",
+	 "Tag:"},
+	{"Default(Circular)",
+	 "Standard(Kreisförmig)"},
+	{"Dental Formula:",
+	 "Zahnformel:"},
+	{"Error 0: No error.",
+	 "Fehler 0: Kein Fehler."},
+	{"Error 101: opts is NULL",
+	 "Fehler 101: opts ist NULL"},
+	{"Error 102: Memory allocation failed.",
+	 "Fehler 102: Speicherzuweisung fehlgeschlagen."},
+	{"Error 103: Opening toothpastes file falling back to default.",
+	 "Fehler 103: Zahnpastadatei konnte nicht geöffnet werden, weiche auf Standard aus."},
+	{"Error 104: Opening pickstats file for writing",
+	 "Fehler 104: pickstats-Datei konnte nicht zum Schreiben geöffnet werden"},
+	{"Error 105: Opening pickstats file for reading",
+	 "Fehler 105: pickstats-Datei konnte nicht zum Lesen geöffnet werden"},
+	{"Error 106: No toothpastes file loaded",
+	 "Fehler 106: Keine Zahnpastadatei geladen"},
+	{"Error 107: Unable to load config ~tpm/tpm.conf\n",
+	 "Fehler 107: Konfiguration ~tpm/tpm.conf konnte nicht geladen werden\n"},
+	{"Error 108: Opening last_pick file for writing",
+	 "Fehler 108: last_pick-Datei konnte nicht zum Schreiben geöffnet werden"},
+	{"Error 109: Pick is NULL perform pick first",
+	 "Fehler 109: Pick ist NULL, bitte zuerst eine Auswahl treffen"},
+	{"Error 110: No toothpastes available.",
+	 "Fehler 110: Keine Zahnpasten verfügbar."},
+	{"Error 111: NULL context",
+	 "Fehler 111: NULL-Kontext"},
+	{"Evening",
+	 "Abend"},
+	{"Friday",
+	 "Freitag"},
+	{"Good",
+	 "Gut"},
+	{"Keyed random",
+	 "Zufällig mit Schlüssel"},
+	{"Last pick time:",
+	 "Letzte Auswahlzeit:"},
+	{"Max rating",
+	 "Maximale Bewertung"},
+	{"Max tube mass",
+	 "Maximale Tubenmasse"},
+	{"Meme:",
+	 "Meme:"},
+	{"Min rating",
+	 "Minimale Bewertung"},
+	{"Min tube mass",
+	 "Minimale Tubenmasse"},
+	{"Monday",
+	 "Montag"},
+	{"Morning",
+	 "Morgen"},
+	{"New next pick stats updated",
+	 "Statistiken für die nächste Auswahl aktualisiert"},
+	{"Night",
+	 "Nacht"},
+	{"Nothing",
+	 "Nichts"},
+	{"Output pick to file ",
+	 "Auswahl in Datei ausgeben "},
+	{"Pick counter clear",
+	 "Auswahlzähler zurückgesetzt"},
+	{"Pick counter set",
+	 "Auswahlzähler gesetzt"},
+	{"Pick type",
+	 "Auswahltyp"},
+	{"Press Enter to continue...",
+	 "Drücken Sie die Eingabetaste, um fortzufahren..."},
+	{"Press any key to continue . . .",
+	 "Drücken Sie eine beliebige Taste, um fortzufahren . . ."},
+	{"Random",
+	 "Zufällig"},
+	{"Saturday",
+	 "Samstag"},
+	{"Source:",
+	 "Quelle:"},
+	{"Sunday",
+	 "Sonntag"},
+	{"Thursday",
+	 "Donnerstag"},
+	{"Time span over please visit dentist",
+	 "Zeitraum abgelaufen, bitte suchen Sie einen Zahnarzt auf"},
+	{"Toothbrush time span over swap the toothbrush(or order new one)",
+	 "Nutzungsdauer der Zahnbürste abgelaufen, bitte Zahnbürste wechseln (oder neue bestellen)"},
+	{"Toothbrush:",
+	 "Zahnbürste:"},
+	{"Toothpaste index:",
+	 "Zahnpasta-Index:"},
+	{"Toothpaste type:",
+	 "Zahnpasta-Typ:"},
+	{"Toothpaste:",
+	 "Zahnpasta:"},
+	{"Total picks:",
+	 "Auswahlen insgesamt:"},
+	{"Tubes wasted:",
+	 "Verbrauchte Tuben:"},
+	{"Tuesday",
+	 "Dienstag"},
+	{"Unknown",
+	 "Unbekannt"},
+	{"Usage:",
+	 "Verwendung:"},
+	{"Wednesday",
+	 "Mittwoch"},
+	{"Welcome to the toothpaste picking manager",
+	 "Willkommen beim Zahnpasta-Auswahl-Manager"}
+};
+
+static const catalog_entry_t catalog_es[] = {
+	{"# Index | Brand | Tube Mass | Rating",
+	 "# Índice | Marca | Masa del tubo | Calificación"},
+	{"# Index | Brand | Tube Mass | Rating | Toothbrush Color | Toothbrush Brand | Toothbrush Length | Toothbrush Hardness",
+	 "# Índice | Marca | Masa del tubo | Calificación | Color del cepillo | Marca del cepillo | Longitud del cepillo | Dureza del cepillo"},
+	{"0-paste",
+	 "Pasta-0"},
+	{"Already picked today",
+	 "Ya se ha seleccionado hoy"},
+	{"Anonymous",
+	 "Anónimo"},
+	{"BUILTIN TOOTHPASTE 1",
+	 "PASTA DE DIENTES INTEGRADA 1"},
+	{"BUILTIN TOOTHPASTE 2",
+	 "PASTA DE DIENTES INTEGRADA 2"},
+	{"BUILTIN TOOTHPASTE 3",
+	 "PASTA DE DIENTES INTEGRADA 3"},
+	{"Brand None",
+	 "Sin marca"},
+	{"Brushing coverage:",
+	 "Cobertura del cepillado:"},
+	{"Builtin",
+	 "Integrado"},
+	{"By brand",
+	 "Por marca"},
+	{"By index",
+	 "Por índice"},
+	{"Compiled on:",
+	 "Compilado el:"},
+	{"Compiler unknown",
+	 "Compilador desconocido"},
+	{"Compiler:",
+	 "Compilador:"},
+	{"Coverage last 30 days:",
+	 "Cobertura últimos 30 días:"},
+	{"Coverage last 7 days:",
+	 "Cobertura últimos 7 días:"},
+	{"Coverage this year:",
+	 "Cobertura este año:"},
+	{"Day",
+	 "Día"},
+	{"Day:",
+	 "Día:"},
+	{"Default(Circular)",
+	 "Por defecto (Circular) "},
+	{"Dental Formula:",
+	 "Fórmula dental:"},
+	{"Error 0: No error.",
+	 "Error 0: Sin error."},
+	{"Error 101: opts is NULL",
+	 "Error 101: opts es NULL"},
+	{"Error 102: Memory allocation failed.",
+	 "Error 102: Fallo en la asignación de memoria."},
+	{"Error 103: Opening toothpastes file falling back to default.",
+	 "Error 103: Error al abrir el archivo de pastas de dientes, volviendo al valor por defecto."},
+	{"Error 104: Opening pickstats file for writing",
+	 "Error 104: Error al abrir el archivo pickstats para escritura"},
+	{"Error 105: Opening pickstats file for reading",
+	 "Error 105: Error al abrir el archivo pickstats para lectura"},
+	{"Error 106: No toothpastes file loaded",
+	 "Error 106: No se ha cargado ningún archivo de pastas de dientes"},
+	{"Error 107: Unable to load config ~tpm/tpm.conf\n",
+	 "Error 107: No se pudo cargar la configuración ~tpm/tpm.conf\n"},
+	{"Error 108: Opening last_pick file for writing",
+	 "Error 108: Error al abrir el archivo last_pick para escritura"},
+	{"Error 109: Pick is NULL perform pick first",
+	 "Error 109: El valor de selección es NULL, realice una selección primero"},
+	{"Error 110: No toothpastes available.",
+	 "Error 110: No hay pastas de dientes disponibles."},
+	{"Error 111: NULL context",
+	 "Error 111: Contexto NULL"},
+	{"Evening",
+	 "Tarde"},
+	{"Friday",
+	 "Viernes"},
+	{"Good",
+	 "Bueno"},
+	{"Keyed random",
+	 "Aleatorio con clave"},
+	{"Last pick time:",
+	 "Hora de la última selección:"},
+	{"Max rating",
+	 "Calificación máxima"},
+	{"Max tube mass",
+	 "Masa máxima del tubo"},
+	{"Meme:",
+	 "Meme:"},
+	{"Min rating",
+	 "Calificación mínima"},
+	{"Min tube mass",
+	 "Masa mínima del tubo"},
+	{"Monday",
+	 "Lunes"},
+	{"Morning",
+	 "Mañana"},
+	{"New next pick stats updated",
+	 "Estadísticas de la siguiente selección actualizadas"},
+	{"Night",
+	 "Noche"},
+	{"Nothing",
+	 "Nada"},
+	{"Output pick to file ",
+	 "Guardando selección en el archivo "},
+	{"Pick counter clear",
+	 "Contador de selección reiniciado"},
+	{"Pick counter set",
+	 "Contador de selección configurado"},
+	{"Pick type",
+	 "Tipo de selección"},
+	{"Press Enter to continue...",
+	 "Presione Enter para continuar..."},
+	{"Press any key to continue . . .",
+	 "Presione cualquier tecla para continuar . . ."},
+	{"Random",
+	 "Aleatorio"},
+	{"Saturday",
+	 "Sábado"},
+	{"Source:",
+	 "Origen:"},
+	{"Sunday",
+	 "Domingo"},
+	{"Thursday",
+	 "Jueves"},
+	{"Time span over please visit dentist",
+	 "Plazo superado, por favor visite al dentista"},
+	{"Toothbrush time span over swap the toothbrush(or order new one)",
+	 "Vida útil del cepillo de dientes superada, por favor cámbielo (o pida uno nuevo)"},
+	{"Toothbrush:",
+	 "Cepillo de dientes:"},
+	{"Toothpaste index:",
+	 "Índice de la pasta de dientes:"},
+	{"Toothpaste type:",
+	 "Tipo de pasta de dientes:"},
+	{"Toothpaste:",
+	 "Pasta de dientes:"},
+	{"Total picks:",
+	 "Selecciones totales:"},
+	{"Tubes wasted:",
+	 "Tubos desperdiciados:"},
+	{"Tuesday",
+	 "Martes"},
+	{"Unknown",
+	 "Desconocido"},
+	{"Usage:",
+	 "Uso:"},
+	{"Wednesday",
+	 "Miércoles"},
+	{"Welcome to the toothpaste picking manager",
+	 "Bienvenido al gestor de selección de pasta de dientes"}
+};
+
+static const catalog_entry_t catalog_fr[] = {
+	{"# Index | Brand | Tube Mass | Rating",
+	 "# Index | Marque | Masse Tube | Note"},
+	{"# Index | Brand | Tube Mass | Rating | Toothbrush Color | Toothbrush Brand | Toothbrush Length | Toothbrush Hardness",
+	 "# Index | Marque | Masse Tube | Note | Couleur Brosse | Marque Brosse | Longueur Brosse | Dureté Brosse"},
+	{"0-paste",
+	 "0-dentifrice"},
+	{"Already picked today",
+	 "Déjà choisi aujourd'hui"},
+	{"Anonymous",
+	 "Anonyme"},
+	{"BUILTIN TOOTHPASTE 1",
+	 "DENTIFRICE INTÉGRÉ 1"},
+	{"BUILTIN TOOTHPASTE 2",
+	 "DENTIFRICE INTÉGRÉ 2"},
+	{"BUILTIN TOOTHPASTE 3",
+	 "DENTIFRICE INTÉGRÉ 3"},
+	{"Brand None",
+	 "Aucune marque"},
+	{"Brushing coverage:",
+	 "Couverture du brossage :"},
+	{"Builtin",
+	 "Intégré"},
+	{"By brand",
+	 "Par marque"},
+	{"By index",
+	 "Par index"},
+	{"Compiled on:",
+	 "Compilé le :"},
+	{"Compiler unknown",
+	 "Compilateur inconnu"},
+	{"Compiler:",
+	 "Compilateur :"},
+	{"Coverage last 30 days:",
+	 "Couverture des 30 derniers jours :"},
+	{"Coverage last 7 days:",
+	 "Couverture des 7 derniers jours :"},
+	{"Coverage this year:",
+	 "Couverture cette année :"},
+	{"Day",
+	 "Jour"},
+	{"Day:",
+	 "Jour :"},
+	{"Default(Circular)",
+	 "Par défaut (Circulaire)"},
+	{"Dental Formula:",
+	 "Formule dentaire :"},
+	{"Error 0: No error.",
+	 "Erreur 0 : Aucune erreur."},
+	{"Error 101: opts is NULL",
+	 "Erreur 101 : opts est NULL"},
+	{"Error 102: Memory allocation failed.",
+	 "Erreur 102 : Échec de l'allocation mémoire."},
+	{"Error 103: Opening toothpastes file falling back to default.",
+	 "Erreur 103 : Ouverture du fichier des dentifrices impossible, retour aux valeurs par défaut."},
+	{"Error 104: Opening pickstats file for writing",
+	 "Erreur 104 : Ouverture du fichier pickstats en écriture impossible"},
+	{"Error 105: Opening pickstats file for reading",
+	 "Erreur 105 : Ouverture du fichier pickstats en lecture impossible"},
+	{"Error 106: No toothpastes file loaded",
+	 "Erreur 106 : Aucun fichier de dentifrices chargé"},
+	{"Error 107: Unable to load config ~tpm/tpm.conf\n",
+	 "Erreur 107 : Impossible de charger la configuration ~tpm/tpm.conf\n"},
+	{"Error 108: Opening last_pick file for writing",
+	 "Erreur 108 : Ouverture du fichier last_pick en écriture impossible"},
+	{"Error 109: Pick is NULL perform pick first",
+	 "Erreur 109 : Pick est NULL, veuillez effectuer un choix d'abord"},
+	{"Error 110: No toothpastes available.",
+	 "Erreur 110 : Aucun dentifrice disponible."},
+	{"Error 111: NULL context",
+	 "Erreur 111 : Contexte NULL"},
+	{"Evening",
+	 "Soir"},
+	{"Friday",
+	 "Vendredi"},
+	{"Good",
+	 "Bon"},
+	{"Keyed random",
+	 "Aléatoire à clé"},
+	{"Last pick time:",
+	 "Heure du dernier choix :"},
+	{"Max rating",
+	 "Note maximale"},
+	{"Max tube mass",
+	 "Masse maximale du tube"},
+	{"Meme:",
+	 "Mème :"},
+	{"Min rating",
+	 "Note minimale"},
+	{"Min tube mass",
+	 "Masse minimale du tube"},
+	{"Monday",
+	 "Lundi"},
+	{"Morning",
+	 "Matin"},
+	{"New next pick stats updated",
+	 "Statistiques du prochain choix mises à jour"},
+	{"Night",
+	 "Nuit"},
+	{"Nothing",
+	 "Rien"},
+	{"Output pick to file ",
+	 "Enregistrement du choix dans le fichier "},
+	{"Pick counter clear",
+	 "Compteur de choix réinitialisé"},
+	{"Pick counter set",
+	 "Compteur de choix configuré"},
+	{"Pick type",
+	 "Type de choix"},
+	{"Press Enter to continue...",
+	 "Appuyez sur Entrée pour continuer..."},
+	{"Press any key to continue . . .",
+	 "Appuyez sur une touche pour continuer . . ."},
+	{"Random",
+	 "Aléatoire"},
+	{"Saturday",
+	 "Samedi"},
+	{"Source:",
+	 "Source :"},
+	{"Sunday",
+	 "Dimanche"},
+	{"Thursday",
+	 "Jeudi"},
+	{"Time span over please visit dentist",
+	 "Délai dépassé, veuillez consulter un dentiste"},
+	{"Toothbrush time span over swap the toothbrush(or order new one)",
+	 "Durée d'utilisation de la brosse à dents dépassée, veuillez la changer (ou en commander une neuve)"},
+	{"Toothbrush:",
+	 "Brosse à dents :"},
+	{"Toothpaste index:",
+	 "Index du dentifrice :"},
+	{"Toothpaste type:",
+	 "Type de dentifrice :"},
+	{"Toothpaste:",
+	 "Dentifrice :"},
+	{"Total picks:",
+	 "Total des choix :"},
+	{"Tubes wasted:",
+	 "Tubes gaspillés :"},
+	{"Tuesday",
+	 "Mardi"},
+	{"Unknown",
+	 "Inconnu"},
+	{"Usage:",
+	 "Utilisation :"},
+	{"Wednesday",
+	 "Mercredi"},
+	{"Welcome to the toothpaste picking manager",
+	 "Bienvenue dans le gestionnaire de choix de dentifrice"}
+};
+
+static const catalog_entry_t catalog_it[] = {
+	{"# Index | Brand | Tube Mass | Rating",
+	 "# Indice | Marca | Massa Tubo | Valutazione"},
+	{"# Index | Brand | Tube Mass | Rating | Toothbrush Color | Toothbrush Brand | Toothbrush Length | Toothbrush Hardness",
+	 "# Indice | Marca | Massa Tubo | Valutazione | Colore Spazzolino | Marca Spazzolino | Lunghezza Spazzolino | Durezza Spazzolino"},
+	{"0-paste",
+	 "Dentifricio-0"},
+	{"Already picked today",
+	 "Già selezionato oggi"},
+	{"Anonymous",
+	 "Anonimo"},
+	{"BUILTIN TOOTHPASTE 1",
+	 "DENTIFRICIO INTEGRATO 1"},
+	{"BUILTIN TOOTHPASTE 2",
+	 "DENTIFRICIO INTEGRATO 2"},
+	{"BUILTIN TOOTHPASTE 3",
+	 "DENTIFRICIO INTEGRATO 3"},
+	{"Brand None",
+	 "Nessuna marca"},
+	{"Brushing coverage:",
+	 "Copertura dello spazzolamento:"},
+	{"Builtin",
+	 "Integrato"},
+	{"By brand",
+	 "Per marca"},
+	{"By index",
+	 "Per indice"},
+	{"Compiled on:",
+	 "Compilato il:"},
+	{"Compiler unknown",
+	 "Compilatore sconosciuto"},
+	{"Compiler:",
+	 "Compilatore:"},
+	{"Coverage last 30 days:",
+	 "Copertura ultimi 30 giorni:"},
+	{"Coverage last 7 days:",
+	 "Copertura ultimi 7 giorni:"},
+	{"Coverage this year:",
+	 "Copertura quest'anno:"},
+	{"Day",
+	 "Giorno"},
+	{"Day:",
+	 "Giorno:"},
+	{"Default(Circular)",
+	 "Tipo di scelta: Predefinito (Circolare)"},
+	{"Dental Formula:",
+	 "Formula dentaria:"},
+	{"Error 0: No error.",
+	 "Errore 0: Nessun errore."},
+	{"Error 101: opts is NULL",
+	 "Errore 101: opts è NULL"},
+	{"Error 102: Memory allocation failed.",
+	 "Errore 102: Allocazione di memoria fallita."},
+	{"Error 103: Opening toothpastes file falling back to default.",
+	 "Errore 103: Impossibile aprire il file dei dentifrici, ripristino dei valori predefiniti."},
+	{"Error 104: Opening pickstats file for writing",
+	 "Errore 104: Impossibile aprire il file pickstats in scrittura"},
+	{"Error 105: Opening pickstats file for reading",
+	 "Errore 105: Impossibile aprire il file pickstats in lettura"},
+	{"Error 106: No toothpastes file loaded",
+	 "Errore 106: Nessun file di dentifrici caricato"},
+	{"Error 107: Unable to load config ~tpm/tpm.conf\n",
+	 "Errore 107: Impossibile caricare la configurazione ~tpm/tpm.conf\n"},
+	{"Error 108: Opening last_pick file for writing",
+	 "Errore 108: Impossibile aprire il file last_pick in scrittura"},
+	{"Error 109: Pick is NULL perform pick first",
+	 "Errore 109: Il valore di scelta è NULL, effettuare prima una selezione"},
+	{"Error 110: No toothpastes available.",
+	 "Errore 110: Nessun dentifricio disponibile."},
+	{"Error 111: NULL context",
+	 "Errore 111: Contesto NULL"},
+	{"Evening",
+	 "Sera"},
+	{"Friday",
+	 "Venerdì"},
+	{"Good",
+	 "Buono"},
+	{"Keyed random",
+	 "Casuale con chiave"},
+	{"Last pick time:",
+	 "Ora dell'ultima selezione:"},
+	{"Max rating",
+	 "Valutazione massima"},
+	{"Max tube mass",
+	 "Massa massima del tubo"},
+	{"Meme:",
+	 "Meme:"},
+	{"Min rating",
+	 "Valutazione minima"},
+	{"Min tube mass",
+	 "Massa minima del tubo"},
+	{"Monday",
+	 "Lunedì"},
+	{"Morning",
+	 "Mattina"},
+	{"New next pick stats updated",
+	 "Statistiche per la prossima selezione aggiornate"},
+	{"Night",
+	 "Notte"},
+	{"Nothing",
+	 "Niente"},
+	{"Output pick to file ",
+	 "Salvataggio della selezione nel file "},
+	{"Pick counter clear",
+	 "Contatore delle selezioni azzerato"},
+	{"Pick counter set",
+	 "Contatore delle selezioni configurato"},
+	{"Pick type",
+	 "Tipo di selezione"},
+	{"Press Enter to continue...",
+	 "Premere Invio per continuare..."},
+	{"Press any key to continue . . .",
+	 "Premere un tasto per continuare . . ."},
+	{"Random",
+	 "Casuale"},
+	{"Saturday",
+	 "Sabato"},
+	{"Source:",
+	 "Origine:"},
+	{"Sunday",
+	 "Domenica"},
+	{"Thursday",
+	 "Giovedì"},
+	{"Time span over please visit dentist",
+	 "Tempo limite superato, si prega di consultare un dentista"},
+	{"Toothbrush time span over swap the toothbrush(or order new one)",
+	 "Durata dello spazzolino superata, si prega di sostituirlo (o di ordinarne uno nuovo)"},
+	{"Toothbrush:",
+	 "Spazzolino:"},
+	{"Toothpaste index:",
+	 "Indice del dentifricio:"},
+	{"Toothpaste type:",
+	 "Tipo di dentifricio:"},
+	{"Toothpaste:",
+	 "Dentifricio:"},
+	{"Total picks:",
+	 "Selezioni totali:"},
+	{"Tubes wasted:",
+	 "Tubi sprecati:"},
+	{"Tuesday",
+	 "Martedì"},
+	{"Unknown",
+	 "Sconosciuto"},
+	{"Usage:",
+	 "Utilizzo:"},
+	{"Wednesday",
+	 "Mercoledì"},
+	{"Welcome to the toothpaste picking manager",
+	 "Benvenuto nel gestore della selezione del dentifricio"}
+};
+
+static const catalog_entry_t catalog_ja[] = {
+	{"# Index | Brand | Tube Mass | Rating",
+	 "# インデックス | ブランド | 容量 | 評価"},
+	{"# Index | Brand | Tube Mass | Rating | Toothbrush Color | Toothbrush Brand | Toothbrush Length | Toothbrush Hardness",
+	 "# インデックス | ブランド | 容量 | 評価 | 歯ブラシの色 | 歯ブラシのブランド | 歯ブラシの長さ | 歯ブラシの硬さ"},
+	{"0-paste",
+	 "0型ペースト"},
+	{"Already picked today",
+	 "本日はすでに選択済みです"},
+	{"Anonymous",
+	 "匿名"},
+	{"BUILTIN TOOTHPASTE 1",
+	 "内蔵歯磨き粉 1"},
+	{"BUILTIN TOOTHPASTE 2",
+	 "内蔵歯磨き粉 2"},
+	{"BUILTIN TOOTHPASTE 3",
+	 "内蔵歯磨き粉 3"},
+	{"Brand None",
+	 "ブランドなし"},
+	{"Brushing coverage:",
+	 "歯磨き達成率："},
+	{"Builtin",
+	 "内蔵"},
+	{"By brand",
+	 "ブランド順"},
+	{"By index",
+	 "インデックス順"},
+	{"Compiled on:",
+	 "コンパイル日時:"},
+	{"Compiler unknown",
+	 "不明なコンパイラ"},
+	{"Compiler:",
+	 "コンパイラ:"},
+	{"Coverage last 30 days:",
+	 "直近30日間の達成率："},
+	{"Coverage last 7 days:",
+	 "直近7日間の達成率："},
+	{"Coverage this year:",
+	 "今年の達成率："},
+	{"Day",
+	 "昼"},
+	{"Day:",
+	 "日付:"},
+	{"Default(Circular)",
+	 "デフォルト (円形)"},
+	{"Dental Formula:",
+	 "デンタルフォーミュラ:"},
+	{"Error 0: No error.",
+	 "エラー 0: エラーはありません。"},
+	{"Error 101: opts is NULL",
+	 "エラー 101: optsがNULLです"},
+	{"Error 102: Memory allocation failed.",
+	 "エラー 102: メモリ割り当てに失敗しました。"},
+	{"Error 103: Opening toothpastes file falling back to default.",
+	 "エラー 103: 歯磨き粉ファイルを開けません。デフォルトに戻します。"},
+	{"Error 104: Opening pickstats file for writing",
+	 "エラー 104: 書き込み用のpickstatsファイルを開けません"},
+	{"Error 105: Opening pickstats file for reading",
+	 "エラー 105: 読み込み用のpickstatsファイルを開けません"},
+	{"Error 106: No toothpastes file loaded",
+	 "エラー 106: 歯磨き粉ファイルが読み込まれていません"},
+	{"Error 107: Unable to load config ~tpm/tpm.conf\n",
+	 "エラー 107: 設定 ~tpm/tpm.conf を読み込めません\n"},
+	{"Error 108: Opening last_pick file for writing",
+	 "エラー 108: 書き込み用のlast_pickファイルを開けません"},
+	{"Error 109: Pick is NULL perform pick first",
+	 "エラー 109: PickがNULLです。先に選択を実行してください"},
+	{"Error 110: No toothpastes available.",
+	 "エラー 110: 利用可能な歯磨き粉がありません。"},
+	{"Error 111: NULL context",
+	 "エラー 111: コンテキストがNULLです"},
+	{"Evening",
+	 "夕方"},
+	{"Friday",
+	 "金曜日"},
+	{"Good",
+	 "良好"},
+	{"Keyed random",
+	 "キー付きランダム"},
+	{"Last pick time:",
+	 "最終選択日時:"},
+	{"Max rating",
+	 "最高評価"},
+	{"Max tube mass",
+	 "最大容量"},
+	{"Meme:",
+	 "ミーム:"},
+	{"Min rating",
+	 "最低評価"},
+	{"Min tube mass",
+	 "最小容量"},
+	{"Monday",
+	 "月曜日"},
+	{"Morning",
+	 "朝"},
+	{"New next pick stats updated",
+	 "次回の選択統計が更新されました"},
+	{"Night",
+	 "夜"},
+	{"Nothing",
+	 "なし"},
+	{"Output pick to file ",
+	 "選択結果をファイルに出力 "},
+	{"Pick counter clear",
+	 "選択カウンターをクリアしました"},
+	{"Pick counter set",
+	 "選択カウンターを設定しました"},
+	{"Pick type",
+	 "選択タイプ"},
+	{"Press Enter to continue...",
+	 "Enterキーを押して続行..."},
+	{"Press any key to continue . . .",
+	 "続行するには何かキーを押してください . . ."},
+	{"Random",
+	 "ランダム"},
+	{"Saturday",
+	 "土曜日"},
+	{"Source:",
+	 "ソース:"},
+	{"Sunday",
+	 "日曜日"},
+	{"Thursday",
+	 "木曜日"},
+	{"Time span over please visit dentist",
+	 "期間を過ぎています。歯医者を受診してください"},
+	{"Toothbrush time span over swap the toothbrush(or order new one)",
+	 "歯ブラシの交換時期を過ぎています。歯ブラシを交換するか、新しいものを注文してください"},
+	{"Toothbrush:",
+	 "歯ブラシ:"},
+	{"Toothpaste index:",
+	 "歯磨き粉インデックス:"},
+	{"Toothpaste type:",
+	 "歯磨き粉タイプ:"},
+	{"Toothpaste:",
+	 "歯磨き粉:"},
+	{"Total picks:",
+	 "総選択回数:"},
+	{"Tubes wasted:",
+	 "廃棄されたチューブ数:"},
+	{"Tuesday",
+	 "火曜日"},
+	{"Unknown",
+	 "不明"},
+	{"Usage:",
+	 "使用法:"},
+	{"Wednesday",
+	 "水曜日"},
+	{"Welcome to the toothpaste picking manager",
+	 "歯磨き粉選択マネージャーへようこそ"}
+};
+
+static const catalog_entry_t catalog_ru[] = {
+	{"# Index | Brand | Tube Mass | Rating",
+	 "# Индекс | Марка | Масса тюбика | Рейтинг"},
+	{"# Index | Brand | Tube Mass | Rating | Toothbrush Color | Toothbrush Brand | Toothbrush Length | Toothbrush Hardness",
+	 "# Индекс | Марка | Масса тюбика | Рейтинг | Цвет щетки | Марка щетки | Длина щетки | Жесткость щетки"},
+	{"0-paste",
+	 "0-паста"},
+	{"Already picked today",
+	 "Сегодня уже подбирали"},
+	{"Anonymous",
+	 "Анонимно"},
+	{"BUILTIN TOOTHPASTE 1",
+	 "ВСТРОЕННАЯ ЗУБНАЯ ПАСТА 1"},
+	{"BUILTIN TOOTHPASTE 2",
+	 "ВСТРОЕННАЯ ЗУБНАЯ ПАСТА 2"},
+	{"BUILTIN TOOTHPASTE 3",
+	 "ВСТРОЕННАЯ ЗУБНАЯ ПАСТА 3"},
+	{"Brand None",
+	 "Без марки"},
+	{"Brushing coverage:",
+	 "Покрытие чисткой:"},
+	{"Builtin",
+	 "Встроенная"},
+	{"By brand",
+	 "По марке"},
+	{"By index",
+	 "По индексу"},
+	{"Compiled on:",
+	 "Скомпилировано:"},
+	{"Compiler unknown",
+	 "Компилятор неизвестен"},
+	{"Compiler:",
+	 "Компилятор:"},
+	{"Coverage last 30 days:",
+	 "Покрытие за 30 дней:"},
+	{"Coverage last 7 days:",
+	 "Покрытие за 7 дней:"},
+	{"Coverage this year:",
+	 "Покрытие за этот год:"},
+	{"Day",
+	 "Добрый день"},
+	{"Day:",
+	 "День:"},
+	{"Default(Circular)",
+	 "По умолчанию(Циркуляр)"},
+	{"Dental Formula:",
+	 "Дентальная формула:"},
+	{"Error 0: No error.",
+	 "Ошибка 0: Нет ошибки."},
+	{"Error 101: opts is NULL",
+	 "Ошибка 101: opts равен NULL"},
+	{"Error 102: Memory allocation failed.",
+	 "Ошибка 102: Сбой выделения памяти."},
+	{"Error 103: Opening toothpastes file falling back to default.",
+	 "Ошибка 103: Ошибка открытия файла зубных паст, возврат к значениям по умолчанию."},
+	{"Error 104: Opening pickstats file for writing",
+	 "Ошибка 104: Ошибка открытия файла pickstats для записи"},
+	{"Error 105: Opening pickstats file for reading",
+	 "Ошибка 105: Ошибка открытия файла pickstats для чтения"},
+	{"Error 106: No toothpastes file loaded",
+	 "Ошибка 106: Файл со списком зубных паст не загружен"},
+	{"Error 107: Unable to load config ~tpm/tpm.conf\n",
+	 "Ошибка 107: Не удалось загрузить конфигурацию ~tpm/tpm.conf\n"},
+	{"Error 108: Opening last_pick file for writing",
+	 "Ошибка 108: Ошибка открытия файла last_pick для записи"},
+	{"Error 109: Pick is NULL perform pick first",
+	 "Ошибка 109: Pick равен NULL, сначала выполните подбор"},
+	{"Error 110: No toothpastes available.",
+	 "Ошибка 110: Нет доступных зубных паст."},
+	{"Error 111: NULL context",
+	 "Ошибка 111: Контекст NULL"},
+	{"Evening",
+	 "Добрый вечер"},
+	{"Friday",
+	 "Пятница"},
+	{"Good",
+	 "-->"},
+	{"Keyed random",
+	 "Случайный по ключу"},
+	{"Last pick time:",
+	 "Время последнего подбора:"},
+	{"Max rating",
+	 "Макс. рейтинг"},
+	{"Max tube mass",
+	 "Макс. масса тюбика"},
+	{"Meme:",
+	 "Мем:"},
+	{"Min rating",
+	 "Мин. рейтинг"},
+	{"Min tube mass",
+	 "Мин. масса тюбика"},
+	{"Monday",
+	 "Понедельник"},
+	{"Morning",
+	 "Доброе утро"},
+	{"New next pick stats updated",
+	 "Статистика следующего подбора обновлена"},
+	{"Night",
+	 "Доброй ночи"},
+	{"Nothing",
+	 "Ничего"},
+	{"Output pick to file ",
+	 "Вывод подбора в файл "},
+	{"Pick counter clear",
+	 "Счетчик подборов сброшен"},
+	{"Pick counter set",
+	 "Счетчик подборов установлен"},
+	{"Pick type",
+	 "Тип подбора"},
+	{"Press Enter to continue...",
+	 "Нажмите Enter для продолжения..."},
+	{"Press any key to continue . . .",
+	 "Нажмите любую клавишу для продолжения . . ."},
+	{"Random",
+	 "Случайно"},
+	{"Saturday",
+	 "Суббота"},
+	{"Source:",
+	 "Источник:"},
+	{"Sunday",
+	 "Воскресенье"},
+	{"Thursday",
+	 "Четверг"},
+	{"Time span over please visit dentist",
+	 "Время вышло, пожалуйста, посетите стоматолога"},
+	{"Toothbrush time span over swap the toothbrush(or order new one)",
+	 "Срок службы зубной щетки испек, замените щетку (или закажите новую)"},
+	{"Toothbrush:",
+	 "Зубная щетка:"},
+	{"Toothpaste index:",
+	 "Индекс зубной пасты:"},
+	{"Toothpaste type:",
+	 "Тип зубной пасты:"},
+	{"Toothpaste:",
+	 "Зубная паста:"},
+	{"Total picks:",
+	 "Всего подборов:"},
+	{"Tubes wasted:",
+	 "Тюбиков использовано:"},
+	{"Tuesday",
+	 "Вторник"},
+	{"Unknown",
+	 "Неизвестно"},
+	{"Usage:",
+	 "Использование:"},
+	{"Wednesday",
+	 "Среда"},
+	{"Welcome to the toothpaste picking manager",
+	 "Добро пожаловать к приказчику подбора зубной пасты"}
+};
+
+static const catalog_entry_t catalog_zh_CN[] = {
+	{"# Index | Brand | Tube Mass | Rating",
+	 "# 索引 | 品牌 | 管重 | 评分"},
+	{"# Index | Brand | Tube Mass | Rating | Toothbrush Color | Toothbrush Brand | Toothbrush Length | Toothbrush Hardness",
+	 "# 索引 | 品牌 | 管重 | 评分 | 牙刷颜色 | 牙刷品牌 | 牙刷长度 | 牙刷硬度"},
+	{"0-paste",
+	 "0型牙膏"},
+	{"Already picked today",
+	 "今天已经选择过了"},
+	{"Anonymous",
+	 "匿名"},
+	{"BUILTIN TOOTHPASTE 1",
+	 "内置牙膏 1"},
+	{"BUILTIN TOOTHPASTE 2",
+	 "内置牙膏 2"},
+	{"BUILTIN TOOTHPASTE 3",
+	 "内置牙膏 3"},
+	{"Brand None",
+	 "无品牌"},
+	{"Brushing coverage:",
+	 "刷牙覆盖率："},
+	{"Builtin",
+	 "内置"},
+	{"By brand",
+	 "按品牌"},
+	{"By index",
+	 "按索引"},
+	{"Compiled on:",
+	 "编译于："},
+	{"Compiler unknown",
+	 "未知编译器"},
+	{"Compiler:",
+	 "编译器："},
+	{"Coverage last 30 days:",
+	 "最近30天覆盖率："},
+	{"Coverage last 7 days:",
+	 "最近7天覆盖率："},
+	{"Coverage this year:",
+	 "今年覆盖率："},
+	{"Day",
+	 "白天"},
+	{"Day:",
+	 "日期："},
+	{"Default(Circular)",
+	 "默认 (圆形)"},
+	{"Dental Formula:",
+	 "牙科配方："},
+	{"Error 0: No error.",
+	 "错误 0：无错误。"},
+	{"Error 101: opts is NULL",
+	 "错误 101：opts 为 NULL"},
+	{"Error 102: Memory allocation failed.",
+	 "错误 102：内存分配失败。"},
+	{"Error 103: Opening toothpastes file falling back to default.",
+	 "错误 103：无法打开牙膏文件，已恢复到默认设置。"},
+	{"Error 104: Opening pickstats file for writing",
+	 "错误 104：无法打开 pickstats 文件以进行写入"},
+	{"Error 105: Opening pickstats file for reading",
+	 "错误 105：无法打开 pickstats 文件以进行读取"},
+	{"Error 106: No toothpastes file loaded",
+	 "错误 106：未加载任何牙膏文件"},
+	{"Error 107: Unable to load config ~tpm/tpm.conf\n",
+	 "错误 107：无法加载配置文件 ~tpm/tpm.conf\n"},
+	{"Error 108: Opening last_pick file for writing",
+	 "错误 108：无法打开 last_pick 文件以进行写入"},
+	{"Error 109: Pick is NULL perform pick first",
+	 "错误 109：Pick 为 NULL，请先执行选择操作"},
+	{"Error 110: No toothpastes available.",
+	 "错误 110：没有可用的牙膏。"},
+	{"Error 111: NULL context",
+	 "错误 111：NULL 上下文"},
+	{"Evening",
+	 "傍晚"},
+	{"Friday",
+	 "星期五"},
+	{"Good",
+	 "良好"},
+	{"Keyed random",
+	 "密钥随机"},
+	{"Last pick time:",
+	 "上次选择时间："},
+	{"Max rating",
+	 "最高评分"},
+	{"Max tube mass",
+	 "最大管重"},
+	{"Meme:",
+	 "迷因："},
+	{"Min rating",
+	 "最低评分"},
+	{"Min tube mass",
+	 "最小管重"},
+	{"Monday",
+	 "星期一"},
+	{"Morning",
+	 "早晨"},
+	{"New next pick stats updated",
+	 "下一次选择的统计数据已更新"},
+	{"Night",
+	 "夜晚"},
+	{"Nothing",
+	 "无"},
+	{"Output pick to file ",
+	 "将选择结果输出到文件 "},
+	{"Pick counter clear",
+	 "选择计数器已清零"},
+	{"Pick counter set",
+	 "选择计数器已设置"},
+	{"Pick type",
+	 "选择类型"},
+	{"Press Enter to continue...",
+	 "按回车键继续..."},
+	{"Press any key to continue . . .",
+	 "按任意键继续 . . ."},
+	{"Random",
+	 "随机"},
+	{"Saturday",
+	 "星期六"},
+	{"Source:",
+	 "来源："},
+	{"Sunday",
+	 "星期日"},
+	{"Thursday",
+	 "星期四"},
+	{"Time span over please visit dentist",
+	 "时间已过，请去看牙医"},
+	{"Toothbrush time span over swap the toothbrush(or order new one)",
+	 "牙刷使用寿命已到，请更换牙刷（或订购新牙刷）"},
+	{"Toothbrush:",
+	 "牙刷："},
+	{"Toothpaste index:",
+	 "牙膏索引："},
+	{"Toothpaste type:",
+	 "牙膏类型："},
+	{"Toothpaste:",
+	 "牙膏："},
+	{"Total picks:",
+	 "总选择次数："},
+	{"Tubes wasted:",
+	 "浪费的管数："},
+	{"Tuesday",
+	 "星期二"},
+	{"Unknown",
+	 "未知"},
+	{"Usage:",
+	 "用法："},
+	{"Wednesday",
+	 "星期三"},
+	{"Welcome to the toothpaste picking manager",
+	 "欢迎使用牙膏选择管理器"}
+};
+
+static const catalog_t embedded_catalogs[] = {
+	{"de", catalog_de, 74},
+	{"es", catalog_es, 74},
+	{"fr", catalog_fr, 74},
+	{"it", catalog_it, 74},
+	{"ja", catalog_ja, 74},
+	{"ru", catalog_ru, 74},
+	{"zh_CN", catalog_zh_CN, 74}
+};
+
+#define TOTAL_EMBEDDED_CATALOGS 7
+
+#endif
@@ -7,11 +7,85 @@
 	it's just impossible to fail making most of tests useless anyway We'll see what really happens here
 */
 
+#define _XOPEN_SOURCE 700
+
 #include <check.h>
+#include <ftw.h>
+#include <signal.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include "../src/tpm.h"
 
+#define FIXTURE_COLGATE "1, Colgate, 75, 5, Blue, Oral-B, 19, 2\n"
+
+/* Every file a pickstats path grows next to itself */
+static void
+remove_stats(const char* stats_path)
+{
+	static const char* const suffixes[] = {"", ".log", ".lock", ".wal", ".corrupt", ".xrp", ".xrp.lock"};
+	char path[MAX_PATH];
+	size_t k;
+	
+	for (k = 0; k < sizeof(suffixes) / sizeof(suffixes[0]); k++)
+	{
+		snprintf(path, sizeof(path), "%s%s", stats_path, suffixes[k]);
+		remove(path);
+	}
+}
+
+/* A fresh context for the test user, stats go to stats_path when given and
+   are not synced unless a test asks for it */
+static void
+fixture_context(toothpaste_pick_options_t* topts, char* template_buffer, const char* stats_path)
+{
+	tpm_init_context(topts);
+	topts->tpm_template = template_buffer;
+	topts->username = "TestUser";
+	topts->meme_payload = "moot";
+	topts->stats_fsync = 0;
+	if (stats_path != NULL)
+	{
+		snprintf(topts->stats_file_path_final, MAX_PATH, "%s", stats_path);
+	}
+}
+
+/* Starts a test: the context, no stats left from an earlier run and the
+   catalog lines written to catalog and loaded. close_fixture undoes it */
+static list_node_t*
+open_fixture(toothpaste_pick_options_t* topts, char* template_buffer, const char* catalog, const char* lines, const char* stats_path)
+{
+	list_node_t* toothpastes_list = NULL;
+	FILE* f;
+	
+	fixture_context(topts, template_buffer, stats_path);
+	if (stats_path != NULL)
+	{
+		remove_stats(stats_path);
+	}
+	f = fopen(catalog, "w");
+	ck_assert_ptr_nonnull(f);
+	fputs(lines, f);
+	fclose(f);
+	
+	tpm_load_list_from_file(catalog, topts, &toothpastes_list);
+	ck_assert_ptr_nonnull(toothpastes_list);
+	return toothpastes_list;
+}
+
+static void
+close_fixture(const char* catalog, const char* stats_path)
+{
+	remove(catalog);
+	if (stats_path != NULL)
+	{
+		remove_stats(stats_path);
+	}
+}
+
 
 START_TEST (welcome_msg)
 {
@@ -48,31 +122,16 @@ END_TEST
 
 START_TEST (length_pick_CSV)
 {
-	list_node_t* toothpastes_list = NULL;
-	toothpaste_pick_t pick = {0};           
-	toothpaste_pick_options_t topts = {0};   
-
-	char template_buffer[] = "guwntdapobiTfWPlUsmI"; 
-	tpm_init_context(&topts);
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	char template_buffer[] = "guwntdapobiTfWPlUsmI";
+	int len;
 	
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, "test_fixtures_csv.txt", FIXTURE_COLGATE, NULL);
 	topts.formula.visit_dentist_times_per_year = 2;
 	topts.formula.swap_toothbrush_times_per_year = 2;
 	topts.ptype = 0;
-	topts.tpm_template = template_buffer;
-	topts.username = "TestUser";
-	topts.meme_payload = "moot";
-
-	int len;
-	
-	const char* test_filename = "test_fixtures_csv.txt";
-	FILE* f = fopen(test_filename, "w");
-	ck_assert_ptr_nonnull(f); 
-	fprintf(f, "1, Colgate, 75, 5, Blue, Oral-B, 19, 2\n");
-	fclose(f);
 	
-	tpm_load_list_from_file(test_filename,&topts,&toothpastes_list);
-	ck_assert_ptr_nonnull(toothpastes_list);
-
 	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
 	
 	char* out;
@@ -82,76 +141,47 @@ START_TEST (length_pick_CSV)
 	len = strlen(out);
 	ck_assert_int_gt(len, 0);
 	
-	remove(test_filename);
+	close_fixture("test_fixtures_csv.txt", NULL);
 }
 END_TEST
 
 START_TEST (length_pick_JSON)
 {
-	list_node_t* toothpastes_list = NULL;
-	toothpaste_pick_t pick = {0};           
-	toothpaste_pick_options_t topts = {0};   
-	
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
 	char template_buffer[] = "guwntdapobiTfWPlUsmI";
-	tpm_init_context(&topts);
+	int len;
+	
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, "test_fixtures_json.txt", FIXTURE_COLGATE, NULL);
 	topts.formula.visit_dentist_times_per_year = 2;
 	topts.formula.swap_toothbrush_times_per_year = 2;
 	topts.ptype = 0;
-	topts.tpm_template = template_buffer;
-	topts.username = "TestUser";
-	topts.meme_payload = "moot";
-	
-	int len;
 	
-	const char* test_filename = "test_fixtures_json.txt";
-	FILE* f = fopen(test_filename, "w");
-	ck_assert_ptr_nonnull(f); 
-	fprintf(f, "1, Colgate, 75, 5, Blue, Oral-B, 19, 2\n");
-	fclose(f);
-	
-	tpm_load_list_from_file(test_filename,&topts,&toothpastes_list);
-	ck_assert_ptr_nonnull(toothpastes_list);
-
 	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
 	
 	char* out;
-    tpm_get_toothpaste_picking_JSON(&pick,&out);
+	tpm_get_toothpaste_picking_JSON(&pick,&out);
 	ck_assert_ptr_nonnull(out);
 	
 	len = strlen(out);
 	ck_assert_int_gt(len, 0);
 	
-	remove(test_filename);
+	close_fixture("test_fixtures_json.txt", NULL);
 }
 END_TEST
 
 START_TEST (length_pick_msg)
 {
-	list_node_t* toothpastes_list = NULL;
-	toothpaste_pick_t pick = {0};            
-	toothpaste_pick_options_t topts = {0};   
-	
-	
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
 	char template_buffer[] = "guwntdapobiTfWPlUsmI";
-	tpm_init_context(&topts);
+	int len;
+	
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, "test_fixtures_toothpastes.txt", FIXTURE_COLGATE, NULL);
 	topts.formula.visit_dentist_times_per_year = 2;
 	topts.formula.swap_toothbrush_times_per_year = 2;
 	topts.ptype = 0;
-	topts.tpm_template = template_buffer; 
-	topts.meme_payload = "moot";
-	topts.username = "TestUser";
-	
-	int len;
 	
-	const char* test_filename = "test_fixtures_toothpastes.txt";
-	FILE* f = fopen(test_filename, "w");
-	ck_assert_ptr_nonnull(f); 
-	fprintf(f, "1, Colgate, 75, 5, Blue, Oral-B, 19, 2\n");
-	fclose(f);
-	
-	tpm_load_list_from_file(test_filename,&topts,&toothpastes_list );
-	ck_assert_ptr_nonnull(toothpastes_list);
-
 	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
 	
 	char* out;
@@ -161,7 +191,438 @@ START_TEST (length_pick_msg)
 	len = strlen(out);
 	ck_assert_int_gt(len, 0);
 	
-	remove(test_filename);
+	close_fixture("test_fixtures_toothpastes.txt", NULL);
+}
+END_TEST
+
+START_TEST (template_recompile)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	char first_template[] = "Pzz";
+	char second_template[] = "zIz";
+	
+	const char* test_filename = "test_fixtures_template.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, NULL, test_filename, FIXTURE_COLGATE, NULL);
+	topts.fake_stats = 1;
+	topts.ptype = PICK_MAX_RATING;
+	
+	/* unknown characters render nothing, a new template is picked up */
+	topts.verbose = 1;
+	topts.tpm_template = first_template;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_ptr_nonnull(strstr(pick.message, "Total picks: ~"));
+	ck_assert_ptr_null(strchr(pick.message, 'z'));
+	
+	topts.verbose = 0;
+	topts.tpm_template = second_template;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_str_eq(pick.message, "Colgate (75g) [5/100]\n");
+	
+	close_fixture(test_filename, NULL);
+}
+END_TEST
+
+START_TEST (template_named_fields)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	char named_template[] = "{brand:upper}|{rating:3}|{mass:-4}|{toothpaste_index:02}|{brand:.3}|{{|{nope}\\n";
+	char long_template[] = "IIIIIIIIIIIIIIIIIIIIIIIIIIIIII";
+	
+	const char* test_filename = "test_fixtures_named.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, NULL, test_filename, FIXTURE_COLGATE, NULL);
+	topts.fake_stats = 1;
+	topts.verbose = 0;
+	topts.ptype = PICK_MAX_RATING;
+	
+	/* modifiers apply, unknown fields stay as written */
+	topts.tpm_template = named_template;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_str_eq(pick.message, "COLGATE|  5|75  |00|Col|{|{nope}\n");
+	
+	/* past the old 24 letter cap every letter still renders */
+	topts.tpm_template = long_template;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_int_eq(strlen(pick.message), 30 * strlen("Colgate (75g) [5/100]\n"));
+	
+	/* fields a pick left empty render as JSON shows them, not as numbers */
+	toothpaste_pick_t empty_pick = {0};
+	char missing_template[] = "[{toothbrush_color}] [{toothbrush_brand}]";
+	
+	topts.ptype = PICK_BY_BRAND;
+	topts.brand_string = "No Such Brand";
+	topts.tpm_template = missing_template;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &empty_pick);
+	ck_assert_str_eq(empty_pick.message, "[Unknown] [Unknown]");
+	
+	close_fixture(test_filename, NULL);
+}
+END_TEST
+
+START_TEST (lazy_waste_report)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	char template_buffer[] = "I";
+	
+	const char* test_filename = "test_fixtures_lazy.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, FIXTURE_COLGATE, NULL);
+	topts.fake_stats = 1;
+	topts.verbose = 0;
+	topts.ptype = PICK_MAX_RATING;
+	
+	/* nothing asked for the report or the CSV yet */
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_ptr_null(pick.waste_report);
+	ck_assert_ptr_null(pick.CSV);
+	
+	char* out;
+	tpm_get_toothpaste_picking_CSV(&pick,&out);
+	ck_assert_ptr_nonnull(out);
+	ck_assert_ptr_nonnull(strstr(out, "TestUser,"));
+	ck_assert_ptr_nonnull(pick.waste_report);
+	
+	close_fixture(test_filename, NULL);
+}
+END_TEST
+
+START_TEST (large_output_complete)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	char template_buffer[] = "m";
+	static char meme[3 * 4096];
+	memset(meme, 'x', sizeof(meme) - 1);
+	
+	const char* test_filename = "test_fixtures_large.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, FIXTURE_COLGATE, NULL);
+	topts.meme_payload = meme;
+	topts.fake_stats = 1;
+	topts.ptype = PICK_MAX_RATING;
+	
+	/* nothing is cut at the old 4 KB block */
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_ptr_nonnull(strstr(pick.message, meme));
+	
+	char* out;
+	tpm_get_toothpaste_picking_JSON(&pick,&out);
+	ck_assert_ptr_nonnull(strstr(out, meme));
+	ck_assert_int_eq(out[strlen(out) - 1], '}');
+	tpm_get_toothpaste_picking_CSV(&pick,&out);
+	ck_assert_ptr_nonnull(strstr(out, meme));
+	
+	close_fixture(test_filename, NULL);
+}
+END_TEST
+
+START_TEST (json_escaping)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	char template_buffer[] = "I";
+	char meme[] = "a \"quoted\" back\\slash\nline\x01 and a long safe tail";
+	
+	const char* test_filename = "test_fixtures_json_escape.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, FIXTURE_COLGATE, NULL);
+	topts.meme_payload = meme;
+	topts.fake_stats = 1;
+	topts.ptype = PICK_MAX_RATING;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	
+	char* out;
+	tpm_get_toothpaste_picking_JSON(&pick,&out);
+	ck_assert_ptr_nonnull(strstr(out, "\"meme\":\"a \\\"quoted\\\" back\\\\slash\\nline\\u0001 and a long safe tail\""));
+	ck_assert_ptr_nonnull(strstr(out, "\"toothpaste\":\"Colgate\""));
+	ck_assert_ptr_nonnull(strstr(out, "\"new_pick\":"));
+	
+	/* the streaming writer emits the same text as the getter */
+	char streamed[4096] = {0};
+	FILE* tmp = tmpfile();
+	ck_assert_ptr_nonnull(tmp);
+	ck_assert_int_eq(tpm_write_toothpaste_picking(&pick, tmp, OUTPUT_FORMAT_JSON), 0);
+	rewind(tmp);
+	size_t n = fread(streamed, 1, sizeof(streamed) - 1, tmp);
+	fclose(tmp);
+	ck_assert_uint_eq(n, strlen(out));
+	ck_assert_str_eq(streamed, out);
+	
+	close_fixture(test_filename, NULL);
+}
+END_TEST
+
+START_TEST (ndjson_lines)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	char template_buffer[] = "I";
+	
+	const char* test_filename = "test_fixtures_ndjson.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename,
+		"1, Colgate, 75, 5\n2, Blend-a-med, 100, 7\n3, Lacalut, 50, 9\n", NULL);
+	topts.fake_stats = 1;
+	topts.ptype = PICK_MAX_RATING;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	
+	/* one compact object per catalog entry, then one per pick */
+	FILE* tmp = tmpfile();
+	ck_assert_ptr_nonnull(tmp);
+	ck_assert_int_eq(tpm_write_toothpaste_list(toothpastes_list, NULL, tmp, OUTPUT_FORMAT_NDJSON), 0);
+	ck_assert_int_eq(tpm_write_toothpaste_picking(&pick, tmp, OUTPUT_FORMAT_NDJSON), 0);
+	rewind(tmp);
+	
+	char line[4096];
+	int lines = 0;
+	while (fgets(line, sizeof(line), tmp) != NULL)
+	{
+		ck_assert_int_eq(line[0], '{');
+		ck_assert_ptr_null(strchr(line, '\t'));
+		ck_assert_int_eq(line[strlen(line) - 2], '}');
+		lines++;
+	}
+	fclose(tmp);
+	ck_assert_int_eq(lines, 4);
+	ck_assert_ptr_nonnull(strstr(line, "\"toothpaste\":\"Lacalut\""));
+	
+	close_fixture(test_filename, NULL);
+}
+END_TEST
+
+START_TEST (binary_formats)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	char template_buffer[] = "I";
+	
+	const char* test_filename = "test_fixtures_binary.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename,
+		"1, Colgate, 75, 5\n2, Blend-a-med, 100, 7\n3, Lacalut, 50, 9\n", NULL);
+	topts.fake_stats = 1;
+	topts.ptype = PICK_MAX_RATING;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	
+	unsigned char bytes[4096];
+	size_t n;
+	FILE* tmp = tmpfile();
+	ck_assert_ptr_nonnull(tmp);
+	
+	/* CBOR map of 29 pairs led by the text key "who" */
+	ck_assert_int_eq(tpm_write_toothpaste_picking(&pick, tmp, OUTPUT_FORMAT_CBOR), 0);
+	rewind(tmp);
+	n = fread(bytes, 1, sizeof(bytes), tmp);
+	ck_assert_uint_gt(n, 6);
+	ck_assert_uint_eq(bytes[0], 0xb8);
+	ck_assert_uint_eq(bytes[1], 29);
+	ck_assert_uint_eq(bytes[2], 0x63);
+	ck_assert_int_eq(memcmp(bytes + 3, "who", 3), 0);
+	
+	/* MessagePack array of 3 fixmaps with 9 pairs each */
+	rewind(tmp);
+	ck_assert_int_eq(tpm_write_toothpaste_list(toothpastes_list, NULL, tmp, OUTPUT_FORMAT_MSGPACK), 0);
+	rewind(tmp);
+	n = fread(bytes, 1, sizeof(bytes), tmp);
+	ck_assert_uint_gt(n, 8);
+	ck_assert_uint_eq(bytes[0], 0x93);
+	ck_assert_uint_eq(bytes[1], 0x89);
+	ck_assert_uint_eq(bytes[2], 0xa5);
+	ck_assert_int_eq(memcmp(bytes + 3, "index", 5), 0);
+	ck_assert_uint_eq(bytes[8], 1);
+	fclose(tmp);
+	
+	ck_assert_int_eq(tpm_write_toothpaste_picking(&pick, stdout, OUTPUT_FORMAT_TEXT), INVALID_ARGUMENT);
+	
+	close_fixture(test_filename, NULL);
+}
+END_TEST
+
+START_TEST (arrow_catalog)
+{
+	toothpaste_pick_options_t topts = {0};
+	
+	const char* test_filename = "test_fixtures_arrow.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, NULL, test_filename,
+		"1, Colgate, 75, 5\n2, Blend-a-med, 100, 7\n3, Lacalut, 50, 9\n", NULL);
+	topts.fake_stats = 1;
+	
+	unsigned char bytes[4096];
+	size_t n;
+	FILE* tmp = tmpfile();
+	ck_assert_ptr_nonnull(tmp);
+	
+	/* Stream: continuation marker, 8-byte aligned metadata, end-of-stream */
+	ck_assert_int_eq(tpm_write_toothpaste_list(toothpastes_list, NULL, tmp, OUTPUT_FORMAT_ARROW), 0);
+	rewind(tmp);
+	n = fread(bytes, 1, sizeof(bytes), tmp);
+	ck_assert_uint_gt(n, 16);
+	ck_assert_uint_eq(n % 8, 0);
+	ck_assert_int_eq(memcmp(bytes, "\xff\xff\xff\xff", 4), 0);
+	ck_assert_uint_eq(bytes[4] % 8, 0);
+	ck_assert_int_eq(memcmp(bytes + n - 8, "\xff\xff\xff\xff\0\0\0\0", 8), 0);
+	fclose(tmp);
+	
+	/* File: magic at both ends around the stream and the footer */
+	tmp = tmpfile();
+	ck_assert_ptr_nonnull(tmp);
+	ck_assert_int_eq(tpm_write_toothpaste_list(toothpastes_list, NULL, tmp, OUTPUT_FORMAT_ARROW_FILE), 0);
+	rewind(tmp);
+	n = fread(bytes, 1, sizeof(bytes), tmp);
+	ck_assert_uint_gt(n, 24);
+	ck_assert_int_eq(memcmp(bytes, "ARROW1\0\0", 8), 0);
+	ck_assert_int_eq(memcmp(bytes + n - 6, "ARROW1", 6), 0);
+	ck_assert_int_eq(memcmp(bytes + 8, "\xff\xff\xff\xff", 4), 0);
+	fclose(tmp);
+	
+	close_fixture(test_filename, NULL);
+}
+END_TEST
+
+START_TEST (list_sort_window)
+{
+	toothpaste_pick_options_t topts = {0};
+	
+	const char* test_filename = "test_fixtures_listing.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, NULL, test_filename,
+		"1, Lacalut, 300, 5\n2, Colgate, 75, 9\n3, Blend-a-med, 100, 5\n4, Aquafresh, 50, 7\n", NULL);
+	topts.fake_stats = 1;
+	
+	char text[1024];
+	size_t n;
+	FILE* tmp = tmpfile();
+	ck_assert_ptr_nonnull(tmp);
+	
+	/* equal ratings keep the catalog order, the window skips the first row */
+	topts.list_sort = LIST_SORT_RATING;
+	topts.list_offset = 1;
+	topts.list_limit = 2;
+	topts.upper_brands = 1;
+	ck_assert_int_eq(tpm_write_toothpaste_listing(toothpastes_list, &topts, tmp), 0);
+	rewind(tmp);
+	n = fread(text, 1, sizeof(text) - 1, tmp);
+	text[n] = '\0';
+	ck_assert_ptr_nonnull(strstr(text, "\n3,BLEND-A-MED,100,5\n4,AQUAFRESH,50,7\n"));
+	ck_assert_ptr_null(strstr(text, "LACALUT"));
+	ck_assert_ptr_null(strstr(text, "COLGATE"));
+	fclose(tmp);
+	
+	/* the catalog itself is not uppercased */
+	ck_assert_str_eq(toothpastes_list->data.toothpaste_brand, "Lacalut");
+	
+	tmp = tmpfile();
+	ck_assert_ptr_nonnull(tmp);
+	topts.list_sort = LIST_SORT_BRAND;
+	topts.list_offset = 0;
+	topts.list_limit = 0;
+	topts.upper_brands = 0;
+	ck_assert_int_eq(tpm_write_toothpaste_listing(toothpastes_list, &topts, tmp), 0);
+	rewind(tmp);
+	n = fread(text, 1, sizeof(text) - 1, tmp);
+	text[n] = '\0';
+	ck_assert_ptr_nonnull(strstr(text, "\n4,Aquafresh,50,7\n3,Blend-a-med,100,5\n2,Colgate,75,9\n1,Lacalut,300,5\n"));
+	fclose(tmp);
+	
+	/* structured listings take the same sort and window */
+	unsigned char bytes[64];
+	
+	topts.list_sort = LIST_SORT_RATING;
+	topts.list_offset = 1;
+	topts.list_limit = 2;
+	tmp = tmpfile();
+	ck_assert_ptr_nonnull(tmp);
+	ck_assert_int_eq(tpm_write_toothpaste_list(toothpastes_list, &topts, tmp, OUTPUT_FORMAT_JSON), 0);
+	rewind(tmp);
+	n = fread(text, 1, sizeof(text) - 1, tmp);
+	text[n] = '\0';
+	ck_assert_ptr_nonnull(strstr(text, "Blend-a-med"));
+	ck_assert_ptr_nonnull(strstr(text, "Aquafresh"));
+	ck_assert_uint_lt((size_t)(strstr(text, "Blend-a-med") - text), (size_t)(strstr(text, "Aquafresh") - text));
+	ck_assert_ptr_null(strstr(text, "Lacalut"));
+	ck_assert_ptr_null(strstr(text, "Colgate"));
+	fclose(tmp);
+	
+	/* the MessagePack array header counts the window, not the catalog */
+	topts.list_offset = 3;
+	topts.list_limit = 0;
+	tmp = tmpfile();
+	ck_assert_ptr_nonnull(tmp);
+	ck_assert_int_eq(tpm_write_toothpaste_list(toothpastes_list, &topts, tmp, OUTPUT_FORMAT_MSGPACK), 0);
+	rewind(tmp);
+	n = fread(bytes, 1, sizeof(bytes), tmp);
+	ck_assert_uint_gt(n, 8);
+	ck_assert_uint_eq(bytes[0], 0x91);
+	ck_assert_ptr_nonnull(memchr(bytes, 'C', n));
+	fclose(tmp);
+	
+	close_fixture(test_filename, NULL);
+}
+END_TEST
+
+START_TEST (csv_quoting)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	char template_buffer[] = "I";
+	char meme[] = "say \"cheese\", twice\nthen brush";
+	
+	const char* test_filename = "test_fixtures_quoting.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename,
+		"1, Colgate, 75, 5\n2, Odd\"Brand, 100, 7\n", NULL);
+	topts.meme_payload = meme;
+	topts.fake_stats = 1;
+	topts.ptype = PICK_MAX_RATING;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	
+	/* the meme keeps its comma, quotes and line break inside one field */
+	char* out;
+	tpm_get_toothpaste_picking_CSV(&pick,&out);
+	ck_assert_ptr_nonnull(out);
+	ck_assert_ptr_nonnull(strstr(out, "TestUser,"));
+	ck_assert_ptr_nonnull(strstr(out, ",\"Odd\"\"Brand\",100,7,"));
+	ck_assert_ptr_nonnull(strstr(out, ",\"say \"\"cheese\"\", twice\nthen brush\""));
+	ck_assert_int_eq(out[strlen(out) - 1], '"');
+	
+	/* the list gets a header row and one line per toothpaste */
+	char text[1024];
+	size_t n;
+	FILE* tmp = tmpfile();
+	ck_assert_ptr_nonnull(tmp);
+	ck_assert_int_eq(tpm_write_toothpaste_list(toothpastes_list, NULL, tmp, OUTPUT_FORMAT_CSV), 0);
+	rewind(tmp);
+	n = fread(text, 1, sizeof(text) - 1, tmp);
+	text[n] = '\0';
+	ck_assert_int_eq(strncmp(text, "index,toothpaste,tube_mass_g,rating,", 36), 0);
+	ck_assert_ptr_nonnull(strstr(text, "\n1,Colgate,75,5,"));
+	ck_assert_ptr_nonnull(strstr(text, "\n2,\"Odd\"\"Brand\",100,7,"));
+	fclose(tmp);
+	
+	close_fixture(test_filename, NULL);
+}
+END_TEST
+
+START_TEST (locale_strings_shared)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_t again = {0};
+	toothpaste_pick_options_t topts = {0};
+	toothpaste_pick_options_t other = {0};
+	char template_buffer[] = "gpTW";
+	char other_template[] = "gpTW";
+	
+	const char* test_filename = "test_fixtures_locale.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, "1, Colgate, 75, 5\n", NULL);
+	fixture_context(&other, other_template, NULL);
+	topts.fake_stats = other.fake_stats = 1;
+	
+	/* the first render resolves the table, later contexts in the same
+	   locale share it */
+	ck_assert_ptr_null(topts.strings);
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_ptr_nonnull(topts.strings);
+	tpm_pick_toothpaste(toothpastes_list, &other, &again);
+	ck_assert(topts.strings == other.strings);
+	ck_assert_ptr_nonnull(strstr(pick.message, topts.strings->pick_types[topts.ptype]));
+	ck_assert_str_eq(pick.message, again.message);
+	
+	close_fixture(test_filename, NULL);
 }
 END_TEST
 
@@ -180,6 +641,947 @@ START_TEST (prng_100_tries)
 }   
 END_TEST
 
+START_TEST (prng_state_resume)
+{
+	int i = 0;
+	uint64_t first[8];
+	size_t size = save_xrp32(NULL, 0);
+	unsigned char* state = malloc(size);
+	ck_assert_ptr_nonnull(state);
+	
+	seed_xrp32(42);
+	ck_assert_uint_eq(save_xrp32(state, size), size);
+	
+	for (i=0;i<8;i++)
+	{
+		first[i] = prng64_xrp32();
+	}
+	ck_assert_int_eq(load_xrp32(state, size), 0);
+	for (i=0;i<8;i++)
+	{
+		ck_assert_uint_eq(prng64_xrp32(), first[i]);
+	}
+	ck_assert_int_ne(load_xrp32(state, size - 1), 0);
+	free(state);
+}
+END_TEST
+
+#ifdef PAIR_TOY_TEST
+/* Plain byte-at-a-time model of one PAIR_TOY_TEST draw, whichever pearson32
+   path the build picked (scalar, SSSE3 or AVX-512) must match it exactly */
+static uint64_t
+toy_draw_reference(xrp_state_t* s, unsigned char used[TABLE_SIZE_BYTES])
+{
+	uint64_t const result = ((s->x * 5) << 7 | (s->x * 5) >> 57) * 9;
+	uint64_t const t = s->x << 17;
+	uint64_t in[4];
+	uint64_t h = 0;
+	unsigned char* a;
+	const unsigned char* b;
+	unsigned char swap;
+	size_t i, k;
+	
+	s->y ^= s->w;
+	s->z ^= s->x;
+	s->x ^= s->y;
+	s->w ^= s->z;
+	s->y ^= t;
+	s->z = (s->z >> 19) | (s->z << 45);
+	++s->counter;
+	
+	a = (unsigned char*)&s->z;
+	b = (const unsigned char*)&result;
+	for (i = 0; i < BYTES_IN_WORD; i++)
+	{
+		swap = s->table[a[i]];
+		s->table[a[i]] = s->table[b[i]];
+		s->table[b[i]] = swap;
+		used[a[i]] |= 1;
+		used[b[i]] |= 1;
+	}
+	
+	in[0] = result; in[1] = s->x; in[2] = s->y; in[3] = s->z;
+	for (k = 0; k < 4; k++)
+	{
+		h ^= in[k];
+		a = (unsigned char*)&h;
+		for (i = 0; i < BYTES_IN_WORD; i++)
+		{
+			used[a[i]] |= 2;
+			a[i] = s->table[a[i]];
+		}
+	}
+	return h;
+}
+
+START_TEST (prng_pearson_paths)
+{
+	xrp_state_t expected;
+	xrp_state_t actual;
+	unsigned char used[TABLE_SIZE_BYTES] = {0};
+	size_t draws = 0;
+	size_t i;
+	
+	ck_assert_uint_eq(save_xrp32(NULL, 0), sizeof(xrp_state_t));
+	seed_xrp32(42);
+	save_xrp32(&expected, sizeof(expected));
+	
+	/* run until every byte value went through both the shuffle and the
+	   lookups, then a while longer */
+	for (i = 0; i < TABLE_SIZE_BYTES; i++)
+	{
+		while (used[i] != 3 && draws < 100000)
+		{
+			ck_assert_uint_eq(prng64_xrp32(), toy_draw_reference(&expected, used));
+			draws++;
+		}
+		ck_assert_uint_eq(used[i], 3);
+	}
+	for (i = 0; i < 4096; i++)
+	{
+		ck_assert_uint_eq(prng64_xrp32(), toy_draw_reference(&expected, used));
+	}
+	save_xrp32(&actual, sizeof(actual));
+	ck_assert_int_eq(memcmp(actual.table, expected.table, TABLE_SIZE_BYTES), 0);
+	ck_assert_uint_eq(actual.z, expected.z);
+}
+END_TEST
+#endif
+
+START_TEST (prng_checkpoint_shared)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	unsigned char child_state[256];
+	unsigned char parent_state[256];
+	size_t child_size;
+	size_t parent_size;
+	pid_t child;
+	int status = 0;
+	FILE* state;
+	char template_buffer[] = "guwntdapobiTfWPlUsmI";
+	
+	const char* test_filename = "test_fixtures_prng.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename,
+		FIXTURE_COLGATE "2, Blendamed, 80, 4, Red, Colgate, 20, 3\n", "test_prng_pickstats");
+	topts.fake_stats = 1;
+	topts.ptype = PICK_RANDOM;
+	ck_assert_int_eq(tpm_pick_toothpaste(toothpastes_list, &topts, &pick), 0);
+	
+	/* another run draws from the checkpoint in between */
+	child = fork();
+	ck_assert_int_ne(child, -1);
+	if (child == 0)
+	{
+		toothpaste_pick_options_t copts = {0};
+		
+		fixture_context(&copts, template_buffer, "test_prng_pickstats");
+		copts.fake_stats = 1;
+		copts.ptype = PICK_RANDOM;
+		_exit(tpm_pick_toothpaste(toothpastes_list, &copts, &pick));
+	}
+	ck_assert_int_eq(waitpid(child, &status, 0), child);
+	ck_assert_int_eq(WEXITSTATUS(status), 0);
+	state = fopen("test_prng_pickstats.xrp", "rb");
+	ck_assert_ptr_nonnull(state);
+	child_size = fread(child_state, 1, sizeof(child_state), state);
+	fclose(state);
+	
+	/* this run continues after it instead of replaying the same draws */
+	ck_assert_int_eq(tpm_pick_toothpaste(toothpastes_list, &topts, &pick), 0);
+	state = fopen("test_prng_pickstats.xrp", "rb");
+	ck_assert_ptr_nonnull(state);
+	parent_size = fread(parent_state, 1, sizeof(parent_state), state);
+	fclose(state);
+	ck_assert_uint_eq(parent_size, child_size);
+	ck_assert_int_ne(memcmp(parent_state, child_state, child_size), 0);
+	
+	/* a checkpoint that cannot be saved fails the pick */
+	snprintf(topts.stats_file_path_final, MAX_PATH, "%s", "no/such/dir/pickstats");
+	ck_assert_int_ne(tpm_pick_toothpaste(toothpastes_list, &topts, &pick), 0);
+	
+	close_fixture(test_filename, "test_prng_pickstats");
+}
+END_TEST
+
+START_TEST (keyed_pick_reproducible)
+{
+	time_t day = 20000;
+	unsigned int i = 0;
+	unsigned int first;
+	unsigned int differs = 0;
+	uint8_t key[32];
+	uint8_t other[32];
+	
+	first = tpm_keyed_pick_index("TestUser", day, 5, "moot");
+	ck_assert_uint_lt(first, 5);
+	ck_assert_uint_eq(tpm_keyed_pick_index("TestUser", day, 5, "moot"), first);
+	
+	for (i=1;i<64;i++)
+	{
+		unsigned int pick = tpm_keyed_pick_index("TestUser", day + i, 5, "moot");
+		ck_assert_uint_lt(pick, 5);
+		if (pick != first) differs++;
+	}
+	ck_assert_uint_gt(differs, 0);
+	ck_assert_uint_eq(tpm_keyed_pick_index("TestUser", day, 0, NULL), 0);
+	
+	/* every key byte and the length count, not a 64-bit digest of them */
+	derive_key_xrp32(key, "moot", 4);
+	derive_key_xrp32(other, "moot", 5);
+	ck_assert_int_ne(memcmp(key, other, sizeof(key)), 0);
+	derive_key_xrp32(other, "moot", 4);
+	ck_assert_int_eq(memcmp(key, other, sizeof(key)), 0);
+	
+	/* a far day stays in its user's stream instead of running into the next */
+	ck_assert(keyed_xrp32(key, 0, (uint64_t)1 << 24, 0) != keyed_xrp32(key, 1, 0, 0));
+}
+END_TEST
+
+START_TEST (pick_log_append)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	pick_log_t log;
+	pick_log_record_t record;
+	char template_buffer[] = "guwntdapobiTfWPlUsmI";
+	
+	const char* test_filename = "test_fixtures_log.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, FIXTURE_COLGATE, "test_pickstats");
+	topts.delta_days = 1;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	
+	ck_assert_int_eq(tpm_open_pick_log(&topts, &log), 0);
+	ck_assert_uint_eq(log.total_records, 1);
+	ck_assert_int_eq(tpm_get_pick_log_record(&log, 0, &record), 0);
+	ck_assert(record.flags & PICK_LOG_NEW_PICK);
+	ck_assert_uint_eq(tpm_count_logged_picks(&log, "TestUser", 0), 1);
+	ck_assert_uint_eq(tpm_count_logged_picks(&log, "OtherUser", 0), 0);
+	ck_assert_int_ne(tpm_get_pick_log_record(&log, 1, &record), 0);
+	
+	/* the history as a MessagePack array of one 7 pair map, the user hash
+	   as a uint 64 after the key */
+	unsigned char bytes[64];
+	unsigned char* hash;
+	uint64_t user_hash = 0;
+	size_t k;
+	FILE* tmp = tmpfile();
+	ck_assert_ptr_nonnull(tmp);
+	ck_assert_int_eq(tpm_write_pick_log(&log, tmp, OUTPUT_FORMAT_MSGPACK), 0);
+	rewind(tmp);
+	ck_assert_uint_gt(fread(bytes, 1, sizeof(bytes), tmp), 32);
+	ck_assert_uint_eq(bytes[0], 0x91);
+	ck_assert_uint_eq(bytes[1], 0x87);
+	ck_assert_int_eq(memcmp(bytes + 3, "when", 4), 0);
+	hash = NULL;
+	for (k = 0; hash == NULL && k + 19 <= sizeof(bytes); k++)
+	{
+		if (memcmp(bytes + k, "\xa9user_hash", 10) == 0)
+		{
+			hash = bytes + k;
+		}
+	}
+	ck_assert_ptr_nonnull(hash);
+	ck_assert_uint_eq(hash[10], 0xcf);
+	for (k = 0; k < 8; k++)
+	{
+		user_hash = (user_hash << 8) | hash[11 + k];
+	}
+	ck_assert_uint_eq(user_hash, record.user_hash);
+	fclose(tmp);
+	tpm_close_pick_log(&log);
+	
+	close_fixture(test_filename, "test_pickstats");
+}
+END_TEST
+
+START_TEST (legacy_pickstats_migration)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	unsigned char legacy[20] = {0};
+	unsigned char damaged[300];
+	unsigned char check[300];
+	long size;
+	char template_buffer[] = "guwntdapobiTfWPlUsmI";
+	
+	const char* test_filename = "test_fixtures_legacy.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, FIXTURE_COLGATE, "test_legacy_pickstats");
+	topts.delta_days = 1;
+	
+	/* raw little-endian time_t, time_t, unsigned int as written before v1 */
+	legacy[0] = 0x00; legacy[1] = 0xE1; legacy[2] = 0xF5; legacy[3] = 0x05;
+	legacy[8] = 0x00; legacy[9] = 0xE1; legacy[10] = 0xF5; legacy[11] = 0x05;
+	legacy[16] = 41;
+	FILE* f = fopen("test_legacy_pickstats", "wb");
+	ck_assert_ptr_nonnull(f);
+	fwrite(legacy, 1, sizeof(legacy), f);
+	fclose(f);
+	
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 42);
+	ck_assert_int_eq((long)pick.stats.first_pick_time, 100000000L);
+	
+	f = fopen("test_legacy_pickstats", "rb");
+	ck_assert_ptr_nonnull(f);
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fclose(f);
+	ck_assert_int_eq(size, 256);
+	
+	/* a damaged file is moved aside, never written over */
+	memset(damaged, 0, sizeof(damaged));
+	f = fopen("test_legacy_pickstats", "rb+");
+	ck_assert_ptr_nonnull(f);
+	ck_assert_uint_eq(fread(damaged, 1, sizeof(damaged), f), 256);
+	damaged[40] ^= 1;
+	rewind(f);
+	fwrite(damaged, 1, 256, f);
+	fclose(f);
+	topts.delta_days = 2;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 1);
+	f = fopen("test_legacy_pickstats.corrupt", "rb");
+	ck_assert_ptr_nonnull(f);
+	ck_assert_uint_eq(fread(check, 1, sizeof(check), f), 256);
+	fclose(f);
+	ck_assert_int_eq(memcmp(damaged, check, 256), 0);
+	
+	close_fixture(test_filename, "test_legacy_pickstats");
+}
+END_TEST
+
+START_TEST (stats_store_users)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_t other = {0};
+	toothpaste_pick_options_t topts = {0};
+	char template_buffer[] = "guwntdapobiTfWPlUsmI";
+	FILE* f;
+	
+	const char* test_filename = "test_fixtures_store.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, FIXTURE_COLGATE, "test_store_pickstats");
+	topts.delta_days = 1;
+	topts.stats_store_slots = 4;
+	topts.stats_store_path = strdup("test_stats_store");
+	remove_stats("test_stats_store");
+	
+	topts.username = "TestUser";
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 1);
+	
+	topts.username = "OtherUser";
+	tpm_pick_toothpaste(toothpastes_list, &topts, &other);
+	ck_assert_uint_eq(other.stats.total_picks, 1);
+	
+	topts.username = "TestUser";
+	topts.delta_days = 2;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 2);
+	
+	f = fopen("test_store_pickstats", "rb");
+	ck_assert_ptr_null(f);
+	
+	free(topts.stats_store_path);
+	close_fixture(test_filename, "test_store_pickstats");
+	remove_stats("test_stats_store");
+}
+END_TEST
+
+/* Little-endian field writer and FNV-1a for hand-made store files */
+static void
+put_le(unsigned char* dst, uint64_t value, int bytes)
+{
+	int k;
+	
+	for (k = 0; k < bytes; k++)
+	{
+		dst[k] = (unsigned char)(value >> (8 * k));
+	}
+}
+
+static uint64_t
+test_fnv1a64(const void* data, size_t size)
+{
+	const unsigned char* bytes = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t k;
+	
+	for (k = 0; k < size; k++)
+	{
+		hash ^= bytes[k];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+START_TEST (stats_store_migration)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	unsigned char store[64 + 2 * 64];
+	unsigned char check[sizeof(store)];
+	uint64_t hash = test_fnv1a64("TestUser", 8);
+	unsigned char* slot = store + 64 + (hash % 2) * 64;
+	time_t now = time(NULL);
+	FILE* f;
+	char template_buffer[] = "guwntdapobiTfWPlUsmI";
+	
+	const char* test_filename = "test_fixtures_v1_store.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, FIXTURE_COLGATE, "test_v1_pickstats");
+	topts.delta_days = 1;
+	topts.stats_store_slots = 8;
+	topts.stats_store_path = strdup("test_v1_store");
+	
+	/* a v1 store: 64 byte slots without rollups, 5 picks for TestUser */
+	memset(store, 0, sizeof(store));
+	memcpy(store, STATS_STORE_MAGIC, 4);
+	put_le(store + 4, 1, 2);
+	put_le(store + 6, PICKSTATS_BYTE_ORDER, 2);
+	put_le(store + 8, 2, 4);
+	put_le(store + 12, 64, 4);
+	put_le(store + 56, test_fnv1a64(store, 56), 8);
+	put_le(slot, hash, 8);
+	put_le(slot + 8, (uint64_t)(now - 10 * 86400), 8);
+	put_le(slot + 16, (uint64_t)(now - 86400), 8);
+	put_le(slot + 24, 5, 8);
+	memcpy(slot + 32, "TestUser", 8);
+	f = fopen("test_v1_store", "wb");
+	ck_assert_ptr_nonnull(f);
+	fwrite(store, 1, sizeof(store), f);
+	fclose(f);
+	
+	/* migrated in place, the slot count of the old store is kept */
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 6);
+	topts.username = "OtherUser";
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 1);
+	topts.username = "ThirdUser";
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 1);
+	f = fopen("test_v1_store", "rb");
+	ck_assert_ptr_nonnull(f);
+	ck_assert_uint_eq(fread(check, 1, 8, f), 8);
+	fclose(f);
+	ck_assert_int_eq(check[4], STATS_STORE_VERSION);
+	
+	/* a store left without header by a crash is built again */
+	memset(store, 0, sizeof(store));
+	f = fopen("test_v1_store", "wb");
+	ck_assert_ptr_nonnull(f);
+	fwrite(store, 1, sizeof(store), f);
+	fclose(f);
+	topts.username = "TestUser";
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 1);
+	
+	/* anything else is not a store and stays as it is */
+	memset(store, 'x', sizeof(store));
+	f = fopen("test_v1_store", "wb");
+	ck_assert_ptr_nonnull(f);
+	fwrite(store, 1, sizeof(store), f);
+	fclose(f);
+	topts.delta_days = 2;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	f = fopen("test_v1_store", "rb");
+	ck_assert_ptr_nonnull(f);
+	ck_assert_uint_eq(fread(check, 1, sizeof(check), f), sizeof(check));
+	fclose(f);
+	ck_assert_int_eq(memcmp(store, check, sizeof(store)), 0);
+	
+	free(topts.stats_store_path);
+	close_fixture(test_filename, "test_v1_pickstats");
+	remove_stats("test_v1_store");
+}
+END_TEST
+
+START_TEST (stats_store_long_names)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	char template_buffer[] = "guwntdapobiTfWPlUsmI";
+	
+	const char* test_filename = "test_fixtures_long.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, FIXTURE_COLGATE, "test_long_pickstats");
+	topts.stats_store_slots = 2;
+	topts.stats_store_path = strdup("test_long_store");
+	remove_stats("test_long_store");
+	
+	/* names alike past the stored prefix still get a slot each */
+	topts.username = "ThisIsAVeryLongUserNameThatSharesPrefix_A";
+	topts.delta_days = 1;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 1);
+	
+	topts.username = "ThisIsAVeryLongUserNameThatSharesPrefix_B";
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 1);
+	
+	topts.username = "ThisIsAVeryLongUserNameThatSharesPrefix_A";
+	topts.delta_days = 2;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 2);
+	
+	/* a full store keeps nothing for a third user and leaves the others be */
+	topts.username = "ThirdUser";
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 1);
+	
+	topts.username = "ThisIsAVeryLongUserNameThatSharesPrefix_B";
+	topts.delta_days = 3;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 2);
+	
+	free(topts.stats_store_path);
+	close_fixture(test_filename, "test_long_pickstats");
+	remove_stats("test_long_store");
+}
+END_TEST
+
+START_TEST (rollup_coverage)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	char template_buffer[] = "guwntdapobiTfWPlUsmIKMY";
+	
+	const char* test_filename = "test_fixtures_rollup.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, FIXTURE_COLGATE, "test_rollup_pickstats");
+	
+	topts.delta_days = 1;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	topts.delta_days = 2;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	
+	ck_assert_uint_eq(pick.stats.total_picks, 2);
+	ck_assert_uint_eq(pick.coverage_short_percents, 14);
+	ck_assert_uint_eq(pick.coverage_long_percents, 3);
+	ck_assert_uint_ge(pick.picks_this_week, 1);
+	ck_assert_ptr_nonnull(strstr(pick.message, "Coverage last 7 days: 14%\n"));
+	ck_assert_ptr_nonnull(strstr(pick.message, "Coverage last 30 days: 3%\n"));
+	ck_assert_ptr_nonnull(strstr(pick.message, "Coverage this year: "));
+	char* out;
+	tpm_get_toothpaste_picking_JSON(&pick,&out);
+	ck_assert_ptr_nonnull(strstr(out, "\"coverage_7_days\":14"));
+	
+	close_fixture(test_filename, "test_rollup_pickstats");
+}
+END_TEST
+
+START_TEST (stats_journal_group_commit)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	pick_log_t log;
+	FILE* wal;
+	long wal_size;
+	int day;
+	char template_buffer[] = "guwntdapobiTfWPlUsmI";
+	
+	const char* test_filename = "test_fixtures_journal.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, FIXTURE_COLGATE, "test_journal_pickstats");
+	topts.journal.enabled = 1;
+	topts.journal.commit_seconds = 3600;
+	
+	for (day = 1; day <= 3; day++)
+	{
+		topts.delta_days = day;
+		tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	}
+	ck_assert_uint_eq(pick.stats.total_picks, 3);
+	ck_assert_int_eq(tpm_flush_stats(&topts), 0);
+	
+	wal = fopen("test_journal_pickstats.wal", "rb");
+	ck_assert_ptr_nonnull(wal);
+	fseek(wal, 0, SEEK_END);
+	wal_size = ftell(wal);
+	fclose(wal);
+	ck_assert_int_eq(wal_size, JOURNAL_HEADER_SIZE + 3 * JOURNAL_RECORD_SIZE);
+	ck_assert_int_eq(tpm_open_pick_log(&topts, &log), 0);
+	ck_assert_uint_eq(log.total_records, 3);
+	tpm_close_pick_log(&log);
+	
+	/* a later pick replays the journal on top of the pickstats file */
+	topts.delta_days = 4;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 4);
+	ck_assert_int_eq(tpm_flush_stats(&topts), 0);
+	
+	close_fixture(test_filename, "test_journal_pickstats");
+}
+END_TEST
+
+START_TEST (stats_write_atomic)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	char before[4096];
+	char after[4096];
+	char temp_path[MAX_PATH];
+	size_t before_size;
+	size_t after_size;
+	pid_t child;
+	int status = 0;
+	FILE* stats;
+	char template_buffer[] = "guwntdapobiTfWPlUsmI";
+	
+	const char* test_filename = "test_fixtures_atomic.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, FIXTURE_COLGATE, "test_atomic_pickstats");
+	topts.stats_fsync = 1;
+	
+	topts.delta_days = 1;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 1);
+	stats = fopen("test_atomic_pickstats", "rb");
+	ck_assert_ptr_nonnull(stats);
+	before_size = fread(before, 1, sizeof(before), stats);
+	fclose(stats);
+	ck_assert_uint_gt(before_size, 0);
+	
+	/* the next write runs out of file size half way through the temp file */
+	child = fork();
+	ck_assert_int_ne(child, -1);
+	if (child == 0)
+	{
+		struct rlimit limit = {16, 16};
+		
+		signal(SIGXFSZ, SIG_IGN);
+		setrlimit(RLIMIT_FSIZE, &limit);
+		topts.delta_days = 2;
+		tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+		_exit(0);
+	}
+	ck_assert_int_eq(waitpid(child, &status, 0), child);
+	ck_assert_int_eq(WIFEXITED(status), 1);
+	
+	stats = fopen("test_atomic_pickstats", "rb");
+	ck_assert_ptr_nonnull(stats);
+	after_size = fread(after, 1, sizeof(after), stats);
+	fclose(stats);
+	ck_assert_uint_eq(after_size, before_size);
+	ck_assert_int_eq(memcmp(before, after, before_size), 0);
+	snprintf(temp_path, sizeof(temp_path), "test_atomic_pickstats.%ld.tmp", (long)child);
+	ck_assert_int_ne(access(temp_path, F_OK), 0);
+	
+	/* and the pick that failed to land counts on the next run */
+	topts.delta_days = 2;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 2);
+	
+	close_fixture(test_filename, "test_atomic_pickstats");
+}
+END_TEST
+
+START_TEST (stats_lock_fork)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	pid_t child;
+	int status = 0;
+	char template_buffer[] = "guwntdapobiTfWPlUsmI";
+	
+	const char* test_filename = "test_fixtures_lock.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename, FIXTURE_COLGATE, "test_lock_pickstats");
+	topts.stats_fsync = 1;
+	topts.journal.enabled = 1;
+	topts.journal.commit_seconds = 3600;
+	
+	/* a journaled pick keeps the lock until it is flushed */
+	topts.delta_days = 1;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 1);
+	
+	child = fork();
+	ck_assert_int_ne(child, -1);
+	if (child == 0)
+	{
+		toothpaste_pick_options_t copts = {0};
+		
+		fixture_context(&copts, template_buffer, "test_lock_pickstats");
+		copts.stats_fsync = 1;
+		copts.journal.enabled = 1;
+		copts.journal.commit_seconds = 3600;
+		copts.delta_days = 2;
+		tpm_pick_toothpaste(toothpastes_list, &copts, &pick);
+		tpm_flush_stats(&copts);
+		_exit((int)pick.stats.total_picks);
+	}
+	
+	/* the second run waits for the lock instead of reading stale counters */
+	sleep(1);
+	ck_assert_int_eq(waitpid(child, &status, WNOHANG), 0);
+	ck_assert_int_eq(tpm_flush_stats(&topts), 0);
+	ck_assert_int_eq(waitpid(child, &status, 0), child);
+	ck_assert_int_eq(WIFEXITED(status), 1);
+	ck_assert_int_eq(WEXITSTATUS(status), 2);
+	
+	/* and what it wrote is there for the next run */
+	topts.delta_days = 3;
+	tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	ck_assert_uint_eq(pick.stats.total_picks, 3);
+	ck_assert_int_eq(tpm_flush_stats(&topts), 0);
+	
+	close_fixture(test_filename, "test_lock_pickstats");
+}
+END_TEST
+
+START_TEST (cfg_hash_index)
+{
+	struct cfg_struct* cfg = cfg_init();
+	const char* keep[] = {"key7", " KEY8 "};
+	char key[32];
+	char value[32];
+	char** keys;
+	size_t count = 0;
+	unsigned int k;
+	
+	for (k = 0; k < 1000; k++)
+	{
+		snprintf(key, sizeof(key), "Key%u", k);
+		snprintf(value, sizeof(value), "%u", k);
+		cfg_set(cfg, key, value);
+	}
+	
+	/* keys match trimmed and case-insensitively, a set replaces in place */
+	ck_assert_str_eq(cfg_get(cfg, "  kEy999\t"), "999");
+	cfg_set(cfg, "KEY500", "five hundred");
+	ck_assert_str_eq(cfg_get(cfg, "key500"), "five hundred");
+	ck_assert_ptr_null(cfg_get(cfg, "key1000"));
+	
+	/* deleted keys leave no trace, the rest are still found behind them */
+	for (k = 0; k < 1000; k += 2)
+	{
+		snprintf(key, sizeof(key), "key%u", k);
+		cfg_delete(cfg, key);
+	}
+	ck_assert_ptr_null(cfg_get(cfg, "key998"));
+	ck_assert_str_eq(cfg_get(cfg, "key997"), "997");
+	
+	/* insertion order survives for cfg_get_keys and cfg_save */
+	keys = cfg_get_keys(cfg, &count);
+	ck_assert_uint_eq(count, 500);
+	ck_assert_str_eq(keys[0], "key1");
+	ck_assert_str_eq(keys[499], "key999");
+	for (k = 0; k < count; k++)
+	{
+		free(keys[k]);
+	}
+	free(keys);
+	
+	cfg_prune(cfg, keep, 2);
+	keys = cfg_get_keys(cfg, &count);
+	ck_assert_uint_eq(count, 1);
+	ck_assert_str_eq(keys[0], "key7");
+	free(keys[0]);
+	free(keys);
+	
+	cfg_free(cfg);
+}
+END_TEST
+
+START_TEST (cfg_typed_values)
+{
+	struct cfg_struct* cfg = cfg_init();
+	const char* names[] = {"circular", "random", "index"};
+	const char* test_filename = "test_fixtures_typed.conf";
+	char path[8];
+	long long number = 0;
+	int flag = -1;
+	int choice = -1;
+	
+	FILE* f = fopen(test_filename, "w");
+	ck_assert_ptr_nonnull(f);
+	fprintf(f, "TRUE=1\nON=yes\nVERBOSE=TRUE\nQUIET=ON\nLEVEL=\"-42\"\n");
+	fprintf(f, "A=B\nB=A\nKIND=Random\nSHORT=abc\nLONG=abcdefgh\n");
+	fprintf(f, "KEY=key\nMEME=\"meme\"\nNEXT=A\n");
+	fclose(f);
+	ck_assert_int_eq(cfg_load(cfg, test_filename), 0);
+	
+	/* chains are followed once at load, quotes are gone from the result */
+	ck_assert_str_eq(cfg_get_value(cfg, "verbose"), "1");
+	ck_assert_int_eq(cfg_get_bool(cfg, "VERBOSE", &flag), 0);
+	ck_assert_int_eq(flag, 1);
+	ck_assert_int_eq(cfg_get_bool(cfg, "QUIET", &flag), 0);
+	ck_assert_int_eq(flag, 1);
+	ck_assert_int_eq(cfg_get_int(cfg, "LEVEL", &number), 0);
+	ck_assert_int_eq(number, -42);
+	ck_assert_int_ne(cfg_get_int(cfg, "QUIET", &number), 0);
+	
+	/* a chain that never ends keeps each key's own text instead of looping */
+	ck_assert_str_eq(cfg_get_value(cfg, "KEY"), "key");
+	ck_assert_str_eq(cfg_get_value(cfg, "meme"), "meme");
+	ck_assert_str_eq(cfg_get_value(cfg, "A"), "B");
+	ck_assert_str_eq(cfg_get_value(cfg, "B"), "A");
+	ck_assert_str_eq(cfg_get_value(cfg, "NEXT"), "A");
+	ck_assert_int_ne(cfg_get_bool(cfg, "B", &flag), 0);
+	
+	ck_assert_int_eq(cfg_get_enum(cfg, "KIND", names, 3, &choice), 0);
+	ck_assert_int_eq(choice, 1);
+	ck_assert_int_ne(cfg_get_enum(cfg, "LEVEL", names, 3, &choice), 0);
+	
+	/* a path that does not fit is refused, not cut */
+	ck_assert_int_eq(cfg_get_path(cfg, "SHORT", path, sizeof(path)), 0);
+	ck_assert_str_eq(path, "abc");
+	ck_assert_int_ne(cfg_get_path(cfg, "LONG", path, sizeof(path)), 0);
+	
+	/* changes are picked up, plain cfg_get keeps the stored value intact */
+	cfg_set(cfg, "TRUE", "0");
+	ck_assert_int_eq(cfg_get_bool(cfg, "VERBOSE", &flag), 0);
+	ck_assert_int_eq(flag, 0);
+	ck_assert_str_eq(cfg_get(cfg, "LEVEL"), "-42");
+	ck_assert_str_eq(cfg_get(cfg, "LEVEL"), "-42");
+	
+	cfg_free(cfg);
+	remove(test_filename);
+}
+END_TEST
+
+START_TEST (cfg_sections)
+{
+	struct cfg_struct* cfg = cfg_init();
+	const char* test_filename = "test_fixtures_sections.conf";
+	char** keys;
+	size_t count, k;
+	int flag = -1;
+	
+	FILE* f = fopen(test_filename, "w");
+	ck_assert_ptr_nonnull(f);
+	fprintf(f, "# top\r\nNAME=top\r\n[CONSTANTS]\nTRUE=1\nFALSE=0 # off\n");
+	fprintf(f, "[ GENERAL ]\nFALSE=TRUE\nVERBOSE=FALSE\nQUIET=TRUE\n");
+	fprintf(f, "COLOR=\"#00ff00\" # green\nHASH='a#b'\nCUT=a#b\nBAD # x=1\nLONG=");
+	for (k = 0; k < 300; k++)
+	{
+		fputc('x', f);
+	}
+	fprintf(f, "\n[]\nTAIL=end");
+	fclose(f);
+	ck_assert_int_eq(cfg_load(cfg, test_filename), 0);
+	
+	/* full names, bare names, and a reference staying in its section */
+	ck_assert_str_eq(cfg_get(cfg, "constants.false"), "0");
+	ck_assert_str_eq(cfg_get(cfg, "General.False"), "TRUE");
+	ck_assert_str_eq(cfg_get(cfg, "NAME"), "top");
+	ck_assert_str_eq(cfg_get(cfg, "TAIL"), "end");
+	ck_assert_int_eq(cfg_get_bool(cfg, "VERBOSE", &flag), 0);
+	ck_assert_int_eq(flag, 1);
+	ck_assert_int_eq(cfg_get_bool(cfg, "QUIET", &flag), 0);
+	ck_assert_int_eq(flag, 1);
+	
+	/* comments stop outside quotes only, lines have no length limit */
+	ck_assert_str_eq(cfg_get(cfg, "COLOR"), "#00ff00");
+	ck_assert_str_eq(cfg_get(cfg, "HASH"), "a#b");
+	ck_assert_str_eq(cfg_get(cfg, "CUT"), "a");
+	ck_assert_ptr_null(cfg_get(cfg, "BAD"));
+	ck_assert_uint_eq(strlen(cfg_get(cfg, "LONG")), 300);
+	
+	/* sections survive a save and load */
+	ck_assert_int_eq(cfg_save(cfg, test_filename), 0);
+	cfg_free(cfg);
+	cfg = cfg_init();
+	ck_assert_int_eq(cfg_load(cfg, test_filename), 0);
+	keys = cfg_get_keys(cfg, &count);
+	ck_assert_uint_eq(count, 11);
+	ck_assert_str_eq(keys[0], "name");
+	ck_assert_str_eq(keys[2], "constants.true");
+	ck_assert_str_eq(keys[1], "tail");
+	ck_assert_str_eq(keys[10], "general.long");
+	for (k = 0; k < count; k++)
+	{
+		free(keys[k]);
+	}
+	free(keys);
+	ck_assert_int_eq(cfg_get_bool(cfg, "VERBOSE", &flag), 0);
+	ck_assert_int_eq(flag, 1);
+	cfg_free(cfg);
+	
+	/* a bare key after [] is its own key, not the last sectioned one */
+	f = fopen(test_filename, "w");
+	ck_assert_ptr_nonnull(f);
+	fprintf(f, "[s]\nk=v\n[s]\nk=w\n[]\nk=top\n");
+	fclose(f);
+	cfg = cfg_init();
+	ck_assert_int_eq(cfg_load(cfg, test_filename), 0);
+	ck_assert_str_eq(cfg_get(cfg, "s.k"), "w");
+	ck_assert_str_eq(cfg_get(cfg, "k"), "top");
+	keys = cfg_get_keys(cfg, &count);
+	ck_assert_uint_eq(count, 2);
+	for (k = 0; k < count; k++)
+	{
+		free(keys[k]);
+	}
+	free(keys);
+	
+	cfg_free(cfg);
+	remove(test_filename);
+}
+END_TEST
+
+#ifdef HAVE_SQLITE
+START_TEST (pick_db_queries)
+{
+	toothpaste_pick_t pick = {0};
+	toothpaste_pick_options_t topts = {0};
+	unsigned int index = UINT_MAX;
+	int day;
+	char template_buffer[] = "guwntdapobiTfWPlUsmI";
+	
+	const char* test_filename = "test_fixtures_db.txt";
+	list_node_t* toothpastes_list = open_fixture(&topts, template_buffer, test_filename,
+		FIXTURE_COLGATE
+		"2, Blendamed, 100, 9, Red, Oral-B, 19, 2\n"
+		"3, Sensodyne, 50, 7, Green, Oral-B, 19, 2\n", "test_db_pickstats");
+	topts.pick_db_path = "test_picks.db";
+	remove("test_picks.db");
+	for (day = 1; day <= 3; day++)
+	{
+		topts.delta_days = day;
+		tpm_pick_toothpaste(toothpastes_list, &topts, &pick);
+	}
+	ck_assert_int_eq(tpm_flush_stats(&topts), 0);
+	ck_assert_uint_eq(tpm_db_count_picks(&topts, "TestUser", 0), 3);
+	ck_assert_uint_eq(tpm_db_count_picks(&topts, "OtherUser", 0), 0);
+	
+	topts.ptype = PICK_MAX_RATING;
+	ck_assert_int_eq(tpm_db_select_toothpaste(&topts, 0, &index), 0);
+	ck_assert_uint_eq(index, 2);
+	topts.ptype = PICK_MIN_MASS;
+	ck_assert_int_eq(tpm_db_select_toothpaste(&topts, 0, &index), 0);
+	ck_assert_uint_eq(index, 3);
+	topts.ptype = PICK_DEFAULT;
+	ck_assert_int_eq(tpm_db_select_toothpaste(&topts, 4, &index), 0);
+	ck_assert_uint_eq(index, 2);
+	topts.ptype = PICK_BY_INDEX;
+	topts.pick_by_index_index = 7;
+	ck_assert_int_eq(tpm_db_select_toothpaste(&topts, 0, &index), 0);
+	ck_assert_uint_eq(index, 3);
+	
+	/* ids need not run from 0 without gaps, every row stays reachable */
+	topts.ptype = PICK_RANDOM;
+	for (day = 0; day < 16; day++)
+	{
+		index = UINT_MAX;
+		ck_assert_int_eq(tpm_db_select_toothpaste(&topts, 0, &index), 0);
+		ck_assert_uint_ge(index, 1);
+		ck_assert_uint_lt(index, 4);
+	}
+	topts.ptype = PICK_KEYED_RANDOM;
+	ck_assert_int_eq(tpm_db_select_toothpaste(&topts, 20000, &index), 0);
+	ck_assert_uint_eq(index, tpm_keyed_pick_index("TestUser", 20000, 3, NULL) + 1);
+	topts.ptype = PICK_BY_BRAND;
+	topts.brand_string = "Nothing";
+	ck_assert_int_ne(tpm_db_select_toothpaste(&topts, 0, &index), 0);
+	ck_assert_int_eq(tpm_close_pick_db(&topts), 0);
+	
+	close_fixture(test_filename, "test_db_pickstats");
+	remove("test_picks.db");
+	remove("test_picks.db-wal");
+	remove("test_picks.db-shm");
+}
+END_TEST
+#endif
+
 START_TEST (bad_toothpastes)
 {
 	list_node_t* toothpastes_list = NULL;
@@ -200,6 +1602,39 @@ START_TEST (bad_toothpastes)
 }
 END_TEST
 
+START_TEST (large_catalog)
+{
+	list_node_t* toothpastes_list = NULL;
+	toothpaste_pick_options_t topts;
+	tpm_init_context(&topts);
+	
+	/* well past the old 1024 line cap, every line is kept in file order */
+	const char* test_filename = "test_fixtures_many.txt";
+	FILE* f = fopen(test_filename, "w");
+	ck_assert_ptr_nonnull(f);
+	unsigned int i;
+	for (i = 1; i <= 5000; i++)
+	{
+		fprintf(f, "%u, Brand %u, 75, 5\n", i, i);
+	}
+	fclose(f);
+	
+	ck_assert_int_eq(tpm_load_list_from_file(test_filename,&topts,&toothpastes_list), 0);
+	
+	i = 0;
+	list_node_t* current = toothpastes_list;
+	while (current != NULL)
+	{
+		i++;
+		ck_assert_uint_eq(current->data.index, i);
+		current = current->next;
+	}
+	ck_assert_uint_eq(i,5000);
+	
+	remove(test_filename);
+}
+END_TEST
+
 
 
 
@@ -223,10 +1658,43 @@ Suite* tpm_suite(void)
      tcase_add_test(tc_null_msg, length_pick_msg);
 	 tcase_add_test(tc_null_msg, length_pick_JSON);
 	 tcase_add_test(tc_null_msg, length_pick_CSV);
+	 tcase_add_test(tc_null_msg, template_recompile);
+	 tcase_add_test(tc_null_msg, template_named_fields);
+	 tcase_add_test(tc_null_msg, lazy_waste_report);
+	 tcase_add_test(tc_null_msg, large_output_complete);
+	 tcase_add_test(tc_null_msg, json_escaping);
+	 tcase_add_test(tc_null_msg, ndjson_lines);
+	 tcase_add_test(tc_null_msg, binary_formats);
+	 tcase_add_test(tc_null_msg, arrow_catalog);
+	 tcase_add_test(tc_null_msg, list_sort_window);
+	 tcase_add_test(tc_null_msg, csv_quoting);
+	 tcase_add_test(tc_null_msg, locale_strings_shared);
+	 tcase_add_test(tc_null_msg, pick_log_append);
+	 tcase_add_test(tc_null_msg, legacy_pickstats_migration);
+	 tcase_add_test(tc_null_msg, stats_store_users);
+	 tcase_add_test(tc_null_msg, stats_store_long_names);
+	 tcase_add_test(tc_null_msg, stats_store_migration);
+	 tcase_add_test(tc_null_msg, rollup_coverage);
+	 tcase_add_test(tc_null_msg, stats_journal_group_commit);
+	 tcase_add_test(tc_null_msg, stats_write_atomic);
+	 tcase_add_test(tc_null_msg, stats_lock_fork);
+	 tcase_add_test(tc_null_msg, cfg_hash_index);
+	 tcase_add_test(tc_null_msg, cfg_typed_values);
+	 tcase_add_test(tc_null_msg, cfg_sections);
+#ifdef HAVE_SQLITE
+	 tcase_add_test(tc_null_msg, pick_db_queries);
+#endif
 	 
 	 tcase_add_test(tc_prng, prng_100_tries);
+	 tcase_add_test(tc_prng, prng_state_resume);
+#ifdef PAIR_TOY_TEST
+	 tcase_add_test(tc_prng, prng_pearson_paths);
+#endif
+	 tcase_add_test(tc_prng, prng_checkpoint_shared);
+	 tcase_add_test(tc_prng, keyed_pick_reproducible);
 	 
 	 tcase_add_test(tc_wrong_file, bad_toothpastes);
+	 tcase_add_test(tc_wrong_file, large_catalog);
 	 
      suite_add_tcase(s, tc_null_msg);
 	 suite_add_tcase(s, tc_prng);
@@ -234,19 +1702,47 @@ Suite* tpm_suite(void)
      return s;
  }
 
+static int
+remove_scratch_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+	(void)st;
+	(void)flag;
+	(void)ftw;
+	remove(path);
+	return 0;
+}
+
 int 
 main(void)
 {
      int number_failed;
      Suite *s;
      SRunner *sr;
+     char scratch[] = "/tmp/tpm_battery.XXXXXX";
+     char stats_dir[sizeof(scratch) + 4];
  
+	 /* tests never see the real ~/tpm: HOME, the default PICK_STATS and
+	    every fixture file live in a scratch directory removed at the end */
+	 if (mkdtemp(scratch) == NULL || chdir(scratch) != 0)
+	 {
+		 perror("tpm_battery: scratch directory");
+		 return EXIT_FAILURE;
+	 }
+	 snprintf(stats_dir, sizeof(stats_dir), "%s/tpm", scratch);
+	 mkdir(stats_dir, 0700);
+	 setenv("HOME", scratch, 1);
+	 
      s = tpm_suite();
      sr = srunner_create(s);
  
      srunner_run_all(sr, CK_NORMAL);
      number_failed = srunner_ntests_failed(sr);
      srunner_free(sr);
+	 
+	 if (chdir("/") == 0)
+	 {
+		 nftw(scratch, remove_scratch_entry, 16, FTW_DEPTH | FTW_PHYS);
+	 }
      return (number_failed<= 1) ? EXIT_SUCCESS : EXIT_FAILURE;
 	 
 	 
@@ -13,7 +13,7 @@ TEST_SOURCES= tests/tpm_battery.c
 
 OBJECTS= tpm.o prng64_xrp32.o cfg_parse.o tpm_battery.o
 
-.PHONY: all clean check
+.PHONY: all clean check check-pearson
 
 all: tpm_battery
 
@@ -30,5 +30,15 @@ check: tpm_battery
 	@echo fire TPM tests 
 	./tpm_battery
 
+# The toy PRNG build once per pearson32 path, each compared bit for bit with
+# the scalar model in the battery; the AVX-512 run needs a VBMI capable CPU
+check-pearson:
+	$(CC) $(CFLAGS) -DPAIR_TOY_TEST -DPAIR_TOY_SCALAR $(LIB_SOURCES) $(TEST_SOURCES) -o tpm_battery_scalar $(LIBS)
+	$(CC) $(CFLAGS) -DPAIR_TOY_TEST -mssse3 $(LIB_SOURCES) $(TEST_SOURCES) -o tpm_battery_ssse3 $(LIBS)
+	$(CC) $(CFLAGS) -DPAIR_TOY_TEST -mavx512vbmi -mavx512bw $(LIB_SOURCES) $(TEST_SOURCES) -o tpm_battery_avx512 $(LIBS)
+	CK_RUN_CASE=PRNG ./tpm_battery_scalar
+	CK_RUN_CASE=PRNG ./tpm_battery_ssse3
+	CK_RUN_CASE=PRNG ./tpm_battery_avx512
+
 clean:
-	$(RM) *.o tpm_battery
\ No newline at end of file
+	$(RM) *.o tpm_battery tpm_battery_scalar tpm_battery_ssse3 tpm_battery_avx512
\ No newline at end of file
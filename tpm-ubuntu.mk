@@ -3,6 +3,7 @@ CC=gcc
 CP=cp -f
 MKDIR=mkdir -p
 RM=rm -f
+AWK=awk
 
 PREFIX    = /usr/local
 BINDIR    = $(PREFIX)/bin
@@ -21,7 +22,10 @@ OBJECTS=    tpm.o \
 			prng64_xrp32.o \
 			cfg_parse.o
 
-.PHONY: all install uninstall clean dist update-po
+SQLITE_LIBS=-lsqlite3
+PO_FILES=$(wildcard locale/*/tpm.po)
+
+.PHONY: all install uninstall clean dist update-po tpm-sqlite tpm-nls-embedded catalog
 
 all: tpm docs update-po
 
@@ -31,6 +35,19 @@ tpm: $(OBJECTS)
 %.o: $(SRC)/%.c
 	$(CC) $(CFLAGS) -c $< -o $@
 
+# same binary with the PICK_DB SQLite backend compiled in
+tpm-sqlite: $(SOURCES)
+	$(CC) $(CFLAGS) -DHAVE_SQLITE $(SOURCES) -o tpm $(SQLITE_LIBS)
+
+# gettext left out, the translations served from tables compiled in from the .po files
+tpm-nls-embedded: $(SOURCES) $(SRC)/tpm_catalog.h
+	$(CC) $(CFLAGS) -UENABLE_NLS -DENABLE_NLS=0 $(SOURCES) -o tpm
+
+catalog: $(SRC)/tpm_catalog.h
+
+$(SRC)/tpm_catalog.h: locale/po2c.awk $(PO_FILES)
+	LC_ALL=C $(AWK) -f locale/po2c.awk $(PO_FILES) > $@
+
 docs:
 	gzip -k -f tpm.1
 
@@ -24,6 +24,10 @@ LDFLAGS = \
     --target=wasm32-wasip1
 
 SRC = src
+AWK = awk
+
+# gettext is not built for WASM, the translations are compiled in instead
+PO_FILES = $(wildcard locale/*/tpm.po)
 
 SOURCES = \
     $(SRC)/tpm.c \
@@ -35,7 +39,7 @@ OBJECTS = \
     prng64_xrp32.o \
     cfg_parse.o
 
-.PHONY: all clean dist
+.PHONY: all clean dist catalog
 
 all: tpm.wasm
 
@@ -45,6 +49,13 @@ tpm.wasm: $(OBJECTS)
 %.o: $(SRC)/%.c
 	$(CC) $(CFLAGS) -c $< -o $@
 
+tpm.o: $(SRC)/tpm_catalog.h
+
+catalog: $(SRC)/tpm_catalog.h
+
+$(SRC)/tpm_catalog.h: locale/po2c.awk $(PO_FILES)
+	LC_ALL=C $(AWK) -f locale/po2c.awk $(PO_FILES) > $@
+
 clean:
 	$(RM) $(OBJECTS) tpm.wasm
 	$(RM) -r tpm-wasm-bin tpm-wasm-bin.tar.gz